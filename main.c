@@ -9,7 +9,7 @@
  * between a minimum and maximum value, configurable via "options.config".
  *
  * Compilation (MinGW GCC):
- * gcc window_refresher.c -o window_refresher.exe -lgdi32 -luser32 -ladvapi32 -Wall -Wextra -pedantic -O2
+ * gcc window_refresher.c -o window_refresher.exe -lgdi32 -luser32 -ladvapi32 -lwtsapi32 -lpsapi -lavrt -ldbghelp -Wall -Wextra -pedantic -O2
  *
  * @version 1.1
  * @date 2025-05-07
@@ -27,9 +27,16 @@
 #include <time.h>
 #include <stdarg.h>
 #include <limits.h> // For UINT_MAX
-#include <ctype.h>  // For isspace
+#include <ctype.h>  // For isspace, tolower
+#include <math.h>   // For sqrt in the benchmark statistics, exp in the freshness compliance
 #include <windows.h>
 #include <wincrypt.h> // For CryptGenRandom
+#include <wtsapi32.h> // For WTSRegisterSessionNotification
+#include <evntprov.h> // For EventRegister/EventWriteString (ETW tracepoints)
+#include <psapi.h>    // For GetProcessMemoryInfo (soak test resource checks)
+#include <avrt.h>     // For AvSetMmThreadCharacteristics (MMCSS injection thread)
+#include <dbghelp.h>  // For MiniDumpWriteDump (stall watchdog)
+#include <versionhelpers.h> // For IsWindows8OrGreater (session lock state at startup)
 
 // === Constants ===
 #define MAX_TITLE_LENGTH 256
@@ -39,14 +46,117 @@
 #define DEFAULT_MIN_DELAY_S 2.0
 #define DEFAULT_MAX_DELAY_S 7.0
 #define ALT_KEY_CHECK_DELAY_MS 500
-#define FOCUS_SWITCH_ATTEMPTS 3
+#define OWN_RELOAD_GRACE_MS 10000 // Title changes this soon after our own refresh are its page load
+#define MAX_TITLE_RESTARTS 2 // Waits a title change may restart in a row before the refresh goes anyway
+#define MAX_RELOAD_KEYS 16 // Refresh keys the keyboard hook holds for the reactor
+#define FOCUS_SWITCH_ATTEMPTS 3 // Defaults for g_focus_timing
 #define FOCUS_SWITCH_RETRY_DELAY_MS 100
 #define FOCUS_SETTLE_DELAY_MS 350
 #define POST_SENDINPUT_DELAY_MS 100
-#define MAIN_LOOP_POLL_INTERVAL_MS 50 // For GetAsyncKeyState in SelectWindowByClick
+#define MAX_FOCUS_SWITCH_ATTEMPTS 10
+#define MAX_FOCUS_DELAY_MS 5000 // Upper bound for the configurable focus delays
+#define MAIN_LOOP_POLL_INTERVAL_MS 50 // For GetAsyncKeyState when window selection runs without input hooks
+#define DEFAULT_TIMER_TOLERANCE_PCT 5 // Share of an idle wait the OS may defer it by to coalesce wakeups
+#define MAX_TIMER_TOLERANCE_PCT 50
+#define MAX_TIMER_TOLERANCE_MS 5000
+#define WAKEUP_REPORT_INTERVAL_MS (60 * 60 * 1000) // Log the wakeup rate once per hour
+#define MAX_PATH_LENGTH 260
+#define TRACE_BUFFER_EVENTS 4096 // Preallocated trace events; flushed to disk in batches
+#define TRACE_FLUSH_THRESHOLD (TRACE_BUFFER_EVENTS / 2)
+#define TRACE_FLUSH_INTERVAL_US (60ULL * 1000000ULL)
+#define TRACE_TRACK_SCHEDULER 0
+#define TRACE_TRACK_TARGET 1
+#define MAX_TRACEPOINT_LENGTH 256
+#define MAX_BENCHMARKS 32
+#define MAX_BENCHMARK_NAME_LENGTH 64
+#define BENCH_SAMPLES 15 // Samples per benchmark; each sample times a batch of operations
+#define BENCH_REGRESSION_T_THRESHOLD 3.0 // Welch t statistic above which a slowdown is significant
+#define BENCH_REGRESSION_MIN_CHANGE 0.10 // Ignore significant but small (<10%) slowdowns
+#define LATENCY_BENCH_REFRESHES 20 // Refreshes per (strategy, focus timing) combination
+#define LATENCY_BENCH_DELIVERY_TIMEOUT_MS 1000 // A key not seen by then counts as missed
+#define LATENCY_BENCH_MAX_EVENTS 1024
+#define MAX_API_CALL_SITES 64
+#define API_CALL_BUDGET_PER_CYCLE 48 // Upper bound for one refresh cycle on the simulated backend
+#define SIM_TARGET_HWND ((HWND)(ULONG_PTR)0x1001)
+#define SIM_USER_HWND ((HWND)(ULONG_PTR)0x2002)
+#define SIM_TARGET_THREAD_ID 101
+#define SIM_USER_THREAD_ID 202
+#define SIM_HUNG_TARGET_BLOCK_MS 5000 // How long a call into the hung simulated target blocks
+#define JOURNAL_VERSION 4 // 2: fewer calls per cycle, and the original window is restored before it is activated; 3: time profiles; 4: trace clock reads not recorded
+#define REPLAY_RESYNC_WINDOW 8 // Records the replay may skip to find the call the code makes next
+#define TUNE_SCREEN_CYCLES 200         // Simulated refreshes per candidate while screening the grid
+#define TUNE_CYCLES_PER_CANDIDATE 2000 // Simulated refreshes per finalist and for the current timing
+#define TUNE_FINALISTS 8               // Best screened candidates simulated again at full length
+#define DEFAULT_TUNE_SUCCESS_PCT 99.0
+#define TUNE_MAX_LATENESS_SAMPLES 4096
+#define CONTROL_MAX_MESSAGE 8192 // Largest control request or reply
+#define CONTROL_CLIENT_TIMEOUT_MS 2000
+#define MAX_CONSOLE_LINE_LENGTH 512
+#define STATUS_REDRAW_INTERVAL_MS 250 // Status view redraws at 4 Hz
+#define STATUS_REDRAW_TOLERANCE_MS 50
+#define STATUS_TITLE_WIDTH 22 // Keeps a status row within 80 columns
+#define STATUS_FRAME_BUFFER_SIZE ((MAX_TARGETS + 6) * 128)
+#define INJECTION_THREAD_TIMEOUT_MS 1000 // How late the injection thread may be before the scheduler injects itself
+#define INJECTION_JITTER_SAMPLES 1024 // Most recent injection lateness samples kept for percentiles
+#define MMCSS_TASK_NAME "Pro Audio"
+#define DEFAULT_WATCHDOG_MS 5000 // Scheduler work running longer than this is reported as a stall
+#define MAX_WATCHDOG_MS (10 * 60 * 1000)
+#define WATCHDOG_MIN_CHECK_INTERVAL_MS 100
+#define WATCHDOG_IDLE_CHECK_INTERVAL_MS 1000 // While watchdog_ms is 0
+#define FLIGHT_RECORDER_ENTRIES 256 // Most recent scheduler steps kept for stall reports
+#define STALL_DUMP_TIMEOUT_MS 30000 // The dump helper is killed after this long
+#define WATCHDOG_STOP_TIMEOUT_MS 2000 // At exit, how long to wait for the watchdog thread
+#define MAX_FRESHNESS_S (7 * 24 * 60 * 60)
+#define FRESHNESS_WINDOW_S 3600 // Time constant of the rolling freshness compliance
+#define FRESHNESS_CHECK_TOLERANCE_MS 1000 // A breach may be noticed this late, so the check can share a wakeup
+#define DEFAULT_TRIGGER_DEBOUNCE_MS 500
+#define DEFAULT_TRIGGER_MIN_GAP_S 10
+#define MAX_TRIGGER_DEBOUNCE_MS 60000
+#define MAX_TRIGGER_LINE_LENGTH 512 // Longer event lines are cut; the filter sees the start
+#define TRIGGER_POLL_MS 1000 // The trigger file's size is checked this often, for appends the directory watch misses
+#define TRIGGER_POLL_TOLERANCE_MS 500 // The check may come this late, so it can share a wakeup
+#define DEFAULT_LOAD_TIMEOUT_S 30 // A load not seen to finish counts as finished after this
+#define LOAD_TIME_SAMPLES 4096 // Most recent page load times kept for percentiles
+#define SIM_PAGE_LOAD_MS 800 // Simulated page load alone in its process; concurrent loads share the process
+#define MAX_TIME_PROFILES 32
+#define MAX_TIME_PROFILE_SPEC 64
+#define MAX_PROFILE_TRANSITIONS (MAX_TIME_PROFILES * 16 + 1) // 7 days, a start and an end each, split at the week's end
+#define SECONDS_PER_WEEK (7 * 24 * 60 * 60)
+#define MAX_FOCUS_BUDGET_MS 60000 // Focus theft budget per minute
+#define MAX_EVENT_AGE_MS 10000 // A WinEvent timestamp older than this is taken as unreliable
+#define REACTOR_FAILURE_BACKOFF_MS 1000 // An unbounded wait whose event wait failed pumps messages this long, then returns
+#define MAX_TARGETS 16 // Windows that can be selected for refreshing
+#define SIM_MAX_TARGETS 100000 // Targets in the multi-target simulation
+#define MAX_FOCUS_DOMAINS 8 // Independent foregrounds (simulated displays) arbitrated separately
+#define SCHEDULER_BENCH_TARGETS 1000
+#define SOAK_DEFAULT_CYCLES 100000
+#define SOAK_FAULT_PERCENT 20 // Share of soak cycles that get a fault injected
+#define SOAK_CLOCK_JUMP_MS (2ULL * 60 * 60 * 1000) // Simulated suspend during an idle wait
+#define SOAK_SAMPLE_INTERVAL 10000 // Cycles between resource samples
+#define SOAK_MAX_HANDLE_GROWTH 8 // Handles the process may gain after the first sample
+#define SOAK_MAX_MEMORY_GROWTH_BYTES (4 * 1024 * 1024) // Private bytes the process may gain after the first sample
+#define SOAK_MAX_LOG_BYTES_PER_CYCLE 4096
+#define SOAK_LATENESS_BUCKETS 10000 // 1 ms buckets; later injections go into the last bucket
+#define SOAK_MAX_REPORTED_VIOLATIONS 10
 
 const char* CONFIG_FILE_NAME = "options.config";
 const char* DEBUG_LOG_FILE_NAME = "debug.log";
+const char* NOTIFY_WINDOW_CLASS_NAME = "WindowRefresherNotifyWindow";
+const char* DEFAULT_BENCH_OUTPUT_FILE_NAME = "bench_results.json";
+const char* BENCH_SCRATCH_LOG_FILE_NAME = "bench_scratch.log";
+const char* BENCH_SCRATCH_CONFIG_FILE_NAME = "bench_scratch.config";
+const char* SOAK_SCRATCH_LOG_FILE_NAME = "soak_scratch.log";
+const char* DEFAULT_TUNING_PROFILE_FILE_NAME = "tuning.profile";
+const char* KEY_ECHO_WINDOW_CLASS_NAME = "WindowRefresherKeyEcho";
+const char* CONTROL_PIPE_NAME = "\\\\.\\pipe\\WindowRefresher";
+const char* STALL_REPORT_FILE_NAME = "stall.log";
+const char* STALL_DUMP_FILE_NAME = "stall.dmp";
+
+/** @brief ETW provider "WindowRefresher" used for the always-compiled tracepoints. */
+static const GUID TRACEPOINT_PROVIDER_GUID = { 0xb3e2de7e, 0xdfbf, 0x457e, { 0x87, 0xd9, 0xd2, 0xb6, 0xa8, 0x07, 0xb4, 0x08 } };
+
+/** @brief GUID_CONSOLE_DISPLAY_STATE, defined locally to avoid depending on libuuid. */
+static const GUID CONSOLE_DISPLAY_STATE_GUID = { 0x6fe69556, 0x704a, 0x47a0, { 0x8f, 0x24, 0xc2, 0x8d, 0x93, 0x6f, 0xda, 0x47 } };
 
 // === Global Variables ===
 // These are global for convenience in this single-file application.
@@ -64,6 +174,897 @@ static double g_min_delay_seconds = DEFAULT_MIN_DELAY_S;
 /** @brief Maximum delay between keystrokes, in seconds. Loaded from config. */
 static double g_max_delay_seconds = DEFAULT_MAX_DELAY_S;
 
+/** @brief Timing of the focus switch around each injected keystroke. */
+typedef struct FocusTiming {
+    int   switchAttempts;  // SetForegroundWindow attempts before giving up
+    DWORD retryDelayMs;    // Pause after each attempt (and after restoring an iconic window)
+    DWORD settleDelayMs;   // Pause after focus is acquired, before injecting
+    DWORD postSendDelayMs; // Pause after injecting, before the next cycle
+} FocusTiming;
+
+/** @brief Focus timing in use. */
+static FocusTiming g_focus_timing = {
+    FOCUS_SWITCH_ATTEMPTS, FOCUS_SWITCH_RETRY_DELAY_MS, FOCUS_SETTLE_DELAY_MS, POST_SENDINPUT_DELAY_MS
+};
+
+/** @brief Path of a focus timing profile written by --tune. Empty if none. Loaded from config. */
+static char g_tuning_profile_path[MAX_PATH_LENGTH] = "";
+
+/** @brief How the refresh keystroke reaches the target window. */
+typedef enum DeliveryStrategy {
+    DELIVERY_SENDINPUT,   // Switch focus, SendInput Ctrl+F5, restore focus (hard refresh)
+    DELIVERY_POSTMESSAGE  // Post WM_KEYDOWN/WM_KEYUP F5 to the window; no focus change, no Ctrl
+} DeliveryStrategy;
+
+static const char* const DELIVERY_STRATEGY_NAMES[] = { "sendinput", "postmessage" };
+
+/** @brief Delivery strategy in use. Loaded from config. */
+static DeliveryStrategy g_delivery_strategy = DELIVERY_SENDINPUT;
+
+/** @brief Kind of refresh a cycle delivers. */
+typedef enum RefreshTier {
+    TIER_HARD, // Ctrl+F5 with the delivery strategy, every min_delay to max_delay seconds
+    TIER_SOFT  // Plain F5 posted to the window, every soft_refresh_s; no focus change
+} RefreshTier;
+
+/** @brief Soft refresh interval in ms; 0 = every refresh is hard. Loaded from config. */
+static DWORD g_soft_refresh_ms = 0;
+
+/** @brief Estimated origin traffic of one hard and one soft refresh, in KB; 0 = unknown. Loaded from config. */
+static DWORD g_hard_refresh_kb = 0, g_soft_refresh_kb = 0;
+
+/** @brief Tolerance for idle waits, as a percentage of the wait. Loaded from config. */
+static int g_timer_tolerance_pct = DEFAULT_TIMER_TOLERANCE_PCT;
+
+/** @brief Waitable timer used for all waits, so each wait can declare a tolerable delay. */
+static HANDLE g_hWaitTimer = NULL;
+
+/** @brief Number of times the process woke from a wait since g_wakeup_window_start_ms. */
+static unsigned long g_wakeup_count = 0;
+
+/** @brief Tick count at which the current wakeup measurement window started. */
+static ULONGLONG g_wakeup_window_start_ms = 0;
+
+/** @brief Hidden window receiving session and display power notifications. */
+static HWND g_hNotifyWindow = NULL;
+
+/** @brief Registration handle for display power notifications. */
+static HPOWERNOTIFY g_hDisplayPowerNotify = NULL;
+
+/** @brief TRUE while the workstation is locked. Updated from WM_WTSSESSION_CHANGE. */
+static BOOL g_session_locked = FALSE;
+
+/** @brief TRUE while the display is off. Updated from WM_POWERBROADCAST. */
+static BOOL g_display_off = FALSE;
+
+/** @brief FALSE suppresses the per-cycle console lines (used by the benchmarks). */
+static BOOL g_console_output_enabled = TRUE;
+
+/** @brief TRUE until the windows are selected: console = quiet only silences what comes after. */
+static BOOL g_console_startup = FALSE;
+
+// === Console Output ===
+// Per-cycle console output goes through ConsolePrintf. In the default scroll mode each
+// event is a line; in status mode a table is redrawn in place at 4 Hz from a reactor
+// timer and the latest event is shown on its last line; quiet mode prints nothing.
+
+/** @brief How the running program uses the console. */
+typedef enum ConsoleMode {
+    CONSOLE_SCROLL,  // One line per wait, keystroke and skip
+    CONSOLE_STATUS,  // A table redrawn in place with VT sequences
+    CONSOLE_QUIET    // Nothing once the windows are selected; see debug.log
+} ConsoleMode;
+
+static const char* const CONSOLE_MODE_NAMES[] = { "scroll", "status", "quiet" };
+
+/** @brief Console mode. Loaded from config; status only takes effect at startup. */
+static ConsoleMode g_console_mode = CONSOLE_SCROLL;
+
+/** @brief Cost of the console writes made since startup. */
+typedef struct ConsoleWriteStats {
+    unsigned long writes;
+    unsigned long long bytes;
+    ULONGLONG totalUs;            // Wall time spent in the writes and in the flushes that push them out
+    BOOL unflushed;               // Written since stdout was last flushed
+} ConsoleWriteStats;
+
+static ConsoleWriteStats g_console_stats;
+
+/** @brief State of the in-place status table. */
+typedef struct StatusView {
+    BOOL active;
+    HANDLE hConsole;
+    DWORD savedConsoleMode;       // Restored when the view stops
+    HANDLE hRedrawTimer;          // Periodic; waited on by the reactor
+    int drawnLines;               // Lines of the last frame, which the next one overwrites
+    char lastEvent[MAX_CONSOLE_LINE_LENGTH]; // Latest line ConsolePrintf would have printed
+    char frame[STATUS_FRAME_BUFFER_SIZE];
+} StatusView;
+
+static StatusView g_status_view;
+
+// === Reactor ===
+// Every wait goes through ReactorWait, which sleeps on the wait timer, the window
+// message queue, the config directory watch and the control pipe at once, so the
+// scheduler reacts to window events, config edits and control commands without polling.
+
+/** @brief Set by event handlers that change what the scheduler should do next; ends the current wait early. */
+static BOOL g_reactor_wake = FALSE;
+
+/** @brief Overlapped watch of the directory holding the config file; hDirectory is NULL if not watched. */
+typedef struct ConfigWatch {
+    HANDLE hDirectory;
+    OVERLAPPED overlapped;        // Its event is waited on by the reactor
+    DWORD changes[1024];          // FILE_NOTIFY_INFORMATION records, which must be DWORD-aligned
+} ConfigWatch;
+
+static ConfigWatch g_config_watch;
+
+/** @brief Set by the scheduler around its deadline wait, the only wait a reactor event may end early. */
+static BOOL g_wait_interruptible = FALSE;
+
+/** @brief Last-write times of the config file and tuning profile when they were last loaded. */
+static FILETIME g_config_write_time;
+static FILETIME g_profile_write_time;
+
+/** @brief TRUE while refreshes are paused by the "pause" control command. */
+static BOOL g_control_paused = FALSE;
+
+/** @brief Set by the "stop" control command; the scheduler returns and the program exits normally. */
+static BOOL g_stop_requested = FALSE;
+
+/** @brief Named pipe server for control commands; one client at a time, one request per connection. */
+typedef struct ControlPipe {
+    HANDLE hPipe;
+    OVERLAPPED overlapped;
+    BOOL reading;   // FALSE while waiting for a client to connect
+    BOOL writing;   // The reply is being written
+    BOOL ioPending; // An overlapped connect, read or write is outstanding
+    char request[CONTROL_MAX_MESSAGE];
+    char reply[CONTROL_MAX_MESSAGE]; // Must outlive the overlapped write
+} ControlPipe;
+
+static ControlPipe g_control_pipe;
+
+/** @brief WinEvent hooks: the foreground hook, then per target process a destroy hook and, with observe_reloads = all or a load limit, a title hook. */
+static HWINEVENTHOOK g_win_event_hooks[2 * MAX_TARGETS + 1];
+static DWORD g_win_event_hook_pids[2 * MAX_TARGETS + 1];
+static DWORD g_win_event_hook_events[2 * MAX_TARGETS + 1];
+static int g_win_event_hook_count = 0;
+
+/** @brief Which reloads made outside the refresher restart a target's wait. */
+typedef enum ReloadObserver {
+    RELOADS_OFF,
+    RELOADS_KEYS, // Refresh keys typed into a target (F5, Ctrl+R, the browser refresh key)
+    RELOADS_ALL   // Keys, and title changes of a target, which a page reload usually causes
+} ReloadObserver;
+
+static const char* const RELOAD_OBSERVER_NAMES[] = { "off", "keys", "all" };
+
+/** @brief Reloads observed; takes effect at startup. Loaded from config. */
+static ReloadObserver g_observe_reloads = RELOADS_OFF;
+
+/** @brief Low-level keyboard hook watching for refresh keys; NULL if reloads are not observed. */
+static HHOOK g_reload_keyboard_hook = NULL;
+
+/** @brief Refresh keys seen by the keyboard hook, for the reactor to handle. */
+typedef struct ReloadKey {
+    HWND hwnd;                    // Foreground window the key went to
+    DWORD timeMs;                 // Key event time, on the GetTickCount clock
+} ReloadKey;
+
+static ReloadKey g_reload_keys[MAX_RELOAD_KEYS];
+static int g_reload_key_count = 0;
+
+/** @brief Low-level input hooks and result of an interactive window selection. */
+typedef struct WindowSelection {
+    HHOOK mouseHook;
+    HHOOK keyboardHook;
+    BOOL allowFinish;
+    BOOL clicked;
+    BOOL finished;
+    POINT point;
+} WindowSelection;
+
+static WindowSelection g_selection;
+
+// === Injection Thread ===
+// With injection_thread set, the settle pause and the SendInput call run on a dedicated
+// thread at raised priority (optionally MMCSS and pinned to one CPU), so the keystroke
+// goes out on time even when the scheduler thread is preempted. That thread only waits,
+// checks the foreground and injects: it never logs or touches files. The scheduler picks
+// up the result through the reactor and does the logging and tracing.
+
+/** @brief Scheduling class of the injection thread. */
+typedef enum InjectionThreadMode {
+    INJECTION_THREAD_OFF,           // Inject from the scheduler thread
+    INJECTION_THREAD_HIGHEST,       // THREAD_PRIORITY_HIGHEST
+    INJECTION_THREAD_TIME_CRITICAL, // THREAD_PRIORITY_TIME_CRITICAL
+    INJECTION_THREAD_MMCSS          // Multimedia Class Scheduler "Pro Audio" task, critical priority
+} InjectionThreadMode;
+
+static const char* const INJECTION_THREAD_MODE_NAMES[] = { "off", "highest", "time_critical", "mmcss" };
+
+/** @brief Scheduling class of the injection thread. Loaded from config. */
+static InjectionThreadMode g_injection_thread_mode = INJECTION_THREAD_OFF;
+
+/** @brief CPU the injection thread is pinned to, or -1 for any. Loaded from config. */
+static int g_injection_cpu = -1;
+
+/** @brief Progress of the single injection request, as a LONG for the Interlocked functions. */
+typedef enum InjectionStatus {
+    INJECTION_IDLE,     // No request; the scheduler may post one
+    INJECTION_PENDING,  // Posted; the thread is waiting for the due time
+    INJECTION_RUNNING,  // The thread is checking the foreground and injecting
+    INJECTION_DONE      // Result written; the done event is set
+} InjectionStatus;
+
+/** @brief The injection thread and its one request slot. */
+typedef struct InjectionThread {
+    HANDLE hThread;
+    HANDLE hRequestEvent;         // Auto-reset; a request was posted, or quit was set
+    HANDLE hDoneEvent;            // Auto-reset; a result is ready. Waited on by the reactor
+    HANDLE hTimer;                // High-resolution timer the thread sleeps on until the due time
+    volatile LONG status;         // InjectionStatus
+    volatile LONG quit;
+    // Request: written by the scheduler before status becomes INJECTION_PENDING
+    HWND hwnd;
+    ULONGLONG dueUs;              // Win32NowUs clock
+    InjectionThreadMode mode;
+    int cpu;
+    // Result: written by the thread before status becomes INJECTION_DONE
+    BOOL wasForeground;
+    BOOL wasIconic;
+    UINT sent;
+    DWORD sendError;
+    ULONGLONG injectedUs;
+    // Scheduling class in effect on the thread; classChanged is cleared by the scheduler once logged
+    InjectionThreadMode appliedMode;
+    int appliedCpu;
+    DWORD applyError;
+    BOOL classChanged;
+    HANDLE hMmcssTask;
+} InjectionThread;
+
+static InjectionThread g_injector;
+
+/** @brief Recent injection lateness (SendInput issued after the settle deadline), on the Win32 backend. */
+typedef struct InjectionJitter {
+    double latenessUs[INJECTION_JITTER_SAMPLES];
+    int count;                    // Valid samples, up to INJECTION_JITTER_SAMPLES
+    int next;                     // Slot the next sample overwrites
+} InjectionJitter;
+
+static InjectionJitter g_injection_jitter;
+
+/** @brief Path of the Chrome trace-event file. Empty disables tracing. Loaded from config. */
+static char g_trace_file_path[MAX_PATH_LENGTH] = "";
+
+// === ETW Tracepoints ===
+// Static probes at the key points of the refresh pipeline, always compiled in. The
+// provider's enable callback caches whether any ETW session is listening, so a probe
+// nobody is attached to costs one flag check; formatting only happens when attached.
+
+/** @brief Registration handle for the tracepoint provider. */
+static REGHANDLE g_tracepoint_provider = 0;
+
+/** @brief Non-zero while at least one ETW session has the provider enabled. */
+static volatile LONG g_tracepoints_enabled = 0;
+
+/** @brief Start of the current refresh (deadline reached), for probe timing arguments. */
+static ULONGLONG g_tracepoint_cycle_start_us = 0;
+
+#define TRACEPOINT(probe, targetId, ...) \
+    do { if (g_tracepoints_enabled) EmitTracepoint((probe), (targetId), __VA_ARGS__); } while (0)
+
+// === Trace Events ===
+// Optional timeline of every refresh cycle in Chrome trace-event JSON, viewable in
+// chrome://tracing or ui.perfetto.dev. Events are recorded into a preallocated
+// buffer and written out in batches; when tracing is off every call returns at once.
+
+/** @brief One recorded trace event. Names must be string literals (not copied). */
+typedef struct TraceEvent {
+    const char *name;
+    char phase;          // 'X' = complete span, 'i' = instant event
+    int track;           // Rendered as a thread id: one track per target
+    ULONGLONG startUs;
+    ULONGLONG durationUs;
+    const char *argName; // Optional numeric argument; NULL if none
+    long argValue;
+} TraceEvent;
+
+static TraceEvent g_trace_events[TRACE_BUFFER_EVENTS];
+static int g_trace_event_count = 0;
+static BOOL g_trace_enabled = FALSE;
+static FILE* g_trace_file = NULL;
+static BOOL g_trace_first_record = TRUE;
+static ULONGLONG g_trace_last_flush_us = 0;
+static unsigned long g_trace_dropped_events = 0;
+
+// === Window System Backend ===
+// Every window-system call made by a refresh cycle goes through this table, so the
+// same cycle code runs against the real desktop or against the simulated backend.
+
+/** @brief Function table for the window-system operations used by a refresh cycle. */
+typedef struct WindowBackend {
+    const char *name;
+    BOOL  (*isWindow)(HWND hWnd);
+    int   (*getWindowText)(HWND hWnd, char *buffer, int bufferSize);
+    HWND  (*getForegroundWindow)(void);
+    BOOL  (*setForegroundWindow)(HWND hWnd);
+    BOOL  (*isIconic)(HWND hWnd);
+    BOOL  (*showWindow)(HWND hWnd, int nCmdShow);
+    DWORD (*getWindowThreadId)(HWND hWnd);
+    BOOL  (*attachThreadInput)(DWORD idAttach, DWORD idAttachTo, BOOL fAttach);
+    UINT  (*sendInput)(UINT count, INPUT *inputs);
+    SHORT (*getAsyncKeyState)(int vKey);
+    BOOL  (*postMessage)(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
+    BOOL  (*genRandom)(unsigned int *value);
+    void  (*sleep)(DWORD milliseconds, DWORD toleranceMs);
+    ULONGLONG (*nowUs)(void);
+} WindowBackend;
+
+/** @brief Faults the soak test can arm on the simulated desktop for one cycle. */
+typedef enum SimFault {
+    SIM_FAULT_NONE,
+    SIM_FAULT_DESTROY_ON_ACTIVATE, // Target is destroyed by the first SetForegroundWindow on it
+    SIM_FAULT_STEAL_DURING_SETTLE, // User clicks back to their window during the settle pause
+    SIM_FAULT_HUNG_TARGET,         // Target thread is hung: attaching to it blocks, activation fails
+    SIM_FAULT_USER_TYPING,         // User holds Alt for the whole cycle
+    SIM_FAULT_CLOCK_JUMP,          // Machine is suspended as the idle wait ends
+    SIM_FAULT_PARTIAL_INPUT,       // SendInput inserts only the key downs of its batch, as when input is blocked
+    SIM_FAULT_COUNT
+} SimFault;
+
+static const char* const SIM_FAULT_NAMES[] = {
+    "none", "destroy_on_activate", "steal_during_settle", "hung_target", "user_typing", "clock_jump", "partial_input"
+};
+
+/**
+ * @brief Timing model of focus switches on a real desktop, fitted from a journal by --tune.
+ * Lateness samples serve both as the extra delay of exact waits and as the time the
+ * target needs after activation before it accepts input.
+ */
+typedef struct FocusModel {
+    double activationMeanMs;      // Mean (exponential) delay until SetForegroundWindow takes effect
+    double focusLossPerMs;        // Hazard of the user taking the foreground back while the target holds it
+    unsigned int *latenessMs;     // Samples of how late exact waits returned
+    int latenessCount;
+} FocusModel;
+
+/** @brief State of the simulated desktop: two windows, a virtual clock and one foreground per display. */
+typedef struct SimulatedDesktop {
+    HWND      foreground;
+    BOOL      targetExists;
+    ULONGLONG clockMs;
+    unsigned int rngState;
+    // Fault injection and per-cycle observations, used by the soak test
+    SimFault  fault;                     // Fault armed for the current cycle
+    int       sleepsThisCycle;
+    int       sleepsWithTargetInFront;
+    ULONGLONG wakeMs;                    // When the first (idle) wait of the cycle ended
+    ULONGLONG suspendedMs;               // Time the machine was suspended this cycle
+    ULONGLONG lastInjectMs;
+    unsigned int injections;             // Keystroke deliveries (SendInput batches or posted F5s)
+    unsigned int misdirectedInjections;  // SendInput while the target was not in front
+    unsigned int injectionsWhileTyping;  // Deliveries while the user held a key
+    int       attachedInputs;            // Successful AttachThreadInput(TRUE) minus detaches
+    BOOL      injectedKeyDown[256];      // Keys pressed by SendInput and not yet released
+    // Focus model, used by the tuner; NULL keeps focus switches instant and permanent
+    const FocusModel *focusModel;
+    unsigned int modelRngState;
+    ULONGLONG pendingForegroundMs;       // When the requested activation takes effect; 0 = none pending
+    ULONGLONG foregroundSinceMs;
+    ULONGLONG focusLossMs;               // When the user takes the foreground back
+    ULONGLONG inputReadyMs;              // From when the target accepts input
+    ULONGLONG foregroundHoldMs;          // Total time the target held the foreground
+    unsigned int deliveredInjections;    // SendInput batches the target accepted
+    // One display per focus domain; the stepped target's display is swapped into foreground
+    int       domain;
+    HWND      domainForeground[MAX_FOCUS_DOMAINS];
+    // Push events, as trigger_file would deliver them; 0 = none
+    ULONGLONG triggerEveryMs;
+    ULONGLONG nextTriggerMs;
+} SimulatedDesktop;
+
+/** @brief Backend in use. Selected once at startup. */
+static const WindowBackend* g_backend = NULL;
+
+/** @brief Simulated desktop used by the --simulate mode. */
+static SimulatedDesktop g_sim;
+
+/** @brief Cached CryptoAPI provider, acquired once instead of once per cycle. */
+static HCRYPTPROV g_hCryptProv = 0;
+
+// === Event Journal ===
+// Optional binary record of every backend call made by the refresh cycles, with its
+// result and timing, enabled by journal_file. "--replay" feeds a journal back through
+// the replay backend, so a production timeline can be re-run against changed code.
+
+/** @brief Journal record types; one per backend operation, plus a cycle marker. */
+typedef enum JournalOp {
+    JOURNAL_OP_IS_WINDOW,
+    JOURNAL_OP_GET_WINDOW_TEXT,
+    JOURNAL_OP_GET_FOREGROUND,
+    JOURNAL_OP_SET_FOREGROUND,
+    JOURNAL_OP_IS_ICONIC,
+    JOURNAL_OP_SHOW_WINDOW,
+    JOURNAL_OP_GET_THREAD_ID,
+    JOURNAL_OP_ATTACH_INPUT,
+    JOURNAL_OP_SEND_INPUT,
+    JOURNAL_OP_GET_KEY_STATE,
+    JOURNAL_OP_POST_MESSAGE,
+    JOURNAL_OP_GEN_RANDOM,
+    JOURNAL_OP_SLEEP,
+    JOURNAL_OP_NOW,
+    JOURNAL_OP_CYCLE,
+    JOURNAL_OP_TIME_PROFILE       // arg = profile + 1 (0 = min_delay/max_delay); value = pause ms with bit 63 set, or min and max delay ms
+} JournalOp;
+
+/** @brief Journal file header. */
+typedef struct JournalHeader {
+    char magic[4];                 // "RFJ1"
+    unsigned int version;
+    unsigned long long targetHwnd;
+} JournalHeader;
+
+/** @brief One backend call (16 bytes), written as-is; journals are replayed on the same platform. */
+typedef struct JournalRecord {
+    unsigned char op;              // JournalOp
+    unsigned char reserved;
+    unsigned short arg;            // Argument that selects behaviour: vKey, nCmdShow, count, message, 1 = target HWND
+    unsigned int deltaUs;          // Time since the previous record, saturated
+    unsigned long long value;      // Result; sleeps store requested ms (low 32 bits) and actual us (high 32 bits)
+} JournalRecord;
+
+/** @brief Path of the event journal. Empty disables recording. Loaded from config. */
+static char g_journal_file_path[MAX_PATH_LENGTH] = "";
+static FILE* g_journal_file = NULL;
+static const WindowBackend* g_journal_inner = NULL; // Backend whose calls are being recorded
+static HWND g_journal_target = NULL;
+static ULONGLONG g_journal_last_us = 0;
+static unsigned long g_journal_record_count = 0;
+
+/** @brief Replay position and the recorded and replayed clocks being compared. */
+typedef struct ReplayState {
+    JournalRecord *records;
+    size_t count;
+    size_t cursor;
+    HWND target;
+    ULONGLONG recordedClockUs;    // Time in the recorded run
+    ULONGLONG clockUs;            // Time in the replay
+    HWND lastForeground;
+    unsigned int rngState;
+    unsigned long divergences;    // Records skipped, or calls with no matching record
+    // Observations of the current cycle, recorded and replayed
+    BOOL catchUp;
+    int recordedSleeps, sleeps;
+    ULONGLONG recordedWakeUs, wakeUs;
+    BOOL recordedInjected, injected;
+    ULONGLONG recordedInjectUs, injectUs;
+} ReplayState;
+
+static ReplayState g_replay;
+
+// === Refresh Targets ===
+// Every refresh is an explicit per-target state machine. A step does the non-blocking
+// work of one state and sets the deadline of the next; no step waits. The scheduler
+// sleeps until the earliest deadline and steps that target, so while one target holds
+// the focus for its settle pause, the others keep running their checks and waits.
+// Only one target at a time may own the focus; the rest queue for it.
+// Targets live in a TargetTable: the fields every scheduler pass reads are kept in
+// parallel arrays indexed by a dense target id, apart from the per-target records the
+// steps use and from the titles, so a pass over many targets streams through memory.
+
+/** @brief Where a target is in its refresh cycle. */
+typedef enum TargetState {
+    TARGET_STARTING,      // Due to check the window and pick the next random wait
+    TARGET_WAITING,       // Idle until the refresh is due
+    TARGET_LOAD_QUEUED,   // Refresh due, but the window's process has max_loads_per_process page loads in flight
+    TARGET_FOCUS_QUEUED,  // Refresh due, but another target owns the focus
+    TARGET_ACTIVATING,    // Restoring or SetForegroundWindow issued; checked after the retry delay
+    TARGET_SETTLING,      // Focus acquired; pausing before injecting
+    TARGET_INJECTING,     // Target was minimized again; checked after restoring it
+    TARGET_RESTORING,     // Keystroke sent; pausing before giving the focus back
+    TARGET_COOLDOWN,      // Pausing after the refresh (or a skip) before the next cycle
+    TARGET_GONE           // Window closed; no longer scheduled
+} TargetState;
+
+static const char* const TARGET_STATE_NAMES[] = {
+    "starting", "waiting", "load_queued", "focus_queued", "activating", "settling", "injecting", "restoring", "cooldown", "gone"
+};
+
+/** @brief How a target's last refresh ended, for the status view. */
+typedef enum TargetResult {
+    RESULT_NONE,          // No refresh finished yet
+    RESULT_SENT,          // Ctrl+F5 injected with SendInput
+    RESULT_POSTED,        // F5 posted
+    RESULT_ALT_HELD,      // Skipped: Alt was down
+    RESULT_PAUSED,        // Skipped: locked, display off or paused
+    RESULT_NO_FOCUS,      // Failed: the target could not be brought to the front
+    RESULT_SEND_FAILED,   // Failed: SendInput or PostMessage refused the input
+    RESULT_RELOADED,      // Not needed: the user reloaded the window during the wait
+    RESULT_RETITLED,      // Postponed: the title changed during the wait, probably a reload by the page
+    RESULT_GONE           // The window was closed
+} TargetResult;
+
+static const char* const TARGET_RESULT_NAMES[] = {
+    "-", "sent", "posted", "alt held", "paused", "no focus", "send failed", "reloaded", "retitled", "gone"
+};
+
+/** @brief One window being refreshed, and its in-flight refresh. State, deadline and counters are in its table. */
+typedef struct RefreshTarget {
+    struct TargetTable *table;
+    int id;                       // Index into the table's arrays
+    HWND hwnd;
+    int track;                    // Trace track and tracepoint target id
+    int domain;                   // Focus domain; each has its own foreground and focus token
+    DeliveryStrategy delivery;
+    RefreshTier tier;             // Tier of the refresh this cycle delivers
+    ULONGLONG hardDueUs;          // When the next hard refresh is due, with soft refreshes in between; 0 = not planned
+    BOOL catchUp;                 // Refresh at once, skipping the random wait
+    BOOL keystrokeSent;
+    DWORD plannedWaitMs;
+    ULONGLONG waitStartUs, probeWaitStartUs, cycleStartUs, queuedAtUs;
+    // Focus switch in progress
+    HWND originalForeground;
+    BOOL targetWasForeground;
+    BOOL focusSet;
+    const char *skipReason;       // Reason of the skip tracepoint if the switch gives up; NULL for no_focus
+    int attempt;                  // SetForegroundWindow attempts made; 0 while an iconic restore settles
+    DWORD targetThreadId, originalThreadId;
+    BOOL attachedToTarget, attachedToOriginal;
+    BOOL originalRestored;        // The minimized original window was restored; activate it next
+    ULONGLONG activateStartUs, phaseStartUs;
+    ULONGLONG attemptUs;          // Last SetForegroundWindow call returned, on the UnrecordedNowUs clock
+    ULONGLONG theftStartUs;       // The target took the foreground from the user's window; 0 if it has not
+    ULONGLONG theftEndUs;         // The foreground moved on from the target; 0 while not seen
+    BOOL budgetDeferred;          // Focus-queued until the focus budget refills; holds no load slot
+    // Outcome of the last refresh, for the status view
+    TargetResult lastResult;
+    ULONGLONG dueUs;              // Deadline at which the current refresh fell due; 0 for a catch-up
+    ULONGLONG lastLatencyUs;      // Due to delivered, measured while the status view is active
+    int failures;
+    ULONGLONG deliveredUs;        // Last refresh delivered, on the UnrecordedNowUs clock
+    int titleRestarts;            // Waits restarted by title changes since the last refresh or refresh key
+    ULONGLONG triggerEventUs;     // First event the pending refresh answers; 0 if none
+    ULONGLONG fallbackDueUs;      // The random timer's deadline while an event brought the refresh forward
+    ULONGLONG pendingTriggerUs;   // First event that came while the target was not waiting; 0 if none
+    // Page load started by the last refresh, on the UnrecordedNowUs clock
+    DWORD processId;              // Owning process; targets of one process share its load limit
+    ULONGLONG loadStartUs;        // 0 if no load is in flight
+    ULONGLONG loadDoneUs;         // When the load finished (the title changed); 0 while not seen
+    ULONGLONG loadQueuedAtUs;     // When the target joined its process's load queue
+    ULONGLONG loadDueUs;          // When the refresh that started the load fell due
+    ULONGLONG loadWorkUs;         // Simulated load: work left, at the process's full speed
+    ULONGLONG loadAdvancedUs;     // Simulated load: when the work left was last brought up to date
+    BOOL injectionPosted;         // Settle pause and SendInput handed to the injection thread
+    ULONGLONG injectDueUs;        // Settle deadline, for the lateness of an injection from this thread; 0 if not measured
+    // Freshness objective, on the UnrecordedNowUs clock
+    ULONGLONG freshnessUs;        // Longest allowed time between successful refreshes; 0 = not tracked
+    ULONGLONG lastFreshUs;        // Last successful refresh or refresh key, or when tracking started
+    ULONGLONG pausedUntilUs;      // End of the time profile pause the target waits out; the objective runs from there
+    ULONGLONG accountedUs;        // Compliance is accounted up to here
+    ULONGLONG trackedUs, breachUs; // Time tracked and time in breach since tracking started
+    double recentBreachShare;     // Share of time in breach, weighted over FRESHNESS_WINDOW_S
+    BOOL inBreach;
+    int breaches;
+} RefreshTarget;
+
+/** @brief Targets as parallel arrays; all arrays have capacity entries and are indexed by target id. */
+typedef struct TargetTable {
+    int count;
+    int capacity;
+    // Hot: read by every scheduler pass. One allocation, in this order.
+    ULONGLONG *deadlineUs;        // When the current state's step is due (backend clock)
+    int *cyclesStarted;
+    int *keystrokeCount;
+    unsigned char *state;         // TargetState
+    unsigned char *exactDeadline; // Focus and post-send pauses may not be coalesced
+    // Warm: touched when a target is stepped
+    RefreshTarget *targets;
+    // Cold: one MAX_TITLE_LENGTH slot per target, in a separate pool
+    char *titles;
+} TargetTable;
+
+/** @brief A target's entry in one of its table's hot arrays; usable as an lvalue. */
+#define TargetHot(t, field) ((t)->table->field[(t)->id])
+/** @brief A target's title slot. */
+#define TargetTitle(t) ((t)->table->titles + (size_t)(t)->id * MAX_TITLE_LENGTH)
+/** @brief The focus token of a target's domain; usable as an lvalue. */
+#define FocusOwner(t) (g_focus_owners[(t)->domain])
+
+/** @brief Counters kept by the scheduler, reported by the multi-target simulation. */
+typedef struct SchedulerStats {
+    unsigned long steps;
+    unsigned long stepsDuringFocusSwitch; // Steps of other targets while one owned the focus
+    unsigned long focusSwitches;
+    unsigned long focusQueued;            // Refreshes that had to wait for the focus
+    unsigned long focusSwitchesOverlapped; // Focus switches started while another domain's was in progress
+    unsigned long cyclesCompleted;
+    unsigned long refreshesSuppressed;    // Waits restarted because the window was reloaded meanwhile
+    unsigned long loadQueued;             // Refreshes that waited for a page load of the same process
+    unsigned long tierRefreshes[2];       // Refreshes delivered per RefreshTier
+    ULONGLONG tierRefreshUs[2];           // Their total time from due to delivered
+} SchedulerStats;
+
+static TargetTable g_target_table;                // Selected windows, up to MAX_TARGETS
+static TargetTable g_single_target_table;         // One-off target of RunRefreshCycle and SendCtrlF5Keystroke
+static TargetTable *g_scheduled_table = NULL;     // Targets of the running scheduler, for focus hand-over
+static RefreshTarget *g_focus_owners[MAX_FOCUS_DOMAINS]; // Per focus domain: target whose focus switch is in progress
+static int g_step_domain = 0;                     // Focus domain of the target being stepped
+static SchedulerStats g_scheduler_stats;
+
+// === Stall Watchdog ===
+// The scheduler notes when it stops waiting to do work (a step, then the bookkeeping
+// after it) and clears the note before it waits again. A watchdog thread checks the
+// note; when the work has run longer than watchdog_ms it appends the phase, the target
+// and the flight recorder (the last FLIGHT_RECORDER_ENTRIES steps) to stall.log and
+// has a helper process (this program run with --stall-dump) write a minidump with
+// every thread's stack to stall.dmp. A dump written from inside the process can
+// deadlock on the loader or heap lock the stuck thread holds. Reactor handlers are
+// marked like steps, without a flight record. Like the injection thread the watchdog
+// never logs, since the scheduler may be stuck holding the log; the scheduler logs
+// the stall once it runs again.
+
+/** @brief One scheduler step in the flight recorder. Times are on the Win32NowUs clock. */
+typedef struct FlightRecord {
+    ULONGLONG startUs;
+    ULONGLONG durationUs;         // 0 while the step runs
+    HWND hwnd;
+    unsigned char stateBefore;    // TargetState the step ran
+    unsigned char stateAfter;
+} FlightRecord;
+
+/** @brief The scheduler's heartbeat, the flight recorder and the watchdog thread. */
+typedef struct Watchdog {
+    HANDLE hThread;
+    HANDLE hQuitEvent;
+    // Written by the scheduler
+    volatile ULONGLONG busySinceUs;    // When the current work started; 0 while waiting
+    volatile LONG busySeq;             // Incremented whenever work starts
+    const char *volatile phase;        // State name of the step, or "bookkeeping"
+    RefreshTarget *volatile target;    // Target of the step in progress
+    FlightRecord records[FLIGHT_RECORDER_ENTRIES];
+    volatile LONG recordCount;         // Steps recorded; the newest is at (recordCount - 1) % FLIGHT_RECORDER_ENTRIES
+    LONG stallsLogged;
+    // What a reactor handler interrupted, put back when it returns
+    ULONGLONG outerSinceUs;
+    const char *outerPhase;
+    RefreshTarget *outerTarget;
+    // Written by the watchdog thread before stalls is incremented
+    LONG reportedSeq;
+    const char *stallPhase;
+    HWND stallHwnd;
+    volatile LONG stalls;
+} Watchdog;
+
+static Watchdog g_watchdog;
+
+/** @brief Stall threshold in ms; 0 turns the checks off. Loaded from config. */
+static DWORD g_watchdog_ms = DEFAULT_WATCHDOG_MS;
+
+// === Freshness Objective ===
+// Each target carries a freshness objective: the longest its content may go without
+// a successful refresh (Ctrl+F5 sent or F5 posted). Time past the objective is time in
+// breach. Compliance is accounted whenever a refresh ends and on a reactor timer set
+// for the next possible breach, so a breach is noticed even while refreshes are paused
+// or keep failing. Entering and leaving a breach runs freshness_command and updates
+// freshness_marker_file, for alerting that does not read the log.
+
+/** @brief Freshness objective given to every target, in seconds; 0 = not tracked. Loaded from config. */
+static DWORD g_freshness_s = 0;
+
+/** @brief Command line run when a target enters or leaves a breach. Empty = none. Loaded from config. */
+static char g_freshness_command[MAX_CONFIG_LINE_LENGTH] = "";
+
+/** @brief File that exists while any target is in breach. Empty = none. Loaded from config. */
+static char g_freshness_marker_path[MAX_PATH_LENGTH] = "";
+
+/** @brief Fires at the earliest time a tracked target can breach; waited on by the reactor. */
+static HANDLE g_hFreshnessTimer = NULL;
+
+// === Push Triggers ===
+// Besides its random timer, a target can be refreshed by events. Lines appended to
+// trigger_file are events (a Server-Sent Events stream saved with "curl -N" works
+// as is), and so is the "trigger" control command. An event that passes
+// trigger_filter moves the waiting target's deadline forward: the refresh follows
+// once no further event came for trigger_debounce_ms, but not sooner than
+// trigger_min_gap_s after the target's last refresh. The random timer stays as the
+// fallback, and a trigger never delays a refresh it would bring.
+
+/** @brief Tailed event file; empty = none. Takes effect at startup. Loaded from config. */
+static char g_trigger_file_path[MAX_PATH_LENGTH] = "";
+
+/** @brief Text an event line must contain to count; empty = every line. Loaded from config. */
+static char g_trigger_filter[MAX_CONFIG_LINE_LENGTH] = "";
+
+/** @brief Quiet period after the last event before the refresh, and least time between refreshes. Loaded from config. */
+static DWORD g_trigger_debounce_ms = DEFAULT_TRIGGER_DEBOUNCE_MS;
+static DWORD g_trigger_min_gap_s = DEFAULT_TRIGGER_MIN_GAP_S;
+
+/** @brief Tail of the trigger file. */
+typedef struct TriggerSource {
+    HANDLE hFile;                 // Open for reading, shared with the writer
+    HANDLE hChange;               // Change notification for the file's directory; waited on by the reactor
+    HANDLE hPollTimer;            // Periodic size check: a writer holding the file open may not notify
+    LONGLONG offset;              // Bytes of the file already read
+    char line[MAX_TRIGGER_LINE_LENGTH]; // Incomplete last line
+    size_t lineLength;
+    unsigned long events;         // Lines that passed the filter, and control triggers
+    unsigned long refreshes;      // Refreshes brought forward by an event
+    ULONGLONG latencyTotalUs, latencyMaxUs; // Event to delivered keystroke
+} TriggerSource;
+
+static TriggerSource g_trigger;
+
+// === Page Loads ===
+// A refresh makes the window's process load the page again. Several loads at once in
+// one browser process compete for it and all finish late, so max_loads_per_process
+// caps the loads in flight per process: a refresh due while the cap is reached waits
+// in its process's queue, first come first served, until a load finishes. A load
+// finishes when the window title changes (the page set its title) or, not seen,
+// after load_timeout_s. Load times are kept for percentiles.
+
+/** @brief Page loads in flight per process; 0 = no limit. Loaded from config. */
+static int g_max_loads_per_process = 0;
+
+/** @brief Time after which a load not seen to finish no longer counts. Loaded from config. */
+static DWORD g_load_timeout_s = DEFAULT_LOAD_TIMEOUT_S;
+
+/** @brief Page load times, for percentiles. Filled while loads are tracked. */
+typedef struct PageLoadStats {
+    BOOL tracking;                // Set where loads are started and their ends can be seen
+    double loadMs[LOAD_TIME_SAMPLES];  // Ring of the most recent load times, delivered to loaded
+    double readyMs[LOAD_TIME_SAMPLES]; // The same loads, due to loaded: load queue and focus switch included
+    int count, next;
+    unsigned long loads, timeouts;
+    unsigned long abandoned;      // Loads still in flight when the next refresh of the window started another
+} PageLoadStats;
+
+static PageLoadStats g_page_loads;
+
+// === Time Profiles ===
+// A time_profile line gives the refreshes in a weekly time window their own delays, or
+// pauses them: "time_profile = mon-fri 09:30-16:00 2 7" or "... sat,sun 00:00-24:00 paused".
+// Where windows overlap, the later line wins; outside all of them min_delay and
+// max_delay apply. At load the lines are compiled into a table of the week's
+// transitions, sorted by time, so a scheduling decision finds the active profile with
+// a binary search. A refresh planned or falling due in a paused window waits until the
+// window ends, as one long wait.
+
+/** @brief One time_profile line. */
+typedef struct TimeProfile {
+    unsigned char days;           // Bit 0 = Monday ... bit 6 = Sunday
+    DWORD startS, endS;           // Seconds into the day; an end at or before the start is on the next day
+    BOOL paused;
+    double minDelayS, maxDelayS;
+    char spec[MAX_TIME_PROFILE_SPEC]; // The line's value, for reports
+    unsigned long waits;          // Waits planned under the profile (pauses, if paused)
+} TimeProfile;
+
+/** @brief From this second of the week (Monday 00:00 local time = 0) on, a profile applies. */
+typedef struct ProfileTransition {
+    DWORD startS;
+    int profile;                  // Index into g_time_profiles; -1 = min_delay/max_delay
+} ProfileTransition;
+
+static TimeProfile g_time_profiles[MAX_TIME_PROFILES];
+static int g_time_profile_count = 0;
+static ProfileTransition g_profile_transitions[MAX_PROFILE_TRANSITIONS];
+static int g_profile_transition_count = 0;
+static unsigned long g_base_profile_waits = 0; // Waits planned outside every time profile
+
+// === Focus Theft Budget ===
+// Every focus switch takes the foreground from the operator's window until the
+// refresher gives it back. That time is measured per switch and charged to one budget
+// for all targets: focus_budget_ms per minute, kept as a credit that refills at that
+// rate up to one minute's worth. A switch may overdraw it; while the credit is used up,
+// a refresh is over budget and posts F5 instead (focus-free), or with
+// focus_budget_action = defer waits in the focus queue until the credit is back. Over
+// time the foreground is taken for no more than the budget, give or take one switch.
+// Each deferred refresh checks the budget again when it wakes, so they go out one
+// switch at a time as the credit allows. While deferred, a refresh gives up its page
+// load slot and takes one again before it switches.
+
+typedef enum FocusBudgetAction {
+    BUDGET_POST,                  // Post F5 without touching the focus
+    BUDGET_DEFER                  // Wait until the budget allows a focus switch
+} FocusBudgetAction;
+
+static const char* const FOCUS_BUDGET_ACTION_NAMES[] = { "post", "defer" };
+
+/** @brief Foreground time the refresher may take per minute; 0 = no budget. Loaded from config. */
+static DWORD g_focus_budget_ms = 0;
+
+/** @brief What a refresh over the focus budget does. Loaded from config. */
+static FocusBudgetAction g_focus_budget_action = BUDGET_POST;
+
+/** @brief Focus theft measurements and budget credit, on the UnrecordedNowUs clock. */
+typedef struct FocusTheftStats {
+    ULONGLONG startUs;            // First measurement; hours are counted from here
+    LONGLONG creditUs;            // Budget left; negative after a switch that took more than was left
+    ULONGLONG refilledUs;         // Credit last topped up
+    ULONGLONG totalUs, worstHourUs;
+    unsigned long switches, posted, deferred;
+    ULONGLONG hourUs;             // Theft in the current hour
+    unsigned long hour, hourSwitches, hourPosted, hourDeferred;
+} FocusTheftStats;
+
+static FocusTheftStats g_focus_theft;
+
+// === API Call Accounting ===
+// Every window-system, log and console call made during a refresh cycle is counted at
+// its call site, so --simulate checks the per-cycle budget in every build. Built with
+// -DREFRESHER_API_COUNTERS, the calls are also broken down per (API, calling function);
+// otherwise only the cycle's totals are kept, at the cost of two increments per call.
+
+/** @brief Kinds of system/API calls tracked by the instrumented build. */
+typedef enum ApiCallKind {
+    API_IS_WINDOW,
+    API_GET_WINDOW_TEXT,
+    API_GET_FOREGROUND_WINDOW,
+    API_SET_FOREGROUND_WINDOW,
+    API_IS_ICONIC,
+    API_SHOW_WINDOW,
+    API_GET_WINDOW_THREAD_ID,
+    API_ATTACH_THREAD_INPUT,
+    API_SEND_INPUT,
+    API_GET_ASYNC_KEY_STATE,
+    API_POST_MESSAGE,             // Last window-system call: each up to here is one round trip into win32k
+    API_GEN_RANDOM,
+    API_SLEEP,
+    API_LOG_WRITE,
+    API_CONSOLE_WRITE,
+    API_KIND_COUNT
+} ApiCallKind;
+
+#ifdef REFRESHER_API_COUNTERS
+static const char* const API_CALL_NAMES[API_KIND_COUNT] = {
+    "IsWindow", "GetWindowText", "GetForegroundWindow", "SetForegroundWindow",
+    "IsIconic", "ShowWindow", "GetWindowThreadProcessId", "AttachThreadInput",
+    "SendInput", "GetAsyncKeyState", "PostMessage", "CryptGenRandom", "Wait",
+    "LogWrite(fflush)", "ConsoleWrite"
+};
+
+/** @brief Call counter for one (API, calling function) pair. */
+typedef struct ApiCallSiteCounter {
+    ApiCallKind kind;
+    const char *site;
+    unsigned int count;
+} ApiCallSiteCounter;
+
+static ApiCallSiteCounter g_api_call_sites[MAX_API_CALL_SITES];
+static int g_api_call_site_count = 0;
+#endif
+
+static unsigned int g_api_calls_this_cycle = 0;
+static unsigned int g_api_round_trips_this_cycle = 0; // Window-system calls only
+
+#ifdef REFRESHER_API_COUNTERS
+#define COUNT_API_CALL_AT(kind, site) CountApiCall((kind), (site))
+#else
+#define COUNT_API_CALL_AT(kind, site) \
+    ((void)(site), (void)g_api_calls_this_cycle++, (void)(g_api_round_trips_this_cycle += ((kind) <= API_POST_MESSAGE)))
+#endif
+#define COUNT_API_CALL(kind) COUNT_API_CALL_AT((kind), __func__)
+
+// Backend call wrappers: count the call at its call site, then dispatch.
+#define BackendIsWindow(h)               (COUNT_API_CALL(API_IS_WINDOW), g_backend->isWindow(h))
+#define BackendGetWindowText(h, buf, n)  (COUNT_API_CALL(API_GET_WINDOW_TEXT), g_backend->getWindowText((h), (buf), (n)))
+#define BackendGetForegroundWindow()     (COUNT_API_CALL(API_GET_FOREGROUND_WINDOW), g_backend->getForegroundWindow())
+#define BackendSetForegroundWindow(h)    (COUNT_API_CALL(API_SET_FOREGROUND_WINDOW), g_backend->setForegroundWindow(h))
+#define BackendIsIconic(h)               (COUNT_API_CALL(API_IS_ICONIC), g_backend->isIconic(h))
+#define BackendShowWindow(h, cmd)        (COUNT_API_CALL(API_SHOW_WINDOW), g_backend->showWindow((h), (cmd)))
+#define BackendGetWindowThreadId(h)      (COUNT_API_CALL(API_GET_WINDOW_THREAD_ID), g_backend->getWindowThreadId(h))
+#define BackendAttachThreadInput(a, b, f) (COUNT_API_CALL(API_ATTACH_THREAD_INPUT), g_backend->attachThreadInput((a), (b), (f)))
+#define BackendSendInput(n, in)          (COUNT_API_CALL(API_SEND_INPUT), g_backend->sendInput((n), (in)))
+#define BackendGetAsyncKeyState(vk)      (COUNT_API_CALL(API_GET_ASYNC_KEY_STATE), g_backend->getAsyncKeyState(vk))
+#define BackendPostMessage(h, m, w, l)   (COUNT_API_CALL(API_POST_MESSAGE), g_backend->postMessage((h), (m), (w), (l)))
+#define BackendGenRandom(v)              (COUNT_API_CALL(API_GEN_RANDOM), g_backend->genRandom(v))
+#define BackendSleep(ms, tol)            (COUNT_API_CALL(API_SLEEP), g_backend->sleep((ms), (tol)))
+#define BackendNowUs()                   (g_backend->nowUs()) // Not counted: QPC is serviced in user mode
+
 
 // === Function Prototypes ===
 // Logging
@@ -72,6 +1073,11 @@ static void LogDebug(const char *format, ...);
 static void LogInfo(const char *format, ...); // For user-facing info that also goes to log
 static void LogWarning(const char *format, ...);
 static void LogError(const char *format, ...);
+// Log writes are counted where they are made; the names in parentheses are the functions.
+#define LogDebug(...)   (COUNT_API_CALL(API_LOG_WRITE), (LogDebug)(__VA_ARGS__))
+#define LogInfo(...)    (COUNT_API_CALL(API_LOG_WRITE), (LogInfo)(__VA_ARGS__))
+#define LogWarning(...) (COUNT_API_CALL(API_LOG_WRITE), (LogWarning)(__VA_ARGS__))
+#define LogError(...)   (COUNT_API_CALL(API_LOG_WRITE), (LogError)(__VA_ARGS__))
 static BOOL InitializeLogging(void);
 static void ShutdownLogging(void);
 
@@ -79,38 +1085,427 @@ static void ShutdownLogging(void);
 static char* TrimWhitespace(char *str);
 static BOOL CreateDefaultConfigFile(void);
 static void LoadConfiguration(void);
+static void ParseConfigurationLines(FILE *configFile, BOOL focusTimingOnly);
+static void ParseFocusDelayMs(const char *key, const char *value, int line_num, DWORD *delayMs);
 
 // Window Interaction
 static void FlashTargetWindow(HWND hWnd);
-static HWND GetTopLevelWindowFromClick(void);
-static BOOL ActivateWindowAndEnsureFocus(HWND hWndToActivate, HWND hOriginalForeground);
-static void RestoreOriginalFocus(HWND hOriginalForeground, HWND hTargetWindow, BOOL focusSwitchedSuccessfully);
-static void SendCtrlF5Keystroke(HWND targetHwnd);
+static HWND GetTopLevelWindowFromClick(BOOL allowFinish);
+static BOOL WaitForSelectionClick(BOOL allowFinish, POINT *point);
+static LRESULT CALLBACK SelectionMouseProc(int nCode, WPARAM wParam, LPARAM lParam);
+static LRESULT CALLBACK SelectionKeyboardProc(int nCode, WPARAM wParam, LPARAM lParam);
+static BOOL SendCtrlF5Keystroke(HWND targetHwnd);
+static BOOL PostF5Keystroke(HWND targetHwnd, int track);
+static BOOL RunRefreshCycle(HWND targetHwnd, int *keystroke_count, BOOL skipWait);
+
+// Refresh state machines
+static BOOL InitTargetTable(TargetTable *table, int capacity);
+static void FreeTargetTable(TargetTable *table);
+static RefreshTarget* AddRefreshTarget(TargetTable *table, HWND hwnd, int track);
+static RefreshTarget* ResetSingleTarget(HWND hwnd);
+static int  FindNextDueTarget(const TargetTable *table, BOOL *exact);
+static void SetTargetDeadline(RefreshTarget *t, TargetState state, DWORD delayMs, BOOL exact);
+static BOOL StepRefreshTarget(RefreshTarget *t);
+static void BeginRefreshCycle(RefreshTarget *t);
+static void PlanTieredRefresh(RefreshTarget *t, const char *title, double minDelayS, double maxDelayS);
+static void RefreshTargetDue(RefreshTarget *t);
+static void SendDueRefresh(RefreshTarget *t);
+static BOOL RefreshMayGo(RefreshTarget *t);
+static const char *RefreshKeyName(const RefreshTarget *t);
+static void BeginKeystroke(RefreshTarget *t);
+static void StartFocusSwitch(RefreshTarget *t);
+static void IssueActivationAttempt(RefreshTarget *t);
+static void CheckActivationAttempt(RefreshTarget *t);
+static void FinishSettle(RefreshTarget *t);
+static void DetachFocusThreads(RefreshTarget *t);
+static void BeginInjection(RefreshTarget *t);
+static void InjectKeystroke(RefreshTarget *t);
+static void FillCtrlF5Inputs(INPUT inputs[4]);
+static void CompleteInjection(RefreshTarget *t, UINT uSent, DWORD sendError, ULONGLONG injectStartUs);
+static void ReleaseInsertedKeys(UINT uSent);
+static void FinishFocusSwitch(RefreshTarget *t);
+static void RestoreFocusNow(RefreshTarget *t);
+static void EndFocusSwitch(RefreshTarget *t);
+static RefreshTarget* AnyFocusOwner(void);
+static void RecordTargetResult(RefreshTarget *t, TargetResult result);
+static BOOL FormatRefreshTiers(char *buffer, size_t bufferSize);
+static BOOL WaitUntilDeadline(ULONGLONG deadlineUs, BOOL exact);
+static int  RunScheduler(TargetTable *table, int maxCycles);
+
+// Session and display state
+static BOOL InitializeSessionNotifications(void);
+static void ShutdownSessionNotifications(void);
+static LRESULT CALLBACK NotifyWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
+static void PumpPendingMessages(void);
+static BOOL IsSchedulingPaused(void);
+static void WaitWhileSchedulingPaused(void);
+
+// Reactor
+static BOOL ReactorWait(DWORD milliseconds, DWORD toleranceMs);
+static void InitializeReactor(void);
+static void ShutdownReactor(void);
+static void ReactorWatchTarget(HWND hwnd);
+static BOOL ReactorHookProcess(DWORD pid, DWORD event);
+static LRESULT CALLBACK ReloadKeyboardProc(int nCode, WPARAM wParam, LPARAM lParam);
+static void OnReloadKeys(void);
+static void OnTargetReloaded(RefreshTarget *t, BOOL byKey);
+static void CALLBACK ReactorWinEventProc(HWINEVENTHOOK hook, DWORD event, HWND hwnd, LONG idObject, LONG idChild,
+                                         DWORD eventThread, DWORD eventTime);
+static void GetFileWriteTime(const char *path, FILETIME *writeTime);
+static void RecordConfigWriteTimes(void);
+static BOOL StartConfigWatch(void);
+static BOOL ArmConfigWatch(void);
+static void StopConfigWatch(void);
+static BOOL ChangeNamesFile(const FILE_NOTIFY_INFORMATION *change, const char *path);
+static void OnConfigDirectoryChanged(void);
+static void ReloadConfiguration(void);
+static BOOL StartControlPipe(void);
+static void ConnectControlPipe(void);
+static void OnControlPipeEvent(void);
+static void HandleControlCommand(char *request, char *reply, size_t replySize);
+static int  RunControlClient(const char *command);
+
+// Console status view
+static BOOL StartStatusView(void);
+static void StopStatusView(void);
+static void PauseStatusView(BOOL paused);
+static void DrawStatusView(void);
+static void ReportConsoleCost(unsigned long cycles);
+
+// Injection thread
+static BOOL StartInjectionThread(void);
+static void StopInjectionThread(void);
+static DWORD WINAPI InjectionThreadProc(LPVOID parameter);
+static void ApplyInjectionThreadClass(void);
+static BOOL PostInjectionRequest(RefreshTarget *t);
+static void CollectInjectionResult(RefreshTarget *t);
+static void OnInjectionDone(void);
+static void RecordInjectionLateness(ULONGLONG dueUs, ULONGLONG injectedUs);
+static void ResetInjectionJitter(void);
+static BOOL GetInjectionJitter(double *p50Us, double *p99Us, double *maxUs);
+static void ReportInjectionJitter(void);
+
+// Stall watchdog
+static BOOL StartWatchdog(void);
+static void StopWatchdog(void);
+static DWORD WINAPI WatchdogThreadProc(LPVOID parameter);
+static void WriteStallReport(LONG stall, ULONGLONG stalledUs, const char *phase, const RefreshTarget *target);
+static BOOL WriteStallDump(DWORD *error);
+static int  RunStallDump(const char *processId);
+static void WatchdogBeginStep(RefreshTarget *t);
+static void WatchdogEndStep(RefreshTarget *t);
+static void WatchdogBeginHandler(const char *handler);
+static void WatchdogEndHandler(void);
+static void WatchdogIdle(void);
+static void ReportWatchdog(void);
+
+// Freshness objective
+static ULONGLONG UnrecordedNowUs(void);
+static void StartFreshnessTracking(TargetTable *table, BOOL withTimer);
+static void StopFreshnessTracking(TargetTable *table);
+static void SetFreshnessObjective(RefreshTarget *t, DWORD seconds, ULONGLONG nowUs);
+static ULONGLONG FreshnessDueUs(const RefreshTarget *t);
+static BOOL AccountFreshness(RefreshTarget *t, ULONGLONG nowUs);
+static void UpdateFreshness(RefreshTarget *t, ULONGLONG nowUs);
+static void SetFreshnessBreach(RefreshTarget *t, BOOL breached, ULONGLONG nowUs);
+static void RunFreshnessCommand(const RefreshTarget *t, BOOL breached, ULONGLONG ageUs);
+static void UpdateFreshnessMarker(ULONGLONG nowUs);
+static void ArmFreshnessTimer(void);
+static void OnFreshnessTimer(void);
+static double RecentBreachShare(const RefreshTarget *t);
+static BOOL GetFreshnessCompliance(const TargetTable *table, double *compliancePct, double *recentPct,
+                                   int *breaches, double *breachS);
+static void ReportFreshness(const TargetTable *table);
+
+// Push triggers
+static void StartTriggerSource(void);
+static void StopTriggerSource(void);
+static void OnTriggerFileChanged(void);
+static void OnTriggerPollTimer(void);
+static void ReadTriggerFile(void);
+static void HandleTriggerLine(char *line);
+static int  TriggerTargets(int number);
+static void TriggerTarget(RefreshTarget *t, ULONGLONG nowUs);
+static void ApplyPendingTrigger(RefreshTarget *t);
+static BOOL FormatTriggers(char *buffer, size_t bufferSize);
+
+// Page loads
+static void StartPageLoad(RefreshTarget *t, ULONGLONG nowUs);
+static void RecordPageLoad(RefreshTarget *t, ULONGLONG doneUs);
+static void FinishPageLoad(RefreshTarget *t, ULONGLONG doneUs);
+static void AdvanceSimulatedLoads(TargetTable *table, DWORD processId, ULONGLONG nowUs);
+static BOOL IsLoadInFlight(RefreshTarget *t, ULONGLONG nowUs);
+static int  CountProcessLoads(const RefreshTarget *t, ULONGLONG nowUs, ULONGLONG *earliestEndUs);
+static BOOL TakeLoadSlot(RefreshTarget *t);
+static void UpdateLoadQueue(DWORD processId);
+static BOOL GetPageLoadTimes(const double *samples, double *p50Ms, double *p99Ms, double *maxMs);
+static BOOL FormatPageLoads(char *buffer, size_t bufferSize);
+
+// Time profiles
+static BOOL ParseTimeProfile(const char *value, TimeProfile *profile);
+static BOOL TimeProfileCovers(const TimeProfile *profile, DWORD secondOfWeek);
+static int  CompareSeconds(const void *a, const void *b);
+static void CompileTimeProfiles(void);
+static ULONGLONG TimeProfileMsOfWeek(void);
+static int  GetTimeProfile(double *minDelayS, double *maxDelayS, DWORD *pausedForMs);
+static int  LookUpTimeProfile(double *minDelayS, double *maxDelayS, DWORD *pausedForMs);
+static const char* TimeProfileName(int profile);
+static void PauseTarget(RefreshTarget *t, DWORD pausedForMs);
+static BOOL FormatTimeProfiles(char *buffer, size_t bufferSize);
+
+// Focus theft budget
+static void ResetFocusTheft(void);
+static void RollFocusTheftHour(ULONGLONG nowUs);
+static BOOL IsOverFocusBudget(void);
+static void DeferForFocusBudget(RefreshTarget *t);
+static void RecordFocusTheft(RefreshTarget *t);
+static BOOL FormatFocusTheft(char *buffer, size_t bufferSize);
+
+// Backends
+static BOOL  Win32IsWindow(HWND hWnd);
+static int   Win32GetWindowText(HWND hWnd, char *buffer, int bufferSize);
+static HWND  Win32GetForegroundWindow(void);
+static BOOL  Win32SetForegroundWindow(HWND hWnd);
+static BOOL  Win32IsIconic(HWND hWnd);
+static BOOL  Win32ShowWindow(HWND hWnd, int nCmdShow);
+static DWORD Win32GetWindowThreadId(HWND hWnd);
+static BOOL  Win32AttachThreadInput(DWORD idAttach, DWORD idAttachTo, BOOL fAttach);
+static UINT  Win32SendInput(UINT count, INPUT *inputs);
+static SHORT Win32GetAsyncKeyState(int vKey);
+static BOOL  Win32PostMessage(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
+static BOOL  Win32GenRandom(unsigned int *value);
+static void  Win32Sleep(DWORD milliseconds, DWORD toleranceMs);
+static ULONGLONG Win32NowUs(void);
+static BOOL  SimIsWindow(HWND hWnd);
+static int   SimGetWindowText(HWND hWnd, char *buffer, int bufferSize);
+static HWND  SimGetForegroundWindow(void);
+static BOOL  SimSetForegroundWindow(HWND hWnd);
+static BOOL  SimIsIconic(HWND hWnd);
+static BOOL  SimShowWindow(HWND hWnd, int nCmdShow);
+static DWORD SimGetWindowThreadId(HWND hWnd);
+static BOOL  SimAttachThreadInput(DWORD idAttach, DWORD idAttachTo, BOOL fAttach);
+static UINT  SimSendInput(UINT count, INPUT *inputs);
+static SHORT SimGetAsyncKeyState(int vKey);
+static BOOL  SimPostMessage(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
+static BOOL  SimGenRandom(unsigned int *value);
+static void  SimSleep(DWORD milliseconds, DWORD toleranceMs);
+static ULONGLONG SimNowUs(void);
+static void  ResetSimulatedDesktop(void);
+static int   RunSimulation(int cycles, int targetCount, int domainCount, int processCount, DWORD triggerEveryMs);
+static int   RunSoakTest(int cycles, unsigned int seed);
+static BOOL  JournalIsWindow(HWND hWnd);
+static int   JournalGetWindowText(HWND hWnd, char *buffer, int bufferSize);
+static HWND  JournalGetForegroundWindow(void);
+static BOOL  JournalSetForegroundWindow(HWND hWnd);
+static BOOL  JournalIsIconic(HWND hWnd);
+static BOOL  JournalShowWindow(HWND hWnd, int nCmdShow);
+static DWORD JournalGetWindowThreadId(HWND hWnd);
+static BOOL  JournalAttachThreadInput(DWORD idAttach, DWORD idAttachTo, BOOL fAttach);
+static UINT  JournalSendInput(UINT count, INPUT *inputs);
+static SHORT JournalGetAsyncKeyState(int vKey);
+static BOOL  JournalPostMessage(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
+static BOOL  JournalGenRandom(unsigned int *value);
+static void  JournalSleep(DWORD milliseconds, DWORD toleranceMs);
+static ULONGLONG JournalNowUs(void);
+static BOOL  StartJournal(const char *path, HWND targetHwnd);
+static void  JournalWrite(JournalOp op, unsigned short arg, ULONGLONG startUs, unsigned long long value);
+static void  JournalMarkCycle(int cycle, BOOL catchUp);
+static void  FlushJournal(void);
+static void  StopJournal(void);
+static BOOL  ReplayIsWindow(HWND hWnd);
+static int   ReplayGetWindowText(HWND hWnd, char *buffer, int bufferSize);
+static HWND  ReplayGetForegroundWindow(void);
+static BOOL  ReplaySetForegroundWindow(HWND hWnd);
+static BOOL  ReplayIsIconic(HWND hWnd);
+static BOOL  ReplayShowWindow(HWND hWnd, int nCmdShow);
+static DWORD ReplayGetWindowThreadId(HWND hWnd);
+static BOOL  ReplayAttachThreadInput(DWORD idAttach, DWORD idAttachTo, BOOL fAttach);
+static UINT  ReplaySendInput(UINT count, INPUT *inputs);
+static SHORT ReplayGetAsyncKeyState(int vKey);
+static BOOL  ReplayPostMessage(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
+static BOOL  ReplayGenRandom(unsigned int *value);
+static void  ReplaySleep(DWORD milliseconds, DWORD toleranceMs);
+static ULONGLONG ReplayNowUs(void);
+static const JournalRecord* ReplayTake(JournalOp op);
+static int   RunReplay(const char *journalPath);
+static int   RunTuner(const char *journalPath, const char *profilePath, double successPct);
+
+// API call accounting (per-site breakdown in the instrumented build only)
+static void ResetApiCallCounters(void);
+#ifdef REFRESHER_API_COUNTERS
+static void CountApiCall(ApiCallKind kind, const char *site);
+static unsigned int ReportApiCallCounters(int cycle);
+#endif
+
+// Benchmarks
+typedef struct BenchmarkResult BenchmarkResult;
+static int RunBenchmarks(const char *outputPath);
+static int CompareBenchmarks(const char *baselinePath, const char *currentPath);
+static void RecordBenchmark(const char *name, const double *samples, int sampleCount);
+static int LoadBenchmarkResults(const char *path, BenchmarkResult *results, int maxResults);
+static int RunLatencyBenchmark(BOOL withLoad);
+static DWORD WINAPI KeyEchoThreadProc(LPVOID parameter);
+static LRESULT CALLBACK KeyEchoWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
+
+// Tracepoints
+static void InitializeTracepoints(void);
+static void ShutdownTracepoints(void);
+static void NTAPI TracepointEnableCallback(LPCGUID sourceId, ULONG isEnabled, UCHAR level, ULONGLONG matchAnyKeyword,
+                                           ULONGLONG matchAllKeyword, PEVENT_FILTER_DESCRIPTOR filterData, PVOID callbackContext);
+static void EmitTracepoint(const char *probe, int targetId, const char *format, ...);
+static ULONGLONG TracepointNowUs(void);
+static ULONGLONG TracepointElapsedUs(void);
+
+// Tracing
+static BOOL InitializeTracing(const char *targetTitle);
+static void TraceNameTrack(int track, const char *targetTitle);
+static void ShutdownTracing(void);
+static ULONGLONG TraceBegin(void);
+static void TraceSpan(const char *name, int track, ULONGLONG startUs, const char *argName, long argValue);
+static void TraceInstant(const char *name, int track);
+static void FlushTraceEvents(BOOL force);
+static void WriteJsonEscaped(FILE *file, const char *text);
 
 // Utilities
+static void ConsolePrintfAt(const char *site, const char *format, ...);
+static void ConsoleWriteAt(const char *site, const char *text, size_t length);
+static void ConsoleFlush(void);
+// Console writes are counted for the function that makes them, and only if they are made.
+#define ConsolePrintf(...)         ConsolePrintfAt(__func__, __VA_ARGS__)
+#define ConsoleWrite(text, length) ConsoleWriteAt(__func__, (text), (length))
 static double GetRandomDelaySeconds(double min_s, double max_s);
 static void WaitMilliseconds(DWORD milliseconds);
+static void WaitCoalesced(DWORD milliseconds);
+static BOOL InitializeWaitTimer(void);
+static void ShutdownWaitTimer(void);
+static void ReportWakeupRate(BOOL force);
 static BOOL IsAltKeyHeld(void);
 
+static const WindowBackend WIN32_BACKEND = {
+    "win32",
+    Win32IsWindow, Win32GetWindowText, Win32GetForegroundWindow, Win32SetForegroundWindow,
+    Win32IsIconic, Win32ShowWindow, Win32GetWindowThreadId, Win32AttachThreadInput,
+    Win32SendInput, Win32GetAsyncKeyState, Win32PostMessage, Win32GenRandom, Win32Sleep, Win32NowUs
+};
+
+static const WindowBackend SIMULATED_BACKEND = {
+    "simulated",
+    SimIsWindow, SimGetWindowText, SimGetForegroundWindow, SimSetForegroundWindow,
+    SimIsIconic, SimShowWindow, SimGetWindowThreadId, SimAttachThreadInput,
+    SimSendInput, SimGetAsyncKeyState, SimPostMessage, SimGenRandom, SimSleep, SimNowUs
+};
+
+static const WindowBackend JOURNAL_BACKEND = {
+    "journal",
+    JournalIsWindow, JournalGetWindowText, JournalGetForegroundWindow, JournalSetForegroundWindow,
+    JournalIsIconic, JournalShowWindow, JournalGetWindowThreadId, JournalAttachThreadInput,
+    JournalSendInput, JournalGetAsyncKeyState, JournalPostMessage, JournalGenRandom, JournalSleep, JournalNowUs
+};
+
+static const WindowBackend REPLAY_BACKEND = {
+    "replay",
+    ReplayIsWindow, ReplayGetWindowText, ReplayGetForegroundWindow, ReplaySetForegroundWindow,
+    ReplayIsIconic, ReplayShowWindow, ReplayGetWindowThreadId, ReplayAttachThreadInput,
+    ReplaySendInput, ReplayGetAsyncKeyState, ReplayPostMessage, ReplayGenRandom, ReplaySleep, ReplayNowUs
+};
+
 // === Main Application Logic ===
 
 /**
  * @brief Main entry point of the application.
- * Initializes logging and configuration, selects a target window,
- * and enters a loop to send keystrokes.
+ * Initializes logging and configuration, selects the target windows,
+ * and runs the scheduler that sends them keystrokes.
+ * Run with "--simulate <cycles> [targets] [domains] [processes] [trigger_ms]" to drive the refresh
+ * cycle against the simulated backend instead of the desktop (no window selection, virtual clock),
+ * with the targets spread over up to MAX_FOCUS_DOMAINS simulated displays.
+ * Run with "--bench [out.json]" to benchmark the building blocks, and with
+ * "--bench-compare <baseline.json> <current.json>" to check for regressions.
+ * Run with "--tune <journal> [profile] [success_pct]" to fit the focus timing to a journal.
+ * Run with "--replay <journal>" to re-run a journal recorded with journal_file.
+ * Run with "--soak [cycles] [seed]" for a long fault-injection run on the simulated desktop.
+ * Run with "--bench-latency [load]" to measure deadline-to-delivery latency end to end
+ * against a key-echo test window, optionally with every CPU kept busy.
+ * @param argc Argument count.
+ * @param argv Argument vector.
  * @return EXIT_SUCCESS on normal termination, EXIT_FAILURE on error.
  */
-int main(void) {
+int main(int argc, char *argv[]) {
+    // Runs before logging is set up: a client must not truncate the running instance's log.
+    if (argc >= 3 && strcmp(argv[1], "--control") == 0) {
+        return RunControlClient(argv[2]);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--stall-dump") == 0) {
+        return RunStallDump(argv[2]);
+    }
+
     if (!InitializeLogging()) {
         // If logging init fails, printf is the fallback for critical errors
         printf("CRITICAL: Failed to initialize logging. Exiting.\n");
         return EXIT_FAILURE;
     }
 
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+        int result = RunBenchmarks(argc >= 3 ? argv[2] : DEFAULT_BENCH_OUTPUT_FILE_NAME);
+        ShutdownLogging();
+        return result;
+    }
+    if (argc >= 2 && strcmp(argv[1], "--bench-latency") == 0) {
+        int result = RunLatencyBenchmark(argc >= 3 && strcmp(argv[2], "load") == 0);
+        ShutdownLogging();
+        return result;
+    }
+    if (argc >= 4 && strcmp(argv[1], "--bench-compare") == 0) {
+        int result = CompareBenchmarks(argv[2], argv[3]);
+        ShutdownLogging();
+        return result;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--soak") == 0) {
+        int cycles = (argc >= 3) ? atoi(argv[2]) : SOAK_DEFAULT_CYCLES;
+        unsigned int seed = (argc >= 4) ? (unsigned int)strtoul(argv[3], NULL, 10) : 1;
+        int result = RunSoakTest(cycles > 0 ? cycles : SOAK_DEFAULT_CYCLES, seed != 0 ? seed : 1);
+        ShutdownLogging();
+        return result;
+    }
+    if (argc >= 3 && strcmp(argv[1], "--tune") == 0) {
+        double successPct = (argc >= 5) ? atof(argv[4]) : DEFAULT_TUNE_SUCCESS_PCT;
+        int result = RunTuner(argv[2], argc >= 4 ? argv[3] : DEFAULT_TUNING_PROFILE_FILE_NAME,
+                              (successPct > 0.0 && successPct <= 100.0) ? successPct : DEFAULT_TUNE_SUCCESS_PCT);
+        ShutdownLogging();
+        return result;
+    }
+    if (argc >= 3 && strcmp(argv[1], "--replay") == 0) {
+        int result = RunReplay(argv[2]);
+        ShutdownLogging();
+        return result;
+    }
+    if (argc >= 2 && strcmp(argv[1], "--simulate") == 0) {
+        int cycles = (argc >= 3) ? atoi(argv[2]) : 100;
+        int targetCount = (argc >= 4) ? atoi(argv[3]) : 1;
+        if (targetCount < 1 || targetCount > SIM_MAX_TARGETS) targetCount = 1;
+        int domainCount = (argc >= 5) ? atoi(argv[4]) : 1;
+        if (domainCount < 1 || domainCount > MAX_FOCUS_DOMAINS || domainCount > targetCount) domainCount = 1;
+        int processCount = (argc >= 6) ? atoi(argv[5]) : 1;
+        if (processCount < 1 || processCount > targetCount) processCount = 1;
+        DWORD triggerEveryMs = (argc >= 7) ? (DWORD)strtoul(argv[6], NULL, 10) : 0;
+        int result = RunSimulation(cycles > 0 ? cycles : 100, targetCount, domainCount, processCount, triggerEveryMs);
+        ShutdownLogging();
+        return result;
+    }
+
+    g_backend = &WIN32_BACKEND;
+    g_console_startup = TRUE;
+    InitializeTracepoints();
     LogInfo("Program started. Mode: Targeted Window Keystroke Sender with Config.");
     printf("Welcome! This program will send Ctrl+F5 to a window you select at random intervals.\n");
 
     LoadConfiguration();
+    if (!InitTargetTable(&g_target_table, MAX_TARGETS)) {
+        printf("CRITICAL: Out of memory. Exiting.\n");
+        ShutdownTracepoints();
+        ShutdownLogging();
+        return EXIT_FAILURE;
+    }
 
     // Seed random number generator
     LARGE_INTEGER perfCounter;
@@ -119,589 +1514,6881 @@ int main(void) {
     } else {
         srand((unsigned int)time(NULL) ^ (unsigned int)GetCurrentProcessId()); // Fallback seeding
     }
+    if (!CryptAcquireContext(&g_hCryptProv, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT | CRYPT_SILENT)) {
+        LogError("Main: CryptAcquireContext failed. Error: %lu. Delays will use rand().", GetLastError());
+        g_hCryptProv = 0;
+    }
+
+    if (!InitializeWaitTimer()) {
+        LogWarning("Main: Could not create a waitable timer. Error: %lu. Waits use the message wait timeout instead.", GetLastError());
+    }
+    if (!InitializeSessionNotifications()) {
+        LogWarning("Main: Session lock/display notifications unavailable. Refreshes will not pause while locked.");
+    }
+    InitializeReactor();
 
-    g_hTargetWindow = GetTopLevelWindowFromClick();
+    g_hTargetWindow = GetTopLevelWindowFromClick(FALSE);
 
     if (g_hTargetWindow == NULL) {
         printf("No window was selected. Exiting program.\n");
         LogError("Main: No target window selected. Program will exit.");
+        ShutdownReactor();
+        ShutdownSessionNotifications();
+        ShutdownWaitTimer();
+        ShutdownTracepoints();
         ShutdownLogging();
         return EXIT_FAILURE;
     }
 
-    printf("Target window acquired. Flashing for confirmation...\n");
-    FlashTargetWindow(g_hTargetWindow);
-    WaitMilliseconds(1000); // Give user a moment
-
-    printf("\nStarting random Ctrl+F5 keystrokes to the selected window.\n");
-    printf("Delays will be between %.1fs and %.1fs.\n", g_min_delay_seconds, g_max_delay_seconds);
-    printf("Press Ctrl+C in this console to stop the program.\n");
-    LogInfo("Main: Entering main loop to send keystrokes to HWND %p. MinDelay: %.2f, MaxDelay: %.2f",
-             (void*)g_hTargetWindow, g_min_delay_seconds, g_max_delay_seconds);
-
-    int keystroke_count = 0;
-    while (TRUE) { // Loop indefinitely until Ctrl+C or error
-        if (!IsWindow(g_hTargetWindow)) {
-            printf("Target window (HWND %p) no longer exists. Stopping.\n", (void*)g_hTargetWindow);
-            LogWarning("Main: Target window HWND %p no longer exists. Exiting loop.", (void*)g_hTargetWindow);
-            break;
+    // Further targets are refreshed by the same scheduler, each on its own schedule.
+    AddRefreshTarget(&g_target_table, g_hTargetWindow, TRACE_TRACK_TARGET);
+    while (g_target_table.count < MAX_TARGETS) {
+        HWND nextHwnd = GetTopLevelWindowFromClick(TRUE);
+        if (nextHwnd == NULL) break;
+        BOOL duplicate = FALSE;
+        for (int i = 0; i < g_target_table.count; ++i) {
+            if (g_target_table.targets[i].hwnd == nextHwnd) duplicate = TRUE;
         }
-
-        double wait_duration_s = GetRandomDelaySeconds(g_min_delay_seconds, g_max_delay_seconds);
-        char windowTitle[MAX_TITLE_LENGTH] = "N/A";
-        GetWindowText(g_hTargetWindow, windowTitle, MAX_TITLE_LENGTH);
-
-        printf("Waiting for %.2fs before sending Ctrl+F5 to \"%s\"...\n", wait_duration_s, (strlen(windowTitle) > 0 ? windowTitle : "No Title"));
-        LogDebug("Main: Waiting for %.3f seconds.", wait_duration_s);
-        WaitMilliseconds((DWORD)(wait_duration_s * 1000.0));
-
-        if (IsAltKeyHeld()) {
-            printf("Info: Alt key is currently pressed. Skipping keystroke to avoid conflict.\n");
-            LogDebug("Main: Alt key detected as pressed. Deferring SendCtrlF5Keystroke.");
-            WaitMilliseconds(ALT_KEY_CHECK_DELAY_MS);
+        if (duplicate) {
+            printf("That window is already selected.\n");
             continue;
         }
+        AddRefreshTarget(&g_target_table, nextHwnd, TRACE_TRACK_TARGET + g_target_table.count);
+    }
 
-        if (!IsWindow(g_hTargetWindow)) { // Re-check after wait and Alt key check
-            printf("Target window (HWND %p) disappeared before sending keystroke. Stopping.\n", (void*)g_hTargetWindow);
-            LogWarning("Main: Target window HWND %p disappeared during wait. Exiting loop.", (void*)g_hTargetWindow);
-            break;
+    printf("%d target window(s) acquired. Flashing for confirmation...\n", g_target_table.count);
+    g_console_startup = FALSE;
+    char selectedTitle[MAX_TITLE_LENGTH] = "";
+    GetWindowText(g_hTargetWindow, selectedTitle, MAX_TITLE_LENGTH);
+    InitializeTracing(selectedTitle);
+    for (int i = 0; i < g_target_table.count; ++i) {
+        RefreshTarget *t = &g_target_table.targets[i];
+        if (i > 0) {
+            char title[MAX_TITLE_LENGTH] = "";
+            GetWindowText(t->hwnd, title, MAX_TITLE_LENGTH);
+            TraceNameTrack(t->track, title);
         }
+        FlashTargetWindow(t->hwnd);
+        GetWindowThreadProcessId(t->hwnd, &t->processId);
+        ReactorWatchTarget(t->hwnd);
+    }
+    WaitMilliseconds(1000); // Give user a moment
 
-        keystroke_count++;
-        printf("Sending Ctrl+F5 (Count: %d) to window \"%s\"...\n", keystroke_count, (strlen(windowTitle) > 0 ? windowTitle : "No Title"));
-        SendCtrlF5Keystroke(g_hTargetWindow);
+    ConsolePrintf("\nStarting random %s keystrokes to the selected window(s).\n",
+                  g_delivery_strategy == DELIVERY_POSTMESSAGE ? "F5" : "Ctrl+F5");
+    ConsolePrintf("Delays will be between %.1fs and %.1fs.\n", g_min_delay_seconds, g_max_delay_seconds);
+    ConsolePrintf("Press Ctrl+C in this console, or run with --control stop, to stop the program.\n");
+    LogInfo("Main: Entering scheduler to send keystrokes to %d target(s), first HWND %p. MinDelay: %.2f, MaxDelay: %.2f",
+             g_target_table.count, (void*)g_hTargetWindow, g_min_delay_seconds, g_max_delay_seconds);
 
-        WaitMilliseconds(POST_SENDINPUT_DELAY_MS);
+    // Journals describe one target's calls; only single-target sessions are recorded.
+    if (g_journal_file_path[0] != '\0') {
+        if (g_target_table.count > 1) {
+            ConsolePrintf("Warning: Journal recording needs a single target window. Recording disabled.\n");
+            LogWarning("Main: journal_file ignored with %d targets.", g_target_table.count);
+        } else if (!StartJournal(g_journal_file_path, g_hTargetWindow)) {
+            ConsolePrintf("Warning: Could not open journal file '%s'. Recording disabled.\n", g_journal_file_path);
+        }
     }
 
-    printf("Program loop terminated.\n");
+    if (g_console_mode == CONSOLE_STATUS) StartStatusView();
+    StartWatchdog();
+    StartFreshnessTracking(&g_target_table, TRUE);
+    StartTriggerSource();
+    g_page_loads.tracking = (g_max_loads_per_process > 0);
+    ResetFocusTheft();
+
+    ResetApiCallCounters();
+    RunScheduler(&g_target_table, 0); // Returns once every target window is gone, or on "stop"
+
+    StopStatusView();
+    ConsolePrintf("Program loop terminated.\n");
+    ReportWakeupRate(TRUE);
+    ReportConsoleCost(g_scheduler_stats.cyclesCompleted);
+    ReportInjectionJitter();
+    char tiers[256];
+    if (FormatRefreshTiers(tiers, sizeof(tiers))) LogInfo("Tiers: %s.", tiers);
+    static char profiles[MAX_TIME_PROFILES * (MAX_TIME_PROFILE_SPEC + 32)];
+    if (FormatTimeProfiles(profiles, sizeof(profiles))) LogInfo("Schedule: %s.", profiles);
+    char theft[256];
+    if (FormatFocusTheft(theft, sizeof(theft))) LogInfo("Focus: %s.", theft);
+    if (g_observe_reloads != RELOADS_OFF) {
+        LogInfo("Reload: %lu refresh(es) not sent because the window had just been reloaded.", g_scheduler_stats.refreshesSuppressed);
+    }
+    StopTriggerSource();
+    char triggers[256];
+    if (FormatTriggers(triggers, sizeof(triggers))) LogInfo("Trigger: %s.", triggers);
+    char loads[320];
+    if (FormatPageLoads(loads, sizeof(loads))) LogInfo("Loads: %s.", loads);
+    StopFreshnessTracking(&g_target_table);
+    ReportFreshness(&g_target_table);
+    ReportWatchdog();
+    StopWatchdog();
+    StopInjectionThread();
+    StopJournal();
+    ShutdownTracing();
+    ShutdownReactor();
+    ShutdownSessionNotifications();
+    ShutdownWaitTimer();
+    ShutdownTracepoints();
+    FreeTargetTable(&g_target_table);
     LogInfo("Program finished.");
+    if (g_hCryptProv != 0) CryptReleaseContext(g_hCryptProv, 0);
     ShutdownLogging();
     return EXIT_SUCCESS;
 }
 
-// === Logging Functions ===
+/**
+ * @brief Runs one refresh cycle of a single target: waits a random delay, then sends Ctrl+F5.
+ * Drives the target's state machine through one cycle with nothing else scheduled.
+ * @param targetHwnd Handle to the window to refresh.
+ * @param keystroke_count Running keystroke counter, incremented when a keystroke is attempted.
+ * @param skipWait TRUE to refresh immediately (catch-up after the session was locked).
+ * @return TRUE to keep looping, FALSE if the target window is gone.
+ */
+static BOOL RunRefreshCycle(HWND targetHwnd, int *keystroke_count, BOOL skipWait) {
+    RefreshTarget *target = ResetSingleTarget(targetHwnd);
+    if (target == NULL) return FALSE;
+    target->catchUp = skipWait;
+    TargetHot(target, keystrokeCount) = *keystroke_count;
+    for (;;) {
+        if (!WaitUntilDeadline(TargetHot(target, deadlineUs), TargetHot(target, exactDeadline))) continue;
+        if (StepRefreshTarget(target)) break;
+    }
+    *keystroke_count = TargetHot(target, keystrokeCount);
+    return TargetHot(target, state) != TARGET_GONE;
+}
 
 /**
- * @brief Core logging function.
- * Prepends a timestamp and level to the message and writes to the debug log file.
- * @param level Log level string (e.g., "DEBUG", "INFO").
- * @param format Format string for the message.
- * @param args Variable arguments list.
+ * @brief Runs refresh cycles against the simulated backend.
+ * Every cycle is checked against API_CALL_BUDGET_PER_CYCLE, in every build, which makes
+ * this mode usable as a regression check for the per-cycle call budget.
+ * With several targets, target 0 refreshes with the configured delivery strategy and
+ * the rest post F5, so the run shows how much non-focus work the scheduler gets done
+ * while a focus switch settles. With several focus domains, targets are dealt out to
+ * them in turn and the first target of each domain uses the configured strategy, so
+ * focus switches on different simulated displays overlap. Targets are dealt out to
+ * browser processes the same way; page loads in one process slow each other down,
+ * which max_loads_per_process limits. Push events can be fed to the targets on a
+ * fixed period of virtual time, to measure the event-to-keystroke latency.
+ * @param cycles Number of refresh cycles to run (across all targets).
+ * @param targetCount Number of simulated targets.
+ * @param domainCount Number of focus domains (simulated displays), at most targetCount.
+ * @param processCount Number of simulated browser processes, at most targetCount.
+ * @param triggerEveryMs Virtual time between events for every target, with several targets; 0 for none.
+ * @return EXIT_SUCCESS if all cycles ran (and stayed within budget), EXIT_FAILURE otherwise.
  */
-static void LogMessage(const char *level, const char *format, va_list args) {
-    if (g_debug_log_file == NULL) return;
+static int RunSimulation(int cycles, int targetCount, int domainCount, int processCount, DWORD triggerEveryMs) {
+    g_backend = &SIMULATED_BACKEND;
+    InitializeTracepoints();
+    ResetSimulatedDesktop();
+    LoadConfiguration();
+    InitializeTracing("Simulated Target");
+    LogInfo("Simulation: Running %d refresh cycles of %d target(s) in %d focus domain(s) on the %s backend.",
+            cycles, targetCount, domainCount, g_backend->name);
 
-    time_t now;
-    time(&now);
-    char time_buf[30];
-    strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    if (targetCount > 1) {
+        TargetTable table;
+        if (!InitTargetTable(&table, targetCount)) {
+            printf("Simulation: Out of memory for %d targets.\n", targetCount);
+            ShutdownTracing();
+            ShutdownTracepoints();
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < targetCount; ++i) {
+            RefreshTarget *t = AddRefreshTarget(&table, SIM_TARGET_HWND, TRACE_TRACK_TARGET + i);
+            t->domain = i % domainCount;
+            t->processId = 1 + (DWORD)(i % processCount);
+            if (i >= domainCount) t->delivery = DELIVERY_POSTMESSAGE;
+        }
+        memset(&g_scheduler_stats, 0, sizeof(g_scheduler_stats));
+        memset(&g_page_loads, 0, sizeof(g_page_loads));
+        g_page_loads.tracking = TRUE;
+        memset(&g_trigger, 0, sizeof(g_trigger));
+        g_sim.triggerEveryMs = triggerEveryMs;
+        g_sim.nextTriggerMs = triggerEveryMs;
+        ResetFocusTheft();
+        StartFreshnessTracking(&table, FALSE);
+        int completed = RunScheduler(&table, cycles);
+        g_sim.triggerEveryMs = 0;
+        StopFreshnessTracking(&table);
+        for (int id = 0; id < table.count; ++id) {
+            AdvanceSimulatedLoads(&table, table.targets[id].processId, UnrecordedNowUs()); // Loads finished since the last step
+        }
+        g_page_loads.tracking = FALSE;
+        int keystrokes = 0;
+        for (int id = 0; id < table.count; ++id) keystrokes += table.keystrokeCount[id];
+        double compliancePct = 0.0, recentPct = 0.0, breachS = 0.0;
+        int breaches = 0;
+        BOOL freshnessTracked = GetFreshnessCompliance(&table, &compliancePct, &recentPct, &breaches, &breachS);
+        FreeTargetTable(&table);
+        ShutdownTracing();
+        ShutdownTracepoints();
 
-    fprintf(g_debug_log_file, "[%s] [%s] ", time_buf, level);
-    vfprintf(g_debug_log_file, format, args);
-    fprintf(g_debug_log_file, "\n"); // Ensure newline
-    fflush(g_debug_log_file);
-}
+        printf("Simulation: %d targets, %d cycles, %d keystrokes, %.1fs of virtual time.\n",
+               targetCount, completed, keystrokes, (double)g_sim.clockMs / 1000.0);
+        printf("Scheduler: %lu steps, %lu focus switches, %lu steps of other targets during focus switches (%.1f per switch).\n",
+               g_scheduler_stats.steps, g_scheduler_stats.focusSwitches, g_scheduler_stats.stepsDuringFocusSwitch,
+               g_scheduler_stats.focusSwitches > 0 ? (double)g_scheduler_stats.stepsDuringFocusSwitch / g_scheduler_stats.focusSwitches : 0.0);
+        if (domainCount > 1) {
+            printf("Focus domains: %d, %lu of %lu focus switches started while another domain's was in progress.\n",
+                   domainCount, g_scheduler_stats.focusSwitchesOverlapped, g_scheduler_stats.focusSwitches);
+        }
+        char tiers[256];
+        if (FormatRefreshTiers(tiers, sizeof(tiers))) printf("Tiers: %s.\n", tiers);
+        char profiles[MAX_TIME_PROFILES * (MAX_TIME_PROFILE_SPEC + 32)];
+        if (FormatTimeProfiles(profiles, sizeof(profiles))) printf("Time profiles: %s.\n", profiles);
+        char theft[256];
+        if (FormatFocusTheft(theft, sizeof(theft))) printf("Focus theft: %s.\n", theft);
+        char loads[320];
+        if (FormatPageLoads(loads, sizeof(loads))) printf("Page loads in %d process(es): %s.\n", processCount, loads);
+        char triggers[256];
+        if (FormatTriggers(triggers, sizeof(triggers))) printf("Triggers every %lums: %s.\n", triggerEveryMs, triggers);
+        if (freshnessTracked) {
+            printf("Freshness: %.2f%% within the %lus objective (%.2f%% over the last hour), %d breach(es), %.1fs in breach.\n",
+                   compliancePct, g_freshness_s, recentPct, breaches, breachS);
+        }
+        printf("Console: %.1f writes, %.0f bytes, %.1fus per cycle.\n", completed > 0 ? (double)g_console_stats.writes / completed : 0.0,
+               completed > 0 ? (double)g_console_stats.bytes / completed : 0.0,
+               completed > 0 ? (double)g_console_stats.totalUs / completed : 0.0);
+        ReportConsoleCost((unsigned long)completed);
+        LogInfo("Simulation: Finished. Targets: %d, Cycles: %d, Keystrokes: %d.", targetCount, completed, keystrokes);
+        return completed == cycles ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-/** @brief Logs a debug message. */
-static void LogDebug(const char *format, ...) {
-    va_list args;
-    va_start(args, format);
-    LogMessage("DEBUG", format, args);
-    va_end(args);
-}
+    int keystroke_count = 0;
+    int failures = 0;
+    unsigned long roundTrips = 0;
+    unsigned int maxRoundTrips = 0;
+    for (int cycle = 1; cycle <= cycles; ++cycle) {
+        ResetApiCallCounters();
+        BOOL keepRunning = RunRefreshCycle(SIM_TARGET_HWND, &keystroke_count, FALSE);
+        roundTrips += g_api_round_trips_this_cycle;
+        if (g_api_round_trips_this_cycle > maxRoundTrips) maxRoundTrips = g_api_round_trips_this_cycle;
+#ifdef REFRESHER_API_COUNTERS
+        unsigned int calls = ReportApiCallCounters(cycle);
+#else
+        unsigned int calls = g_api_calls_this_cycle;
+#endif
+        if (calls > API_CALL_BUDGET_PER_CYCLE) {
+            printf("FAIL: cycle %d made %u API calls (budget %d).\n", cycle, calls, API_CALL_BUDGET_PER_CYCLE);
+            failures++;
+        }
+        if (!keepRunning) {
+            printf("FAIL: simulated target disappeared in cycle %d.\n", cycle);
+            failures++;
+            break;
+        }
+        FlushTraceEvents(FALSE);
+    }
+    ShutdownTracing();
+    ShutdownTracepoints();
 
-/** @brief Logs an informational message. */
-static void LogInfo(const char *format, ...) {
-    va_list args;
-    va_start(args, format);
-    LogMessage("INFO", format, args);
-    va_end(args);
+    printf("Simulation: %d cycles, %d keystrokes, %.1fs of virtual time, %d failure(s).\n",
+           cycles, keystroke_count, (double)g_sim.clockMs / 1000.0, failures);
+    printf("Round trips: %.1f window-system calls per cycle, %u in the busiest cycle.\n",
+           (double)roundTrips / cycles, maxRoundTrips);
+    printf("Console: %.1f writes, %.0f bytes, %.1fus per cycle.\n", (double)g_console_stats.writes / cycles,
+           (double)g_console_stats.bytes / cycles, (double)g_console_stats.totalUs / cycles);
+    ReportConsoleCost((unsigned long)cycles);
+    LogInfo("Simulation: Finished. Keystrokes: %d, Failures: %d.", keystroke_count, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-/** @brief Logs a warning message. */
-static void LogWarning(const char *format, ...) {
-    va_list args;
-    va_start(args, format);
-    LogMessage("WARNING", format, args);
-    va_end(args);
-}
+// === Soak Test ===
+// "--soak" runs a very large number of refresh cycles on the simulated desktop and
+// arms a random fault in some of them. After every cycle it checks the invariants a
+// refresher running for weeks depends on; every SOAK_SAMPLE_INTERVAL cycles it checks
+// the process's handle count, private bytes and log output rate.
 
-/** @brief Logs an error message. */
-static void LogError(const char *format, ...) {
-    va_list args;
-    va_start(args, format);
-    LogMessage("ERROR", format, args);
-    va_end(args);
-}
+typedef enum SoakViolation {
+    SOAK_STUCK_KEY,          // A key pressed by SendInput was not released by the end of the cycle
+    SOAK_MISDIRECTED_INPUT,  // Input was injected while the target was not in front
+    SOAK_INPUT_WHILE_TYPING, // Input was injected while the user held a key
+    SOAK_FOCUS_NOT_RETURNED, // The target was left in the foreground after the cycle
+    SOAK_ATTACH_LEAK,        // AttachThreadInput was not undone
+    SOAK_LATENESS,           // Injection came later after the deadline than the focus timing allows
+    SOAK_HANDLE_GROWTH,
+    SOAK_MEMORY_GROWTH,
+    SOAK_LOG_GROWTH,
+    SOAK_VIOLATION_COUNT
+} SoakViolation;
+
+static const char* const SOAK_VIOLATION_NAMES[] = {
+    "stuck_key", "misdirected_input", "input_while_typing", "focus_not_returned", "attach_leak",
+    "lateness", "handle_growth", "memory_growth", "log_growth"
+};
 
+/** @brief Lateness histogram of a soak run (deadline to injection, virtual ms). */
+static unsigned long g_soak_lateness_histogram[SOAK_LATENESS_BUCKETS];
+
+/** @brief Violation counters of a soak run. */
+static unsigned long g_soak_violations[SOAK_VIOLATION_COUNT];
 
 /**
- * @brief Initializes the debug logging system.
- * Opens the debug log file for writing.
- * @return TRUE if initialization was successful, FALSE otherwise.
+ * @brief Counts an invariant violation and prints the first few.
+ * @param kind Violated invariant.
+ * @param cycle Cycle in which it was detected.
+ * @param fault Fault armed in that cycle.
  */
-static BOOL InitializeLogging(void) {
-    g_debug_log_file = fopen(DEBUG_LOG_FILE_NAME, "w");
-    if (g_debug_log_file == NULL) {
-        perror("CRITICAL ERROR opening debug.log"); // Use perror for system errors
-        return FALSE;
+static void RecordSoakViolation(SoakViolation kind, int cycle, SimFault fault) {
+    unsigned long total = 0;
+    for (int i = 0; i < SOAK_VIOLATION_COUNT; ++i) total += g_soak_violations[i];
+    g_soak_violations[kind]++;
+    if (total < SOAK_MAX_REPORTED_VIOLATIONS) {
+        printf("VIOLATION: %s in cycle %d (fault: %s).\n", SOAK_VIOLATION_NAMES[kind], cycle, SIM_FAULT_NAMES[fault]);
     }
-    // Log successful initialization to the file itself
-    LogInfo("Logging system initialized.");
-    return TRUE;
 }
 
 /**
- * @brief Shuts down the logging system.
- * Closes the debug log file.
+ * @brief Returns the value below which the given share of histogram samples fall.
+ * @param total Number of samples in the histogram.
+ * @param fraction Percentile as a fraction (e.g., 0.99).
+ * @return Upper edge of the bucket holding the percentile, in ms.
  */
-static void ShutdownLogging(void) {
-    if (g_debug_log_file != NULL) {
-        LogInfo("Logging system shutting down.");
-        fclose(g_debug_log_file);
-        g_debug_log_file = NULL;
+static unsigned long SoakLatenessPercentileMs(unsigned long total, double fraction) {
+    unsigned long rank = (unsigned long)(fraction * (double)total);
+    unsigned long seen = 0;
+    for (int i = 0; i < SOAK_LATENESS_BUCKETS; ++i) {
+        seen += g_soak_lateness_histogram[i];
+        if (seen > rank) return (unsigned long)i;
     }
-}
-
-// === Configuration Functions ===
-
-/**
- * @brief Trims leading and trailing whitespace from a string in-place.
- * @param str The string to trim.
- * @return Pointer to the beginning of the trimmed string (which is str itself or a part of it).
- */
-static char* TrimWhitespace(char *str) {
-    char *end;
-    // Trim leading space
-    while(isspace((unsigned char)*str)) str++;
-    if(*str == '\0') return str; // All spaces?
-    // Trim trailing space
-    end = str + strlen(str) - 1;
-    while(end > str && isspace((unsigned char)*end)) end--;
-    // Write new null terminator
-    *(end + 1) = '\0';
-    return str;
+    return SOAK_LATENESS_BUCKETS - 1;
 }
 
 /**
- * @brief Creates a default configuration file if one doesn't exist.
- * @return TRUE if the file was created or already existed, FALSE on creation error.
+ * @brief Reads the process's handle count and private bytes.
+ * @param handles Receives the handle count.
+ * @param privateBytes Receives the committed private memory.
  */
-static BOOL CreateDefaultConfigFile(void) {
-    FILE* configFile = fopen(CONFIG_FILE_NAME, "w");
-    if (configFile == NULL) {
-        printf("Warning: Could not create default '%s'.\n", CONFIG_FILE_NAME);
-        LogWarning("LoadConfig: Failed to create default '%s'.", CONFIG_FILE_NAME);
-        return FALSE;
+static void SampleProcessResources(DWORD *handles, SIZE_T *privateBytes) {
+    PROCESS_MEMORY_COUNTERS counters;
+    *handles = 0;
+    *privateBytes = 0;
+    GetProcessHandleCount(GetCurrentProcess(), handles);
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        *privateBytes = counters.PagefileUsage;
     }
-    fprintf(configFile, "# Configuration for Window Refresher\n");
-    fprintf(configFile, "# Delays are in seconds (can be fractional, e.g., 2.5)\n");
-    fprintf(configFile, "min_delay = %.1f\n", DEFAULT_MIN_DELAY_S);
-    fprintf(configFile, "max_delay = %.1f\n", DEFAULT_MAX_DELAY_S);
-    fclose(configFile);
-    printf("Info: A default '%s' has been created.\n", CONFIG_FILE_NAME);
-    LogInfo("LoadConfig: Created default '%s'.", CONFIG_FILE_NAME);
-    return TRUE;
 }
 
 /**
- * @brief Loads configuration settings from "options.config".
- * Reads min_delay and max_delay. If the file doesn't exist,
- * it uses default values and attempts to create a default config file.
+ * @brief Runs refresh cycles with random faults on the simulated desktop and checks invariants.
+ * Log output goes to a scratch file that is truncated at every resource sample, so the
+ * run measures the log growth rate without filling the disk.
+ * @param cycles Number of refresh cycles to run.
+ * @param seed Seed for the fault schedule; the same seed reproduces the same run.
+ * @return EXIT_SUCCESS if no invariant was violated, EXIT_FAILURE otherwise.
  */
-static void LoadConfiguration(void) {
-    FILE *configFile = fopen(CONFIG_FILE_NAME, "r");
-    char line[MAX_CONFIG_LINE_LENGTH];
-    char key[MAX_CONFIG_KEY_LENGTH];
-    char value_str[MAX_CONFIG_VALUE_LENGTH];
+static int RunSoakTest(int cycles, unsigned int seed) {
+    g_backend = &SIMULATED_BACKEND;
+    ResetSimulatedDesktop();
+    LoadConfiguration();
+    g_console_output_enabled = FALSE;
+    memset(g_soak_lateness_histogram, 0, sizeof(g_soak_lateness_histogram));
+    memset(g_soak_violations, 0, sizeof(g_soak_violations));
+    LogInfo("Soak: Running %d cycles with seed %u (%d%% of cycles get a fault).", cycles, seed, SOAK_FAULT_PERCENT);
+    printf("Soak: %d cycles, seed %u. Faults in %d%% of cycles.\n", cycles, seed, SOAK_FAULT_PERCENT);
 
-    // Set defaults initially
-    g_min_delay_seconds = DEFAULT_MIN_DELAY_S;
-    g_max_delay_seconds = DEFAULT_MAX_DELAY_S;
+    // Longest the refresher itself may take from the deadline to the injection.
+    ULONGLONG latenessBoundMs = (ULONGLONG)g_focus_timing.switchAttempts * g_focus_timing.retryDelayMs +
+                                g_focus_timing.retryDelayMs + g_focus_timing.settleDelayMs + SIM_HUNG_TARGET_BLOCK_MS;
 
-    if (configFile == NULL) {
-        printf("Info: '%s' not found. Using default delay values (Min: %.1fs, Max: %.1fs).\n",
-               CONFIG_FILE_NAME, g_min_delay_seconds, g_max_delay_seconds);
-        LogInfo("LoadConfig: '%s' not found. Using default delays.", CONFIG_FILE_NAME);
-        CreateDefaultConfigFile(); // Attempt to create it
-        return;
-    }
+    FILE *realLogFile = g_debug_log_file;
+    g_debug_log_file = fopen(SOAK_SCRATCH_LOG_FILE_NAME, "w");
 
-    LogInfo("LoadConfig: Reading configuration from '%s'.", CONFIG_FILE_NAME);
-    int line_num = 0;
-    while (fgets(line, sizeof(line), configFile) != NULL) {
-        line_num++;
-        char *trimmed_line = TrimWhitespace(line);
+    unsigned long faultCounts[SIM_FAULT_COUNT] = {0};
+    unsigned long latenessSamples = 0, targetRecreations = 0;
+    ULONGLONG latenessMaxMs = 0, latenessSumMs = 0;
+    DWORD baseHandles = 0, handles = 0, peakHandles = 0;
+    SIZE_T basePrivateBytes = 0, privateBytes = 0, peakPrivateBytes = 0;
+    double peakLogBytesPerCycle = 0.0;
+    unsigned int faultRng = seed;
+    int keystroke_count = 0;
+    ULONGLONG startUs = Win32NowUs();
 
-        if (trimmed_line[0] == '\0' || trimmed_line[0] == '#' || trimmed_line[0] == ';') {
-            continue; // Skip empty lines and comments
+    for (int cycle = 1; cycle <= cycles; ++cycle) {
+        // xorshift32, separate from the simulated desktop's RNG so the delays do not depend on the faults
+        faultRng ^= faultRng << 13; faultRng ^= faultRng >> 17; faultRng ^= faultRng << 5;
+        SimFault fault = SIM_FAULT_NONE;
+        if (faultRng % 100 < SOAK_FAULT_PERCENT) {
+            fault = (SimFault)(1 + (faultRng / 100) % (SIM_FAULT_COUNT - 1));
         }
+        faultCounts[fault]++;
+        g_sim.fault = fault;
+        g_sim.sleepsThisCycle = 0;
+        g_sim.sleepsWithTargetInFront = 0;
+        g_sim.suspendedMs = 0;
+        unsigned int injectionsBefore = g_sim.injections;
+        unsigned int misdirectedBefore = g_sim.misdirectedInjections;
+        unsigned int whileTypingBefore = g_sim.injectionsWhileTyping;
 
-        if (sscanf(trimmed_line, "%127[^= \t] = %127s", key, value_str) == 2) {
-            char *trimmed_key = TrimWhitespace(key);
-            char *trimmed_value_str = TrimWhitespace(value_str);
-            double parsed_val = atof(trimmed_value_str);
+        ResetApiCallCounters();
+        if (!RunRefreshCycle(SIM_TARGET_HWND, &keystroke_count, FALSE) || !g_sim.targetExists) {
+            g_sim.targetExists = TRUE; // The user reopens the page; the soak goes on
+            targetRecreations++;
+        }
+        g_sim.fault = SIM_FAULT_NONE;
 
-            if (strcmp(trimmed_key, "min_delay") == 0) {
-                if (parsed_val > 0.0 && parsed_val < 3600.0) { // Basic validation
-                    g_min_delay_seconds = parsed_val;
-                    LogDebug("LoadConfig: Loaded min_delay = %.2f", g_min_delay_seconds);
-                } else {
-                    LogWarning("LoadConfig: Invalid value for min_delay on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
-                }
-            } else if (strcmp(trimmed_key, "max_delay") == 0) {
-                 if (parsed_val > 0.0 && parsed_val < 3600.0) { // Basic validation
-                    g_max_delay_seconds = parsed_val;
-                    LogDebug("LoadConfig: Loaded max_delay = %.2f", g_max_delay_seconds);
-                } else {
-                    LogWarning("LoadConfig: Invalid value for max_delay on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
-                }
+        for (int vk = 0; vk < 256; ++vk) {
+            if (g_sim.injectedKeyDown[vk]) {
+                RecordSoakViolation(SOAK_STUCK_KEY, cycle, fault);
+                g_sim.injectedKeyDown[vk] = FALSE;
+            }
+        }
+        if (g_sim.misdirectedInjections != misdirectedBefore) RecordSoakViolation(SOAK_MISDIRECTED_INPUT, cycle, fault);
+        if (g_sim.injectionsWhileTyping != whileTypingBefore) RecordSoakViolation(SOAK_INPUT_WHILE_TYPING, cycle, fault);
+        if (g_sim.foreground != SIM_USER_HWND) {
+            RecordSoakViolation(SOAK_FOCUS_NOT_RETURNED, cycle, fault);
+            g_sim.foreground = SIM_USER_HWND;
+        }
+        if (g_sim.attachedInputs != 0) {
+            RecordSoakViolation(SOAK_ATTACH_LEAK, cycle, fault);
+            g_sim.attachedInputs = 0;
+        }
+        if (g_sim.injections != injectionsBefore) {
+            ULONGLONG latenessMs = g_sim.lastInjectMs - g_sim.wakeMs - g_sim.suspendedMs; // Suspended time is not the refresher's
+            g_soak_lateness_histogram[latenessMs < SOAK_LATENESS_BUCKETS ? latenessMs : SOAK_LATENESS_BUCKETS - 1]++;
+            latenessSamples++;
+            latenessSumMs += latenessMs;
+            if (latenessMs > latenessMaxMs) latenessMaxMs = latenessMs;
+            if (latenessMs > latenessBoundMs) RecordSoakViolation(SOAK_LATENESS, cycle, fault);
+        }
+
+        if (cycle % SOAK_SAMPLE_INTERVAL == 0 || cycle == cycles) {
+            SampleProcessResources(&handles, &privateBytes);
+            if (handles > peakHandles) peakHandles = handles;
+            if (privateBytes > peakPrivateBytes) peakPrivateBytes = privateBytes;
+            if (basePrivateBytes == 0) { // First sample is the baseline, after warm-up
+                baseHandles = handles;
+                basePrivateBytes = privateBytes;
             } else {
-                LogWarning("LoadConfig: Unknown key '%s' on line %d.", trimmed_key, line_num);
+                if (handles > baseHandles + SOAK_MAX_HANDLE_GROWTH) RecordSoakViolation(SOAK_HANDLE_GROWTH, cycle, fault);
+                if (privateBytes > basePrivateBytes + SOAK_MAX_MEMORY_GROWTH_BYTES) RecordSoakViolation(SOAK_MEMORY_GROWTH, cycle, fault);
+            }
+            if (g_debug_log_file != NULL) {
+                int sampledCycles = (cycle % SOAK_SAMPLE_INTERVAL == 0) ? SOAK_SAMPLE_INTERVAL : cycle % SOAK_SAMPLE_INTERVAL;
+                double logBytesPerCycle = (double)ftell(g_debug_log_file) / sampledCycles;
+                if (logBytesPerCycle > peakLogBytesPerCycle) peakLogBytesPerCycle = logBytesPerCycle;
+                if (logBytesPerCycle > SOAK_MAX_LOG_BYTES_PER_CYCLE) RecordSoakViolation(SOAK_LOG_GROWTH, cycle, fault);
+                fclose(g_debug_log_file);
+                g_debug_log_file = fopen(SOAK_SCRATCH_LOG_FILE_NAME, "w");
             }
-        } else {
-            LogWarning("LoadConfig: Could not parse line %d: '%s'", line_num, trimmed_line);
         }
     }
-    fclose(configFile);
 
-    if (g_min_delay_seconds > g_max_delay_seconds) {
-        printf("Warning: min_delay (%.1fs) in config is greater than max_delay (%.1fs). Swapping them.\n",
-               g_min_delay_seconds, g_max_delay_seconds);
-        LogWarning("LoadConfig: min_delay > max_delay. Swapping. Min: %.2f, Max: %.2f", g_min_delay_seconds, g_max_delay_seconds);
-        double temp = g_min_delay_seconds;
-        g_min_delay_seconds = g_max_delay_seconds;
-        g_max_delay_seconds = temp;
+    double elapsedS = (double)(Win32NowUs() - startUs) / 1000000.0;
+    if (g_debug_log_file != NULL) fclose(g_debug_log_file);
+    remove(SOAK_SCRATCH_LOG_FILE_NAME);
+    g_debug_log_file = realLogFile;
+    g_console_output_enabled = TRUE;
+
+    unsigned long totalViolations = 0;
+    for (int i = 0; i < SOAK_VIOLATION_COUNT; ++i) totalViolations += g_soak_violations[i];
+
+    printf("\nThroughput: %d cycles in %.2fs (%.0f cycles/s), %.1f days of virtual time.\n", cycles, elapsedS,
+           elapsedS > 0.0 ? cycles / elapsedS : 0.0, (double)g_sim.clockMs / 86400000.0);
+    printf("Keystrokes: %u delivered, %d attempted, target recreated %lu time(s).\n",
+           g_sim.injections, keystroke_count, targetRecreations);
+    printf("Faults:");
+    for (int i = 1; i < SIM_FAULT_COUNT; ++i) printf(" %s=%lu", SIM_FAULT_NAMES[i], faultCounts[i]);
+    printf("\n");
+    if (latenessSamples > 0) {
+        printf("Lateness (deadline to injection, virtual): mean %.1fms p50 %lums p99 %lums max %llums (bound %llums).\n",
+               (double)latenessSumMs / latenessSamples, SoakLatenessPercentileMs(latenessSamples, 0.50),
+               SoakLatenessPercentileMs(latenessSamples, 0.99), latenessMaxMs, latenessBoundMs);
     }
-    printf("Info: Using delays - Min: %.1fs, Max: %.1fs (from '%s').\n",
-           g_min_delay_seconds, g_max_delay_seconds, CONFIG_FILE_NAME);
+    printf("Resources: handles %lu -> %lu (peak %lu), private bytes %.1f MB -> %.1f MB (peak %.1f MB), log %.0f bytes/cycle at most.\n",
+           baseHandles, handles, peakHandles, basePrivateBytes / 1048576.0, privateBytes / 1048576.0,
+           peakPrivateBytes / 1048576.0, peakLogBytesPerCycle);
+    printf("Invariants:");
+    for (int i = 0; i < SOAK_VIOLATION_COUNT; ++i) printf(" %s=%lu", SOAK_VIOLATION_NAMES[i], g_soak_violations[i]);
+    printf("\n%s\n", totalViolations == 0 ? "Soak PASSED." : "Soak FAILED.");
+
+    LogInfo("Soak: %d cycles in %.2fs, %u keystrokes, %lu violation(s), lateness max %llums, handles %lu -> %lu, private bytes %lu -> %lu.",
+            cycles, elapsedS, g_sim.injections, totalViolations, latenessMaxMs, baseHandles, handles,
+            (unsigned long)basePrivateBytes, (unsigned long)privateBytes);
+    return totalViolations == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
+// === Benchmarks ===
+// "--bench" times the building blocks and writes one JSON object per benchmark;
+// "--bench-compare" flags statistically significant slowdowns against a baseline.
+// All timing uses the real performance counter, even when the simulated backend runs.
 
-// === Window Interaction Functions ===
+/** @brief Summary statistics for one benchmark, in nanoseconds per operation. */
+struct BenchmarkResult {
+    char name[MAX_BENCHMARK_NAME_LENGTH];
+    int samples;
+    double mean;
+    double stddev;
+    double min;
+};
+
+static BenchmarkResult g_bench_results[MAX_BENCHMARKS];
+static int g_bench_result_count = 0;
 
 /**
- * @brief Briefly flashes the border/title bar of the specified window.
- * @param hWnd Handle to the window to flash.
+ * @brief Times batches of log calls at one level against a scratch log file.
+ * @param name Benchmark name.
+ * @param logFunction Logging function under test.
  */
-static void FlashTargetWindow(HWND hWnd) {
-    if (!IsWindow(hWnd)) {
-        LogWarning("FlashTargetWindow: Invalid window handle provided (%p).", (void*)hWnd);
-        return;
-    }
-    FLASHWINFO fwi;
-    fwi.cbSize = sizeof(FLASHWINFO);
-    fwi.hwnd = hWnd;
-    fwi.dwFlags = FLASHW_ALL | FLASHW_TIMERNOFG; // Flash caption and taskbar, don't steal focus if not foreground
-    fwi.uCount = 3;    // Number of flashes
-    fwi.dwTimeout = 0; // Default flash rate (system default)
-    if (!FlashWindowEx(&fwi)) {
-        LogError("FlashTargetWindow: FlashWindowEx failed for HWND %p. Error: %lu", (void*)hWnd, GetLastError());
-    } else {
-        LogDebug("FlashTargetWindow: Flashed window HWND: %p", (void*)hWnd);
+static void BenchLogLevel(const char *name, void (*logFunction)(const char *format, ...)) {
+    const int batch = 200;
+    double samples[BENCH_SAMPLES];
+    for (int s = 0; s < BENCH_SAMPLES; ++s) {
+        ULONGLONG startUs = Win32NowUs();
+        for (int i = 0; i < batch; ++i) {
+            logFunction("Bench: Log line %d with a typical HWND %p and value %.3f.", i, (void*)SIM_TARGET_HWND, 1.5);
+        }
+        samples[s] = (double)(Win32NowUs() - startUs) * 1000.0 / batch;
     }
+    RecordBenchmark(name, samples, BENCH_SAMPLES);
 }
 
 /**
- * @brief Prompts the user to click on a window and returns its top-level handle.
- * @return HWND of the selected top-level window, or NULL on failure or if no window is found.
+ * @brief Times parsing of a generated configuration file with the given number of lines.
+ * The log is detached while parsing, since one debug line per key and its flush would
+ * be most of the measurement. The settings the file sets are put back afterwards.
+ * @param lines Number of lines in the generated file.
  */
-static HWND GetTopLevelWindowFromClick(void) {
-    POINT cursorPos;
-    HWND clickedHwnd = NULL;
-    HWND topLevelHwnd = NULL;
-
-    printf("\n--- Window Selection ---\n");
-    printf("Please CLICK ANYWHERE on the window you want to target.\n");
-    printf("Waiting for your click...\n");
-    fflush(stdout);
-    LogDebug("GetTopLevelWindowFromClick: Waiting for left mouse button click.");
-
-    // Wait for left mouse button press
-    while (!(GetAsyncKeyState(VK_LBUTTON) & 0x8000)) {
-        WaitMilliseconds(MAIN_LOOP_POLL_INTERVAL_MS);
+static void BenchConfigParse(int lines) {
+    FILE *file = fopen(BENCH_SCRATCH_CONFIG_FILE_NAME, "w");
+    if (file == NULL) return;
+    for (int i = 0; i < lines; ++i) {
+        switch (i % 4) {
+            case 0: fprintf(file, "# Comment line %d\n", i); break;
+            case 1: fprintf(file, "min_delay = %.1f\n", 2.0 + (i % 7)); break;
+            case 2: fprintf(file, "max_delay = %.1f\n", 10.0 + (i % 7)); break;
+            default: fprintf(file, "timer_tolerance_pct = %d\n", i % 10); break;
+        }
     }
-    LogDebug("GetTopLevelWindowFromClick: Left mouse button pressed.");
+    fclose(file);
 
-    // Wait for the button to be released to avoid issues with drag/multiple clicks
-    while (GetAsyncKeyState(VK_LBUTTON) & 0x8000) {
-        WaitMilliseconds(MAIN_LOOP_POLL_INTERVAL_MS);
+    double savedMinDelayS = g_min_delay_seconds;
+    double savedMaxDelayS = g_max_delay_seconds;
+    int savedTolerancePct = g_timer_tolerance_pct;
+    FILE *savedLog = g_debug_log_file;
+    g_debug_log_file = NULL;
+    double samples[BENCH_SAMPLES];
+    int sampleCount = 0;
+    for (; sampleCount < BENCH_SAMPLES; ++sampleCount) {
+        ULONGLONG startUs = Win32NowUs();
+        file = fopen(BENCH_SCRATCH_CONFIG_FILE_NAME, "r");
+        if (file == NULL) break;
+        ParseConfigurationLines(file, FALSE);
+        fclose(file);
+        samples[sampleCount] = (double)(Win32NowUs() - startUs) * 1000.0; // Per file, not per line
     }
-    LogDebug("GetTopLevelWindowFromClick: Left mouse button released.");
+    g_debug_log_file = savedLog;
+    g_min_delay_seconds = savedMinDelayS;
+    g_max_delay_seconds = savedMaxDelayS;
+    g_timer_tolerance_pct = savedTolerancePct;
+    remove(BENCH_SCRATCH_CONFIG_FILE_NAME);
+    if (sampleCount < BENCH_SAMPLES) return;
 
-    if (GetCursorPos(&cursorPos)) {
-        clickedHwnd = WindowFromPoint(cursorPos);
-        if (clickedHwnd != NULL) {
-            // Try to get the ultimate owner window (the main application window)
-            topLevelHwnd = GetAncestor(clickedHwnd, GA_ROOTOWNER);
-            if (topLevelHwnd == NULL) { // Fallback to GA_ROOT if GA_ROOTOWNER fails
-                topLevelHwnd = GetAncestor(clickedHwnd, GA_ROOT);
-            }
-            if (topLevelHwnd == NULL) { // If still NULL, use the directly clicked window
-                topLevelHwnd = clickedHwnd;
-            }
+    char name[MAX_BENCHMARK_NAME_LENGTH];
+    snprintf(name, sizeof(name), "config.parse.%d_lines", lines);
+    RecordBenchmark(name, samples, BENCH_SAMPLES);
+}
 
-            char windowTitle[MAX_TITLE_LENGTH];
-            GetWindowText(topLevelHwnd, windowTitle, MAX_TITLE_LENGTH);
-            printf("Window selected: \"%s\" (HWND: %p)\n",
-                   (strlen(windowTitle) > 0 ? windowTitle : "No Title"), (void*)topLevelHwnd);
-            LogInfo("GetTopLevelWindowFromClick: Click at (%ld, %ld). WindowFromPoint HWND: %p. Top-level HWND: %p. Title: %s",
-                         cursorPos.x, cursorPos.y, (void*)clickedHwnd, (void*)topLevelHwnd, windowTitle);
-            return topLevelHwnd;
-        } else {
-            printf("Could not identify a window at the click position.\n");
-            LogWarning("GetTopLevelWindowFromClick: WindowFromPoint returned NULL.");
+/**
+ * @brief Times random delay sampling on the current backend.
+ * @param name Benchmark name.
+ */
+static void BenchRandomDelay(const char *name) {
+    const int batch = 1000;
+    double samples[BENCH_SAMPLES];
+    volatile double sink = 0.0;
+    for (int s = 0; s < BENCH_SAMPLES; ++s) {
+        ULONGLONG startUs = Win32NowUs();
+        for (int i = 0; i < batch; ++i) {
+            sink += GetRandomDelaySeconds(DEFAULT_MIN_DELAY_S, DEFAULT_MAX_DELAY_S);
         }
-    } else {
-        printf("Failed to get cursor position.\n");
-        LogError("GetTopLevelWindowFromClick: GetCursorPos failed. Error: %lu", GetLastError());
+        samples[s] = (double)(Win32NowUs() - startUs) * 1000.0 / batch;
     }
-    return NULL;
+    (void)sink;
+    RecordBenchmark(name, samples, BENCH_SAMPLES);
 }
 
-
 /**
- * @brief Attempts to activate the target window and ensure it has focus.
- * This involves attaching thread inputs and using SetForegroundWindow.
- * @param hWndToActivate The window to activate.
- * @param hOriginalForeground The window that was originally in the foreground.
- * @return TRUE if focus was successfully switched (or target was already foreground), FALSE otherwise.
+ * @brief Measures how late a wait returns compared to the requested duration.
+ * @param milliseconds Requested wait.
+ * @param coalesced TRUE to use the tolerant idle wait, FALSE for the exact wait.
  */
-static BOOL ActivateWindowAndEnsureFocus(HWND hWndToActivate, HWND hOriginalForeground) {
-    if (hOriginalForeground == hWndToActivate) {
-        LogDebug("ActivateWindow: Target window %p is already foreground.", (void*)hWndToActivate);
-        return TRUE; // Already foreground
+static void BenchWaitLateness(DWORD milliseconds, BOOL coalesced) {
+    double samples[BENCH_SAMPLES];
+    for (int s = 0; s < BENCH_SAMPLES; ++s) {
+        ULONGLONG startUs = Win32NowUs();
+        if (coalesced) WaitCoalesced(milliseconds); else WaitMilliseconds(milliseconds);
+        double elapsedNs = (double)(Win32NowUs() - startUs) * 1000.0;
+        samples[s] = elapsedNs - (double)milliseconds * 1000000.0;
     }
+    char name[MAX_BENCHMARK_NAME_LENGTH];
+    snprintf(name, sizeof(name), "wait.%s.%lums.lateness", coalesced ? "coalesced" : "exact", milliseconds);
+    RecordBenchmark(name, samples, BENCH_SAMPLES);
+}
 
-    LogDebug("ActivateWindow: Target %p is not foreground. Attempting to activate.", (void*)hWndToActivate);
-
-    DWORD dwCurrentThreadId = GetCurrentThreadId();
-    DWORD dwTargetThreadId = GetWindowThreadProcessId(hWndToActivate, NULL);
-    DWORD dwOriginalForegroundThreadId = GetWindowThreadProcessId(hOriginalForeground, NULL);
-
-    BOOL attachedToTarget = FALSE;
-    BOOL attachedToOriginalFG = FALSE;
-
-    if (dwTargetThreadId != 0 && dwTargetThreadId != dwCurrentThreadId) {
-        if (AttachThreadInput(dwCurrentThreadId, dwTargetThreadId, TRUE)) {
-            attachedToTarget = TRUE;
-        } else {
-            LogWarning("ActivateWindow: Failed to attach to target thread %lu. Error: %lu", dwTargetThreadId, GetLastError());
-        }
-    }
-    if (hOriginalForeground && dwOriginalForegroundThreadId != 0 &&
-        dwOriginalForegroundThreadId != dwCurrentThreadId &&
-        dwOriginalForegroundThreadId != dwTargetThreadId) { // Avoid double attach
-        if (AttachThreadInput(dwCurrentThreadId, dwOriginalForegroundThreadId, TRUE)) {
-            attachedToOriginalFG = TRUE;
-        } else {
-            LogWarning("ActivateWindow: Failed to attach to original FG thread %lu. Error: %lu", dwOriginalForegroundThreadId, GetLastError());
+/** @brief Times complete refresh cycles on the simulated backend (CPU cost, virtual waits). */
+static void BenchSimulatedCycle(void) {
+    const int batch = 100;
+    double samples[BENCH_SAMPLES];
+    int keystroke_count = 0;
+    ResetSimulatedDesktop();
+    g_backend = &SIMULATED_BACKEND;
+    for (int s = 0; s < BENCH_SAMPLES; ++s) {
+        ULONGLONG startUs = Win32NowUs();
+        for (int i = 0; i < batch; ++i) {
+            RunRefreshCycle(SIM_TARGET_HWND, &keystroke_count, FALSE);
         }
+        samples[s] = (double)(Win32NowUs() - startUs) * 1000.0 / batch;
     }
+    g_backend = &WIN32_BACKEND;
+    RecordBenchmark("cycle.simulated", samples, BENCH_SAMPLES);
+}
 
-    if (IsIconic(hWndToActivate)) {
-        LogDebug("ActivateWindow: Target %p is iconic, restoring.", (void*)hWndToActivate);
-        ShowWindow(hWndToActivate, SW_RESTORE);
-        WaitMilliseconds(FOCUS_SWITCH_RETRY_DELAY_MS);
+/**
+ * @brief Times one scheduler step with SCHEDULER_BENCH_TARGETS targets on the simulated
+ * backend: one focus-switching target and the rest posting F5.
+ */
+static void BenchSchedulerStep(void) {
+    const int batch = 1000;
+    double samples[BENCH_SAMPLES];
+    TargetTable table;
+    if (!InitTargetTable(&table, SCHEDULER_BENCH_TARGETS)) return;
+    ResetSimulatedDesktop();
+    g_backend = &SIMULATED_BACKEND;
+    for (int i = 0; i < SCHEDULER_BENCH_TARGETS; ++i) {
+        RefreshTarget *t = AddRefreshTarget(&table, SIM_TARGET_HWND, TRACE_TRACK_TARGET + i);
+        t->delivery = (i == 0) ? DELIVERY_SENDINPUT : DELIVERY_POSTMESSAGE;
     }
-
-    BOOL focusSet = FALSE;
-    for (int i = 0; i < FOCUS_SWITCH_ATTEMPTS; ++i) {
-        SetForegroundWindow(hWndToActivate);
-        WaitMilliseconds(FOCUS_SWITCH_RETRY_DELAY_MS);
-        if (GetForegroundWindow() == hWndToActivate) {
-            focusSet = TRUE;
-            LogDebug("ActivateWindow: SetForegroundWindow for %p succeeded on attempt %d.", (void*)hWndToActivate, i + 1);
-            break;
-        }
-        LogDebug("ActivateWindow: SetForegroundWindow for %p failed on attempt %d. Current FG: %p",
-                 (void*)hWndToActivate, i + 1, (void*)GetForegroundWindow());
-    }
-    
-    if (focusSet) {
-        LogDebug("ActivateWindow: Pausing (%dms) for system to settle.", FOCUS_SETTLE_DELAY_MS);
-        WaitMilliseconds(FOCUS_SETTLE_DELAY_MS);
-        if (GetForegroundWindow() != hWndToActivate) {
-            LogWarning("ActivateWindow: Focus lost from target %p after settling pause. Current FG: %p.",
-                       (void*)hWndToActivate, (void*)GetForegroundWindow());
-            focusSet = FALSE; // Mark as failed if focus was lost
-        } else {
-            LogDebug("ActivateWindow: Target %p still has focus after settling pause.", (void*)hWndToActivate);
-        }
-    } else {
-         LogWarning("ActivateWindow: Failed to set foreground to target %p after %d attempts.", (void*)hWndToActivate, FOCUS_SWITCH_ATTEMPTS);
+    RunScheduler(&table, SCHEDULER_BENCH_TARGETS); // Warm up: every target mid-cycle
+    for (int s = 0; s < BENCH_SAMPLES; ++s) {
+        unsigned long stepsBefore = g_scheduler_stats.steps;
+        ULONGLONG startUs = Win32NowUs();
+        RunScheduler(&table, batch);
+        unsigned long steps = g_scheduler_stats.steps - stepsBefore;
+        samples[s] = (double)(Win32NowUs() - startUs) * 1000.0 / (steps > 0 ? steps : 1);
     }
-
-    // Detach in reverse order of attach, and only if attached
-    if (attachedToOriginalFG) AttachThreadInput(dwCurrentThreadId, dwOriginalForegroundThreadId, FALSE);
-    if (attachedToTarget) AttachThreadInput(dwCurrentThreadId, dwTargetThreadId, FALSE);
-    
-    return focusSet;
+    g_backend = &WIN32_BACKEND;
+    memset(g_focus_owners, 0, sizeof(g_focus_owners));
+    FreeTargetTable(&table);
+    RecordBenchmark("sched.step.1000_targets", samples, BENCH_SAMPLES);
 }
 
 /**
- * @brief Restores focus to the original foreground window if conditions are met.
- * @param hOriginalForeground The window that was originally in the foreground.
- * @param hTargetWindow The window that was targeted for input.
- * @param focusSwitchedSuccessfully Whether the focus was successfully switched to the target.
+ * @brief Times the two target table operations that grow with the target count:
+ * a sweep (one FindNextDueTarget pass) and an update (a random target moved to a
+ * new state and deadline, as a step does), on the simulated backend.
+ * @param targetCount Number of targets in the table.
  */
-static void RestoreOriginalFocus(HWND hOriginalForeground, HWND hTargetWindow, BOOL focusSwitchedSuccessfully) {
-    if (hOriginalForeground == hTargetWindow || !hOriginalForeground || !IsWindow(hOriginalForeground)) {
-        return; // No need or nothing to restore to
-    }
-
-    if (!focusSwitchedSuccessfully) {
-        LogDebug("RestoreFocus: Input was not sent to target, not aggressively restoring original focus.");
-        return;
+static void BenchTargetTable(int targetCount) {
+    const int updates = 100000;
+    const int sweeps = (targetCount < 2000000) ? 2000000 / targetCount : 1; // About 2M targets scanned per sample
+    double sweepSamples[BENCH_SAMPLES], updateSamples[BENCH_SAMPLES];
+    TargetTable table;
+    if (!InitTargetTable(&table, targetCount)) return;
+    ResetSimulatedDesktop();
+    g_backend = &SIMULATED_BACKEND;
+    unsigned int rng = 0x9E3779B9u;
+    for (int i = 0; i < targetCount; ++i) {
+        RefreshTarget *t = AddRefreshTarget(&table, SIM_TARGET_HWND, TRACE_TRACK_TARGET + i);
+        rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+        SetTargetDeadline(t, TARGET_WAITING, 1 + rng % 7000, FALSE);
     }
-    
-    HWND currentFgAfterInput = GetForegroundWindow();
-    // Only restore if the target is still foreground, or if user switched to something else (not original)
-    if (currentFgAfterInput == hTargetWindow || currentFgAfterInput != hOriginalForeground) {
-        LogDebug("RestoreFocus: Attempting to restore original foreground to HWND %p", (void*)hOriginalForeground);
-        WaitMilliseconds(FOCUS_SWITCH_RETRY_DELAY_MS); // Brief pause
 
-        DWORD dwCurrentThreadId = GetCurrentThreadId();
-        DWORD dwOriginalFGThreadId = GetWindowThreadProcessId(hOriginalForeground, NULL);
-        BOOL needsAttach = (dwOriginalFGThreadId != 0 && dwOriginalFGThreadId != dwCurrentThreadId);
-
-        if (needsAttach) AttachThreadInput(dwCurrentThreadId, dwOriginalFGThreadId, TRUE);
-        
-        if (IsIconic(hOriginalForeground)) ShowWindow(hOriginalForeground, SW_RESTORE);
-        SetForegroundWindow(hOriginalForeground); // Attempt to restore
-        
-        if (needsAttach) AttachThreadInput(dwCurrentThreadId, dwOriginalFGThreadId, FALSE);
+    volatile int sink = 0;
+    for (int s = 0; s < BENCH_SAMPLES; ++s) {
+        ULONGLONG startUs = Win32NowUs();
+        for (int k = 0; k < sweeps; ++k) {
+            BOOL exact;
+            sink += FindNextDueTarget(&table, &exact);
+        }
+        sweepSamples[s] = (double)(Win32NowUs() - startUs) * 1000.0 / sweeps;
 
-        if (GetForegroundWindow() == hOriginalForeground) {
-            LogDebug("RestoreFocus: Successfully restored foreground to HWND %p", (void*)hOriginalForeground);
-        } else {
-            LogWarning("RestoreFocus: Failed to restore foreground to HWND %p. Current FG: %p",
-                       (void*)hOriginalForeground, (void*)GetForegroundWindow());
+        startUs = Win32NowUs();
+        for (int k = 0; k < updates; ++k) {
+            rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+            RefreshTarget *t = &table.targets[rng % (unsigned int)targetCount];
+            SetTargetDeadline(t, (rng & 0x100) ? TARGET_WAITING : TARGET_COOLDOWN, 1 + (rng >> 9) % 7000, FALSE);
+            TargetHot(t, keystrokeCount)++;
         }
-    } else {
-        LogDebug("RestoreFocus: Original foreground window %p is already active or user switched. No restore needed.", (void*)hOriginalForeground);
+        updateSamples[s] = (double)(Win32NowUs() - startUs) * 1000.0 / updates;
     }
-}
+    (void)sink;
+    g_backend = &WIN32_BACKEND;
+    FreeTargetTable(&table);
 
+    char name[MAX_BENCHMARK_NAME_LENGTH];
+    snprintf(name, sizeof(name), "targets.sweep.%d", targetCount);
+    RecordBenchmark(name, sweepSamples, BENCH_SAMPLES);
+    snprintf(name, sizeof(name), "targets.update.%d", targetCount);
+    RecordBenchmark(name, updateSamples, BENCH_SAMPLES);
+}
 
 /**
- * @brief Sends a Ctrl+F5 keystroke combination to the target window.
- * This function attempts to bring the target window to the foreground briefly
- * to ensure reliable keystroke delivery via SendInput.
- * @param targetHwnd Handle to the window to receive the keystrokes.
+ * @brief Runs the benchmark suite and writes the results as JSON.
+ * Log output during the benchmarks goes to a scratch file so debug.log stays readable.
+ * @param outputPath File to write the JSON results to.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the results could not be written.
  */
-static void SendCtrlF5Keystroke(HWND targetHwnd) {
-    if (!IsWindow(targetHwnd)) {
-        LogWarning("SendCtrlF5: Target HWND %p is invalid. Skipping.", (void*)targetHwnd);
-        printf("Warning: The target window seems to be closed. Keystroke not sent.\n");
-        return;
+static int RunBenchmarks(const char *outputPath) {
+    g_backend = &WIN32_BACKEND;
+    g_bench_result_count = 0;
+    g_console_output_enabled = FALSE;
+    if (!CryptAcquireContext(&g_hCryptProv, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT | CRYPT_SILENT)) {
+        g_hCryptProv = 0;
     }
+    InitializeWaitTimer();
+    LogInfo("Bench: Running benchmarks (%d samples each).", BENCH_SAMPLES);
 
-    HWND hOriginalForeground = GetForegroundWindow();
-    BOOL targetWasAlreadyForeground = (hOriginalForeground == targetHwnd);
-    BOOL focusSetForInput = targetWasAlreadyForeground;
+    FILE *realLogFile = g_debug_log_file;
+    g_debug_log_file = fopen(BENCH_SCRATCH_LOG_FILE_NAME, "w");
+    if (g_debug_log_file != NULL) {
+        BenchLogLevel("log.debug", LogDebug);
+        BenchLogLevel("log.info", LogInfo);
+        BenchLogLevel("log.warning", LogWarning);
+        BenchLogLevel("log.error", LogError);
+    }
 
-    if (!targetWasAlreadyForeground) {
-        focusSetForInput = ActivateWindowAndEnsureFocus(targetHwnd, hOriginalForeground);
-    } else {
-        LogDebug("SendCtrlF5: Target window %p is already foreground.", (void*)targetHwnd);
-    }
-
-    if (focusSetForInput) {
-        // Final check: ensure window is not iconic just before sending
-        if (IsIconic(targetHwnd)) {
-            LogDebug("SendCtrlF5: Target %p became iconic before SendInput. Restoring.", (void*)targetHwnd);
-            ShowWindow(targetHwnd, SW_RESTORE);
-            WaitMilliseconds(FOCUS_SWITCH_RETRY_DELAY_MS);
-            if (GetForegroundWindow() != targetHwnd) {
-                LogWarning("SendCtrlF5: Failed to keep target %p foreground after restore. Skipping SendInput.", (void*)targetHwnd);
-                focusSetForInput = FALSE; // Mark as failed
-            }
-        }
+    BenchConfigParse(10);
+    BenchConfigParse(100);
+    BenchConfigParse(1000);
+    BenchConfigParse(10000);
 
-        if (focusSetForInput) {
-            INPUT inputs[4] = {0};
-            inputs[0].type = INPUT_KEYBOARD; inputs[0].ki.wVk = VK_CONTROL;
-            inputs[1].type = INPUT_KEYBOARD; inputs[1].ki.wVk = VK_F5;
-            inputs[2].type = INPUT_KEYBOARD; inputs[2].ki.wVk = VK_F5;      inputs[2].ki.dwFlags = KEYEVENTF_KEYUP;
-            inputs[3].type = INPUT_KEYBOARD; inputs[3].ki.wVk = VK_CONTROL; inputs[3].ki.dwFlags = KEYEVENTF_KEYUP;
+    BenchRandomDelay("rng.delay.win32");
+    g_backend = &SIMULATED_BACKEND;
+    ResetSimulatedDesktop();
+    BenchRandomDelay("rng.delay.simulated");
+    g_backend = &WIN32_BACKEND;
 
-            UINT uSent = SendInput(4, inputs, sizeof(INPUT));
-            if (uSent != 4) {
-                LogError("SendCtrlF5 (SendInput): Failed. Sent %u of 4. Error: %lu", uSent, GetLastError());
-            } else {
-                LogDebug("SendCtrlF5 (SendInput): Sent Ctrl+F5 to HWND %p.", (void*)targetHwnd);
-            }
-        }
-    } else {
-        printf("Info: Could not reliably switch to target window. Keystroke for Ctrl+F5 skipped this cycle.\n");
-        // Logged sufficiently by ActivateWindowAndEnsureFocus
+    BenchWaitLateness(1, FALSE);
+    BenchWaitLateness(20, FALSE);
+    BenchWaitLateness(100, FALSE);
+    BenchWaitLateness(100, TRUE);
+
+    BenchSimulatedCycle();
+    BenchSchedulerStep();
+    BenchTargetTable(1000);
+    BenchTargetTable(10000);
+    BenchTargetTable(100000);
+
+    if (g_debug_log_file != NULL) {
+        fclose(g_debug_log_file);
+        remove(BENCH_SCRATCH_LOG_FILE_NAME);
     }
+    g_debug_log_file = realLogFile;
+    ShutdownWaitTimer();
+    if (g_hCryptProv != 0) CryptReleaseContext(g_hCryptProv, 0);
+    g_console_output_enabled = TRUE;
 
-    // Restore original focus if necessary
-    if (!targetWasAlreadyForeground) {
-         RestoreOriginalFocus(hOriginalForeground, targetHwnd, focusSetForInput);
+    FILE *output = fopen(outputPath, "w");
+    if (output == NULL) {
+        printf("Error: Could not write benchmark results to '%s'.\n", outputPath);
+        LogError("Bench: Failed to open '%s' for writing.", outputPath);
+        return EXIT_FAILURE;
+    }
+    fprintf(output, "{\"unit\":\"ns/op\",\"benchmarks\":[\n");
+    for (int i = 0; i < g_bench_result_count; ++i) {
+        const BenchmarkResult *r = &g_bench_results[i];
+        fprintf(output, "{\"name\":\"%s\",\"samples\":%d,\"mean\":%.1f,\"stddev\":%.1f,\"min\":%.1f}%s\n",
+                r->name, r->samples, r->mean, r->stddev, r->min, (i + 1 < g_bench_result_count) ? "," : "");
+        printf("%-32s mean %14.1f ns  stddev %12.1f ns  min %14.1f ns\n", r->name, r->mean, r->stddev, r->min);
     }
+    fprintf(output, "]}\n");
+    fclose(output);
+    printf("Benchmark results written to '%s'.\n", outputPath);
+    LogInfo("Bench: %d results written to '%s'.", g_bench_result_count, outputPath);
+    return EXIT_SUCCESS;
 }
 
-
-// === Utility Functions ===
-
 /**
- * @brief Generates a random delay in seconds between a specified min and max.
- * Uses CryptGenRandom for better randomness if available, falls back to rand().
- * @param min_s Minimum delay in seconds.
- * @param max_s Maximum delay in seconds.
- * @return Random delay in seconds.
+ * @brief Stores mean, standard deviation and minimum of a benchmark's samples.
+ * @param name Benchmark name.
+ * @param samples Per-sample cost in nanoseconds.
+ * @param sampleCount Number of samples.
  */
-static double GetRandomDelaySeconds(double min_s, double max_s) {
-    if (min_s >= max_s) {
-        LogDebug("GetRandomDelay: min_s (%.2f) >= max_s (%.2f). Returning min_s.", min_s, max_s);
-        return min_s;
-    }
-
-    HCRYPTPROV hCryptProv = 0;
-    unsigned int random_value;
-    BOOL cryptoSuccess = FALSE;
-
-    if (CryptAcquireContext(&hCryptProv, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT | CRYPT_SILENT)) {
-        if (CryptGenRandom(hCryptProv, sizeof(random_value), (BYTE*)&random_value)) {
-            cryptoSuccess = TRUE;
-        } else {
-            LogError("GetRandomDelay: CryptGenRandom failed. Error: %lu. Falling back to rand().", GetLastError());
-        }
-        CryptReleaseContext(hCryptProv, 0);
-    } else {
-        LogError("GetRandomDelay: CryptAcquireContext failed. Error: %lu. Falling back to rand().", GetLastError());
+static void RecordBenchmark(const char *name, const double *samples, int sampleCount) {
+    if (g_bench_result_count >= MAX_BENCHMARKS || sampleCount <= 0) return;
+    BenchmarkResult *result = &g_bench_results[g_bench_result_count++];
+    double sum = 0.0, min = samples[0];
+    for (int i = 0; i < sampleCount; ++i) {
+        sum += samples[i];
+        if (samples[i] < min) min = samples[i];
     }
-
-    if (!cryptoSuccess) {
-        random_value = rand(); // Fallback
+    double mean = sum / sampleCount;
+    double squares = 0.0;
+    for (int i = 0; i < sampleCount; ++i) {
+        squares += (samples[i] - mean) * (samples[i] - mean);
     }
-
-    double scale = (double)random_value / (double)UINT_MAX;
-    return min_s + scale * (max_s - min_s);
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->samples = sampleCount;
+    result->mean = mean;
+    result->stddev = (sampleCount > 1) ? sqrt(squares / (sampleCount - 1)) : 0.0;
+    result->min = min;
 }
 
 /**
- * @brief Pauses execution for a specified number of milliseconds.
- * @param milliseconds Duration to wait.
+ * @brief Reads results written by RunBenchmarks (one benchmark object per line).
+ * @param path JSON file to read.
+ * @param results Array receiving the results.
+ * @param maxResults Capacity of results.
+ * @return Number of results read, or -1 if the file could not be opened.
  */
-static void WaitMilliseconds(DWORD milliseconds) {
-    if (milliseconds > 0) {
-        Sleep(milliseconds);
+static int LoadBenchmarkResults(const char *path, BenchmarkResult *results, int maxResults) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return -1;
+    char line[MAX_CONFIG_LINE_LENGTH];
+    int count = 0;
+    while (count < maxResults && fgets(line, sizeof(line), file) != NULL) {
+        BenchmarkResult *r = &results[count];
+        if (sscanf(line, "{\"name\":\"%63[^\"]\",\"samples\":%d,\"mean\":%lf,\"stddev\":%lf,\"min\":%lf",
+                   r->name, &r->samples, &r->mean, &r->stddev, &r->min) == 5) {
+            count++;
+        }
     }
+    fclose(file);
+    return count;
 }
 
 /**
- * @brief Checks if any Alt key (Left, Right, or generic) is currently held down.
- * @return TRUE if an Alt key is pressed, FALSE otherwise.
+ * @brief Compares two benchmark runs and flags statistically significant slowdowns.
+ * A benchmark regresses when Welch's t statistic for (current - baseline) exceeds
+ * BENCH_REGRESSION_T_THRESHOLD and both the mean and the best sample got at least
+ * BENCH_REGRESSION_MIN_CHANGE slower. Requiring the minimum to move as well keeps
+ * one-off interference (other processes, disk flushes) from reading as a regression.
+ * Wait lateness is compared on the same scale (lateness in ns).
+ * @param baselinePath Stored baseline results.
+ * @param currentPath Results of the run under test.
+ * @return EXIT_SUCCESS if nothing regressed, EXIT_FAILURE otherwise.
+ */
+static int CompareBenchmarks(const char *baselinePath, const char *currentPath) {
+    BenchmarkResult baseline[MAX_BENCHMARKS];
+    BenchmarkResult current[MAX_BENCHMARKS];
+    int baselineCount = LoadBenchmarkResults(baselinePath, baseline, MAX_BENCHMARKS);
+    int currentCount = LoadBenchmarkResults(currentPath, current, MAX_BENCHMARKS);
+    if (baselineCount < 0 || currentCount < 0) {
+        printf("Error: Could not read '%s' or '%s'.\n", baselinePath, currentPath);
+        return EXIT_FAILURE;
+    }
+
+    int regressions = 0;
+    for (int i = 0; i < currentCount; ++i) {
+        const BenchmarkResult *cur = &current[i];
+        const BenchmarkResult *base = NULL;
+        for (int j = 0; j < baselineCount; ++j) {
+            if (strcmp(baseline[j].name, cur->name) == 0) { base = &baseline[j]; break; }
+        }
+        if (base == NULL) {
+            printf("%-32s new benchmark, no baseline\n", cur->name);
+            continue;
+        }
+
+        double standardError = sqrt((base->stddev * base->stddev) / base->samples +
+                                    (cur->stddev * cur->stddev) / cur->samples);
+        double t = (standardError > 0.0) ? (cur->mean - base->mean) / standardError : 0.0;
+        double scale = fabs(base->mean) > 1.0 ? fabs(base->mean) : 1.0;
+        double change = (cur->mean - base->mean) / scale;
+        double minScale = fabs(base->min) > 1.0 ? fabs(base->min) : 1.0;
+        double minChange = (cur->min - base->min) / minScale;
+        BOOL regressed = (t > BENCH_REGRESSION_T_THRESHOLD && change > BENCH_REGRESSION_MIN_CHANGE &&
+                          minChange > BENCH_REGRESSION_MIN_CHANGE);
+        if (regressed) regressions++;
+        printf("%-32s %14.1f -> %14.1f ns  %+7.1f%%  t=%6.2f  %s\n",
+               cur->name, base->mean, cur->mean, change * 100.0, t, regressed ? "REGRESSION" : "ok");
+    }
+    printf("%d regression(s) found.\n", regressions);
+    LogInfo("Bench: Compared '%s' against baseline '%s': %d regression(s).", currentPath, baselinePath, regressions);
+    return regressions == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// === End-to-End Latency Benchmark ===
+// "--bench-latency" opens two test windows on a separate thread: a key-echo window
+// that timestamps every F5 it receives and every activation change, and a stand-in
+// for the user's window. The refresh pipeline is then driven against the echo
+// window for each delivery strategy and focus settle setting.
+
+/** @brief Events recorded by the key-echo thread; written there, read by the benchmark. */
+typedef struct KeyEchoState {
+    HWND hEchoWindow;
+    HWND hUserWindow;
+    HANDLE hReadyEvent;
+    volatile LONG keyCount;
+    ULONGLONG keyTimesUs[LATENCY_BENCH_MAX_EVENTS];
+    BOOL keyHadCtrl[LATENCY_BENCH_MAX_EVENTS];
+    volatile LONG activationCount;
+    ULONGLONG activationTimesUs[LATENCY_BENCH_MAX_EVENTS];
+    BOOL activationIsActive[LATENCY_BENCH_MAX_EVENTS];
+} KeyEchoState;
+
+static KeyEchoState g_key_echo;
+
+/** @brief Results for one (strategy, settle delay) combination. */
+typedef struct LatencyBenchRow {
+    DeliveryStrategy strategy;
+    DWORD settleDelayMs;
+    InjectionThreadMode injectionThread;
+    double latencyUs[LATENCY_BENCH_REFRESHES];
+    int delivered;
+    int missed;
+    int duplicated;
+    int withoutCtrl;
+    double totalHoldUs;
+    BOOL lateMeasured;             // SendInput lateness after the settle deadline
+    double lateP50Us, lateP99Us, lateMaxUs;
+} LatencyBenchRow;
+
+/** @brief Cleared to stop the CPU load threads of "--bench-latency load". */
+static volatile LONG g_bench_load_running = 0;
+
+/** @brief Orders doubles ascending, for qsort. */
+static int CompareDoubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Window procedure of the test windows: timestamps F5 presses and activation changes.
+ */
+static LRESULT CALLBACK KeyEchoWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
+    if (hWnd == g_key_echo.hEchoWindow) {
+        if (uMsg == WM_KEYDOWN && wParam == VK_F5 && !(lParam & ((LPARAM)1 << 30))) { // Ignore auto-repeat
+            LONG index = g_key_echo.keyCount;
+            if (index < LATENCY_BENCH_MAX_EVENTS) {
+                g_key_echo.keyTimesUs[index] = Win32NowUs();
+                g_key_echo.keyHadCtrl[index] = (GetKeyState(VK_CONTROL) & 0x8000) != 0;
+                InterlockedIncrement(&g_key_echo.keyCount); // Publish after the slot is written
+            }
+            return 0;
+        }
+        if (uMsg == WM_ACTIVATE) {
+            LONG index = g_key_echo.activationCount;
+            if (index < LATENCY_BENCH_MAX_EVENTS) {
+                g_key_echo.activationTimesUs[index] = Win32NowUs();
+                g_key_echo.activationIsActive[index] = (LOWORD(wParam) != WA_INACTIVE);
+                InterlockedIncrement(&g_key_echo.activationCount);
+            }
+        }
+    }
+    if (uMsg == WM_CLOSE) return 0; // Only the benchmark ends these windows
+    return DefWindowProc(hWnd, uMsg, wParam, lParam);
+}
+
+/**
+ * @brief Thread owning the test windows; runs their message loop until WM_QUIT.
+ * @param parameter Unused.
+ * @return 0 on normal exit, 1 if the windows could not be created.
+ */
+static DWORD WINAPI KeyEchoThreadProc(LPVOID parameter) {
+    (void)parameter;
+    WNDCLASS wc = {0};
+    wc.lpfnWndProc = KeyEchoWindowProc;
+    wc.hInstance = GetModuleHandle(NULL);
+    wc.lpszClassName = KEY_ECHO_WINDOW_CLASS_NAME;
+    RegisterClass(&wc);
+
+    g_key_echo.hUserWindow = CreateWindowEx(0, KEY_ECHO_WINDOW_CLASS_NAME, "Refresher Latency Bench - User Window",
+                                            WS_OVERLAPPEDWINDOW | WS_VISIBLE, 100, 100, 400, 200, NULL, NULL, wc.hInstance, NULL);
+    g_key_echo.hEchoWindow = CreateWindowEx(0, KEY_ECHO_WINDOW_CLASS_NAME, "Refresher Latency Bench - Key Echo Target",
+                                            WS_OVERLAPPEDWINDOW | WS_VISIBLE, 550, 100, 400, 200, NULL, NULL, wc.hInstance, NULL);
+    if (g_key_echo.hUserWindow == NULL || g_key_echo.hEchoWindow == NULL) {
+        if (g_key_echo.hUserWindow != NULL) DestroyWindow(g_key_echo.hUserWindow);
+        if (g_key_echo.hEchoWindow != NULL) DestroyWindow(g_key_echo.hEchoWindow);
+        g_key_echo.hUserWindow = NULL;
+        g_key_echo.hEchoWindow = NULL;
+        SetEvent(g_key_echo.hReadyEvent);
+        return 1;
+    }
+    SetEvent(g_key_echo.hReadyEvent);
+
+    MSG msg;
+    while (GetMessage(&msg, NULL, 0, 0) > 0) {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+    DestroyWindow(g_key_echo.hEchoWindow);
+    DestroyWindow(g_key_echo.hUserWindow);
+    return 0;
+}
+
+/**
+ * @brief Sums how long the echo window was active between two activation event indexes.
+ * @param firstEvent Index of the first activation event belonging to the refresh.
+ * @param lastEvent One past the last activation event belonging to the refresh.
+ * @param endUs End of the refresh, closing an activation that was never ended.
+ * @return Foreground hold time in microseconds.
+ */
+static double MeasureEchoHoldUs(LONG firstEvent, LONG lastEvent, ULONGLONG endUs) {
+    double holdUs = 0.0;
+    ULONGLONG activeSinceUs = 0;
+    for (LONG i = firstEvent; i < lastEvent; ++i) {
+        if (g_key_echo.activationIsActive[i]) {
+            if (activeSinceUs == 0) activeSinceUs = g_key_echo.activationTimesUs[i];
+        } else if (activeSinceUs != 0) {
+            holdUs += (double)(g_key_echo.activationTimesUs[i] - activeSinceUs);
+            activeSinceUs = 0;
+        }
+    }
+    if (activeSinceUs != 0 && endUs > activeSinceUs) holdUs += (double)(endUs - activeSinceUs);
+    return holdUs;
+}
+
+/**
+ * @brief Spins at normal priority until g_bench_load_running is cleared, competing with the scheduler thread.
+ * @param parameter Unused.
+ * @return 0.
+ */
+static DWORD WINAPI BenchLoadThreadProc(LPVOID parameter) {
+    (void)parameter;
+    volatile unsigned long spin = 0;
+    while (g_bench_load_running) spin++;
+    return 0;
+}
+
+/**
+ * @brief Drives LATENCY_BENCH_REFRESHES refreshes against the echo window with the
+ * current strategy and focus timing, starting each from the user window in front.
+ * @param row Receives the measurements.
+ */
+static void RunLatencyBenchRow(LatencyBenchRow *row) {
+    ResetInjectionJitter();
+    for (int r = 0; r < LATENCY_BENCH_REFRESHES; ++r) {
+        // Start every refresh with the "user" window in the foreground. The previous
+        // refresh restored it already; this process set the foreground last, so it may.
+        if (GetForegroundWindow() != g_key_echo.hUserWindow) SetForegroundWindow(g_key_echo.hUserWindow);
+        Sleep(50);
+
+        LONG keysBefore = g_key_echo.keyCount;
+        LONG activationsBefore = g_key_echo.activationCount;
+        ULONGLONG deadlineUs = Win32NowUs();
+        SendCtrlF5Keystroke(g_key_echo.hEchoWindow);
+
+        while (g_key_echo.keyCount == keysBefore &&
+               Win32NowUs() - deadlineUs < (ULONGLONG)LATENCY_BENCH_DELIVERY_TIMEOUT_MS * 1000) {
+            Sleep(1);
+        }
+        Sleep(100); // Leave room for duplicates to show up
+        ULONGLONG endUs = Win32NowUs();
+
+        LONG keys = g_key_echo.keyCount - keysBefore;
+        if (keys == 0) {
+            row->missed++;
+        } else {
+            row->latencyUs[row->delivered++] = (double)(g_key_echo.keyTimesUs[keysBefore] - deadlineUs);
+            if (keys > 1) row->duplicated += keys - 1;
+            if (!g_key_echo.keyHadCtrl[keysBefore]) row->withoutCtrl++;
+        }
+        row->totalHoldUs += MeasureEchoHoldUs(activationsBefore, g_key_echo.activationCount, endUs);
+    }
+    row->lateMeasured = GetInjectionJitter(&row->lateP50Us, &row->lateP99Us, &row->lateMaxUs);
+}
+
+/**
+ * @brief Runs the end-to-end latency benchmark and prints one row per combination.
+ * SendInput rows run once injecting from the scheduler thread and once from a
+ * time-critical injection thread, so the two can be compared.
+ * @param withLoad TRUE to keep every CPU busy with normal-priority threads meanwhile.
+ * @return EXIT_SUCCESS if the test windows could be created, EXIT_FAILURE otherwise.
+ */
+static int RunLatencyBenchmark(BOOL withLoad) {
+    static const DWORD SETTLE_DELAYS_MS[] = { 0, 50, 150, FOCUS_SETTLE_DELAY_MS };
+    const int settleCount = (int)(sizeof(SETTLE_DELAYS_MS) / sizeof(SETTLE_DELAYS_MS[0]));
+    LatencyBenchRow rows[2 * (sizeof(SETTLE_DELAYS_MS) / sizeof(SETTLE_DELAYS_MS[0])) + 1];
+    int rowCount = 0;
+    HANDLE loadThreads[64];
+    int loadThreadCount = 0;
+
+    g_backend = &WIN32_BACKEND;
+    memset(&g_key_echo, 0, sizeof(g_key_echo));
+    g_key_echo.hReadyEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    DWORD echoThreadId = 0;
+    HANDLE hEchoThread = (g_key_echo.hReadyEvent != NULL) ? CreateThread(NULL, 0, KeyEchoThreadProc, NULL, 0, &echoThreadId) : NULL;
+    if (hEchoThread == NULL) {
+        printf("Error: Could not start the key-echo test window thread.\n");
+        if (g_key_echo.hReadyEvent != NULL) CloseHandle(g_key_echo.hReadyEvent);
+        return EXIT_FAILURE;
+    }
+    WaitForSingleObject(g_key_echo.hReadyEvent, INFINITE);
+    if (g_key_echo.hEchoWindow == NULL || g_key_echo.hUserWindow == NULL) {
+        printf("Error: Could not create the key-echo test windows.\n");
+        WaitForSingleObject(hEchoThread, INFINITE); // It ends on its own when the windows fail
+        CloseHandle(hEchoThread);
+        CloseHandle(g_key_echo.hReadyEvent);
+        return EXIT_FAILURE;
+    }
+    g_console_output_enabled = FALSE;
+    InitializeWaitTimer();
+    printf("Latency benchmark: %d refreshes per setting. Do not touch the keyboard or mouse.\n", LATENCY_BENCH_REFRESHES);
+    LogInfo("LatencyBench: Echo window %p, user window %p.", (void*)g_key_echo.hEchoWindow, (void*)g_key_echo.hUserWindow);
+    if (withLoad) {
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        int cpuCount = (int)systemInfo.dwNumberOfProcessors;
+        if (cpuCount > (int)(sizeof(loadThreads) / sizeof(loadThreads[0]))) cpuCount = (int)(sizeof(loadThreads) / sizeof(loadThreads[0]));
+        InterlockedExchange(&g_bench_load_running, 1);
+        for (int i = 0; i < cpuCount; ++i) {
+            HANDLE hLoad = CreateThread(NULL, 0, BenchLoadThreadProc, NULL, 0, NULL);
+            if (hLoad != NULL) loadThreads[loadThreadCount++] = hLoad;
+        }
+        printf("Keeping %d CPU(s) busy with normal-priority threads.\n", loadThreadCount);
+        LogInfo("LatencyBench: %d load threads running.", loadThreadCount);
+    }
+
+    FocusTiming savedTiming = g_focus_timing;
+    DeliveryStrategy savedStrategy = g_delivery_strategy;
+    InjectionThreadMode savedInjectionThread = g_injection_thread_mode;
+    for (int i = 0; i <= 2 * settleCount; ++i) {
+        LatencyBenchRow *row = &rows[rowCount++];
+        memset(row, 0, sizeof(*row));
+        // One row per settle delay with SendInput from this thread, the same from the
+        // injection thread, then one for PostMessage (which does not switch focus).
+        row->strategy = (i < 2 * settleCount) ? DELIVERY_SENDINPUT : DELIVERY_POSTMESSAGE;
+        row->settleDelayMs = (i < 2 * settleCount) ? SETTLE_DELAYS_MS[i % settleCount] : 0;
+        row->injectionThread = (i >= settleCount && i < 2 * settleCount) ? INJECTION_THREAD_TIME_CRITICAL : INJECTION_THREAD_OFF;
+        g_delivery_strategy = row->strategy;
+        g_injection_thread_mode = row->injectionThread;
+        g_focus_timing = savedTiming;
+        g_focus_timing.settleDelayMs = row->settleDelayMs;
+        RunLatencyBenchRow(row);
+    }
+    g_focus_timing = savedTiming;
+    g_delivery_strategy = savedStrategy;
+    g_injection_thread_mode = savedInjectionThread;
+    StopInjectionThread();
+    InterlockedExchange(&g_bench_load_running, 0);
+    for (int i = 0; i < loadThreadCount; ++i) {
+        WaitForSingleObject(loadThreads[i], INFINITE);
+        CloseHandle(loadThreads[i]);
+    }
+
+    PostThreadMessage(echoThreadId, WM_QUIT, 0, 0);
+    WaitForSingleObject(hEchoThread, INFINITE);
+    CloseHandle(hEchoThread);
+    CloseHandle(g_key_echo.hReadyEvent);
+    ShutdownWaitTimer();
+    g_console_output_enabled = TRUE;
+
+    printf("\n%-12s %-13s %8s %10s %10s %10s %10s %7s %6s %6s %8s %9s %9s\n", "strategy", "inject from", "settle",
+           "p50 ms", "p95 ms", "max ms", "hold ms", "missed", "dup", "noCtrl", "sent", "late p50", "late p99");
+    for (int i = 0; i < rowCount; ++i) {
+        LatencyBenchRow *row = &rows[i];
+        double p50 = 0.0, p95 = 0.0, max = 0.0;
+        if (row->delivered > 0) {
+            qsort(row->latencyUs, (size_t)row->delivered, sizeof(double), CompareDoubles);
+            p50 = row->latencyUs[row->delivered / 2];
+            p95 = row->latencyUs[(row->delivered * 95) / 100 < row->delivered ? (row->delivered * 95) / 100 : row->delivered - 1];
+            max = row->latencyUs[row->delivered - 1];
+        }
+        double meanHoldMs = row->totalHoldUs / LATENCY_BENCH_REFRESHES / 1000.0;
+        const char *injectFrom = (row->strategy != DELIVERY_SENDINPUT) ? "-" :
+                                 (row->injectionThread == INJECTION_THREAD_OFF) ? "scheduler" : "thread";
+        char lateP50[16] = "-", lateP99[16] = "-";
+        if (row->lateMeasured) {
+            snprintf(lateP50, sizeof(lateP50), "%.0fus", row->lateP50Us);
+            snprintf(lateP99, sizeof(lateP99), "%.0fus", row->lateP99Us);
+        }
+        printf("%-12s %-13s %6lums %10.2f %10.2f %10.2f %10.2f %7d %6d %6d %8d %9s %9s\n", DELIVERY_STRATEGY_NAMES[row->strategy],
+               injectFrom, row->settleDelayMs, p50 / 1000.0, p95 / 1000.0, max / 1000.0, meanHoldMs, row->missed, row->duplicated,
+               row->withoutCtrl, LATENCY_BENCH_REFRESHES, lateP50, lateP99);
+        LogInfo("LatencyBench: %s from=%s settle=%lums p50=%.2fms p95=%.2fms max=%.2fms hold=%.2fms missed=%d dup=%d noCtrl=%d "
+                "late_p50=%.0fus late_p99=%.0fus late_max=%.0fus load=%d",
+                DELIVERY_STRATEGY_NAMES[row->strategy], injectFrom, row->settleDelayMs, p50 / 1000.0, p95 / 1000.0, max / 1000.0,
+                meanHoldMs, row->missed, row->duplicated, row->withoutCtrl, row->lateP50Us, row->lateP99Us, row->lateMaxUs,
+                withLoad);
+    }
+    printf("\nLatency is measured from the refresh deadline to WM_KEYDOWN(F5) in the echo window.\n");
+    printf("\"hold\" is how long the echo window held the foreground per refresh; \"noCtrl\" counts F5s that arrived without Ctrl.\n");
+    printf("\"late\" is how long after the settle deadline SendInput was called; \"thread\" rows inject from a time-critical thread.\n");
+    return EXIT_SUCCESS;
+}
+
+// === Logging Functions ===
+
+/**
+ * @brief Core logging function.
+ * Prepends a timestamp and level to the message and writes to the debug log file.
+ * @param level Log level string (e.g., "DEBUG", "INFO").
+ * @param format Format string for the message.
+ * @param args Variable arguments list.
+ */
+static void LogMessage(const char *level, const char *format, va_list args) {
+    if (g_debug_log_file == NULL) return;
+
+    time_t now;
+    time(&now);
+    char time_buf[30];
+    strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", localtime(&now));
+
+    fprintf(g_debug_log_file, "[%s] [%s] ", time_buf, level);
+    vfprintf(g_debug_log_file, format, args);
+    fprintf(g_debug_log_file, "\n"); // Ensure newline
+    fflush(g_debug_log_file);
+}
+
+/** @brief Logs a debug message. */
+static void (LogDebug)(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    LogMessage("DEBUG", format, args);
+    va_end(args);
+}
+
+/** @brief Logs an informational message. */
+static void (LogInfo)(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    LogMessage("INFO", format, args);
+    va_end(args);
+}
+
+/** @brief Logs a warning message. */
+static void (LogWarning)(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    LogMessage("WARNING", format, args);
+    va_end(args);
+}
+
+/** @brief Logs an error message. */
+static void (LogError)(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    LogMessage("ERROR", format, args);
+    va_end(args);
+}
+
+
+/**
+ * @brief Initializes the debug logging system.
+ * Opens the debug log file for writing.
+ * @return TRUE if initialization was successful, FALSE otherwise.
+ */
+static BOOL InitializeLogging(void) {
+    g_debug_log_file = fopen(DEBUG_LOG_FILE_NAME, "w");
+    if (g_debug_log_file == NULL) {
+        perror("CRITICAL ERROR opening debug.log"); // Use perror for system errors
+        return FALSE;
+    }
+    // Log successful initialization to the file itself
+    LogInfo("Logging system initialized.");
+    return TRUE;
+}
+
+/**
+ * @brief Shuts down the logging system.
+ * Closes the debug log file.
+ */
+static void ShutdownLogging(void) {
+    if (g_debug_log_file != NULL) {
+        LogInfo("Logging system shutting down.");
+        fclose(g_debug_log_file);
+        g_debug_log_file = NULL;
+    }
+}
+
+// === Configuration Functions ===
+
+/**
+ * @brief Trims leading and trailing whitespace from a string in-place.
+ * @param str The string to trim.
+ * @return Pointer to the beginning of the trimmed string (which is str itself or a part of it).
+ */
+static char* TrimWhitespace(char *str) {
+    char *end;
+    // Trim leading space
+    while(isspace((unsigned char)*str)) str++;
+    if(*str == '\0') return str; // All spaces?
+    // Trim trailing space
+    end = str + strlen(str) - 1;
+    while(end > str && isspace((unsigned char)*end)) end--;
+    // Write new null terminator
+    *(end + 1) = '\0';
+    return str;
+}
+
+/**
+ * @brief Creates a default configuration file if one doesn't exist.
+ * @return TRUE if the file was created or already existed, FALSE on creation error.
+ */
+static BOOL CreateDefaultConfigFile(void) {
+    FILE* configFile = fopen(CONFIG_FILE_NAME, "w");
+    if (configFile == NULL) {
+        ConsolePrintf("Warning: Could not create default '%s'.\n", CONFIG_FILE_NAME);
+        LogWarning("LoadConfig: Failed to create default '%s'.", CONFIG_FILE_NAME);
+        return FALSE;
+    }
+    fprintf(configFile, "# Configuration for Window Refresher\n");
+    fprintf(configFile, "# Delays are in seconds (can be fractional, e.g., 2.5)\n");
+    fprintf(configFile, "min_delay = %.1f\n", DEFAULT_MIN_DELAY_S);
+    fprintf(configFile, "max_delay = %.1f\n", DEFAULT_MAX_DELAY_S);
+    fprintf(configFile, "# Percentage of an idle wait Windows may defer it by to batch wakeups (0 = exact)\n");
+    fprintf(configFile, "timer_tolerance_pct = %d\n", DEFAULT_TIMER_TOLERANCE_PCT);
+    fclose(configFile);
+    ConsolePrintf("Info: A default '%s' has been created.\n", CONFIG_FILE_NAME);
+    LogInfo("LoadConfig: Created default '%s'.", CONFIG_FILE_NAME);
+    return TRUE;
+}
+
+/**
+ * @brief Parses a focus timing delay (0 to MAX_FOCUS_DELAY_MS), keeping the old value if invalid.
+ * @param key Config key, for the log.
+ * @param value Value string.
+ * @param line_num Line number, for the log.
+ * @param delayMs Receives the delay.
+ */
+static void ParseFocusDelayMs(const char *key, const char *value, int line_num, DWORD *delayMs) {
+    int parsed_ms = atoi(value);
+    if (parsed_ms >= 0 && parsed_ms <= MAX_FOCUS_DELAY_MS) {
+        *delayMs = (DWORD)parsed_ms;
+        LogDebug("LoadConfig: Loaded %s = %d", key, parsed_ms);
+    } else {
+        LogWarning("LoadConfig: Invalid value for %s on line %d: '%s'. Using default or previous.", key, line_num, value);
+    }
+}
+
+/**
+ * @brief Tells whether a key is one of the focus timing keys a tuning profile may set.
+ * @param key Trimmed key.
+ * @return TRUE for focus_switch_attempts, focus_retry_delay_ms, focus_settle_delay_ms and post_send_delay_ms.
+ */
+static BOOL IsFocusTimingKey(const char *key) {
+    return strcmp(key, "focus_switch_attempts") == 0 || strcmp(key, "focus_retry_delay_ms") == 0 ||
+           strcmp(key, "focus_settle_delay_ms") == 0 || strcmp(key, "post_send_delay_ms") == 0;
+}
+
+/**
+ * @brief Parses "key = value" lines from an open configuration file into the globals.
+ * @param configFile File to read; left open for the caller to close.
+ * @param focusTimingOnly TRUE for a tuning profile: only the focus timing keys are applied.
+ */
+static void ParseConfigurationLines(FILE *configFile, BOOL focusTimingOnly) {
+    char line[MAX_CONFIG_LINE_LENGTH];
+    char key[MAX_CONFIG_KEY_LENGTH];
+    char value_str[MAX_CONFIG_VALUE_LENGTH];
+    int line_num = 0;
+    while (fgets(line, sizeof(line), configFile) != NULL) {
+        line_num++;
+        char *trimmed_line = TrimWhitespace(line);
+
+        if (trimmed_line[0] == '\0' || trimmed_line[0] == '#' || trimmed_line[0] == ';') {
+            continue; // Skip empty lines and comments
+        }
+
+        if (sscanf(trimmed_line, "%127[^= \t] = %127s", key, value_str) == 2) {
+            char *trimmed_key = TrimWhitespace(key);
+            char *trimmed_value_str = TrimWhitespace(value_str);
+            double parsed_val = atof(trimmed_value_str);
+            char *line_value = TrimWhitespace(strchr(trimmed_line, '=') + 1); // Whole value, for values with spaces
+            if (focusTimingOnly && !IsFocusTimingKey(trimmed_key)) {
+                LogWarning("LoadConfig: Key '%s' on line %d of the tuning profile is not a focus timing key. Ignored.", trimmed_key, line_num);
+                continue;
+            }
+
+            if (strcmp(trimmed_key, "time_profile") == 0) {
+                char *profile_str = line_value;
+                if (g_time_profile_count < MAX_TIME_PROFILES && ParseTimeProfile(profile_str, &g_time_profiles[g_time_profile_count])) {
+                    g_time_profile_count++;
+                    LogDebug("LoadConfig: Loaded time_profile = %s", profile_str);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for time_profile on line %d: '%s'. Using default or previous.", line_num, profile_str);
+                }
+            } else if (strcmp(trimmed_key, "min_delay") == 0) {
+                if (parsed_val > 0.0 && parsed_val < 3600.0) { // Basic validation
+                    g_min_delay_seconds = parsed_val;
+                    LogDebug("LoadConfig: Loaded min_delay = %.2f", g_min_delay_seconds);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for min_delay on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "max_delay") == 0) {
+                 if (parsed_val > 0.0 && parsed_val < 3600.0) { // Basic validation
+                    g_max_delay_seconds = parsed_val;
+                    LogDebug("LoadConfig: Loaded max_delay = %.2f", g_max_delay_seconds);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for max_delay on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "timer_tolerance_pct") == 0) {
+                int parsed_pct = atoi(trimmed_value_str);
+                if (parsed_pct >= 0 && parsed_pct <= MAX_TIMER_TOLERANCE_PCT) {
+                    g_timer_tolerance_pct = parsed_pct;
+                    LogDebug("LoadConfig: Loaded timer_tolerance_pct = %d", g_timer_tolerance_pct);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for timer_tolerance_pct on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "delivery") == 0) {
+                if (strcmp(trimmed_value_str, "sendinput") == 0) {
+                    g_delivery_strategy = DELIVERY_SENDINPUT;
+                    LogDebug("LoadConfig: Loaded delivery = sendinput");
+                } else if (strcmp(trimmed_value_str, "postmessage") == 0) {
+                    g_delivery_strategy = DELIVERY_POSTMESSAGE;
+                    LogDebug("LoadConfig: Loaded delivery = postmessage");
+                } else {
+                    LogWarning("LoadConfig: Invalid value for delivery on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "console") == 0) {
+                int mode = -1;
+                for (int m = 0; m < (int)(sizeof(CONSOLE_MODE_NAMES) / sizeof(CONSOLE_MODE_NAMES[0])); ++m) {
+                    if (strcmp(trimmed_value_str, CONSOLE_MODE_NAMES[m]) == 0) mode = m;
+                }
+                if (mode >= 0) {
+                    g_console_mode = (ConsoleMode)mode;
+                    LogDebug("LoadConfig: Loaded console = %s", trimmed_value_str);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for console on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "injection_thread") == 0) {
+                int mode = -1;
+                for (int m = 0; m < (int)(sizeof(INJECTION_THREAD_MODE_NAMES) / sizeof(INJECTION_THREAD_MODE_NAMES[0])); ++m) {
+                    if (strcmp(trimmed_value_str, INJECTION_THREAD_MODE_NAMES[m]) == 0) mode = m;
+                }
+                if (mode >= 0) {
+                    g_injection_thread_mode = (InjectionThreadMode)mode;
+                    LogDebug("LoadConfig: Loaded injection_thread = %s", trimmed_value_str);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for injection_thread on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "injection_cpu") == 0) {
+                char *end = NULL;
+                long parsed_cpu = strtol(trimmed_value_str, &end, 10);
+                if (end != trimmed_value_str && *end == '\0' && parsed_cpu >= -1 && parsed_cpu < (long)(sizeof(DWORD_PTR) * 8)) {
+                    g_injection_cpu = (int)parsed_cpu;
+                    LogDebug("LoadConfig: Loaded injection_cpu = %d", g_injection_cpu);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for injection_cpu on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "watchdog_ms") == 0) {
+                char *end = NULL;
+                long parsed_ms = strtol(trimmed_value_str, &end, 10);
+                if (end != trimmed_value_str && *end == '\0' && parsed_ms >= 0 && parsed_ms <= MAX_WATCHDOG_MS) {
+                    g_watchdog_ms = (DWORD)parsed_ms;
+                    LogDebug("LoadConfig: Loaded watchdog_ms = %lu", g_watchdog_ms);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for watchdog_ms on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "observe_reloads") == 0) {
+                int mode = -1;
+                for (int m = 0; m < (int)(sizeof(RELOAD_OBSERVER_NAMES) / sizeof(RELOAD_OBSERVER_NAMES[0])); ++m) {
+                    if (strcmp(trimmed_value_str, RELOAD_OBSERVER_NAMES[m]) == 0) mode = m;
+                }
+                if (mode >= 0) {
+                    g_observe_reloads = (ReloadObserver)mode;
+                    LogDebug("LoadConfig: Loaded observe_reloads = %s", trimmed_value_str);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for observe_reloads on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "soft_refresh_s") == 0) {
+                if (parsed_val >= 0.0 && parsed_val < 3600.0) {
+                    g_soft_refresh_ms = (DWORD)(parsed_val * 1000.0);
+                    LogDebug("LoadConfig: Loaded soft_refresh_s = %.2f", parsed_val);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for soft_refresh_s on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "hard_refresh_kb") == 0 || strcmp(trimmed_key, "soft_refresh_kb") == 0) {
+                char *end = NULL;
+                long parsed_kb = strtol(trimmed_value_str, &end, 10);
+                if (end != trimmed_value_str && *end == '\0' && parsed_kb >= 0 && parsed_kb <= 1024L * 1024L) {
+                    DWORD *estimate = (strcmp(trimmed_key, "hard_refresh_kb") == 0) ? &g_hard_refresh_kb : &g_soft_refresh_kb;
+                    *estimate = (DWORD)parsed_kb;
+                    LogDebug("LoadConfig: Loaded %s = %ld", trimmed_key, parsed_kb);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for %s on line %d: '%s'. Using default or previous.", trimmed_key, line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "trigger_file") == 0) {
+                snprintf(g_trigger_file_path, sizeof(g_trigger_file_path), "%s", line_value);
+                LogDebug("LoadConfig: Loaded trigger_file = %s", g_trigger_file_path);
+            } else if (strcmp(trimmed_key, "trigger_filter") == 0) {
+                snprintf(g_trigger_filter, sizeof(g_trigger_filter), "%s", line_value); // May contain spaces
+                LogDebug("LoadConfig: Loaded trigger_filter = %s", g_trigger_filter);
+            } else if (strcmp(trimmed_key, "trigger_debounce_ms") == 0) {
+                char *end = NULL;
+                long parsed_ms = strtol(trimmed_value_str, &end, 10);
+                if (end != trimmed_value_str && *end == '\0' && parsed_ms >= 0 && parsed_ms <= MAX_TRIGGER_DEBOUNCE_MS) {
+                    g_trigger_debounce_ms = (DWORD)parsed_ms;
+                    LogDebug("LoadConfig: Loaded trigger_debounce_ms = %lu", g_trigger_debounce_ms);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for trigger_debounce_ms on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "trigger_min_gap_s") == 0) {
+                char *end = NULL;
+                long parsed_s = strtol(trimmed_value_str, &end, 10);
+                if (end != trimmed_value_str && *end == '\0' && parsed_s >= 0 && parsed_s <= 3600) {
+                    g_trigger_min_gap_s = (DWORD)parsed_s;
+                    LogDebug("LoadConfig: Loaded trigger_min_gap_s = %lu", g_trigger_min_gap_s);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for trigger_min_gap_s on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "max_loads_per_process") == 0) {
+                char *end = NULL;
+                long parsed = strtol(trimmed_value_str, &end, 10);
+                if (end != trimmed_value_str && *end == '\0' && parsed >= 0 && parsed <= MAX_TARGETS) {
+                    g_max_loads_per_process = (int)parsed;
+                    LogDebug("LoadConfig: Loaded max_loads_per_process = %d", g_max_loads_per_process);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for max_loads_per_process on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "load_timeout_s") == 0) {
+                char *end = NULL;
+                long parsed_s = strtol(trimmed_value_str, &end, 10);
+                if (end != trimmed_value_str && *end == '\0' && parsed_s >= 1 && parsed_s <= 3600) {
+                    g_load_timeout_s = (DWORD)parsed_s;
+                    LogDebug("LoadConfig: Loaded load_timeout_s = %lu", g_load_timeout_s);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for load_timeout_s on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "focus_budget_ms") == 0) {
+                char *end = NULL;
+                long parsed_ms = strtol(trimmed_value_str, &end, 10);
+                if (end != trimmed_value_str && *end == '\0' && parsed_ms >= 0 && parsed_ms <= MAX_FOCUS_BUDGET_MS) {
+                    g_focus_budget_ms = (DWORD)parsed_ms;
+                    LogDebug("LoadConfig: Loaded focus_budget_ms = %lu", g_focus_budget_ms);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for focus_budget_ms on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "focus_budget_action") == 0) {
+                int action = -1;
+                for (int i = 0; i < (int)(sizeof(FOCUS_BUDGET_ACTION_NAMES) / sizeof(FOCUS_BUDGET_ACTION_NAMES[0])); ++i) {
+                    if (strcmp(trimmed_value_str, FOCUS_BUDGET_ACTION_NAMES[i]) == 0) action = i;
+                }
+                if (action >= 0) {
+                    g_focus_budget_action = (FocusBudgetAction)action;
+                    LogDebug("LoadConfig: Loaded focus_budget_action = %s", trimmed_value_str);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for focus_budget_action on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "freshness_s") == 0) {
+                char *end = NULL;
+                long parsed_s = strtol(trimmed_value_str, &end, 10);
+                if (end != trimmed_value_str && *end == '\0' && parsed_s >= 0 && parsed_s <= MAX_FRESHNESS_S) {
+                    g_freshness_s = (DWORD)parsed_s;
+                    LogDebug("LoadConfig: Loaded freshness_s = %lu", g_freshness_s);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for freshness_s on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "freshness_command") == 0) {
+                snprintf(g_freshness_command, sizeof(g_freshness_command), "%s", line_value); // Arguments included
+                LogDebug("LoadConfig: Loaded freshness_command = %s", g_freshness_command);
+            } else if (strcmp(trimmed_key, "freshness_marker_file") == 0) {
+                snprintf(g_freshness_marker_path, sizeof(g_freshness_marker_path), "%s", line_value);
+                LogDebug("LoadConfig: Loaded freshness_marker_file = %s", g_freshness_marker_path);
+            } else if (strcmp(trimmed_key, "trace_file") == 0) {
+                snprintf(g_trace_file_path, sizeof(g_trace_file_path), "%s", trimmed_value_str);
+                LogDebug("LoadConfig: Loaded trace_file = %s", g_trace_file_path);
+            } else if (strcmp(trimmed_key, "focus_switch_attempts") == 0) {
+                int parsed_attempts = atoi(trimmed_value_str);
+                if (parsed_attempts >= 1 && parsed_attempts <= MAX_FOCUS_SWITCH_ATTEMPTS) {
+                    g_focus_timing.switchAttempts = parsed_attempts;
+                    LogDebug("LoadConfig: Loaded focus_switch_attempts = %d", parsed_attempts);
+                } else {
+                    LogWarning("LoadConfig: Invalid value for focus_switch_attempts on line %d: '%s'. Using default or previous.", line_num, trimmed_value_str);
+                }
+            } else if (strcmp(trimmed_key, "focus_retry_delay_ms") == 0) {
+                ParseFocusDelayMs(trimmed_key, trimmed_value_str, line_num, &g_focus_timing.retryDelayMs);
+            } else if (strcmp(trimmed_key, "focus_settle_delay_ms") == 0) {
+                ParseFocusDelayMs(trimmed_key, trimmed_value_str, line_num, &g_focus_timing.settleDelayMs);
+            } else if (strcmp(trimmed_key, "post_send_delay_ms") == 0) {
+                ParseFocusDelayMs(trimmed_key, trimmed_value_str, line_num, &g_focus_timing.postSendDelayMs);
+            } else if (strcmp(trimmed_key, "tuning_profile") == 0) {
+                snprintf(g_tuning_profile_path, sizeof(g_tuning_profile_path), "%s", trimmed_value_str);
+                LogDebug("LoadConfig: Loaded tuning_profile = %s", g_tuning_profile_path);
+            } else if (strcmp(trimmed_key, "journal_file") == 0) {
+                snprintf(g_journal_file_path, sizeof(g_journal_file_path), "%s", trimmed_value_str);
+                LogDebug("LoadConfig: Loaded journal_file = %s", g_journal_file_path);
+            } else {
+                LogWarning("LoadConfig: Unknown key '%s' on line %d.", trimmed_key, line_num);
+            }
+        } else {
+            LogWarning("LoadConfig: Could not parse line %d: '%s'", line_num, trimmed_line);
+        }
+    }
+}
+
+/**
+ * @brief Loads configuration settings from "options.config".
+ * Reads min_delay and max_delay. If the file doesn't exist,
+ * it uses default values and attempts to create a default config file.
+ */
+static void LoadConfiguration(void) {
+    FILE *configFile = fopen(CONFIG_FILE_NAME, "r");
+
+    // Set defaults initially
+    g_min_delay_seconds = DEFAULT_MIN_DELAY_S;
+    g_max_delay_seconds = DEFAULT_MAX_DELAY_S;
+    g_timer_tolerance_pct = DEFAULT_TIMER_TOLERANCE_PCT;
+    g_trace_file_path[0] = '\0';
+    g_journal_file_path[0] = '\0';
+    g_tuning_profile_path[0] = '\0';
+    g_delivery_strategy = DELIVERY_SENDINPUT;
+    g_injection_thread_mode = INJECTION_THREAD_OFF;
+    g_injection_cpu = -1;
+    g_watchdog_ms = DEFAULT_WATCHDOG_MS;
+    g_observe_reloads = RELOADS_OFF;
+    g_soft_refresh_ms = 0;
+    g_hard_refresh_kb = 0;
+    g_soft_refresh_kb = 0;
+    g_trigger_file_path[0] = '\0';
+    g_trigger_filter[0] = '\0';
+    g_trigger_debounce_ms = DEFAULT_TRIGGER_DEBOUNCE_MS;
+    g_trigger_min_gap_s = DEFAULT_TRIGGER_MIN_GAP_S;
+    g_max_loads_per_process = 0;
+    g_load_timeout_s = DEFAULT_LOAD_TIMEOUT_S;
+    g_time_profile_count = 0;
+    g_profile_transition_count = 0;
+    g_focus_budget_ms = 0;
+    g_focus_budget_action = BUDGET_POST;
+    g_freshness_s = 0;
+    g_freshness_command[0] = '\0';
+    g_freshness_marker_path[0] = '\0';
+    g_console_mode = CONSOLE_SCROLL;
+    g_focus_timing.switchAttempts = FOCUS_SWITCH_ATTEMPTS;
+    g_focus_timing.retryDelayMs = FOCUS_SWITCH_RETRY_DELAY_MS;
+    g_focus_timing.settleDelayMs = FOCUS_SETTLE_DELAY_MS;
+    g_focus_timing.postSendDelayMs = POST_SENDINPUT_DELAY_MS;
+
+    if (configFile == NULL) {
+        ConsolePrintf("Info: '%s' not found. Using default delay values (Min: %.1fs, Max: %.1fs).\n",
+                      CONFIG_FILE_NAME, g_min_delay_seconds, g_max_delay_seconds);
+        LogInfo("LoadConfig: '%s' not found. Using default delays.", CONFIG_FILE_NAME);
+        CreateDefaultConfigFile(); // Attempt to create it
+        return;
+    }
+
+    LogInfo("LoadConfig: Reading configuration from '%s'.", CONFIG_FILE_NAME);
+    ParseConfigurationLines(configFile, FALSE);
+    fclose(configFile);
+
+    if (g_tuning_profile_path[0] != '\0') {
+        // A profile is a config fragment written by --tune; its focus timing, and nothing else, overrides the config.
+        FILE *profileFile = fopen(g_tuning_profile_path, "r");
+        if (profileFile != NULL) {
+            LogInfo("LoadConfig: Reading tuning profile '%s'.", g_tuning_profile_path);
+            ParseConfigurationLines(profileFile, TRUE);
+            fclose(profileFile);
+            ConsolePrintf("Info: Focus timing from '%s': %d attempts, retry %lums, settle %lums, post-send %lums.\n",
+                          g_tuning_profile_path, g_focus_timing.switchAttempts, g_focus_timing.retryDelayMs,
+                          g_focus_timing.settleDelayMs, g_focus_timing.postSendDelayMs);
+        } else {
+            ConsolePrintf("Warning: Tuning profile '%s' not found. Using the default focus timing.\n", g_tuning_profile_path);
+            LogWarning("LoadConfig: Tuning profile '%s' not found.", g_tuning_profile_path);
+        }
+    }
+
+    if (g_min_delay_seconds > g_max_delay_seconds) {
+        ConsolePrintf("Warning: min_delay (%.1fs) in config is greater than max_delay (%.1fs). Swapping them.\n",
+                      g_min_delay_seconds, g_max_delay_seconds);
+        LogWarning("LoadConfig: min_delay > max_delay. Swapping. Min: %.2f, Max: %.2f", g_min_delay_seconds, g_max_delay_seconds);
+        double temp = g_min_delay_seconds;
+        g_min_delay_seconds = g_max_delay_seconds;
+        g_max_delay_seconds = temp;
+    }
+    ConsolePrintf("Info: Using delays - Min: %.1fs, Max: %.1fs (from '%s').\n",
+                  g_min_delay_seconds, g_max_delay_seconds, CONFIG_FILE_NAME);
+    CompileTimeProfiles();
+    if (g_time_profile_count > 0) ConsolePrintf("Info: %d time profile(s) in effect.\n", g_time_profile_count);
+}
+
+
+// === Window Interaction Functions ===
+
+/**
+ * @brief Briefly flashes the border/title bar of the specified window.
+ * @param hWnd Handle to the window to flash.
+ */
+static void FlashTargetWindow(HWND hWnd) {
+    if (!IsWindow(hWnd)) {
+        LogWarning("FlashTargetWindow: Invalid window handle provided (%p).", (void*)hWnd);
+        return;
+    }
+    FLASHWINFO fwi;
+    fwi.cbSize = sizeof(FLASHWINFO);
+    fwi.hwnd = hWnd;
+    fwi.dwFlags = FLASHW_ALL | FLASHW_TIMERNOFG; // Flash caption and taskbar, don't steal focus if not foreground
+    fwi.uCount = 3;    // Number of flashes
+    fwi.dwTimeout = 0; // Default flash rate (system default)
+    if (!FlashWindowEx(&fwi)) {
+        LogError("FlashTargetWindow: FlashWindowEx failed for HWND %p. Error: %lu", (void*)hWnd, GetLastError());
+    } else {
+        LogDebug("FlashTargetWindow: Flashed window HWND: %p", (void*)hWnd);
+    }
+}
+
+/**
+ * @brief Prompts the user to click on a window and returns its top-level handle.
+ * @param allowFinish TRUE when prompting for an additional target; Enter then ends the selection.
+ * @return HWND of the selected top-level window, or NULL on failure, if no window is found or Enter was pressed.
+ */
+static HWND GetTopLevelWindowFromClick(BOOL allowFinish) {
+    POINT cursorPos;
+    HWND clickedHwnd = NULL;
+    HWND topLevelHwnd = NULL;
+
+    if (allowFinish) {
+        printf("\nCLICK another window to refresh it as well, or press ENTER in any window to start.\n");
+    } else {
+        printf("\n--- Window Selection ---\n");
+        printf("Please CLICK ANYWHERE on the window you want to target.\n");
+        printf("Waiting for your click...\n");
+    }
+    fflush(stdout);
+    LogDebug("GetTopLevelWindowFromClick: Waiting for left mouse button click.");
+
+    if (WaitForSelectionClick(allowFinish, &cursorPos)) {
+        clickedHwnd = WindowFromPoint(cursorPos);
+        if (clickedHwnd != NULL) {
+            // Try to get the ultimate owner window (the main application window)
+            topLevelHwnd = GetAncestor(clickedHwnd, GA_ROOTOWNER);
+            if (topLevelHwnd == NULL) { // Fallback to GA_ROOT if GA_ROOTOWNER fails
+                topLevelHwnd = GetAncestor(clickedHwnd, GA_ROOT);
+            }
+            if (topLevelHwnd == NULL) { // If still NULL, use the directly clicked window
+                topLevelHwnd = clickedHwnd;
+            }
+
+            char windowTitle[MAX_TITLE_LENGTH];
+            GetWindowText(topLevelHwnd, windowTitle, MAX_TITLE_LENGTH);
+            printf("Window selected: \"%s\" (HWND: %p)\n",
+                   (strlen(windowTitle) > 0 ? windowTitle : "No Title"), (void*)topLevelHwnd);
+            LogInfo("GetTopLevelWindowFromClick: Click at (%ld, %ld). WindowFromPoint HWND: %p. Top-level HWND: %p. Title: %s",
+                         cursorPos.x, cursorPos.y, (void*)clickedHwnd, (void*)topLevelHwnd, windowTitle);
+            return topLevelHwnd;
+        } else {
+            printf("Could not identify a window at the click position.\n");
+            LogWarning("GetTopLevelWindowFromClick: WindowFromPoint returned NULL.");
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Waits in the reactor for a left click (or Enter) reported by low-level input hooks.
+ * Falls back to polling GetAsyncKeyState if the hooks cannot be installed.
+ * @param allowFinish TRUE if Enter ends the selection.
+ * @param point Receives the screen position of the click.
+ * @return TRUE if a click was made, FALSE on Enter, on "stop" or if the position is unknown.
+ */
+static BOOL WaitForSelectionClick(BOOL allowFinish, POINT *point) {
+    memset(&g_selection, 0, sizeof(g_selection));
+    g_selection.allowFinish = allowFinish;
+    g_selection.mouseHook = SetWindowsHookEx(WH_MOUSE_LL, SelectionMouseProc, GetModuleHandle(NULL), 0);
+    g_selection.keyboardHook = SetWindowsHookEx(WH_KEYBOARD_LL, SelectionKeyboardProc, GetModuleHandle(NULL), 0);
+
+    if (g_selection.mouseHook != NULL && g_selection.keyboardHook != NULL) {
+        // Hooks are called from this thread's message pump, which ReactorWait runs.
+        while (!g_selection.clicked && !g_selection.finished && !g_stop_requested) {
+            ReactorWait(INFINITE, 0);
+        }
+        UnhookWindowsHookEx(g_selection.mouseHook);
+        UnhookWindowsHookEx(g_selection.keyboardHook);
+        if (!g_selection.clicked) {
+            LogDebug("GetTopLevelWindowFromClick: Selection finished without a click.");
+            return FALSE;
+        }
+        *point = g_selection.point;
+        LogDebug("GetTopLevelWindowFromClick: Left mouse button released.");
+        return TRUE;
+    }
+
+    LogWarning("GetTopLevelWindowFromClick: Input hooks unavailable. Error: %lu. Polling the mouse instead.", GetLastError());
+    if (g_selection.mouseHook != NULL) UnhookWindowsHookEx(g_selection.mouseHook);
+    if (g_selection.keyboardHook != NULL) UnhookWindowsHookEx(g_selection.keyboardHook);
+
+    // Wait for left mouse button press (or Enter, when finishing the selection is allowed)
+    while (!(GetAsyncKeyState(VK_LBUTTON) & 0x8000)) {
+        if (g_stop_requested) return FALSE;
+        if (allowFinish && (GetAsyncKeyState(VK_RETURN) & 0x8000)) {
+            while (GetAsyncKeyState(VK_RETURN) & 0x8000) {
+                WaitCoalesced(MAIN_LOOP_POLL_INTERVAL_MS);
+            }
+            LogDebug("GetTopLevelWindowFromClick: Enter pressed. Selection finished.");
+            return FALSE;
+        }
+        WaitCoalesced(MAIN_LOOP_POLL_INTERVAL_MS);
+    }
+    LogDebug("GetTopLevelWindowFromClick: Left mouse button pressed.");
+
+    // Wait for the button to be released to avoid issues with drag/multiple clicks
+    while (GetAsyncKeyState(VK_LBUTTON) & 0x8000) {
+        WaitCoalesced(MAIN_LOOP_POLL_INTERVAL_MS);
+    }
+    LogDebug("GetTopLevelWindowFromClick: Left mouse button released.");
+
+    if (!GetCursorPos(point)) {
+        printf("Failed to get cursor position.\n");
+        LogError("GetTopLevelWindowFromClick: GetCursorPos failed. Error: %lu", GetLastError());
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/** @brief Low-level mouse hook for window selection: records where the left button was released. */
+static LRESULT CALLBACK SelectionMouseProc(int nCode, WPARAM wParam, LPARAM lParam) {
+    if (nCode == HC_ACTION && wParam == WM_LBUTTONUP && !g_selection.clicked) {
+        g_selection.point = ((const MSLLHOOKSTRUCT*)lParam)->pt;
+        g_selection.clicked = TRUE;
+        g_reactor_wake = TRUE;
+    }
+    return CallNextHookEx(NULL, nCode, wParam, lParam);
+}
+
+/** @brief Low-level keyboard hook for window selection: Enter ends the selection when allowed. */
+static LRESULT CALLBACK SelectionKeyboardProc(int nCode, WPARAM wParam, LPARAM lParam) {
+    if (nCode == HC_ACTION && wParam == WM_KEYUP && g_selection.allowFinish &&
+        ((const KBDLLHOOKSTRUCT*)lParam)->vkCode == VK_RETURN) {
+        g_selection.finished = TRUE;
+        g_reactor_wake = TRUE;
+    }
+    return CallNextHookEx(NULL, nCode, wParam, lParam);
+}
+
+
+// === Refresh State Machines ===
+
+/**
+ * @brief Allocates an empty table for up to capacity targets.
+ * The hot arrays share one allocation; records and titles get their own.
+ * @param table Table to initialize.
+ * @param capacity Maximum number of targets.
+ * @return TRUE on success, FALSE if out of memory (the table is left empty).
+ */
+static BOOL InitTargetTable(TargetTable *table, int capacity) {
+    size_t n = (size_t)capacity;
+    memset(table, 0, sizeof(*table));
+    char *hot = (char*)calloc(n, sizeof(ULONGLONG) + 2 * sizeof(int) + 2 * sizeof(unsigned char));
+    table->targets = (RefreshTarget*)calloc(n, sizeof(RefreshTarget));
+    table->titles = (char*)calloc(n, MAX_TITLE_LENGTH);
+    if (hot == NULL || table->targets == NULL || table->titles == NULL) {
+        LogError("TargetTable: Out of memory for %d targets.", capacity);
+        free(hot);
+        FreeTargetTable(table);
+        return FALSE;
+    }
+    table->deadlineUs = (ULONGLONG*)hot;
+    table->cyclesStarted = (int*)(hot + n * sizeof(ULONGLONG));
+    table->keystrokeCount = table->cyclesStarted + n;
+    table->state = (unsigned char*)(table->keystrokeCount + n);
+    table->exactDeadline = table->state + n;
+    table->capacity = capacity;
+    return TRUE;
+}
+
+/** @brief Frees a table's arrays and leaves it empty. */
+static void FreeTargetTable(TargetTable *table) {
+    free(table->deadlineUs); // Start of the hot allocation
+    free(table->targets);
+    free(table->titles);
+    memset(table, 0, sizeof(*table));
+}
+
+/**
+ * @brief Adds a refresh target to a table; its first step is due at once.
+ * @param table Table to add to.
+ * @param hwnd Window to refresh.
+ * @param track Trace track and tracepoint target id for this target.
+ * @return The new target, or NULL if the table is full.
+ */
+static RefreshTarget* AddRefreshTarget(TargetTable *table, HWND hwnd, int track) {
+    if (table->count >= table->capacity) return NULL;
+    int id = table->count++;
+    RefreshTarget *t = &table->targets[id];
+    memset(t, 0, sizeof(*t));
+    t->table = table;
+    t->id = id;
+    t->hwnd = hwnd;
+    t->track = track;
+    t->delivery = g_delivery_strategy;
+    strcpy(TargetTitle(t), "N/A");
+    table->state[id] = TARGET_STARTING;
+    table->deadlineUs[id] = 0;
+    table->exactDeadline[id] = FALSE;
+    table->cyclesStarted[id] = 0;
+    table->keystrokeCount[id] = 0;
+    return t;
+}
+
+/**
+ * @brief Replaces the one-off target used outside the scheduler.
+ * @param hwnd Window to refresh.
+ * @return The target, or NULL if its table could not be allocated.
+ */
+static RefreshTarget* ResetSingleTarget(HWND hwnd) {
+    if (g_single_target_table.capacity == 0 && !InitTargetTable(&g_single_target_table, 1)) return NULL;
+    g_single_target_table.count = 0;
+    return AddRefreshTarget(&g_single_target_table, hwnd, TRACE_TRACK_TARGET);
+}
+
+/**
+ * @brief Finds the target whose step is due first, reading only the hot arrays.
+ * @param table Targets to scan.
+ * @param exact Set to TRUE if any pending deadline is exact.
+ * @return Id of the earliest-due target, or -1 if every target is gone.
+ */
+static int FindNextDueTarget(const TargetTable *table, BOOL *exact) {
+    int next = -1;
+    ULONGLONG nextDeadlineUs = ULLONG_MAX;
+    BOOL anyExact = FALSE;
+    for (int id = 0; id < table->count; ++id) {
+        if (table->state[id] == TARGET_GONE) continue;
+        ULONGLONG deadlineUs = table->deadlineUs[id];
+        if (table->exactDeadline[id] && deadlineUs != ULLONG_MAX) anyExact = TRUE;
+        if (next < 0 || deadlineUs < nextDeadlineUs) {
+            next = id;
+            nextDeadlineUs = deadlineUs;
+        }
+    }
+    *exact = anyExact;
+    return next;
+}
+
+/**
+ * @brief Moves a target to a state whose step is due after a delay.
+ * @param t Target to update.
+ * @param state New state.
+ * @param delayMs Delay from now until the step is due.
+ * @param exact TRUE if the delay may not be stretched to coalesce wakeups.
+ */
+static void SetTargetDeadline(RefreshTarget *t, TargetState state, DWORD delayMs, BOOL exact) {
+    TargetHot(t, state) = (unsigned char)state;
+    TargetHot(t, deadlineUs) = (delayMs == 0) ? 0 : BackendNowUs() + (ULONGLONG)delayMs * 1000; // 0: due at once, no clock read
+    TargetHot(t, exactDeadline) = (unsigned char)exact;
+}
+
+/**
+ * @brief Runs the step of a target's current state. Never waits.
+ * @param t Target whose deadline has been reached.
+ * @return TRUE if this step ended the target's cycle (refreshed, skipped or gone).
+ */
+static BOOL StepRefreshTarget(RefreshTarget *t) {
+    g_tracepoint_cycle_start_us = t->cycleStartUs;
+    g_step_domain = t->domain;
+    switch ((TargetState)TargetHot(t, state)) {
+        case TARGET_STARTING:     BeginRefreshCycle(t); ApplyPendingTrigger(t); break;
+        case TARGET_WAITING:      RefreshTargetDue(t); break;
+        case TARGET_LOAD_QUEUED:
+            if (!TakeLoadSlot(t)) break;
+            if (!t->budgetDeferred) SendDueRefresh(t);
+            else if (RefreshMayGo(t)) BeginKeystroke(t); // A deferred refresh was counted already
+            break;
+        case TARGET_FOCUS_QUEUED:
+            if (t->budgetDeferred) {
+                if (!TakeLoadSlot(t)) break; // Its load slot was given up while deferred
+                if (!RefreshMayGo(t)) break;
+                if (FocusOwner(t) != NULL) t->budgetDeferred = FALSE; // Now queued for the focus like any other
+            }
+            if (FocusOwner(t) == NULL) {
+                BeginKeystroke(t); // Checks the focus budget again before switching
+            } else {
+                TargetHot(t, deadlineUs) = ULLONG_MAX; // Woken again by EndFocusSwitch
+            }
+            break;
+        case TARGET_ACTIVATING:   CheckActivationAttempt(t); break;
+        case TARGET_SETTLING:     FinishSettle(t); break;
+        case TARGET_INJECTING:
+            if (BackendGetForegroundWindow() != t->hwnd) {
+                LogWarning("SendCtrlF5: Failed to keep target %p foreground after restore. Skipping SendInput.", (void*)t->hwnd);
+                t->focusSet = FALSE;
+                FinishFocusSwitch(t);
+            } else {
+                InjectKeystroke(t);
+            }
+            break;
+        case TARGET_RESTORING:    RestoreFocusNow(t); break;
+        case TARGET_COOLDOWN:     SetTargetDeadline(t, TARGET_STARTING, 0, FALSE); break;
+        case TARGET_GONE:         break;
+    }
+    return TargetHot(t, state) == TARGET_STARTING || TargetHot(t, state) == TARGET_GONE;
+}
+
+/**
+ * @brief Starts a cycle: checks the window is still there and schedules the refresh,
+ * with the delays of the time profile in force, or for when a paused one ends.
+ * @param t Target in TARGET_STARTING.
+ */
+static void BeginRefreshCycle(RefreshTarget *t) {
+    JournalMarkCycle(++TargetHot(t, cyclesStarted), t->catchUp);
+    t->triggerEventUs = 0;
+    t->budgetDeferred = FALSE;
+    if (!BackendIsWindow(t->hwnd)) {
+        ConsolePrintf("Target window (HWND %p) no longer exists. Dropping it.\n", (void*)t->hwnd);
+        LogWarning("Refresh: Target window HWND %p no longer exists. Removing it from the schedule.", (void*)t->hwnd);
+        RecordTargetResult(t, RESULT_GONE);
+        TargetHot(t, state) = TARGET_GONE;
+        return;
+    }
+
+    char *title = TargetTitle(t);
+    strcpy(title, "N/A");
+    BackendGetWindowText(t->hwnd, title, MAX_TITLE_LENGTH);
+    if (title[0] == '\0') title = "No Title";
+
+    if (t->catchUp) {
+        ConsolePrintf("Session is available again. Sending a catch-up %s to \"%s\"...\n", RefreshKeyName(t), title);
+        LogInfo("Refresh: Catch-up refresh of HWND %p after scheduling was paused.", (void*)t->hwnd);
+        TraceInstant("catch_up", t->track);
+        t->plannedWaitMs = 0;
+        t->tier = TIER_HARD;
+        t->hardDueUs = 0;
+        SetTargetDeadline(t, TARGET_WAITING, 0, FALSE);
+        return;
+    }
+
+    double minDelayS, maxDelayS;
+    DWORD pausedForMs;
+    int profile = GetTimeProfile(&minDelayS, &maxDelayS, &pausedForMs);
+    if (profile >= 0) g_time_profiles[profile].waits++; else g_base_profile_waits++;
+    if (pausedForMs > 0) {
+        ConsolePrintf("Paused by time profile \"%s\" for %.1f minutes. Refreshing \"%s\" when it ends.\n",
+                      TimeProfileName(profile), (double)pausedForMs / 60000.0, title);
+        LogInfo("Schedule: Time profile \"%s\" pauses HWND %p for %.1f minutes.", TimeProfileName(profile),
+                (void*)t->hwnd, (double)pausedForMs / 60000.0);
+        t->waitStartUs = TraceBegin();
+        t->probeWaitStartUs = TracepointNowUs();
+        t->plannedWaitMs = pausedForMs;
+        PauseTarget(t, pausedForMs);
+        return;
+    }
+
+    // Tiers need the plan to outlive the cycle, which a one-off target does not.
+    if (g_soft_refresh_ms != 0 && t->table != &g_single_target_table) {
+        PlanTieredRefresh(t, title, minDelayS, maxDelayS);
+        return;
+    }
+
+    double wait_duration_s = GetRandomDelaySeconds(minDelayS, maxDelayS);
+    ConsolePrintf("Waiting for %.2fs before sending %s to \"%s\"...\n", wait_duration_s, RefreshKeyName(t), title);
+    LogDebug("Refresh: Waiting for %.3f seconds.", wait_duration_s);
+    t->waitStartUs = TraceBegin();
+    t->probeWaitStartUs = TracepointNowUs();
+    t->plannedWaitMs = (DWORD)(wait_duration_s * 1000.0);
+    SetTargetDeadline(t, TARGET_WAITING, t->plannedWaitMs, FALSE);
+}
+
+/**
+ * @brief Parks a target until a paused time profile ends. Its freshness objective is
+ * suspended meanwhile: it runs again from the end of the pause.
+ * @param t Target.
+ * @param pausedForMs How long the pause lasts from now.
+ */
+static void PauseTarget(RefreshTarget *t, DWORD pausedForMs) {
+    ULONGLONG nowUs = UnrecordedNowUs();
+    UpdateFreshness(t, nowUs); // Accounted up to the pause under the old deadline
+    t->pausedUntilUs = nowUs + (ULONGLONG)pausedForMs * 1000;
+    SetTargetDeadline(t, TARGET_WAITING, pausedForMs, FALSE);
+    if (t->table == &g_target_table) ArmFreshnessTimer();
+}
+
+/**
+ * @brief Schedules the next refresh while soft refreshes are on: a soft refresh every
+ * soft_refresh_s until the hard refresh, planned min_delay to max_delay seconds ahead,
+ * falls due. A soft refresh due less than half a soft interval before the hard one is
+ * replaced by it, so a hard refresh never follows a soft one almost at once.
+ * @param t Target in TARGET_STARTING.
+ * @param title Window title, for the console.
+ * @param minDelayS Shortest hard refresh wait, from the time profile in force.
+ * @param maxDelayS Longest hard refresh wait.
+ */
+static void PlanTieredRefresh(RefreshTarget *t, const char *title, double minDelayS, double maxDelayS) {
+    ULONGLONG nowUs = BackendNowUs();
+    if (t->hardDueUs == 0) {
+        t->hardDueUs = nowUs + (ULONGLONG)(GetRandomDelaySeconds(minDelayS, maxDelayS) * 1e6);
+    }
+    ULONGLONG dueUs = nowUs + (ULONGLONG)g_soft_refresh_ms * 1000;
+    t->tier = TIER_SOFT;
+    if (dueUs + (ULONGLONG)g_soft_refresh_ms * 500 >= t->hardDueUs) {
+        dueUs = (t->hardDueUs > nowUs) ? t->hardDueUs : nowUs;
+        t->tier = TIER_HARD;
+    }
+    ConsolePrintf("Waiting for %.2fs before sending %s to \"%s\"...\n", (double)(dueUs - nowUs) / 1e6,
+                  RefreshKeyName(t), title);
+    LogDebug("Refresh: Waiting for %.3f seconds (%s refresh).", (double)(dueUs - nowUs) / 1e6, t->tier == TIER_SOFT ? "soft" : "hard");
+    t->waitStartUs = TraceBegin();
+    t->probeWaitStartUs = TracepointNowUs();
+    t->plannedWaitMs = (DWORD)((dueUs - nowUs) / 1000);
+    TargetHot(t, state) = TARGET_WAITING;
+    TargetHot(t, deadlineUs) = (dueUs > nowUs) ? dueUs : 0;
+    TargetHot(t, exactDeadline) = FALSE;
+}
+
+/**
+ * @brief The refresh is due: checks the skip conditions and starts the keystroke,
+ * unless the window's process is at its page load limit (then the refresh queues) or
+ * a paused time profile is in force (then it waits on).
+ * A hard refresh is replanned afterwards whether or not it was delivered.
+ * @param t Target in TARGET_WAITING.
+ */
+static void RefreshTargetDue(RefreshTarget *t) {
+    double minDelayS, maxDelayS;
+    DWORD pausedForMs;
+    int profile = GetTimeProfile(&minDelayS, &maxDelayS, &pausedForMs);
+    if (pausedForMs > 0) {
+        // A paused time window began during the wait; the refresh goes when it ends.
+        LogDebug("Schedule: Time profile \"%s\" began during the wait of HWND %p. Waiting %.1f more minutes.",
+                 TimeProfileName(profile), (void*)t->hwnd, (double)pausedForMs / 60000.0);
+        if (profile >= 0) g_time_profiles[profile].waits++;
+        PauseTarget(t, pausedForMs);
+        return;
+    }
+    t->dueUs = TargetHot(t, deadlineUs);
+    if (t->tier == TIER_HARD) t->hardDueUs = 0;
+    if (t->catchUp) {
+        t->catchUp = FALSE;
+        t->cycleStartUs = TracepointNowUs();
+        g_tracepoint_cycle_start_us = t->cycleStartUs;
+        TRACEPOINT("cycle_start", t->track, "planned_wait_ms=0 late_us=0 catch_up=1");
+    } else {
+        TraceSpan("wait", t->track, t->waitStartUs, "planned_ms", (long)t->plannedWaitMs);
+        t->cycleStartUs = TracepointNowUs();
+        g_tracepoint_cycle_start_us = t->cycleStartUs;
+        TRACEPOINT("cycle_start", t->track, "planned_wait_ms=%lu late_us=%lld catch_up=0", t->plannedWaitMs,
+                   (long long)(t->cycleStartUs - t->probeWaitStartUs) - (long long)t->plannedWaitMs * 1000);
+
+        if (IsSchedulingPaused()) {
+            // Locked, display off or paused during the wait; the scheduler pauses and catches up.
+            LogDebug("Refresh: Scheduling paused during the wait. Not sending this cycle.");
+            TraceInstant("skip.paused", t->track);
+            TRACEPOINT("skip", t->track, "reason=paused elapsed_us=%llu", TracepointElapsedUs());
+            RecordTargetResult(t, RESULT_PAUSED);
+            SetTargetDeadline(t, TARGET_STARTING, 0, FALSE);
+            return;
+        }
+    }
+
+    if (TakeLoadSlot(t)) SendDueRefresh(t);
+}
+
+/**
+ * @brief Sends a due refresh that may go: checks the Alt key and the window, then starts the keystroke.
+ * @param t Target in TARGET_WAITING or TARGET_LOAD_QUEUED.
+ */
+static void SendDueRefresh(RefreshTarget *t) {
+    if (!RefreshMayGo(t)) return;
+    TargetHot(t, keystrokeCount)++;
+    BeginKeystroke(t);
+}
+
+/**
+ * @brief Checks that a refresh may be sent now: Alt is not held and the window still exists.
+ * Otherwise records the result and ends the cycle.
+ * @param t Target whose refresh is due, or deferred for the focus budget until now.
+ * @return TRUE if the keystroke may start.
+ */
+static BOOL RefreshMayGo(RefreshTarget *t) {
+    if (IsAltKeyHeld()) {
+        TraceInstant("skip.alt_held", t->track);
+        TRACEPOINT("skip", t->track, "reason=alt_held elapsed_us=%llu", TracepointElapsedUs());
+        ConsolePrintf("Info: Alt key is currently pressed. Skipping keystroke to avoid conflict.\n");
+        LogDebug("Refresh: Alt key detected as pressed. Deferring the keystroke.");
+        RecordTargetResult(t, RESULT_ALT_HELD);
+        SetTargetDeadline(t, TARGET_COOLDOWN, ALT_KEY_CHECK_DELAY_MS, FALSE);
+        return FALSE;
+    }
+
+    if (!BackendIsWindow(t->hwnd)) { // Re-check after wait and Alt key check
+        TRACEPOINT("skip", t->track, "reason=target_gone elapsed_us=%llu", TracepointElapsedUs());
+        ConsolePrintf("Target window (HWND %p) disappeared before sending keystroke. Dropping it.\n", (void*)t->hwnd);
+        LogWarning("Refresh: Target window HWND %p disappeared during wait. Removing it from the schedule.", (void*)t->hwnd);
+        RecordTargetResult(t, RESULT_GONE);
+        TargetHot(t, state) = TARGET_GONE;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Names the key a refresh of the target is planned to send.
+ * @param t Target.
+ * @return "F5" for soft refreshes and postmessage delivery, "Ctrl+F5" otherwise.
+ */
+static const char *RefreshKeyName(const RefreshTarget *t) {
+    return (t->delivery == DELIVERY_POSTMESSAGE || t->tier == TIER_SOFT) ? "F5" : "Ctrl+F5";
+}
+
+/**
+ * @brief Starts delivering the keystroke. With the postmessage strategy, or for a soft
+ * refresh, a plain F5 is posted at once and focus is left alone; otherwise the target
+ * queues for the focus. Over the focus budget, F5 is posted too, or the refresh deferred.
+ * @param t Target whose refresh is due; the caller has checked the window still exists.
+ */
+static void BeginKeystroke(RefreshTarget *t) {
+    t->keystrokeSent = FALSE;
+    BOOL overBudget = (t->delivery == DELIVERY_SENDINPUT && t->tier == TIER_HARD && IsOverFocusBudget());
+    if (overBudget && g_focus_budget_action == BUDGET_DEFER) {
+        DeferForFocusBudget(t);
+        return;
+    }
+    t->budgetDeferred = FALSE;
+    if (overBudget) {
+        g_focus_theft.posted++;
+        g_focus_theft.hourPosted++;
+        LogDebug("Focus: Over the focus budget. Posting F5 to HWND %p instead of switching the focus.", (void*)t->hwnd);
+    }
+    BOOL postF5 = (t->delivery == DELIVERY_POSTMESSAGE || t->tier == TIER_SOFT || overBudget);
+    ConsolePrintf("Sending %s (Count: %d) to window \"%s\"...\n", postF5 ? "F5" : "Ctrl+F5",
+                  TargetHot(t, keystrokeCount), (TargetTitle(t)[0] != '\0' ? TargetTitle(t) : "No Title"));
+    if (postF5) {
+        t->keystrokeSent = PostF5Keystroke(t->hwnd, t->track);
+        RecordTargetResult(t, t->keystrokeSent ? RESULT_POSTED : RESULT_SEND_FAILED);
+        SetTargetDeadline(t, TARGET_COOLDOWN, g_focus_timing.postSendDelayMs, TRUE);
+        return;
+    }
+    if (FocusOwner(t) != NULL && FocusOwner(t) != t) {
+        LogDebug("SendCtrlF5: Focus switch for HWND %p in progress. HWND %p queued.", (void*)FocusOwner(t)->hwnd, (void*)t->hwnd);
+        g_scheduler_stats.focusQueued++;
+        t->queuedAtUs = BackendNowUs();
+        TargetHot(t, state) = TARGET_FOCUS_QUEUED;
+        TargetHot(t, deadlineUs) = ULLONG_MAX;
+        TargetHot(t, exactDeadline) = FALSE;
+        return;
+    }
+    StartFocusSwitch(t);
+}
+
+/**
+ * @brief Takes the focus token and starts bringing the target to the foreground.
+ * This involves attaching thread inputs and using SetForegroundWindow.
+ * @param t Target that now owns the focus.
+ */
+static void StartFocusSwitch(RefreshTarget *t) {
+    if (AnyFocusOwner() != NULL) g_scheduler_stats.focusSwitchesOverlapped++;
+    FocusOwner(t) = t;
+    g_scheduler_stats.focusSwitches++;
+    t->originalForeground = BackendGetForegroundWindow();
+    t->targetWasForeground = (t->originalForeground == t->hwnd);
+    t->focusSet = t->targetWasForeground;
+    t->attachedToTarget = FALSE;
+    t->attachedToOriginal = FALSE;
+    t->originalRestored = FALSE;
+    t->theftStartUs = 0;
+    t->theftEndUs = 0;
+    if (t->targetWasForeground) {
+        LogDebug("SendCtrlF5: Target window %p is already foreground.", (void*)t->hwnd);
+        BeginInjection(t);
+        return;
+    }
+
+    LogDebug("ActivateWindow: Target %p is not foreground. Attempting to activate.", (void*)t->hwnd);
+    t->activateStartUs = TraceBegin();
+
+    DWORD dwCurrentThreadId = GetCurrentThreadId();
+    t->targetThreadId = BackendGetWindowThreadId(t->hwnd);
+    t->originalThreadId = t->originalForeground ? BackendGetWindowThreadId(t->originalForeground) : 0;
+
+    if (t->targetThreadId != 0 && t->targetThreadId != dwCurrentThreadId) {
+        if (BackendAttachThreadInput(dwCurrentThreadId, t->targetThreadId, TRUE)) {
+            t->attachedToTarget = TRUE;
+        } else {
+            LogWarning("ActivateWindow: Failed to attach to target thread %lu. Error: %lu", t->targetThreadId, GetLastError());
+        }
+    }
+    if (t->originalForeground && t->originalThreadId != 0 &&
+        t->originalThreadId != dwCurrentThreadId &&
+        t->originalThreadId != t->targetThreadId) { // Avoid double attach
+        if (BackendAttachThreadInput(dwCurrentThreadId, t->originalThreadId, TRUE)) {
+            t->attachedToOriginal = TRUE;
+        } else {
+            LogWarning("ActivateWindow: Failed to attach to original FG thread %lu. Error: %lu", t->originalThreadId, GetLastError());
+        }
+    }
+
+    t->attempt = 0;
+    if (BackendIsIconic(t->hwnd)) {
+        LogDebug("ActivateWindow: Target %p is iconic, restoring.", (void*)t->hwnd);
+        BackendShowWindow(t->hwnd, SW_RESTORE);
+        SetTargetDeadline(t, TARGET_ACTIVATING, g_focus_timing.retryDelayMs, TRUE);
+        return;
+    }
+    IssueActivationAttempt(t);
+}
+
+/**
+ * @brief Issues one SetForegroundWindow attempt; the result is checked after the retry delay.
+ * @param t Target owning the focus.
+ */
+static void IssueActivationAttempt(RefreshTarget *t) {
+    t->attempt++;
+    t->phaseStartUs = TraceBegin();
+    TRACEPOINT("activate_attempt", t->track, "attempt=%d elapsed_us=%llu", t->attempt, TracepointElapsedUs());
+    BackendSetForegroundWindow(t->hwnd);
+    t->attemptUs = UnrecordedNowUs();
+    SetTargetDeadline(t, TARGET_ACTIVATING, g_focus_timing.retryDelayMs, TRUE);
+}
+
+/**
+ * @brief Checks the last activation attempt; moves on to settling, retries, or gives up.
+ * @param t Target in TARGET_ACTIVATING.
+ */
+static void CheckActivationAttempt(RefreshTarget *t) {
+    if (t->attempt == 0) { // An iconic target was restored; now make the first attempt
+        IssueActivationAttempt(t);
+        return;
+    }
+
+    HWND foreground = BackendGetForegroundWindow();
+    BOOL attemptSucceeded = (foreground == t->hwnd);
+    TraceSpan("activate.attempt", t->track, t->phaseStartUs, "attempt", t->attempt);
+    if (attemptSucceeded) {
+        if (t->theftStartUs == 0) t->theftStartUs = t->attemptUs; // Unless the foreground event came first
+        TRACEPOINT("focus_acquired", t->track, "attempt=%d elapsed_us=%llu", t->attempt, TracepointElapsedUs());
+        LogDebug("ActivateWindow: SetForegroundWindow for %p succeeded on attempt %d.", (void*)t->hwnd, t->attempt);
+        TraceSpan("activate", t->track, t->activateStartUs, "succeeded", TRUE);
+        LogDebug("ActivateWindow: Pausing (%lums) for system to settle.", g_focus_timing.settleDelayMs);
+        t->phaseStartUs = TraceBegin();
+        if (PostInjectionRequest(t)) {
+            // Woken early by OnInjectionDone; the deadline only matters if the thread never answers.
+            SetTargetDeadline(t, TARGET_SETTLING, g_focus_timing.settleDelayMs + INJECTION_THREAD_TIMEOUT_MS, TRUE);
+            return;
+        }
+        SetTargetDeadline(t, TARGET_SETTLING, g_focus_timing.settleDelayMs, TRUE);
+        t->injectDueUs = (g_backend == &WIN32_BACKEND) ? TargetHot(t, deadlineUs) : 0;
+        return;
+    }
+    LogDebug("ActivateWindow: SetForegroundWindow for %p failed on attempt %d. Current FG: %p",
+             (void*)t->hwnd, t->attempt, (void*)foreground);
+    if (t->attempt < g_focus_timing.switchAttempts) {
+        IssueActivationAttempt(t);
+        return;
+    }
+
+    TraceSpan("activate", t->track, t->activateStartUs, "succeeded", FALSE);
+    LogWarning("ActivateWindow: Failed to set foreground to target %p after %d attempts.", (void*)t->hwnd, g_focus_timing.switchAttempts);
+    TraceInstant("fail.activate", t->track);
+    DetachFocusThreads(t);
+    t->focusSet = FALSE;
+    t->skipReason = "activate_failed";
+    FinishFocusSwitch(t);
+}
+
+/**
+ * @brief Ends the settle pause: checks the target kept the focus and injects if it did.
+ * @param t Target in TARGET_SETTLING.
+ */
+static void FinishSettle(RefreshTarget *t) {
+    if (t->injectionPosted) {
+        CollectInjectionResult(t);
+        return;
+    }
+    TraceSpan("settle", t->track, t->phaseStartUs, NULL, 0);
+    HWND foreground = BackendGetForegroundWindow();
+    if (foreground != t->hwnd) {
+        LogWarning("ActivateWindow: Focus lost from target %p after settling pause. Current FG: %p.",
+                   (void*)t->hwnd, (void*)foreground);
+        TraceInstant("fail.focus_lost", t->track);
+        TRACEPOINT("focus_lost", t->track, "phase=settle elapsed_us=%llu", TracepointElapsedUs());
+        t->focusSet = FALSE;
+        t->skipReason = "focus_lost";
+    } else {
+        LogDebug("ActivateWindow: Target %p still has focus after settling pause.", (void*)t->hwnd);
+        t->focusSet = TRUE;
+    }
+    DetachFocusThreads(t);
+    if (t->focusSet) {
+        BeginInjection(t);
+    } else {
+        FinishFocusSwitch(t);
+    }
+}
+
+/**
+ * @brief Detaches the thread inputs attached by StartFocusSwitch, in reverse order.
+ * @param t Target owning the focus.
+ */
+static void DetachFocusThreads(RefreshTarget *t) {
+    DWORD dwCurrentThreadId = GetCurrentThreadId();
+    if (t->attachedToOriginal) BackendAttachThreadInput(dwCurrentThreadId, t->originalThreadId, FALSE);
+    if (t->attachedToTarget) BackendAttachThreadInput(dwCurrentThreadId, t->targetThreadId, FALSE);
+    t->attachedToOriginal = FALSE;
+    t->attachedToTarget = FALSE;
+}
+
+/**
+ * @brief Injects once the target is in front, restoring it first if it was minimized again.
+ * @param t Target owning the focus.
+ */
+static void BeginInjection(RefreshTarget *t) {
+    // Final check: ensure window is not iconic just before sending
+    if (BackendIsIconic(t->hwnd)) {
+        LogDebug("SendCtrlF5: Target %p became iconic before SendInput. Restoring.", (void*)t->hwnd);
+        t->injectDueUs = 0; // The restore delay is not injection lateness
+        BackendShowWindow(t->hwnd, SW_RESTORE);
+        SetTargetDeadline(t, TARGET_INJECTING, g_focus_timing.retryDelayMs, TRUE);
+        return;
+    }
+    InjectKeystroke(t);
+}
+
+/**
+ * @brief Sends Ctrl+F5 with SendInput to the target, which is in the foreground.
+ * @param t Target owning the focus.
+ */
+static void InjectKeystroke(RefreshTarget *t) {
+    INPUT inputs[4];
+    FillCtrlF5Inputs(inputs);
+
+    if (t->injectDueUs != 0) RecordInjectionLateness(t->injectDueUs, Win32NowUs());
+    t->injectDueUs = 0;
+    ULONGLONG injectStartUs = TraceBegin();
+    UINT uSent = BackendSendInput(4, inputs);
+    CompleteInjection(t, uSent, (uSent != 4) ? GetLastError() : 0, injectStartUs);
+}
+
+/**
+ * @brief Fills the four SendInput events of Ctrl+F5: Ctrl down, F5 down, F5 up, Ctrl up.
+ * @param inputs Receives the events.
+ */
+static void FillCtrlF5Inputs(INPUT inputs[4]) {
+    memset(inputs, 0, 4 * sizeof(INPUT));
+    inputs[0].type = INPUT_KEYBOARD; inputs[0].ki.wVk = VK_CONTROL;
+    inputs[1].type = INPUT_KEYBOARD; inputs[1].ki.wVk = VK_F5;
+    inputs[2].type = INPUT_KEYBOARD; inputs[2].ki.wVk = VK_F5;      inputs[2].ki.dwFlags = KEYEVENTF_KEYUP;
+    inputs[3].type = INPUT_KEYBOARD; inputs[3].ki.wVk = VK_CONTROL; inputs[3].ki.dwFlags = KEYEVENTF_KEYUP;
+}
+
+/**
+ * @brief Logs and traces a SendInput call, made here or on the injection thread, and moves on to restoring focus.
+ * @param t Target owning the focus.
+ * @param uSent Events SendInput reported as inserted.
+ * @param sendError GetLastError() after a short SendInput, 0 otherwise.
+ * @param injectStartUs Trace timestamp taken just before SendInput.
+ */
+static void CompleteInjection(RefreshTarget *t, UINT uSent, DWORD sendError, ULONGLONG injectStartUs) {
+    TraceSpan("inject", t->track, injectStartUs, "events_sent", (long)uSent);
+    TRACEPOINT("inject", t->track, "sent=%u elapsed_us=%llu", uSent, TracepointElapsedUs());
+    if (uSent != 4) {
+        LogError("SendCtrlF5 (SendInput): Failed. Sent %u of 4. Error: %lu", uSent, sendError);
+        TraceInstant("fail.send_input", t->track);
+        ReleaseInsertedKeys(uSent);
+        RecordTargetResult(t, RESULT_SEND_FAILED);
+    } else {
+        LogDebug("SendCtrlF5 (SendInput): Sent Ctrl+F5 to HWND %p.", (void*)t->hwnd);
+        t->keystrokeSent = TRUE;
+        RecordTargetResult(t, RESULT_SENT);
+    }
+    FinishFocusSwitch(t);
+}
+
+/**
+ * @brief Releases the keys a short SendInput pressed but did not release, so Ctrl is
+ * not left held down for the user.
+ * @param uSent Events of the Ctrl+F5 batch that were inserted.
+ */
+static void ReleaseInsertedKeys(UINT uSent) {
+    INPUT inputs[4], releases[4];
+    UINT count = 0;
+    FillCtrlF5Inputs(inputs);
+    for (UINT i = uSent; i < 4; ++i) {
+        if (!(inputs[i].ki.dwFlags & KEYEVENTF_KEYUP)) continue;
+        for (UINT j = 0; j < uSent && j < 4; ++j) {
+            if (!(inputs[j].ki.dwFlags & KEYEVENTF_KEYUP) && inputs[j].ki.wVk == inputs[i].ki.wVk) {
+                releases[count++] = inputs[i];
+                break;
+            }
+        }
+    }
+    if (count == 0) return;
+    UINT released = BackendSendInput(count, releases);
+    if (released != count) {
+        LogError("SendCtrlF5 (SendInput): Releasing %u pressed key(s) failed. Sent %u. Error: %lu", count, released, GetLastError());
+    }
+}
+
+/**
+ * @brief After injecting (or giving up), starts restoring the original foreground window if conditions are met.
+ * A refresh given up emits one skip tracepoint, with the reason noted where the switch failed.
+ * @param t Target owning the focus.
+ */
+static void FinishFocusSwitch(RefreshTarget *t) {
+    const char *skipReason = (t->skipReason != NULL) ? t->skipReason : "no_focus";
+    t->skipReason = NULL;
+    if (!t->focusSet) {
+        TraceInstant("skip.no_focus", t->track);
+        TRACEPOINT("skip", t->track, "reason=%s elapsed_us=%llu", skipReason, TracepointElapsedUs());
+        ConsolePrintf("Info: Could not reliably switch to target window. Keystroke for Ctrl+F5 skipped this cycle.\n");
+        RecordTargetResult(t, RESULT_NO_FOCUS);
+    }
+
+    HWND hOriginalForeground = t->originalForeground;
+    if (t->targetWasForeground || !hOriginalForeground || !BackendIsWindow(hOriginalForeground)) {
+        EndFocusSwitch(t); // No need or nothing to restore to
+        return;
+    }
+    if (!t->focusSet) {
+        LogDebug("RestoreFocus: Input was not sent to target, not aggressively restoring original focus.");
+        EndFocusSwitch(t);
+        return;
+    }
+
+    HWND currentFgAfterInput = BackendGetForegroundWindow();
+    // Only restore if the target is still foreground, or if user switched to something else (not original)
+    if (currentFgAfterInput == t->hwnd || currentFgAfterInput != hOriginalForeground) {
+        LogDebug("RestoreFocus: Attempting to restore original foreground to HWND %p", (void*)hOriginalForeground);
+        t->phaseStartUs = TraceBegin();
+        SetTargetDeadline(t, TARGET_RESTORING, g_focus_timing.retryDelayMs, TRUE); // Brief pause
+        return;
+    }
+    LogDebug("RestoreFocus: Original foreground window %p is already active or user switched. No restore needed.", (void*)hOriginalForeground);
+    EndFocusSwitch(t);
+}
+
+/**
+ * @brief Gives the foreground back to the window that had it before the focus switch.
+ * A minimized original window is restored first, and activated after another pause.
+ * @param t Target in TARGET_RESTORING.
+ */
+static void RestoreFocusNow(RefreshTarget *t) {
+    HWND hOriginalForeground = t->originalForeground;
+    if (!t->originalRestored && BackendIsIconic(hOriginalForeground)) {
+        BackendShowWindow(hOriginalForeground, SW_RESTORE);
+        t->originalRestored = TRUE;
+        SetTargetDeadline(t, TARGET_RESTORING, g_focus_timing.retryDelayMs, TRUE);
+        return;
+    }
+    t->originalRestored = FALSE;
+    DWORD dwCurrentThreadId = GetCurrentThreadId();
+    DWORD dwOriginalFGThreadId = t->originalThreadId; // Looked up by StartFocusSwitch; a window keeps its thread
+    BOOL needsAttach = (dwOriginalFGThreadId != 0 && dwOriginalFGThreadId != dwCurrentThreadId);
+
+    if (needsAttach) BackendAttachThreadInput(dwCurrentThreadId, dwOriginalFGThreadId, TRUE);
+
+    BackendSetForegroundWindow(hOriginalForeground); // Attempt to restore
+
+    if (needsAttach) BackendAttachThreadInput(dwCurrentThreadId, dwOriginalFGThreadId, FALSE);
+
+    HWND foreground = BackendGetForegroundWindow();
+    BOOL restored = (foreground == hOriginalForeground);
+    TraceSpan("restore", t->track, t->phaseStartUs, "succeeded", restored);
+    TRACEPOINT("restore", t->track, "ok=%d elapsed_us=%llu", restored, TracepointElapsedUs());
+    if (restored) {
+        LogDebug("RestoreFocus: Successfully restored foreground to HWND %p", (void*)hOriginalForeground);
+    } else {
+        LogWarning("RestoreFocus: Failed to restore foreground to HWND %p. Current FG: %p",
+                   (void*)hOriginalForeground, (void*)foreground);
+        TraceInstant("fail.restore", t->track);
+    }
+    EndFocusSwitch(t);
+}
+
+/**
+ * @brief Releases the focus token of the target's domain, charges the focus theft,
+ * wakes the longest-queued target of the same domain (not one deferred for the focus
+ * budget) and starts the post-send pause.
+ * @param t Target that owned the focus.
+ */
+static void EndFocusSwitch(RefreshTarget *t) {
+    if (FocusOwner(t) == t) FocusOwner(t) = NULL;
+    RecordFocusTheft(t);
+    SetTargetDeadline(t, TARGET_COOLDOWN, g_focus_timing.postSendDelayMs, TRUE);
+
+    TargetTable *table = g_scheduled_table;
+    RefreshTarget *next = NULL;
+    for (int id = 0; table != NULL && id < table->count; ++id) {
+        if (table->state[id] != TARGET_FOCUS_QUEUED) continue;
+        RefreshTarget *queued = &table->targets[id];
+        if (queued->domain != t->domain || queued->budgetDeferred) continue; // Deferred ones wait for the credit
+        if (next == NULL || queued->queuedAtUs < next->queuedAtUs) next = queued;
+    }
+    if (next != NULL) {
+        TargetHot(next, deadlineUs) = 0;
+        TargetHot(next, exactDeadline) = TRUE;
+    }
+}
+
+/** @brief Returns a target whose focus switch is in progress, in any focus domain, or NULL. */
+static RefreshTarget* AnyFocusOwner(void) {
+    for (int domain = 0; domain < MAX_FOCUS_DOMAINS; ++domain) {
+        if (g_focus_owners[domain] != NULL) return g_focus_owners[domain];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Notes how a target's refresh ended and updates the statistics that depend on it:
+ * latency, tier counts, page loads and the freshness objective.
+ * @param t Target whose refresh ended.
+ * @param result Outcome.
+ */
+static void RecordTargetResult(RefreshTarget *t, TargetResult result) {
+    t->lastResult = result;
+    if (result == RESULT_NO_FOCUS || result == RESULT_SEND_FAILED) t->failures++;
+    if ((result == RESULT_SENT || result == RESULT_POSTED) && g_status_view.active && t->dueUs != 0) {
+        ULONGLONG nowUs = Win32NowUs(); // For the status view only; not a journaled clock read
+        t->lastLatencyUs = (nowUs > t->dueUs) ? nowUs - t->dueUs : 0;
+    }
+    if (result == RESULT_SENT || result == RESULT_POSTED || result == RESULT_RELOADED) t->titleRestarts = 0;
+    if (result == RESULT_SENT || result == RESULT_POSTED) {
+        t->deliveredUs = UnrecordedNowUs();
+        if (t->triggerEventUs != 0) {
+            ULONGLONG latencyUs = (t->deliveredUs > t->triggerEventUs) ? t->deliveredUs - t->triggerEventUs : 0;
+            g_trigger.refreshes++;
+            g_trigger.latencyTotalUs += latencyUs;
+            if (latencyUs > g_trigger.latencyMaxUs) g_trigger.latencyMaxUs = latencyUs;
+        }
+        if (t->dueUs != 0) {
+            g_scheduler_stats.tierRefreshes[t->tier]++;
+            g_scheduler_stats.tierRefreshUs[t->tier] += (t->deliveredUs > t->dueUs) ? t->deliveredUs - t->dueUs : 0;
+        }
+        if (g_page_loads.tracking) StartPageLoad(t, t->deliveredUs);
+    }
+    if (g_page_loads.tracking) UpdateLoadQueue(t->processId);
+    if (t->freshnessUs != 0) {
+        ULONGLONG nowUs = UnrecordedNowUs();
+        if (result == RESULT_GONE) {
+            SetFreshnessObjective(t, 0, nowUs);
+        } else if (result == RESULT_SENT || result == RESULT_POSTED || result == RESULT_RELOADED) {
+            // Recovery is checked first: a refresh landing past the objective before the
+            // timer noticed ends the breach it would have entered, so none is raised.
+            BOOL late = AccountFreshness(t, nowUs);
+            BOOL wasInBreach = t->inBreach;
+            if (wasInBreach) {
+                SetFreshnessBreach(t, FALSE, nowUs);
+            } else if (late) {
+                t->breaches++;
+                LogInfo("Freshness: Target %p \"%s\" was refreshed %.1fs after its objective, before the breach was raised.",
+                        (void*)t->hwnd, TargetTitle(t), (double)(nowUs - FreshnessDueUs(t)) / 1e6);
+            }
+            t->lastFreshUs = nowUs;
+            if (wasInBreach) ArmFreshnessTimer();
+        } else {
+            UpdateFreshness(t, nowUs);
+        }
+    }
+}
+
+/**
+ * @brief Summarizes the refresh tiers: refreshes per tier, and what the soft ones saved
+ * against hard refreshes in refresher time (due to delivered, focus switch included)
+ * and, with hard_refresh_kb and soft_refresh_kb, in estimated origin traffic.
+ * @param buffer Receives the summary.
+ * @param bufferSize Size of the buffer.
+ * @return FALSE if no soft refresh was delivered.
+ */
+static BOOL FormatRefreshTiers(char *buffer, size_t bufferSize) {
+    unsigned long soft = g_scheduler_stats.tierRefreshes[TIER_SOFT], hard = g_scheduler_stats.tierRefreshes[TIER_HARD];
+    if (soft == 0) return FALSE;
+    double softMs = (double)g_scheduler_stats.tierRefreshUs[TIER_SOFT] / 1000.0 / soft;
+    double hardMs = hard > 0 ? (double)g_scheduler_stats.tierRefreshUs[TIER_HARD] / 1000.0 / hard : softMs;
+    int length = snprintf(buffer, bufferSize, "%lu soft and %lu hard refreshes (%.1fms and %.1fms each); the soft ones saved %.1fs",
+                          soft, hard, softMs, hardMs, hardMs > softMs ? (hardMs - softMs) * soft / 1000.0 : 0.0);
+    if (g_hard_refresh_kb > g_soft_refresh_kb && length > 0 && (size_t)length < bufferSize) {
+        snprintf(buffer + length, bufferSize - (size_t)length, " and about %.1f MB of origin traffic",
+                 (double)(g_hard_refresh_kb - g_soft_refresh_kb) * soft / 1024.0);
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Sleeps until a deadline on the backend clock, or until a reactor event needs handling.
+ * @param deadlineUs Deadline; returns at once if it has passed or is 0. ULLONG_MAX (every
+ * target parked until an event) waits for events only.
+ * @param exact TRUE for focus-critical pauses, FALSE to let the OS coalesce the wakeup.
+ * @return TRUE if the deadline was reached, FALSE if an event may have changed the schedule.
+ */
+static BOOL WaitUntilDeadline(ULONGLONG deadlineUs, BOOL exact) {
+    if (g_reactor_wake) {
+        g_reactor_wake = FALSE;
+        return FALSE;
+    }
+    if (deadlineUs == 0) return TRUE;
+    ULONGLONG nowUs = BackendNowUs();
+    if (deadlineUs <= nowUs) return TRUE;
+    ULONGLONG waitMs = (deadlineUs - nowUs + 999) / 1000;
+    DWORD milliseconds = (deadlineUs == ULLONG_MAX) ? INFINITE : (DWORD)(waitMs < INFINITE ? waitMs : INFINITE - 1);
+    g_wait_interruptible = TRUE;
+    if (exact) {
+        WaitMilliseconds(milliseconds);
+    } else {
+        WaitCoalesced(milliseconds);
+    }
+    g_wait_interruptible = FALSE;
+    if (g_reactor_wake) {
+        g_reactor_wake = FALSE;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Drives a set of targets from one thread until all are gone (or maxCycles cycles end).
+ * Each pass sleeps until the earliest deadline and steps that target. The sleep is
+ * exact while any focus-critical deadline is pending, coalesced otherwise. A reactor
+ * event ends the sleep early and the pass starts over with the updated deadlines.
+ * @param table Targets to drive, added with AddRefreshTarget.
+ * @param maxCycles Stop after this many completed cycles across all targets; 0 for no limit.
+ * @return Number of completed cycles.
+ */
+static int RunScheduler(TargetTable *table, int maxCycles) {
+    int completed = 0;
+    g_scheduled_table = table;
+
+    while (TRUE) {
+        WatchdogIdle();
+        // Stops and pauses take effect between focus switches, so no thread input stays attached.
+        if (g_stop_requested && AnyFocusOwner() == NULL) break;
+        if (IsSchedulingPaused() && AnyFocusOwner() == NULL) {
+            WaitWhileSchedulingPaused();
+            if (g_stop_requested) break;
+            // One immediate refresh per target once the session is usable again.
+            for (int id = 0; id < table->count; ++id) {
+                TargetState state = (TargetState)table->state[id];
+                if (state == TARGET_STARTING || state == TARGET_WAITING || state == TARGET_LOAD_QUEUED ||
+                    state == TARGET_FOCUS_QUEUED) {
+                    table->targets[id].catchUp = TRUE;
+                    SetTargetDeadline(&table->targets[id], TARGET_STARTING, 0, FALSE);
+                }
+            }
+        }
+
+        BOOL exact = FALSE;
+        int nextId = FindNextDueTarget(table, &exact);
+        if (nextId < 0) break; // Every target is gone
+        RefreshTarget *next = &table->targets[nextId];
+
+        if (!WaitUntilDeadline(table->deadlineUs[nextId], exact)) continue;
+        WatchdogBeginStep(next);
+        g_scheduler_stats.steps++;
+        if (FocusOwner(next) != next && AnyFocusOwner() != NULL) g_scheduler_stats.stepsDuringFocusSwitch++;
+        BOOL cycleEnded = StepRefreshTarget(next);
+        WatchdogEndStep(next);
+        if (!cycleEnded) continue;
+
+        completed++;
+        g_scheduler_stats.cyclesCompleted++;
+#ifdef REFRESHER_API_COUNTERS
+        ReportApiCallCounters(completed);
+#endif
+        ResetApiCallCounters();
+        ReportWakeupRate(FALSE);
+        FlushTraceEvents(FALSE);
+        FlushJournal();
+        if (maxCycles > 0 && completed >= maxCycles) break;
+    }
+
+    WatchdogIdle();
+    g_scheduled_table = NULL;
+    return completed;
+}
+
+/**
+ * @brief Sends a Ctrl+F5 keystroke combination to the target window right away.
+ * Drives a one-off refresh target from the keystroke through the focus restore,
+ * waiting out each pause; used where nothing else needs to run meanwhile.
+ * @param targetHwnd Handle to the window to receive the keystrokes.
+ * @return TRUE if the keystroke was handed to the system, FALSE if it was skipped or failed.
+ */
+static BOOL SendCtrlF5Keystroke(HWND targetHwnd) {
+    RefreshTarget *target = ResetSingleTarget(targetHwnd);
+    if (target == NULL) return FALSE;
+    if (!BackendIsWindow(targetHwnd)) {
+        LogWarning("SendCtrlF5: Target HWND %p is invalid. Skipping.", (void*)targetHwnd);
+        ConsolePrintf("Warning: The target window seems to be closed. Keystroke not sent.\n");
+        RecordTargetResult(target, RESULT_GONE);
+        return FALSE;
+    }
+    BeginKeystroke(target);
+    while (TargetHot(target, state) != TARGET_COOLDOWN && TargetHot(target, state) != TARGET_GONE) {
+        if (!WaitUntilDeadline(TargetHot(target, deadlineUs), TRUE)) continue;
+        StepRefreshTarget(target);
+    }
+    return target->keystrokeSent;
+}
+
+/**
+ * @brief Posts an F5 key press directly to the target window's message queue.
+ * Focus is not touched, so the user is never interrupted. Posted messages carry
+ * no modifier state, so this is a soft refresh (F5), and it only works for
+ * applications that handle keys on their top-level window.
+ * @param targetHwnd Handle to the window to receive the keystroke.
+ * @param track Trace track of the target.
+ * @return TRUE if both messages were posted, FALSE otherwise.
+ */
+static BOOL PostF5Keystroke(HWND targetHwnd, int track) {
+    LPARAM scanCode = (LPARAM)(MapVirtualKey(VK_F5, MAPVK_VK_TO_VSC) & 0xFF) << 16;
+    LPARAM keyDownParam = 1 | scanCode;
+    LPARAM keyUpParam = 1 | scanCode | ((LPARAM)1 << 30) | ((LPARAM)1 << 31);
+
+    ULONGLONG injectStartUs = TraceBegin();
+    BOOL posted = BackendPostMessage(targetHwnd, WM_KEYDOWN, VK_F5, keyDownParam) &&
+                  BackendPostMessage(targetHwnd, WM_KEYUP, VK_F5, keyUpParam);
+    TraceSpan("inject", track, injectStartUs, "posted", posted);
+    TRACEPOINT("inject", track, "sent=%u elapsed_us=%llu", posted ? 2u : 0u, TracepointElapsedUs());
+    if (!posted) {
+        LogError("PostF5: PostMessage to HWND %p failed. Error: %lu", (void*)targetHwnd, GetLastError());
+        TraceInstant("fail.post_message", track);
+        return FALSE;
+    }
+    LogDebug("PostF5: Posted F5 to HWND %p.", (void*)targetHwnd);
+    return TRUE;
+}
+
+
+// === Session and Display State ===
+
+/**
+ * @brief Creates a hidden window and registers it for session lock/unlock and
+ * display power notifications.
+ * A hidden top-level window is used rather than a message-only one because
+ * message-only windows do not receive broadcast power messages.
+ * @return TRUE if lock notifications are registered, FALSE otherwise.
+ */
+static BOOL InitializeSessionNotifications(void) {
+    WNDCLASS wc = {0};
+    wc.lpfnWndProc = NotifyWindowProc;
+    wc.hInstance = GetModuleHandle(NULL);
+    wc.lpszClassName = NOTIFY_WINDOW_CLASS_NAME;
+    if (!RegisterClass(&wc)) {
+        LogError("SessionNotify: RegisterClass failed. Error: %lu", GetLastError());
+        return FALSE;
+    }
+
+    g_hNotifyWindow = CreateWindowEx(0, NOTIFY_WINDOW_CLASS_NAME, "", 0, 0, 0, 0, 0, NULL, NULL, wc.hInstance, NULL);
+    if (g_hNotifyWindow == NULL) {
+        LogError("SessionNotify: CreateWindowEx failed. Error: %lu", GetLastError());
+        return FALSE;
+    }
+
+    if (!WTSRegisterSessionNotification(g_hNotifyWindow, NOTIFY_FOR_THIS_SESSION)) {
+        LogError("SessionNotify: WTSRegisterSessionNotification failed. Error: %lu", GetLastError());
+        DestroyWindow(g_hNotifyWindow);
+        g_hNotifyWindow = NULL;
+        return FALSE;
+    }
+
+    // A session locked before startup sends no WTS_SESSION_LOCK, so ask for its state.
+    // Windows 7 reports the lock flag inverted; there a locked start is noticed at unlock.
+    WTSINFOEX *sessionInfo = NULL;
+    DWORD sessionInfoBytes = 0;
+    if (WTSQuerySessionInformation(WTS_CURRENT_SERVER_HANDLE, WTS_CURRENT_SESSION, WTSSessionInfoEx,
+                                   (LPTSTR*)&sessionInfo, &sessionInfoBytes)) {
+        if (sessionInfoBytes >= sizeof(WTSINFOEX) && sessionInfo->Level == 1 && IsWindows8OrGreater() &&
+            sessionInfo->Data.WTSInfoExLevel1.SessionFlags == WTS_SESSIONSTATE_LOCK) {
+            g_session_locked = TRUE;
+            LogInfo("SessionNotify: Session is locked at startup.");
+        }
+        WTSFreeMemory(sessionInfo);
+    } else {
+        LogWarning("SessionNotify: WTSQuerySessionInformation failed. Error: %lu. A session locked at startup is noticed at unlock.",
+                   GetLastError());
+    }
+
+    // The current display state is delivered immediately after registering.
+    g_hDisplayPowerNotify = RegisterPowerSettingNotification(g_hNotifyWindow, &CONSOLE_DISPLAY_STATE_GUID, DEVICE_NOTIFY_WINDOW_HANDLE);
+    if (g_hDisplayPowerNotify == NULL) {
+        LogWarning("SessionNotify: RegisterPowerSettingNotification failed. Error: %lu. Display-off state is not tracked.", GetLastError());
+    }
+    PumpPendingMessages();
+    LogDebug("SessionNotify: Registered for session and display notifications (HWND %p).", (void*)g_hNotifyWindow);
+    return TRUE;
+}
+
+/** @brief Unregisters notifications and destroys the hidden window. */
+static void ShutdownSessionNotifications(void) {
+    if (g_hDisplayPowerNotify != NULL) {
+        UnregisterPowerSettingNotification(g_hDisplayPowerNotify);
+        g_hDisplayPowerNotify = NULL;
+    }
+    if (g_hNotifyWindow != NULL) {
+        WTSUnRegisterSessionNotification(g_hNotifyWindow);
+        DestroyWindow(g_hNotifyWindow);
+        g_hNotifyWindow = NULL;
+    }
+}
+
+/**
+ * @brief Window procedure for the hidden notification window.
+ * Tracks session lock state and display power state.
+ */
+static LRESULT CALLBACK NotifyWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
+    if (uMsg == WM_WTSSESSION_CHANGE) {
+        if (wParam == WTS_SESSION_LOCK) {
+            g_session_locked = TRUE;
+            g_reactor_wake = TRUE;
+            LogInfo("SessionNotify: Session locked.");
+        } else if (wParam == WTS_SESSION_UNLOCK) {
+            g_session_locked = FALSE;
+            g_reactor_wake = TRUE;
+            LogInfo("SessionNotify: Session unlocked.");
+        }
+        return 0;
+    }
+    if (uMsg == WM_POWERBROADCAST && wParam == PBT_POWERSETTINGCHANGE) {
+        const POWERBROADCAST_SETTING *setting = (const POWERBROADCAST_SETTING*)lParam;
+        if (setting != NULL && memcmp(&setting->PowerSetting, &CONSOLE_DISPLAY_STATE_GUID, sizeof(GUID)) == 0 &&
+            setting->DataLength >= sizeof(DWORD)) {
+            DWORD displayState = *(const DWORD*)setting->Data; // 0 = off, 1 = on, 2 = dimmed
+            g_display_off = (displayState == 0);
+            g_reactor_wake = TRUE;
+            LogInfo("SessionNotify: Display state changed to %lu (%s).", displayState, g_display_off ? "off" : "on");
+        }
+        return TRUE;
+    }
+    return DefWindowProc(hWnd, uMsg, wParam, lParam);
+}
+
+/** @brief Dispatches all messages currently queued for this thread. */
+static void PumpPendingMessages(void) {
+    MSG msg;
+    while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+}
+
+/**
+ * @brief Reports whether refreshes should be held back.
+ * SetForegroundWindow cannot succeed while the session is locked, nobody can
+ * see the target while the display is off, and the user may pause over the control pipe.
+ * @return TRUE if the session is locked, the display is off or a "pause" command is in effect.
+ */
+static BOOL IsSchedulingPaused(void) {
+    return g_session_locked || g_display_off || g_control_paused;
+}
+
+/**
+ * @brief Blocks, without any timer, until nothing holds refreshes back (or "stop" is received).
+ */
+static void WaitWhileSchedulingPaused(void) {
+    if (g_control_paused) {
+        ConsolePrintf("Info: Paused by control command. Refreshes paused until \"resume\".\n");
+    } else {
+        ConsolePrintf("Info: Session locked or display off. Refreshes paused.\n");
+    }
+    PauseStatusView(TRUE);
+    LogInfo("Main: Scheduling paused (locked: %d, display off: %d, control: %d).",
+            g_session_locked, g_display_off, g_control_paused);
+    ULONGLONG pausedStartUs = TraceBegin();
+    while (IsSchedulingPaused() && !g_stop_requested) {
+        ReactorWait(INFINITE, 0);
+    }
+    TraceSpan("paused", TRACE_TRACK_SCHEDULER, pausedStartUs, NULL, 0);
+    ConsolePrintf("Info: Refreshes resumed.\n");
+    PauseStatusView(FALSE);
+    LogInfo("Main: Scheduling resumed.");
+}
+
+// === Reactor Functions ===
+
+/**
+ * @brief Waits for the timer while handling every other event source as it fires.
+ * A handler that changes the schedule sets g_reactor_wake, which ends the wait; a wake
+ * left over from before the call does not.
+ * @param milliseconds Duration to wait, or INFINITE to wait only for events.
+ * @param toleranceMs How much later than the deadline the wakeup may occur.
+ * @return TRUE if the full duration elapsed, FALSE if a handler set g_reactor_wake or
+ * an unbounded wait ended.
+ */
+static BOOL ReactorWait(DWORD milliseconds, DWORD toleranceMs) {
+    BOOL pendingWake = g_reactor_wake;
+    BOOL timerArmed = FALSE;
+    BOOL elapsed = FALSE;
+    ULONGLONG deadlineMs = 0;
+
+    g_reactor_wake = FALSE;
+    if (milliseconds != INFINITE) {
+        deadlineMs = GetTickCount64() + milliseconds;
+        if (g_hWaitTimer != NULL) {
+            LARGE_INTEGER dueTime;
+            dueTime.QuadPart = -(LONGLONG)milliseconds * 10000; // Relative, in 100ns units
+            timerArmed = SetWaitableTimerEx(g_hWaitTimer, &dueTime, 0, NULL, NULL, NULL, toleranceMs);
+            if (!timerArmed) {
+                LogWarning("Reactor: Waitable timer failed. Error: %lu. Using the wait timeout instead.", GetLastError());
+            }
+        }
+    }
+
+    while (!g_reactor_wake) {
+        // Rebuilt every pass: a handler may have closed its handle.
+        HANDLE handles[8];
+        DWORD handleCount = 0;
+        int timerIndex = -1, configIndex = -1, pipeIndex = -1, injectorIndex = -1, redrawIndex = -1, freshnessIndex = -1;
+        int triggerIndex = -1, triggerPollIndex = -1;
+        if (timerArmed) { timerIndex = (int)handleCount; handles[handleCount++] = g_hWaitTimer; }
+        if (g_config_watch.hDirectory != NULL) { configIndex = (int)handleCount; handles[handleCount++] = g_config_watch.overlapped.hEvent; }
+        if (g_control_pipe.hPipe != NULL) { pipeIndex = (int)handleCount; handles[handleCount++] = g_control_pipe.overlapped.hEvent; }
+        if (g_injector.hThread != NULL) { injectorIndex = (int)handleCount; handles[handleCount++] = g_injector.hDoneEvent; }
+        if (g_status_view.active) { redrawIndex = (int)handleCount; handles[handleCount++] = g_status_view.hRedrawTimer; }
+        if (g_hFreshnessTimer != NULL) { freshnessIndex = (int)handleCount; handles[handleCount++] = g_hFreshnessTimer; }
+        if (g_trigger.hChange != NULL) { triggerIndex = (int)handleCount; handles[handleCount++] = g_trigger.hChange; }
+        if (g_trigger.hPollTimer != NULL) { triggerPollIndex = (int)handleCount; handles[handleCount++] = g_trigger.hPollTimer; }
+
+        DWORD timeoutMs = INFINITE;
+        if (milliseconds != INFINITE && !timerArmed) {
+            ULONGLONG nowMs = GetTickCount64();
+            if (nowMs >= deadlineMs) { elapsed = TRUE; break; }
+            timeoutMs = (DWORD)(deadlineMs - nowMs);
+        }
+
+        ConsoleFlush(); // Lines written since the last wait go out before this one
+        DWORD result = MsgWaitForMultipleObjectsEx(handleCount, handles, timeoutMs, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+        g_wakeup_count++; // Every return is a wakeup, whether or not the scheduler runs after it
+        int signaled = (result < WAIT_OBJECT_0 + handleCount) ? (int)(result - WAIT_OBJECT_0) : -1;
+        if (result == WAIT_TIMEOUT || (signaled >= 0 && signaled == timerIndex)) {
+            elapsed = TRUE;
+        } else if (result == WAIT_OBJECT_0 + handleCount) {
+            WatchdogBeginHandler("window messages");
+            PumpPendingMessages();
+            WatchdogEndHandler();
+            continue;
+        } else if (signaled >= 0 && signaled == configIndex) {
+            WatchdogBeginHandler("config change");
+            OnConfigDirectoryChanged();
+            WatchdogEndHandler();
+            continue;
+        } else if (signaled >= 0 && signaled == pipeIndex) {
+            WatchdogBeginHandler("control pipe");
+            OnControlPipeEvent();
+            WatchdogEndHandler();
+            continue;
+        } else if (signaled >= 0 && signaled == injectorIndex) {
+            WatchdogBeginHandler("injection result");
+            OnInjectionDone();
+            WatchdogEndHandler();
+            continue;
+        } else if (signaled >= 0 && signaled == redrawIndex) {
+            WatchdogBeginHandler("status view");
+            DrawStatusView(); // Display only; the scheduler is not woken
+            WatchdogEndHandler();
+            continue;
+        } else if (signaled >= 0 && signaled == freshnessIndex) {
+            WatchdogBeginHandler("freshness check");
+            OnFreshnessTimer();
+            WatchdogEndHandler();
+            continue;
+        } else if (signaled >= 0 && signaled == triggerIndex) {
+            WatchdogBeginHandler("trigger file");
+            OnTriggerFileChanged();
+            WatchdogEndHandler();
+            continue;
+        } else if (signaled >= 0 && signaled == triggerPollIndex) {
+            WatchdogBeginHandler("trigger poll");
+            OnTriggerPollTimer();
+            WatchdogEndHandler();
+            continue;
+        } else {
+            LogError("Reactor: MsgWaitForMultipleObjectsEx failed. Error: %lu", GetLastError());
+            // Without the event handles, messages are still pumped until the deadline, so
+            // the hooks and session notifications keep working.
+            // An unbounded wait does so for a while and returns FALSE, so its caller's loop
+            // condition decides whether to wait again instead of spinning.
+            if (milliseconds == INFINITE) deadlineMs = GetTickCount64() + REACTOR_FAILURE_BACKOFF_MS;
+            for (ULONGLONG nowMs = GetTickCount64(); nowMs < deadlineMs; nowMs = GetTickCount64()) {
+                MsgWaitForMultipleObjectsEx(0, NULL, (DWORD)(deadlineMs - nowMs), QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+                PumpPendingMessages();
+            }
+            elapsed = (milliseconds != INFINITE);
+        }
+        break;
+    }
+
+    if (!elapsed && timerArmed) CancelWaitableTimer(g_hWaitTimer);
+    if (g_reload_key_count > 0) {
+        WatchdogBeginHandler("reload keys");
+        OnReloadKeys();
+        WatchdogEndHandler();
+    }
+    BOOL woken = g_reactor_wake;
+    g_reactor_wake = woken || pendingWake;
+    return elapsed && !woken;
+}
+
+/**
+ * @brief Starts the event sources of the live program: the config directory watch,
+ * the control pipe and the foreground-change hook. Each one is optional.
+ */
+static void InitializeReactor(void) {
+    RecordConfigWriteTimes();
+    if (!StartConfigWatch()) {
+        LogWarning("Reactor: Cannot watch the config directory. Error: %lu. Edits to '%s' need a restart.",
+                   GetLastError(), CONFIG_FILE_NAME);
+    }
+
+    if (!StartControlPipe()) {
+        ConsolePrintf("Warning: Control pipe unavailable. --control commands will not reach this instance.\n");
+    }
+
+    HWINEVENTHOOK foregroundHook = SetWinEventHook(EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND, NULL, ReactorWinEventProc,
+                                                   0, 0, WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+    if (foregroundHook != NULL) {
+        g_win_event_hook_pids[g_win_event_hook_count] = 0;
+        g_win_event_hook_events[g_win_event_hook_count] = EVENT_SYSTEM_FOREGROUND;
+        g_win_event_hooks[g_win_event_hook_count++] = foregroundHook;
+    } else {
+        LogWarning("Reactor: Foreground event hook failed. Error: %lu. Activation is checked after the retry delay only.", GetLastError());
+    }
+    if (g_observe_reloads != RELOADS_OFF) {
+        g_reload_keyboard_hook = SetWindowsHookEx(WH_KEYBOARD_LL, ReloadKeyboardProc, GetModuleHandle(NULL), 0);
+        if (g_reload_keyboard_hook == NULL) {
+            LogWarning("Reactor: Keyboard hook failed. Error: %lu. Refreshes by the user are not noticed.", GetLastError());
+        }
+    }
+    LogDebug("Reactor: Started (config watch: %d, control pipe: %d, foreground hook: %d, reload keys hook: %d).",
+             g_config_watch.hDirectory != NULL, g_control_pipe.hPipe != NULL, foregroundHook != NULL, g_reload_keyboard_hook != NULL);
+}
+
+/** @brief Removes the hooks and closes the config watch and the control pipe. */
+static void ShutdownReactor(void) {
+    for (int i = 0; i < g_win_event_hook_count; ++i) {
+        UnhookWinEvent(g_win_event_hooks[i]);
+    }
+    g_win_event_hook_count = 0;
+    if (g_reload_keyboard_hook != NULL) {
+        UnhookWindowsHookEx(g_reload_keyboard_hook);
+        g_reload_keyboard_hook = NULL;
+    }
+    StopConfigWatch();
+    if (g_control_pipe.hPipe != NULL) {
+        CancelIo(g_control_pipe.hPipe);
+        CloseHandle(g_control_pipe.hPipe);
+        g_control_pipe.hPipe = NULL;
+    }
+    if (g_control_pipe.overlapped.hEvent != NULL) {
+        CloseHandle(g_control_pipe.overlapped.hEvent);
+        g_control_pipe.overlapped.hEvent = NULL;
+    }
+}
+
+/**
+ * @brief Subscribes to window destruction in the target's process, so a closed target
+ * is dropped at once instead of when its wait ends. With observe_reloads = all, or a
+ * load limit, title changes are subscribed to as well, as the sign of a page (re)load.
+ * Called again on reload, it adds only the subscriptions the new settings need.
+ * @param hwnd Target window.
+ */
+static void ReactorWatchTarget(HWND hwnd) {
+    DWORD pid = 0;
+    GetWindowThreadProcessId(hwnd, &pid);
+    if (pid == 0) return;
+    if (!ReactorHookProcess(pid, EVENT_OBJECT_DESTROY)) {
+        LogWarning("Reactor: Destroy event hook for process %lu failed. Error: %lu", pid, GetLastError());
+        return;
+    }
+    if (g_observe_reloads != RELOADS_ALL && g_max_loads_per_process <= 0) return;
+    if (!ReactorHookProcess(pid, EVENT_OBJECT_NAMECHANGE)) {
+        LogWarning("Reactor: Title event hook for process %lu failed. Error: %lu. Page reloads and loads are not noticed.", pid, GetLastError());
+    }
+}
+
+/**
+ * @brief Subscribes to one event of a process, unless already subscribed (another
+ * target lives in the same process).
+ * @param pid Process to watch.
+ * @param event WinEvent to deliver to ReactorWinEventProc.
+ * @return FALSE if the hook could not be set or the table is full.
+ */
+static BOOL ReactorHookProcess(DWORD pid, DWORD event) {
+    for (int i = 0; i < g_win_event_hook_count; ++i) {
+        if (g_win_event_hook_pids[i] == pid && g_win_event_hook_events[i] == event) return TRUE;
+    }
+    if (g_win_event_hook_count >= 2 * MAX_TARGETS + 1) return FALSE;
+    HWINEVENTHOOK hook = SetWinEventHook(event, event, NULL, ReactorWinEventProc, pid, 0, WINEVENT_OUTOFCONTEXT);
+    if (hook == NULL) return FALSE;
+    g_win_event_hook_pids[g_win_event_hook_count] = pid;
+    g_win_event_hook_events[g_win_event_hook_count] = event;
+    g_win_event_hooks[g_win_event_hook_count++] = hook;
+    return TRUE;
+}
+
+/**
+ * @brief Low-level keyboard hook, called through the message pump in ReactorWait.
+ * A refresh key typed while a target is in front means the user just refreshed it.
+ * Injected keys, the refresher's own Ctrl+F5 among them, are ignored. Every key
+ * waits on this hook, so it only notes the window and time; OnReloadKeys does the rest.
+ */
+static LRESULT CALLBACK ReloadKeyboardProc(int nCode, WPARAM wParam, LPARAM lParam) {
+    const KBDLLHOOKSTRUCT *key = (const KBDLLHOOKSTRUCT*)lParam;
+    if (nCode == HC_ACTION && (wParam == WM_KEYDOWN || wParam == WM_SYSKEYDOWN) && !(key->flags & LLKHF_INJECTED) &&
+        (key->vkCode == VK_F5 || key->vkCode == VK_BROWSER_REFRESH ||
+         (key->vkCode == 'R' && (GetAsyncKeyState(VK_CONTROL) & 0x8000))) &&
+        g_reload_key_count < MAX_RELOAD_KEYS) {
+        g_reload_keys[g_reload_key_count].hwnd = GetForegroundWindow();
+        g_reload_keys[g_reload_key_count++].timeMs = key->time;
+        g_reactor_wake = TRUE;
+    }
+    return CallNextHookEx(NULL, nCode, wParam, lParam);
+}
+
+/** @brief Reactor side of the keyboard hook: restarts the waits of targets the user refreshed. */
+static void OnReloadKeys(void) {
+    DWORD nowMs = GetTickCount();
+    for (int k = 0; k < g_reload_key_count && g_observe_reloads != RELOADS_OFF; ++k) {
+        for (int i = 0; i < g_target_table.count; ++i) {
+            RefreshTarget *t = &g_target_table.targets[i];
+            if (t->hwnd != g_reload_keys[k].hwnd) continue;
+            LogDebug("Reload: Refresh key for HWND %p, %lu ms ago.", (void*)t->hwnd, nowMs - g_reload_keys[k].timeMs);
+            OnTargetReloaded(t, TRUE);
+        }
+    }
+    g_reload_key_count = 0;
+}
+
+/**
+ * @brief A target was reloaded from outside the refresher. If it is waiting, its wait
+ * starts over, so the refresh that was due does not reload the page a second time.
+ * A reload in place of a hard refresh also replans the hard refresh.
+ * Only a refresh key proves a reload, so only it restarts the freshness objective. A
+ * title change may be a page updating its title on its own, so it restarts the wait
+ * at most MAX_TITLE_RESTARTS times in a row; then the refresh goes anyway.
+ * @param t Target.
+ * @param byKey TRUE for a refresh key, FALSE for a title change.
+ */
+static void OnTargetReloaded(RefreshTarget *t, BOOL byKey) {
+    if (TargetHot(t, state) != TARGET_WAITING || t->catchUp) return;
+    const char *source = byKey ? "refresh key" : "title change";
+    if (!byKey && t->titleRestarts >= MAX_TITLE_RESTARTS) {
+        LogDebug("Reload: HWND %p title changed; its wait was restarted %d times already, so the refresh goes as planned.",
+                 (void*)t->hwnd, t->titleRestarts);
+        return;
+    }
+    g_scheduler_stats.refreshesSuppressed++;
+    LogInfo("Reload: HWND %p \"%s\" was reloaded (%s). Its wait starts over.", (void*)t->hwnd, TargetTitle(t), source);
+    ConsolePrintf("Info: \"%s\" was reloaded (%s). Restarting its wait.\n", TargetTitle(t), source);
+    TraceInstant("skip.reloaded", t->track);
+    if (t->tier == TIER_HARD) t->hardDueUs = 0;
+    if (!byKey) t->titleRestarts++;
+    RecordTargetResult(t, byKey ? RESULT_RELOADED : RESULT_RETITLED);
+    SetTargetDeadline(t, TARGET_STARTING, 0, FALSE);
+    g_reactor_wake = TRUE;
+}
+
+/**
+ * @brief WinEvent callback, delivered through the message pump in ReactorWait.
+ * A destroyed target that is waiting is rescheduled at once (its next step drops it);
+ * the focus owner coming to the front ends the activation retry delay early, and it
+ * or another window coming to the front times the focus owner's focus theft. A title
+ * change ends the page load the refresher's own refresh started; otherwise it counts
+ * as a page reload, unless it follows that refresh closely.
+ */
+static void CALLBACK ReactorWinEventProc(HWINEVENTHOOK hook, DWORD event, HWND hwnd, LONG idObject, LONG idChild,
+                                         DWORD eventThread, DWORD eventTime) {
+    (void)hook; (void)eventThread;
+    if (hwnd == NULL || idObject != OBJID_WINDOW || idChild != CHILDID_SELF) return;
+
+    if (event == EVENT_OBJECT_DESTROY) {
+        for (int i = 0; i < g_target_table.count; ++i) {
+            RefreshTarget *t = &g_target_table.targets[i];
+            if (t->hwnd == hwnd && TargetHot(t, state) == TARGET_WAITING) {
+                LogDebug("Reactor: Target HWND %p was destroyed.", (void*)hwnd);
+                SetTargetDeadline(t, TARGET_STARTING, 0, FALSE);
+                g_reactor_wake = TRUE;
+            }
+        }
+    } else if (event == EVENT_OBJECT_NAMECHANGE) {
+        ULONGLONG nowUs = UnrecordedNowUs();
+        for (int i = 0; i < g_target_table.count; ++i) {
+            RefreshTarget *t = &g_target_table.targets[i];
+            if (t->hwnd != hwnd) continue;
+            if (g_page_loads.tracking && t->loadStartUs != 0 && t->loadDoneUs == 0) {
+                FinishPageLoad(t, nowUs);
+            } else if (g_observe_reloads == RELOADS_ALL &&
+                       (t->deliveredUs == 0 || nowUs - t->deliveredUs >= (ULONGLONG)OWN_RELOAD_GRACE_MS * 1000)) {
+                OnTargetReloaded(t, FALSE);
+            }
+        }
+    } else if (event == EVENT_SYSTEM_FOREGROUND) {
+        // Times the focus theft to when the foreground changed rather than to when the
+        // event was dispatched. eventTime is on the GetTickCount clock.
+        ULONGLONG nowUs = UnrecordedNowUs();
+        ULONGLONG ageUs = (ULONGLONG)(GetTickCount() - eventTime) * 1000;
+        ULONGLONG eventUs = (ageUs < nowUs && ageUs <= (ULONGLONG)MAX_EVENT_AGE_MS * 1000) ? nowUs - ageUs : nowUs;
+        for (int domain = 0; domain < MAX_FOCUS_DOMAINS; ++domain) {
+            RefreshTarget *owner = g_focus_owners[domain];
+            if (owner == NULL || owner->targetWasForeground) continue;
+            if (owner->hwnd == hwnd && owner->theftStartUs == 0) owner->theftStartUs = eventUs;
+            if (owner->hwnd != hwnd && owner->theftStartUs != 0 && owner->theftEndUs == 0) owner->theftEndUs = eventUs;
+            if (owner->hwnd == hwnd && TargetHot(owner, state) == TARGET_ACTIVATING && owner->attempt > 0) {
+                TargetHot(owner, deadlineUs) = 0;
+                g_reactor_wake = TRUE;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Reads a file's last-write time.
+ * @param path File to query; empty paths and missing files give a zero time.
+ * @param writeTime Receives the time.
+ */
+static void GetFileWriteTime(const char *path, FILETIME *writeTime) {
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    memset(writeTime, 0, sizeof(*writeTime));
+    if (path[0] != '\0' && GetFileAttributesEx(path, GetFileExInfoStandard, &attributes)) {
+        *writeTime = attributes.ftLastWriteTime;
+    }
+}
+
+/** @brief Remembers the write times of the loaded config and profile, to tell their edits from other changes. */
+static void RecordConfigWriteTimes(void) {
+    GetFileWriteTime(CONFIG_FILE_NAME, &g_config_write_time);
+    GetFileWriteTime(g_tuning_profile_path, &g_profile_write_time);
+}
+
+/**
+ * @brief Opens the working directory, which the config file is opened relative to, and
+ * starts watching it for writes and renames.
+ * @return FALSE if the directory cannot be watched.
+ */
+static BOOL StartConfigWatch(void) {
+    memset(&g_config_watch, 0, sizeof(g_config_watch));
+    g_config_watch.overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (g_config_watch.overlapped.hEvent == NULL) return FALSE;
+    HANDLE hDirectory = CreateFile(".", FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                   NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+    if (hDirectory == INVALID_HANDLE_VALUE) {
+        StopConfigWatch();
+        return FALSE;
+    }
+    g_config_watch.hDirectory = hDirectory;
+    if (!ArmConfigWatch()) {
+        StopConfigWatch();
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Asks for the next batch of changes in the watched directory.
+ * @return FALSE if the request failed.
+ */
+static BOOL ArmConfigWatch(void) {
+    ResetEvent(g_config_watch.overlapped.hEvent);
+    return ReadDirectoryChangesW(g_config_watch.hDirectory, g_config_watch.changes, sizeof(g_config_watch.changes), FALSE,
+                                 FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE, NULL, &g_config_watch.overlapped, NULL);
+}
+
+/** @brief Cancels the directory watch and closes its handles. */
+static void StopConfigWatch(void) {
+    if (g_config_watch.hDirectory != NULL) {
+        CancelIo(g_config_watch.hDirectory);
+        CloseHandle(g_config_watch.hDirectory);
+        g_config_watch.hDirectory = NULL;
+    }
+    if (g_config_watch.overlapped.hEvent != NULL) {
+        CloseHandle(g_config_watch.overlapped.hEvent);
+        g_config_watch.overlapped.hEvent = NULL;
+    }
+}
+
+/**
+ * @brief Tells whether a directory change is about a file, compared by name without case.
+ * @param change Change record.
+ * @param path File in the watched directory; a path into another directory never matches.
+ * @return TRUE if the change names the file.
+ */
+static BOOL ChangeNamesFile(const FILE_NOTIFY_INFORMATION *change, const char *path) {
+    if (path[0] == '\0' || strchr(path, '\\') != NULL || strchr(path, '/') != NULL) return FALSE;
+    size_t length = change->FileNameLength / sizeof(WCHAR);
+    if (strlen(path) != length) return FALSE;
+    for (size_t i = 0; i < length; ++i) {
+        WCHAR c = change->FileName[i];
+        if (c > 0x7F || tolower((unsigned char)c) != tolower((unsigned char)path[i])) return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Handles a batch of changes in the watched directory. The log file lives there
+ * too and changes all the time, so only changes naming the config file or tuning profile
+ * are looked at, and the configuration is only reloaded if one of their write times moved.
+ */
+static void OnConfigDirectoryChanged(void) {
+    DWORD bytes = 0;
+    if (!GetOverlappedResult(g_config_watch.hDirectory, &g_config_watch.overlapped, &bytes, FALSE)) {
+        LogWarning("Reactor: Config directory watch failed. Error: %lu. No longer watching.", GetLastError());
+        StopConfigWatch();
+        return;
+    }
+    BOOL named = (bytes == 0); // The change buffer overflowed: any file may have changed
+    for (DWORD offset = 0; offset < bytes;) {
+        const FILE_NOTIFY_INFORMATION *change = (const FILE_NOTIFY_INFORMATION*)((const BYTE*)g_config_watch.changes + offset);
+        if (ChangeNamesFile(change, CONFIG_FILE_NAME) || ChangeNamesFile(change, g_tuning_profile_path)) named = TRUE;
+        if (change->NextEntryOffset == 0) break;
+        offset += change->NextEntryOffset;
+    }
+    if (!ArmConfigWatch()) {
+        LogWarning("Reactor: Config directory watch failed. Error: %lu. No longer watching.", GetLastError());
+        StopConfigWatch();
+    }
+    if (!named) return;
+    FILETIME configTime, profileTime;
+    GetFileWriteTime(CONFIG_FILE_NAME, &configTime);
+    GetFileWriteTime(g_tuning_profile_path, &profileTime);
+    if (CompareFileTime(&configTime, &g_config_write_time) == 0 && CompareFileTime(&profileTime, &g_profile_write_time) == 0) {
+        return;
+    }
+    ReloadConfiguration();
+}
+
+/**
+ * @brief Reloads the config file while running. New delays apply from each target's
+ * next wait; the delivery strategy changes for targets that are not mid-refresh.
+ * The freshness objective replaces any set with the control pipe.
+ * The trace and journal paths only take effect at startup.
+ */
+static void ReloadConfiguration(void) {
+    LogInfo("Reactor: Reloading configuration.");
+    LoadConfiguration();
+    RecordConfigWriteTimes();
+    ULONGLONG nowUs = UnrecordedNowUs();
+    // Loads are timed from now on if a limit was set; title hooks it needs are added below.
+    if (g_max_loads_per_process > 0) g_page_loads.tracking = TRUE;
+    for (int i = 0; i < g_target_table.count; ++i) {
+        RefreshTarget *t = &g_target_table.targets[i];
+        TargetState state = (TargetState)g_target_table.state[i];
+        if (state == TARGET_STARTING || state == TARGET_WAITING || state == TARGET_COOLDOWN) {
+            t->delivery = g_delivery_strategy;
+        }
+        if (state == TARGET_GONE) continue;
+        if (state == TARGET_WAITING && t->pausedUntilUs > nowUs) {
+            // Parked in a pause the new profiles may have moved or removed: planned again.
+            t->pausedUntilUs = nowUs;
+            SetTargetDeadline(t, TARGET_STARTING, 0, FALSE);
+        }
+        SetFreshnessObjective(t, g_freshness_s, nowUs);
+        ReactorWatchTarget(t->hwnd);
+        if (state == TARGET_LOAD_QUEUED) {
+            // Queued behind a limit that is gone: due at once, and TakeLoadSlot lets it go.
+            if (g_max_loads_per_process <= 0) TargetHot(t, deadlineUs) = 0;
+            else UpdateLoadQueue(t->processId); // The head of a raised limit may go now
+        }
+    }
+    ArmFreshnessTimer();
+    ConsolePrintf("Info: Configuration reloaded.\n");
+    g_reactor_wake = TRUE;
+}
+
+/**
+ * @brief Creates the control pipe and starts waiting for a client.
+ * Only local clients are accepted, and only one instance may own the pipe name.
+ * @return TRUE if the pipe is listening.
+ */
+static BOOL StartControlPipe(void) {
+    g_control_pipe.overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL); // Overlapped I/O needs a manual-reset event
+    if (g_control_pipe.overlapped.hEvent == NULL) {
+        LogWarning("Reactor: CreateEvent for the control pipe failed. Error: %lu", GetLastError());
+        return FALSE;
+    }
+    HANDLE hPipe = CreateNamedPipe(CONTROL_PIPE_NAME, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                                   PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                   1, CONTROL_MAX_MESSAGE, CONTROL_MAX_MESSAGE, 0, NULL);
+    if (hPipe == INVALID_HANDLE_VALUE) {
+        LogWarning("Reactor: CreateNamedPipe failed (another instance running?). Error: %lu", GetLastError());
+        CloseHandle(g_control_pipe.overlapped.hEvent);
+        g_control_pipe.overlapped.hEvent = NULL;
+        return FALSE;
+    }
+    g_control_pipe.hPipe = hPipe;
+    ConnectControlPipe();
+    return g_control_pipe.hPipe != NULL;
+}
+
+/** @brief Starts an overlapped wait for the next client; the pipe event fires when one connects. */
+static void ConnectControlPipe(void) {
+    g_control_pipe.reading = FALSE;
+    g_control_pipe.writing = FALSE;
+    g_control_pipe.ioPending = FALSE;
+    ResetEvent(g_control_pipe.overlapped.hEvent);
+    if (!ConnectNamedPipe(g_control_pipe.hPipe, &g_control_pipe.overlapped)) {
+        DWORD error = GetLastError();
+        if (error == ERROR_IO_PENDING) {
+            g_control_pipe.ioPending = TRUE;
+            return;
+        }
+        if (error != ERROR_PIPE_CONNECTED) {
+            LogError("Reactor: ConnectNamedPipe failed. Error: %lu. Control pipe closed.", error);
+            CloseHandle(g_control_pipe.hPipe);
+            g_control_pipe.hPipe = NULL;
+            return;
+        }
+    }
+    SetEvent(g_control_pipe.overlapped.hEvent); // Client connected between create and connect
+}
+
+/**
+ * @brief Advances the control pipe when its event fires: a client connected, or a
+ * request arrived. Each request gets one reply; the connection is kept until the
+ * client closes it, which completes the next read with ERROR_BROKEN_PIPE.
+ */
+static void OnControlPipeEvent(void) {
+    ControlPipe *pipe = &g_control_pipe;
+    DWORD bytes = 0;
+    if (pipe->ioPending) {
+        pipe->ioPending = FALSE;
+        if (!GetOverlappedResult(pipe->hPipe, &pipe->overlapped, &bytes, FALSE)) {
+            DWORD error = GetLastError();
+            if (error == ERROR_MORE_DATA) {
+                LogWarning("Reactor: Control request longer than %d bytes dropped.", CONTROL_MAX_MESSAGE - 1);
+            } else if (error != ERROR_BROKEN_PIPE) {
+                LogWarning("Reactor: Control pipe I/O failed. Error: %lu", error);
+            }
+            DisconnectNamedPipe(pipe->hPipe);
+            ConnectControlPipe();
+            return;
+        }
+    } else {
+        ResetEvent(pipe->overlapped.hEvent);
+    }
+
+    if (pipe->writing) {
+        pipe->writing = FALSE; // The reply went out; read the next request
+    } else if (pipe->reading) {
+        pipe->request[bytes] = '\0';
+        HandleControlCommand(pipe->request, pipe->reply, sizeof(pipe->reply));
+        // The write completes in the background; the pipe event fires when it is done.
+        if (WriteFile(pipe->hPipe, pipe->reply, (DWORD)strlen(pipe->reply), NULL, &pipe->overlapped) ||
+            GetLastError() == ERROR_IO_PENDING) {
+            pipe->writing = TRUE;
+            pipe->ioPending = TRUE;
+            return;
+        }
+        LogWarning("Reactor: Writing the control reply failed. Error: %lu", GetLastError());
+    }
+
+    // Connected, or replied: read the next request. A read that completes at once still signals the event.
+    pipe->reading = TRUE;
+    if (ReadFile(pipe->hPipe, pipe->request, CONTROL_MAX_MESSAGE - 1, NULL, &pipe->overlapped) ||
+        GetLastError() == ERROR_IO_PENDING) {
+        pipe->ioPending = TRUE;
+        return;
+    }
+    if (GetLastError() != ERROR_BROKEN_PIPE) {
+        LogWarning("Reactor: Reading from the control pipe failed. Error: %lu", GetLastError());
+    }
+    DisconnectNamedPipe(pipe->hPipe);
+    ConnectControlPipe();
+}
+
+/**
+ * @brief Executes one control command and formats the reply.
+ * Commands: status, pause, resume, refresh, reload, stop, "trigger [target]" to send
+ * a push event, and "freshness <target> <seconds>" to change one target's freshness
+ * objective until the next reload.
+ * @param request Command text; trimmed in place.
+ * @param reply Receives the reply, starting with "ok" or "error".
+ * @param replySize Size of the reply buffer.
+ */
+static void HandleControlCommand(char *request, char *reply, size_t replySize) {
+    char *command = TrimWhitespace(request);
+    LogInfo("Control: Received \"%s\".", command);
+
+    if (strcmp(command, "status") == 0) {
+        // Read outside the backend, so status requests do not show up in a journal.
+        ULONGLONG nowUs = Win32NowUs();
+        RollFocusTheftHour(UnrecordedNowUs());
+        size_t length = (size_t)snprintf(reply, replySize, "ok targets=%d paused=%d locked=%d display_off=%d focus_owner=%p stalls=%ld suppressed=%lu theft_ms_hour=%llu\n",
+                                         g_target_table.count, g_control_paused, g_session_locked, g_display_off,
+                                         AnyFocusOwner() != NULL ? (void*)AnyFocusOwner()->hwnd : NULL, g_watchdog.stalls,
+                                         g_scheduler_stats.refreshesSuppressed, g_focus_theft.hourUs / 1000);
+        for (int i = 0; i < g_target_table.count && length < replySize; ++i) {
+            const RefreshTarget *t = &g_target_table.targets[i];
+            ULONGLONG deadlineUs = TargetHot(t, deadlineUs);
+            long long dueInMs = (deadlineUs == ULLONG_MAX) ? -1 :
+                                (deadlineUs <= nowUs) ? 0 : (long long)((deadlineUs - nowUs) / 1000);
+            length += (size_t)snprintf(reply + length, replySize - length, "%p %s due_in_ms=%lld keystrokes=%d ",
+                                       (void*)t->hwnd, TARGET_STATE_NAMES[TargetHot(t, state)], dueInMs,
+                                       TargetHot(t, keystrokeCount));
+            if (t->freshnessUs != 0 && length < replySize) {
+                ULONGLONG freshUs = UnrecordedNowUs();
+                length += (size_t)snprintf(reply + length, replySize - length, "age_ms=%llu objective_s=%llu in_breach=%d ",
+                                           (freshUs - t->lastFreshUs) / 1000, t->freshnessUs / 1000000, t->inBreach);
+            }
+            if (length < replySize) length += (size_t)snprintf(reply + length, replySize - length, "\"%s\"\n", TargetTitle(t));
+        }
+    } else if (strcmp(command, "pause") == 0) {
+        g_control_paused = TRUE;
+        g_reactor_wake = TRUE;
+        snprintf(reply, replySize, "ok paused");
+    } else if (strcmp(command, "resume") == 0) {
+        g_control_paused = FALSE;
+        g_reactor_wake = TRUE;
+        snprintf(reply, replySize, "ok resumed");
+    } else if (strcmp(command, "refresh") == 0) {
+        int due = 0;
+        for (int i = 0; i < g_target_table.count; ++i) {
+            if (g_target_table.state[i] == TARGET_WAITING) {
+                SetTargetDeadline(&g_target_table.targets[i], TARGET_WAITING, 0, FALSE);
+                due++;
+            }
+        }
+        g_reactor_wake = TRUE;
+        snprintf(reply, replySize, "ok refreshing %d target(s)", due);
+    } else if (strcmp(command, "reload") == 0) {
+        ReloadConfiguration();
+        snprintf(reply, replySize, "ok reloaded");
+    } else if (strcmp(command, "stop") == 0) {
+        g_stop_requested = TRUE;
+        g_reactor_wake = TRUE;
+        snprintf(reply, replySize, "ok stopping");
+    } else if (strcmp(command, "trigger") == 0 || strncmp(command, "trigger ", 8) == 0) {
+        int number = (command[7] != '\0') ? atoi(command + 8) : 0;
+        if (number < 0 || number > g_target_table.count || (command[7] != '\0' && number == 0)) {
+            snprintf(reply, replySize, "error usage: trigger [target 1-%d]", g_target_table.count);
+        } else {
+            snprintf(reply, replySize, "ok triggered %d target(s)", TriggerTargets(number));
+        }
+    } else if (strncmp(command, "freshness ", 10) == 0) {
+        int number = 0;
+        long seconds = -1;
+        char extra = '\0';
+        if (sscanf(command + 10, "%d %ld %c", &number, &seconds, &extra) != 2 || number < 1 || number > g_target_table.count ||
+            seconds < 0 || seconds > MAX_FRESHNESS_S) {
+            snprintf(reply, replySize, "error usage: freshness <target 1-%d> <seconds 0-%d>", g_target_table.count, MAX_FRESHNESS_S);
+        } else if (g_target_table.state[number - 1] == TARGET_GONE) {
+            snprintf(reply, replySize, "error target %d is gone", number);
+        } else {
+            SetFreshnessObjective(&g_target_table.targets[number - 1], (DWORD)seconds, UnrecordedNowUs());
+            ArmFreshnessTimer();
+            snprintf(reply, replySize, "ok target %d freshness objective %lds", number, seconds);
+        }
+    } else {
+        snprintf(reply, replySize, "error unknown command \"%s\" (status, pause, resume, refresh, reload, stop, trigger, freshness)", command);
+    }
+}
+
+/**
+ * @brief Sends one command to the running instance's control pipe and prints the reply.
+ * Runs without logging, so the running instance's log is left alone.
+ * @param command Command text (e.g., "status").
+ * @return EXIT_SUCCESS if the reply starts with "ok", EXIT_FAILURE otherwise.
+ */
+static int RunControlClient(const char *command) {
+    char reply[CONTROL_MAX_MESSAGE];
+    DWORD replyLength = 0;
+    if (!CallNamedPipe(CONTROL_PIPE_NAME, (LPVOID)command, (DWORD)strlen(command), reply, sizeof(reply) - 1,
+                       &replyLength, CONTROL_CLIENT_TIMEOUT_MS)) {
+        printf("Error: No running instance answered on %s. Error: %lu\n", CONTROL_PIPE_NAME, GetLastError());
+        return EXIT_FAILURE;
+    }
+    reply[replyLength] = '\0';
+    printf("%s\n", reply);
+    return strncmp(reply, "ok", 2) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// === Console Status View Functions ===
+
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004 // Windows 10 and later
+#endif
+
+/**
+ * @brief Switches the console to VT processing and starts the 4 Hz redraw timer.
+ * Fails when output is redirected or the console predates VT support; the caller
+ * then keeps printing one line per event.
+ * @return TRUE if the status view is drawing.
+ */
+static BOOL StartStatusView(void) {
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD consoleMode = 0;
+    if (hConsole == NULL || hConsole == INVALID_HANDLE_VALUE || !GetConsoleMode(hConsole, &consoleMode) ||
+        !SetConsoleMode(hConsole, consoleMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING)) {
+        LogWarning("Console: VT sequences unavailable (output redirected or console too old). Error: %lu. Using console = scroll.",
+                   GetLastError());
+        ConsolePrintf("Warning: This console cannot redraw in place. Showing one line per event instead.\n");
+        return FALSE;
+    }
+
+    HANDLE hTimer = CreateWaitableTimer(NULL, FALSE, NULL);
+    LARGE_INTEGER dueTime;
+    dueTime.QuadPart = -(LONGLONG)STATUS_REDRAW_INTERVAL_MS * 10000; // Relative, in 100ns units
+    if (hTimer == NULL ||
+        !SetWaitableTimerEx(hTimer, &dueTime, STATUS_REDRAW_INTERVAL_MS, NULL, NULL, NULL, STATUS_REDRAW_TOLERANCE_MS)) {
+        LogWarning("Console: Redraw timer failed. Error: %lu. Using console = scroll.", GetLastError());
+        if (hTimer != NULL) CloseHandle(hTimer);
+        SetConsoleMode(hConsole, consoleMode);
+        return FALSE;
+    }
+
+    g_status_view.hConsole = hConsole;
+    g_status_view.savedConsoleMode = consoleMode;
+    g_status_view.hRedrawTimer = hTimer;
+    g_status_view.drawnLines = 0;
+    g_status_view.lastEvent[0] = '\0';
+    g_status_view.active = TRUE;
+    ConsoleWrite("\x1b[?25l", 6); // Hide the cursor while redrawing
+    DrawStatusView();
+    LogDebug("Console: Status view started.");
+    return TRUE;
+}
+
+/** @brief Draws the final frame, stops the redraw timer and gives the console back as it was. */
+static void StopStatusView(void) {
+    if (!g_status_view.active) return;
+    DrawStatusView();
+    CancelWaitableTimer(g_status_view.hRedrawTimer);
+    CloseHandle(g_status_view.hRedrawTimer);
+    g_status_view.hRedrawTimer = NULL;
+    g_status_view.active = FALSE;
+    ConsoleWrite("\x1b[?25h", 6);
+    ConsoleFlush();
+    SetConsoleMode(g_status_view.hConsole, g_status_view.savedConsoleMode);
+}
+
+/**
+ * @brief Stops redrawing while refreshes are paused (nobody sees a locked or dark screen),
+ * after drawing once so the table shows the pause, and resumes afterwards.
+ * @param paused TRUE when entering the pause, FALSE when leaving it.
+ */
+static void PauseStatusView(BOOL paused) {
+    if (!g_status_view.active) return;
+    DrawStatusView();
+    if (paused) {
+        CancelWaitableTimer(g_status_view.hRedrawTimer);
+        return;
+    }
+    LARGE_INTEGER dueTime;
+    dueTime.QuadPart = -(LONGLONG)STATUS_REDRAW_INTERVAL_MS * 10000;
+    SetWaitableTimerEx(g_status_view.hRedrawTimer, &dueTime, STATUS_REDRAW_INTERVAL_MS, NULL, NULL, NULL, STATUS_REDRAW_TOLERANCE_MS);
+}
+
+/**
+ * @brief Redraws the status table over the previous frame with one console write.
+ * Reads the scheduler's table and the Win32 clock only; no backend calls.
+ */
+static void DrawStatusView(void) {
+    const TargetTable *table = (g_scheduled_table != NULL) ? g_scheduled_table : &g_target_table;
+    char *frame = g_status_view.frame;
+    size_t size = sizeof(g_status_view.frame);
+    size_t length = 0;
+    int lines = 0;
+    ULONGLONG nowUs = Win32NowUs();
+
+#define STATUS_APPEND(...) do { \
+        int written_ = snprintf(frame + length, size - length, __VA_ARGS__); \
+        if (written_ > 0) length += ((size_t)written_ < size - length) ? (size_t)written_ : size - length - 1; \
+    } while (0)
+
+    if (g_status_view.drawnLines > 0) STATUS_APPEND("\x1b[%dF", g_status_view.drawnLines); // Back to the frame's first line
+
+    int refreshes = 0, live = 0;
+    for (int id = 0; id < table->count; ++id) {
+        refreshes += table->keystrokeCount[id];
+        if (table->state[id] != TARGET_GONE) live++;
+    }
+    const char *activity = g_stop_requested ? "stopping" :
+                           g_control_paused ? "paused (control)" :
+                           g_session_locked ? "paused (locked)" :
+                           g_display_off ? "paused (display off)" : "running";
+    STATUS_APPEND("Window Refresher: %d of %d window(s), %d refresh(es), %s\x1b[K\n", live, table->count, refreshes, activity);
+    lines++;
+    STATUS_APPEND(" # %-*s %-12s %7s %-11s %8s %5s %4s\x1b[K\n", STATUS_TITLE_WIDTH, "Window", "State", "Next in",
+                  "Last result", "Latency", "Sent", "Fail");
+    lines++;
+
+    for (int id = 0; id < table->count; ++id) {
+        const RefreshTarget *t = &table->targets[id];
+        ULONGLONG deadlineUs = table->deadlineUs[id];
+        char nextIn[16] = "-";
+        if (table->state[id] == TARGET_WAITING && deadlineUs != ULLONG_MAX) {
+            snprintf(nextIn, sizeof(nextIn), "%.1fs", (deadlineUs > nowUs) ? (double)(deadlineUs - nowUs) / 1000000.0 : 0.0);
+        } else if (table->state[id] == TARGET_FOCUS_QUEUED || table->state[id] == TARGET_LOAD_QUEUED) {
+            snprintf(nextIn, sizeof(nextIn), "queued");
+        }
+        char latency[16] = "-";
+        if (t->lastLatencyUs != 0) snprintf(latency, sizeof(latency), "%.0fms", (double)t->lastLatencyUs / 1000.0);
+        const char *title = table->titles + (size_t)id * MAX_TITLE_LENGTH;
+        STATUS_APPEND("%2d %-*.*s %-12s %7s %-11s %8s %5d %4d\x1b[K\n", id + 1, STATUS_TITLE_WIDTH, STATUS_TITLE_WIDTH,
+                      title[0] != '\0' ? title : "No Title", TARGET_STATE_NAMES[table->state[id]], nextIn,
+                      TARGET_RESULT_NAMES[t->lastResult], latency, table->keystrokeCount[id], t->failures);
+        lines++;
+    }
+
+    STATUS_APPEND("Last: %.72s\x1b[K\n", g_status_view.lastEvent);
+    lines++;
+    unsigned long cycles = g_scheduler_stats.cyclesCompleted;
+    STATUS_APPEND("Console: %.0fus per refresh (%lu writes)\x1b[K\n",
+                  cycles > 0 ? (double)g_console_stats.totalUs / cycles : 0.0, g_console_stats.writes);
+    lines++;
+#undef STATUS_APPEND
+
+    g_status_view.drawnLines = lines;
+    ConsoleWrite(frame, length);
+}
+
+/**
+ * @brief Logs how much console output cost, in total and per refresh cycle.
+ * @param cycles Refresh cycles completed over the same period.
+ */
+static void ReportConsoleCost(unsigned long cycles) {
+    LogInfo("Console: %lu writes, %llu bytes, %.1fms in total, %.1fus per cycle over %lu cycles (console = %s).",
+            g_console_stats.writes, g_console_stats.bytes, (double)g_console_stats.totalUs / 1000.0,
+            cycles > 0 ? (double)g_console_stats.totalUs / cycles : 0.0, cycles, CONSOLE_MODE_NAMES[g_console_mode]);
+}
+
+// === Injection Thread Functions ===
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002 // Windows 10 1803 and later; older systems fail the call
+#endif
+
+/**
+ * @brief Creates the injection thread, its events and its timer.
+ * The thread starts at normal priority and applies the configured class itself on its first request.
+ * @return TRUE if the thread is running.
+ */
+static BOOL StartInjectionThread(void) {
+    if (g_injector.hThread != NULL) return TRUE;
+    memset(&g_injector, 0, sizeof(g_injector));
+    g_injector.appliedCpu = -1;
+    g_injector.hRequestEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    g_injector.hDoneEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    g_injector.hTimer = CreateWaitableTimerEx(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (g_injector.hTimer == NULL) {
+        LogDebug("Injector: High-resolution timer unavailable (error %lu). Using a standard timer.", GetLastError());
+        g_injector.hTimer = CreateWaitableTimer(NULL, FALSE, NULL);
+    }
+    if (g_injector.hRequestEvent != NULL && g_injector.hDoneEvent != NULL && g_injector.hTimer != NULL) {
+        g_injector.hThread = CreateThread(NULL, 0, InjectionThreadProc, NULL, 0, NULL);
+    }
+    if (g_injector.hThread == NULL) {
+        LogWarning("Injector: Could not start the injection thread. Error: %lu. Injecting from the scheduler thread.", GetLastError());
+        StopInjectionThread();
+        return FALSE;
+    }
+    LogInfo("Injector: Injection thread started (class %s, CPU %d).",
+            INJECTION_THREAD_MODE_NAMES[g_injection_thread_mode], g_injection_cpu);
+    return TRUE;
+}
+
+/** @brief Stops the injection thread, if running, and closes its handles. */
+static void StopInjectionThread(void) {
+    if (g_injector.hThread != NULL) {
+        InterlockedExchange(&g_injector.quit, 1);
+        SetEvent(g_injector.hRequestEvent);
+        CancelWaitableTimer(g_injector.hTimer);
+        if (WaitForSingleObject(g_injector.hThread, INJECTION_THREAD_TIMEOUT_MS) != WAIT_OBJECT_0) {
+            LogWarning("Injector: Injection thread did not stop in time.");
+        }
+        CloseHandle(g_injector.hThread);
+    }
+    if (g_injector.hRequestEvent != NULL) CloseHandle(g_injector.hRequestEvent);
+    if (g_injector.hDoneEvent != NULL) CloseHandle(g_injector.hDoneEvent);
+    if (g_injector.hTimer != NULL) CloseHandle(g_injector.hTimer);
+    memset(&g_injector, 0, sizeof(g_injector));
+}
+
+/**
+ * @brief Body of the injection thread: waits for a request, sleeps until its due time,
+ * and sends Ctrl+F5 if the target is still in front. No logging or other I/O happens here.
+ * @param parameter Unused.
+ * @return 0 when asked to quit.
+ */
+static DWORD WINAPI InjectionThreadProc(LPVOID parameter) {
+    (void)parameter;
+    INPUT inputs[4];
+    FillCtrlF5Inputs(inputs);
+
+    for (;;) {
+        WaitForSingleObject(g_injector.hRequestEvent, INFINITE);
+        if (g_injector.quit) break;
+        if (g_injector.status != INJECTION_PENDING) continue;
+        ApplyInjectionThreadClass();
+
+        // Re-read the due time after every wake: the scheduler may have withdrawn this
+        // request and posted the next one while the thread slept.
+        for (;;) {
+            ULONGLONG nowUs = Win32NowUs();
+            ULONGLONG dueUs = g_injector.dueUs;
+            if (g_injector.quit || nowUs >= dueUs) break;
+            LARGE_INTEGER dueTime;
+            dueTime.QuadPart = -(LONGLONG)(dueUs - nowUs) * 10; // Relative, in 100ns units
+            if (!SetWaitableTimer(g_injector.hTimer, &dueTime, 0, NULL, NULL, FALSE)) {
+                Sleep((DWORD)((dueUs - nowUs + 999) / 1000));
+                continue;
+            }
+            WaitForSingleObject(g_injector.hTimer, INFINITE);
+        }
+        if (g_injector.quit) break;
+        if (InterlockedCompareExchange(&g_injector.status, INJECTION_RUNNING, INJECTION_PENDING) != INJECTION_PENDING) {
+            continue; // Withdrawn by the scheduler
+        }
+
+        HWND hwnd = g_injector.hwnd;
+        g_injector.wasForeground = (GetForegroundWindow() == hwnd);
+        g_injector.wasIconic = g_injector.wasForeground && IsIconic(hwnd);
+        g_injector.sent = 0;
+        g_injector.sendError = 0;
+        if (g_injector.wasForeground && !g_injector.wasIconic) {
+            g_injector.injectedUs = Win32NowUs();
+            g_injector.sent = SendInput(4, inputs, sizeof(INPUT));
+            if (g_injector.sent != 4) g_injector.sendError = GetLastError();
+        }
+        InterlockedExchange(&g_injector.status, INJECTION_DONE);
+        SetEvent(g_injector.hDoneEvent);
+    }
+    if (g_injector.hMmcssTask != NULL) AvRevertMmThreadCharacteristics(g_injector.hMmcssTask);
+    return 0;
+}
+
+/**
+ * @brief Applies the requested scheduling class and CPU to the calling (injection) thread
+ * if they changed. Errors are stored for the scheduler to log; MMCSS falls back to
+ * THREAD_PRIORITY_TIME_CRITICAL when the service refuses the task.
+ */
+static void ApplyInjectionThreadClass(void) {
+    InjectionThreadMode mode = g_injector.mode;
+    int cpu = g_injector.cpu;
+    if (mode == g_injector.appliedMode && cpu == g_injector.appliedCpu) return;
+
+    DWORD error = 0;
+    HANDLE hThread = GetCurrentThread();
+    if (g_injector.hMmcssTask != NULL) {
+        AvRevertMmThreadCharacteristics(g_injector.hMmcssTask);
+        g_injector.hMmcssTask = NULL;
+    }
+    int priority = THREAD_PRIORITY_NORMAL;
+    if (mode == INJECTION_THREAD_HIGHEST) priority = THREAD_PRIORITY_HIGHEST;
+    if (mode == INJECTION_THREAD_TIME_CRITICAL) priority = THREAD_PRIORITY_TIME_CRITICAL;
+    if (mode == INJECTION_THREAD_MMCSS) {
+        DWORD taskIndex = 0;
+        g_injector.hMmcssTask = AvSetMmThreadCharacteristics(MMCSS_TASK_NAME, &taskIndex);
+        if (g_injector.hMmcssTask != NULL) {
+            AvSetMmThreadPriority(g_injector.hMmcssTask, AVRT_PRIORITY_CRITICAL);
+        } else {
+            error = GetLastError();
+            priority = THREAD_PRIORITY_TIME_CRITICAL;
+        }
+    }
+    if (g_injector.hMmcssTask == NULL && !SetThreadPriority(hThread, priority) && error == 0) error = GetLastError();
+
+    DWORD_PTR processMask = 0, systemMask = 0;
+    DWORD_PTR mask = 0;
+    if (cpu >= 0) {
+        mask = (DWORD_PTR)1 << cpu;
+    } else if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) {
+        mask = processMask;
+    }
+    if (mask != 0 && !SetThreadAffinityMask(hThread, mask) && error == 0) error = GetLastError();
+
+    g_injector.appliedMode = mode;
+    g_injector.appliedCpu = cpu;
+    g_injector.applyError = error;
+    g_injector.classChanged = TRUE;
+}
+
+/**
+ * @brief Hands the settle pause and SendInput of a focus switch to the injection thread,
+ * starting the thread if needed. Only the plain Win32 backend injects from the thread:
+ * simulated, journaled and replayed runs keep every call on the scheduler thread.
+ * @param t Target that just acquired the focus.
+ * @return TRUE if the thread took the request; FALSE to settle and inject on this thread.
+ */
+static BOOL PostInjectionRequest(RefreshTarget *t) {
+    if (g_injection_thread_mode == INJECTION_THREAD_OFF || g_backend != &WIN32_BACKEND) return FALSE;
+    if (!StartInjectionThread()) {
+        g_injection_thread_mode = INJECTION_THREAD_OFF; // Until the config is loaded again
+        return FALSE;
+    }
+    // A result the scheduler gave up waiting for may have arrived since; it is stale now.
+    InterlockedCompareExchange(&g_injector.status, INJECTION_IDLE, INJECTION_DONE);
+    if (g_injector.status != INJECTION_IDLE) return FALSE;
+
+    // The input attachments were only needed for SetForegroundWindow; drop them before the
+    // thread can inject, as FinishSettle does before injecting from here.
+    DetachFocusThreads(t);
+    g_injector.hwnd = t->hwnd;
+    g_injector.dueUs = Win32NowUs() + (ULONGLONG)g_focus_timing.settleDelayMs * 1000;
+    g_injector.mode = g_injection_thread_mode;
+    g_injector.cpu = g_injection_cpu;
+    InterlockedExchange(&g_injector.status, INJECTION_PENDING);
+    SetEvent(g_injector.hRequestEvent);
+    t->injectionPosted = TRUE;
+    t->injectDueUs = 0;
+    return TRUE;
+}
+
+/**
+ * @brief Ends a settle pause handed to the injection thread: logs what the thread did and
+ * carries on as FinishSettle and InjectKeystroke would. If the thread has not started
+ * injecting by the fallback deadline, the request is withdrawn and this thread injects.
+ * @param t Target in TARGET_SETTLING with injectionPosted set.
+ */
+static void CollectInjectionResult(RefreshTarget *t) {
+    t->injectionPosted = FALSE;
+    LONG status = InterlockedCompareExchange(&g_injector.status, INJECTION_IDLE, INJECTION_PENDING);
+    if (status == INJECTION_PENDING) {
+        LogWarning("Injector: No result %lums after the settle deadline. Injecting from the scheduler thread.",
+                   (DWORD)INJECTION_THREAD_TIMEOUT_MS);
+        FinishSettle(t);
+        return;
+    }
+    if (status == INJECTION_RUNNING) {
+        WaitForSingleObject(g_injector.hDoneEvent, INJECTION_THREAD_TIMEOUT_MS); // Only SendInput is left
+    }
+    if (InterlockedCompareExchange(&g_injector.status, INJECTION_IDLE, INJECTION_DONE) != INJECTION_DONE) {
+        LogError("Injector: Injection thread stopped responding. Keystroke for HWND %p skipped.", (void*)t->hwnd);
+        t->focusSet = FALSE;
+        FinishFocusSwitch(t);
+        return;
+    }
+
+    if (g_injector.classChanged) {
+        g_injector.classChanged = FALSE;
+        if (g_injector.applyError != 0) {
+            LogWarning("Injector: Could not fully apply class %s on CPU %d. Error: %lu",
+                       INJECTION_THREAD_MODE_NAMES[g_injector.appliedMode], g_injector.appliedCpu, g_injector.applyError);
+        } else {
+            LogInfo("Injector: Injection thread class %s on CPU %d.",
+                    INJECTION_THREAD_MODE_NAMES[g_injector.appliedMode], g_injector.appliedCpu);
+        }
+    }
+
+    TraceSpan("settle", t->track, t->phaseStartUs, NULL, 0);
+    if (!g_injector.wasForeground) {
+        LogWarning("ActivateWindow: Focus lost from target %p after settling pause. Current FG: %p.",
+                   (void*)t->hwnd, (void*)BackendGetForegroundWindow());
+        TraceInstant("fail.focus_lost", t->track);
+        TRACEPOINT("focus_lost", t->track, "phase=settle elapsed_us=%llu", TracepointElapsedUs());
+        t->focusSet = FALSE;
+        t->skipReason = "focus_lost";
+        FinishFocusSwitch(t);
+        return;
+    }
+    LogDebug("ActivateWindow: Target %p still has focus after settling pause.", (void*)t->hwnd);
+    t->focusSet = TRUE;
+    if (g_injector.wasIconic) {
+        BeginInjection(t); // Restores it here, then injects from this thread
+        return;
+    }
+    RecordInjectionLateness(g_injector.dueUs, g_injector.injectedUs);
+    CompleteInjection(t, g_injector.sent, g_injector.sendError, g_trace_enabled ? g_injector.injectedUs : 0);
+}
+
+/** @brief Reactor handler for the injection thread's done event: the posting focus owner's settle step is due now. */
+static void OnInjectionDone(void) {
+    for (int domain = 0; domain < MAX_FOCUS_DOMAINS; ++domain) {
+        RefreshTarget *owner = g_focus_owners[domain];
+        if (owner == NULL || !owner->injectionPosted) continue; // Left over from a withdrawn request
+        TargetHot(owner, deadlineUs) = 0;
+        g_reactor_wake = TRUE;
+    }
+}
+
+/**
+ * @brief Records how late SendInput was issued relative to the settle deadline.
+ * @param dueUs Settle deadline (Win32 clock).
+ * @param injectedUs Time just before SendInput (Win32 clock).
+ */
+static void RecordInjectionLateness(ULONGLONG dueUs, ULONGLONG injectedUs) {
+    g_injection_jitter.latenessUs[g_injection_jitter.next] = (injectedUs > dueUs) ? (double)(injectedUs - dueUs) : 0.0;
+    g_injection_jitter.next = (g_injection_jitter.next + 1) % INJECTION_JITTER_SAMPLES;
+    if (g_injection_jitter.count < INJECTION_JITTER_SAMPLES) g_injection_jitter.count++;
+}
+
+/** @brief Discards the recorded injection lateness samples. */
+static void ResetInjectionJitter(void) {
+    g_injection_jitter.count = 0;
+    g_injection_jitter.next = 0;
+}
+
+/**
+ * @brief Computes percentiles of the recorded injection lateness.
+ * @param p50Us Receives the median, in microseconds.
+ * @param p99Us Receives the 99th percentile.
+ * @param maxUs Receives the maximum.
+ * @return FALSE if there are no samples.
+ */
+static BOOL GetInjectionJitter(double *p50Us, double *p99Us, double *maxUs) {
+    static double sorted[INJECTION_JITTER_SAMPLES];
+    int count = g_injection_jitter.count;
+    if (count == 0) return FALSE;
+    memcpy(sorted, g_injection_jitter.latenessUs, (size_t)count * sizeof(double));
+    qsort(sorted, (size_t)count, sizeof(double), CompareDoubles);
+    *p50Us = sorted[count / 2];
+    *p99Us = sorted[(count * 99) / 100];
+    *maxUs = sorted[count - 1];
+    return TRUE;
+}
+
+/** @brief Logs the injection lateness percentiles, if any injection was measured. */
+static void ReportInjectionJitter(void) {
+    double p50 = 0.0, p99 = 0.0, max = 0.0;
+    if (!GetInjectionJitter(&p50, &p99, &max)) return;
+    LogInfo("Injector: Lateness over the last %d injections: p50 %.0fus, p99 %.0fus, max %.0fus (injection_thread %s).",
+            g_injection_jitter.count, p50, p99, max, INJECTION_THREAD_MODE_NAMES[g_injection_thread_mode]);
+}
+
+// === Stall Watchdog Functions ===
+
+/**
+ * @brief Starts the watchdog thread. It runs for the whole session and reads watchdog_ms
+ * on every check, so a config reload can change the threshold or turn the checks off.
+ * @return TRUE if the thread is running.
+ */
+static BOOL StartWatchdog(void) {
+    if (g_watchdog.hThread != NULL) return TRUE;
+    memset(&g_watchdog, 0, sizeof(g_watchdog));
+    g_watchdog.reportedSeq = -1;
+    g_watchdog.hQuitEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (g_watchdog.hQuitEvent != NULL) {
+        g_watchdog.hThread = CreateThread(NULL, 0, WatchdogThreadProc, NULL, 0, NULL);
+    }
+    if (g_watchdog.hThread == NULL) {
+        LogWarning("Watchdog: Could not start the watchdog thread. Error: %lu. Stalls will not be reported.", GetLastError());
+        StopWatchdog();
+        return FALSE;
+    }
+    LogInfo("Watchdog: Watching the scheduler (watchdog_ms = %lu).", g_watchdog_ms);
+    return TRUE;
+}
+
+/**
+ * @brief Stops the watchdog thread, if running, and closes its handles. A thread still
+ * busy with a stall report is left to the process exit, handles and all.
+ */
+static void StopWatchdog(void) {
+    if (g_watchdog.hThread != NULL) {
+        SetEvent(g_watchdog.hQuitEvent);
+        if (WaitForSingleObject(g_watchdog.hThread, WATCHDOG_STOP_TIMEOUT_MS) != WAIT_OBJECT_0) {
+            LogWarning("Watchdog: The watchdog thread did not stop within %dms. Leaving it to the exit.", WATCHDOG_STOP_TIMEOUT_MS);
+            g_watchdog.hThread = NULL;
+            return;
+        }
+        CloseHandle(g_watchdog.hThread);
+        g_watchdog.hThread = NULL;
+    }
+    if (g_watchdog.hQuitEvent != NULL) CloseHandle(g_watchdog.hQuitEvent);
+    g_watchdog.hQuitEvent = NULL;
+}
+
+/**
+ * @brief Body of the watchdog thread: checks a few times per threshold whether the
+ * scheduler's current work has run too long, and reports each stall once.
+ * @param parameter Unused.
+ * @return 0 when asked to quit.
+ */
+static DWORD WINAPI WatchdogThreadProc(LPVOID parameter) {
+    (void)parameter;
+    for (;;) {
+        DWORD thresholdMs = g_watchdog_ms;
+        DWORD intervalMs = (thresholdMs == 0) ? WATCHDOG_IDLE_CHECK_INTERVAL_MS : thresholdMs / 4;
+        if (intervalMs < WATCHDOG_MIN_CHECK_INTERVAL_MS) intervalMs = WATCHDOG_MIN_CHECK_INTERVAL_MS;
+        if (WaitForSingleObject(g_watchdog.hQuitEvent, intervalMs) == WAIT_OBJECT_0) break;
+        if (thresholdMs == 0) continue;
+
+        LONG seq = g_watchdog.busySeq;
+        ULONGLONG busySinceUs = g_watchdog.busySinceUs;
+        if (busySinceUs == 0 || seq == g_watchdog.reportedSeq) continue;
+        ULONGLONG nowUs = Win32NowUs();
+        if (nowUs < busySinceUs || nowUs - busySinceUs < (ULONGLONG)thresholdMs * 1000) continue;
+
+        const char *phase = g_watchdog.phase;
+        RefreshTarget *target = g_watchdog.target;
+        g_watchdog.reportedSeq = seq;
+        g_watchdog.stallPhase = phase;
+        g_watchdog.stallHwnd = (target != NULL) ? target->hwnd : NULL;
+        LONG stall = InterlockedIncrement(&g_watchdog.stalls);
+        WriteStallReport(stall, nowUs - busySinceUs, phase, target);
+    }
+    return 0;
+}
+
+/**
+ * @brief Appends a stall to stall.log and replaces stall.dmp. Runs on the watchdog thread,
+ * so it only uses plain file handles: the scheduler may hold the CRT's locks.
+ * @param stall Stall number.
+ * @param stalledUs How long the scheduler's current work has run.
+ * @param phase What the scheduler was doing.
+ * @param target Target of the step in progress, or NULL.
+ */
+static void WriteStallReport(LONG stall, ULONGLONG stalledUs, const char *phase, const RefreshTarget *target) {
+    HANDLE hReport = CreateFile(STALL_REPORT_FILE_NAME, FILE_APPEND_DATA, FILE_SHARE_READ, NULL,
+                                OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    DWORD dumpError = 0;
+    BOOL dumped = WriteStallDump(&dumpError);
+    if (hReport == INVALID_HANDLE_VALUE) return;
+
+    char line[MAX_TITLE_LENGTH + 256];
+    DWORD written = 0;
+    SYSTEMTIME now;
+    GetLocalTime(&now);
+    int length;
+    if (target != NULL) {
+        length = snprintf(line, sizeof(line), "=== Stall %ld at %04u-%02u-%02u %02u:%02u:%02u: %s of HWND %p \"%s\" running for %llums ===\r\n",
+                          stall, now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond,
+                          phase != NULL ? phase : "?", (void*)target->hwnd, TargetTitle(target), stalledUs / 1000);
+    } else {
+        length = snprintf(line, sizeof(line), "=== Stall %ld at %04u-%02u-%02u %02u:%02u:%02u: %s running for %llums ===\r\n",
+                          stall, now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond,
+                          phase != NULL ? phase : "?", stalledUs / 1000);
+    }
+    WriteFile(hReport, line, (DWORD)length, &written, NULL);
+
+    LONG count = g_watchdog.recordCount;
+    LONG first = (count > FLIGHT_RECORDER_ENTRIES) ? count - FLIGHT_RECORDER_ENTRIES : 0;
+    ULONGLONG newestUs = (count > 0) ? g_watchdog.records[(count - 1) % FLIGHT_RECORDER_ENTRIES].startUs : 0;
+    length = snprintf(line, sizeof(line), "Last %ld scheduler steps, oldest first (start relative to the newest, state change, duration):\r\n",
+                      count - first);
+    WriteFile(hReport, line, (DWORD)length, &written, NULL);
+    for (LONG i = first; i < count; ++i) {
+        const FlightRecord *record = &g_watchdog.records[i % FLIGHT_RECORDER_ENTRIES];
+        length = snprintf(line, sizeof(line), "  %+12.3fms  HWND %p  %-12s -> %-12s  %.3fms\r\n",
+                          (double)((LONGLONG)record->startUs - (LONGLONG)newestUs) / 1000.0, (void*)record->hwnd,
+                          TARGET_STATE_NAMES[record->stateBefore],
+                          record->durationUs != 0 ? TARGET_STATE_NAMES[record->stateAfter] : "(running)",
+                          (double)record->durationUs / 1000.0);
+        WriteFile(hReport, line, (DWORD)length, &written, NULL);
+    }
+    if (dumped) {
+        length = snprintf(line, sizeof(line), "Minidump with all thread stacks: %s\r\n", STALL_DUMP_FILE_NAME);
+    } else {
+        length = snprintf(line, sizeof(line), "Minidump failed. Error: %lu\r\n", dumpError);
+    }
+    WriteFile(hReport, line, (DWORD)length, &written, NULL);
+    CloseHandle(hReport);
+}
+
+/**
+ * @brief Runs this program with --stall-dump to write stall.dmp, and waits for it up to
+ * STALL_DUMP_TIMEOUT_MS. Runs on the watchdog thread.
+ * @param error Receives the helper's error, WAIT_TIMEOUT if it was killed, when it fails.
+ * @return TRUE if the dump was written.
+ */
+static BOOL WriteStallDump(DWORD *error) {
+    char path[MAX_PATH];
+    char commandLine[MAX_PATH + 64]; // CreateProcess may write to the command line
+    DWORD length = GetModuleFileName(NULL, path, sizeof(path));
+    if (length == 0 || length >= sizeof(path)) {
+        *error = GetLastError();
+        return FALSE;
+    }
+    snprintf(commandLine, sizeof(commandLine), "\"%s\" --stall-dump %lu", path, GetCurrentProcessId());
+    STARTUPINFO startupInfo;
+    PROCESS_INFORMATION processInfo;
+    memset(&startupInfo, 0, sizeof(startupInfo));
+    startupInfo.cb = sizeof(startupInfo);
+    if (!CreateProcess(path, commandLine, NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, NULL, &startupInfo, &processInfo)) {
+        *error = GetLastError();
+        return FALSE;
+    }
+    CloseHandle(processInfo.hThread);
+    DWORD exitCode = WAIT_TIMEOUT;
+    if (WaitForSingleObject(processInfo.hProcess, STALL_DUMP_TIMEOUT_MS) == WAIT_OBJECT_0) {
+        GetExitCodeProcess(processInfo.hProcess, &exitCode);
+    } else {
+        TerminateProcess(processInfo.hProcess, WAIT_TIMEOUT);
+    }
+    CloseHandle(processInfo.hProcess);
+    *error = exitCode;
+    return exitCode == 0;
+}
+
+/**
+ * @brief Body of the dump helper: writes a minidump of the stalled process to stall.dmp.
+ * Runs before logging is set up, so the stalled process's log stays untouched.
+ * @param processId Process to dump, in decimal.
+ * @return 0 on success, otherwise the Win32 error.
+ */
+static int RunStallDump(const char *processId) {
+    DWORD pid = (DWORD)strtoul(processId, NULL, 10);
+    HANDLE hProcess = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ | PROCESS_DUP_HANDLE, FALSE, pid);
+    if (hProcess == NULL) return (int)GetLastError();
+    HANDLE hDump = CreateFile(STALL_DUMP_FILE_NAME, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hDump == INVALID_HANDLE_VALUE) {
+        DWORD error = GetLastError();
+        CloseHandle(hProcess);
+        return (int)error;
+    }
+    DWORD error = 0;
+    if (!MiniDumpWriteDump(hProcess, pid, hDump, (MINIDUMP_TYPE)(MiniDumpNormal | MiniDumpWithThreadInfo), NULL, NULL, NULL)) {
+        error = GetLastError();
+        if (error == 0) error = ERROR_GEN_FAILURE;
+    }
+    CloseHandle(hDump);
+    CloseHandle(hProcess);
+    return (int)error;
+}
+
+/**
+ * @brief Marks the start of a scheduler step for the watchdog and records it in the flight recorder.
+ * @param t Target about to be stepped.
+ */
+static void WatchdogBeginStep(RefreshTarget *t) {
+    if (g_watchdog.hThread == NULL) return;
+    ULONGLONG nowUs = Win32NowUs();
+    FlightRecord *record = &g_watchdog.records[g_watchdog.recordCount % FLIGHT_RECORDER_ENTRIES];
+    record->startUs = nowUs;
+    record->durationUs = 0;
+    record->hwnd = t->hwnd;
+    record->stateBefore = TargetHot(t, state);
+    record->stateAfter = TargetHot(t, state);
+    g_watchdog.recordCount++;
+    g_watchdog.phase = TARGET_STATE_NAMES[TargetHot(t, state)];
+    g_watchdog.target = t;
+    g_watchdog.busySinceUs = nowUs;
+    InterlockedIncrement(&g_watchdog.busySeq);
+}
+
+/**
+ * @brief Completes the step's flight record. The scheduler stays busy with the bookkeeping
+ * until WatchdogIdle.
+ * @param t Target that was stepped.
+ */
+static void WatchdogEndStep(RefreshTarget *t) {
+    if (g_watchdog.hThread == NULL || g_watchdog.recordCount == 0) return;
+    FlightRecord *record = &g_watchdog.records[(g_watchdog.recordCount - 1) % FLIGHT_RECORDER_ENTRIES];
+    ULONGLONG nowUs = Win32NowUs();
+    record->stateAfter = TargetHot(t, state);
+    record->durationUs = (nowUs > record->startUs) ? nowUs - record->startUs : 1;
+    g_watchdog.phase = "bookkeeping";
+}
+
+/**
+ * @brief Marks the start of a reactor handler for the watchdog. Handlers run inside
+ * waits, which may come in the middle of a step; that work is put back afterwards.
+ * @param handler Name reported as the phase.
+ */
+static void WatchdogBeginHandler(const char *handler) {
+    if (g_watchdog.hThread == NULL) return;
+    g_watchdog.outerSinceUs = g_watchdog.busySinceUs;
+    g_watchdog.outerPhase = g_watchdog.phase;
+    g_watchdog.outerTarget = g_watchdog.target;
+    g_watchdog.phase = handler;
+    g_watchdog.target = NULL;
+    g_watchdog.busySinceUs = Win32NowUs();
+    InterlockedIncrement(&g_watchdog.busySeq);
+}
+
+/** @brief Marks the end of a reactor handler and puts back the work it interrupted, if any. */
+static void WatchdogEndHandler(void) {
+    if (g_watchdog.hThread == NULL) return;
+    if (g_watchdog.outerSinceUs == 0) {
+        WatchdogIdle();
+        return;
+    }
+    g_watchdog.phase = g_watchdog.outerPhase;
+    g_watchdog.target = g_watchdog.outerTarget;
+    g_watchdog.busySinceUs = g_watchdog.outerSinceUs;
+}
+
+/**
+ * @brief Marks the scheduler as waiting, and logs any stall the watchdog reported
+ * while it was busy.
+ */
+static void WatchdogIdle(void) {
+    if (g_watchdog.hThread == NULL) return;
+    if (g_watchdog.stalls != g_watchdog.stallsLogged) {
+        ULONGLONG stalledMs = (Win32NowUs() - g_watchdog.busySinceUs) / 1000;
+        g_watchdog.stallsLogged = g_watchdog.stalls;
+        LogWarning("Watchdog: Scheduler was stuck for %llums in %s of HWND %p (stall %ld). See %s and %s.",
+                   stalledMs, g_watchdog.stallPhase, (void*)g_watchdog.stallHwnd, g_watchdog.stallsLogged,
+                   STALL_REPORT_FILE_NAME, STALL_DUMP_FILE_NAME);
+        ConsolePrintf("Warning: Refreshing was stuck for %.1fs. Details are in %s.\n",
+                      (double)stalledMs / 1000.0, STALL_REPORT_FILE_NAME);
+    }
+    g_watchdog.busySinceUs = 0;
+    g_watchdog.target = NULL;
+}
+
+/** @brief Logs how many stalls the watchdog reported, if it ran. */
+static void ReportWatchdog(void) {
+    if (g_watchdog.hThread == NULL) return;
+    LogInfo("Watchdog: %ld scheduler stall(s) reported (threshold %lums).", g_watchdog.stalls, g_watchdog_ms);
+}
+
+// === Freshness Objective Functions ===
+
+/**
+ * @brief Reads the clock the freshness objective, traces and tracepoints are kept on. It is
+ * the backend's clock, read past the journal and without consuming replay records, so
+ * tracking freshness or turning tracing on does not change what a journal records or a
+ * replay expects.
+ * @return Current time in microseconds.
+ */
+static ULONGLONG UnrecordedNowUs(void) {
+    if (g_backend == &JOURNAL_BACKEND) return g_journal_inner->nowUs();
+    if (g_backend == &REPLAY_BACKEND) return g_replay.clockUs;
+    return g_backend->nowUs();
+}
+
+/**
+ * @brief Gives every target of a table the configured freshness objective and, in a live
+ * run, creates the reactor timer that notices breaches between refreshes.
+ * @param table Targets about to be scheduled.
+ * @param withTimer TRUE to create the timer; simulations notice breaches when refreshes end.
+ */
+static void StartFreshnessTracking(TargetTable *table, BOOL withTimer) {
+    ULONGLONG nowUs = UnrecordedNowUs();
+    for (int i = 0; i < table->count; ++i) {
+        SetFreshnessObjective(&table->targets[i], g_freshness_s, nowUs);
+    }
+    if (withTimer) {
+        g_hFreshnessTimer = CreateWaitableTimerEx(NULL, NULL, 0, TIMER_ALL_ACCESS);
+        if (g_hFreshnessTimer == NULL) {
+            LogWarning("Freshness: CreateWaitableTimerEx failed. Error: %lu. Breaches are noticed when a refresh ends.", GetLastError());
+        }
+        ArmFreshnessTimer();
+    }
+    if (g_freshness_s != 0) LogInfo("Freshness: Tracking an objective of %lus for %d target(s).", g_freshness_s, table->count);
+}
+
+/**
+ * @brief Accounts compliance up to the end of the run, closes the timer and removes the
+ * breach marker file, which would otherwise report a breach of a program that has stopped.
+ * @param table Targets that were scheduled.
+ */
+static void StopFreshnessTracking(TargetTable *table) {
+    ULONGLONG nowUs = UnrecordedNowUs();
+    for (int i = 0; i < table->count; ++i) {
+        UpdateFreshness(&table->targets[i], nowUs);
+    }
+    if (g_hFreshnessTimer != NULL) {
+        CancelWaitableTimer(g_hFreshnessTimer);
+        CloseHandle(g_hFreshnessTimer);
+        g_hFreshnessTimer = NULL;
+    }
+    if (g_freshness_marker_path[0] != '\0' && g_backend != &SIMULATED_BACKEND && g_backend != &REPLAY_BACKEND) {
+        DeleteFile(g_freshness_marker_path);
+    }
+}
+
+/**
+ * @brief Changes a target's freshness objective. Tracking that starts counts from now;
+ * a target already tracked keeps the time of its last refresh.
+ * @param t Target.
+ * @param seconds New objective; 0 stops tracking.
+ * @param nowUs Current time on the UnrecordedNowUs clock.
+ */
+static void SetFreshnessObjective(RefreshTarget *t, DWORD seconds, ULONGLONG nowUs) {
+    UpdateFreshness(t, nowUs);
+    if (t->freshnessUs == 0) {
+        t->lastFreshUs = nowUs;
+        t->accountedUs = nowUs;
+    }
+    t->freshnessUs = (ULONGLONG)seconds * 1000000;
+    BOOL breached = (t->freshnessUs != 0 && nowUs > FreshnessDueUs(t));
+    if (breached != t->inBreach) SetFreshnessBreach(t, breached, nowUs);
+}
+
+/**
+ * @brief When a target breaches its objective unless refreshed first: the objective
+ * after its last successful refresh, or after the end of the time profile pause it
+ * waits out, whichever is later. A pause is not a breach.
+ * @param t Target with an objective.
+ * @return Time on the UnrecordedNowUs clock.
+ */
+static ULONGLONG FreshnessDueUs(const RefreshTarget *t) {
+    ULONGLONG fromUs = (t->pausedUntilUs > t->lastFreshUs) ? t->pausedUntilUs : t->lastFreshUs;
+    return fromUs + t->freshnessUs;
+}
+
+/**
+ * @brief Accounts a target's compliance since the last accounting.
+ * @param t Target; untracked targets are left alone.
+ * @param nowUs Current time on the UnrecordedNowUs clock.
+ * @return TRUE if the objective has passed without a successful refresh.
+ */
+static BOOL AccountFreshness(RefreshTarget *t, ULONGLONG nowUs) {
+    if (t->freshnessUs == 0 || nowUs <= t->accountedUs) return FALSE;
+    ULONGLONG breachStartUs = FreshnessDueUs(t);
+    ULONGLONG spanUs = nowUs - t->accountedUs;
+    ULONGLONG breachInSpanUs = 0;
+    if (nowUs > breachStartUs) breachInSpanUs = nowUs - (breachStartUs > t->accountedUs ? breachStartUs : t->accountedUs);
+    t->trackedUs += spanUs;
+    t->breachUs += breachInSpanUs;
+    // Exponentially weighted, so a span's weight does not depend on how often accounting runs.
+    double weight = 1.0 - exp(-(double)spanUs / (FRESHNESS_WINDOW_S * 1e6));
+    t->recentBreachShare += weight * ((double)breachInSpanUs / (double)spanUs - t->recentBreachShare);
+    t->accountedUs = nowUs;
+    return nowUs > breachStartUs;
+}
+
+/**
+ * @brief Accounts a target's compliance since the last accounting, and enters a breach
+ * once the objective has passed without a successful refresh.
+ * @param t Target; untracked targets are left alone.
+ * @param nowUs Current time on the UnrecordedNowUs clock.
+ */
+static void UpdateFreshness(RefreshTarget *t, ULONGLONG nowUs) {
+    if (AccountFreshness(t, nowUs) && !t->inBreach) SetFreshnessBreach(t, TRUE, nowUs);
+}
+
+/**
+ * @brief Enters or leaves a breach: logs it, runs freshness_command and updates the
+ * marker file. The hooks only run against real windows, not in simulations or replays.
+ * @param t Target.
+ * @param breached TRUE on entering a breach.
+ * @param nowUs Current time on the UnrecordedNowUs clock.
+ */
+static void SetFreshnessBreach(RefreshTarget *t, BOOL breached, ULONGLONG nowUs) {
+    ULONGLONG ageUs = nowUs - t->lastFreshUs;
+    t->inBreach = breached;
+    if (breached) {
+        t->breaches++;
+        LogWarning("Freshness: Target %p \"%s\" breached its objective: last refreshed %.1fs ago, objective %.0fs.",
+                   (void*)t->hwnd, TargetTitle(t), (double)ageUs / 1e6, (double)t->freshnessUs / 1e6);
+        ConsolePrintf("Warning: \"%s\" has not been refreshed for %.0fs.\n", TargetTitle(t), (double)ageUs / 1e6);
+    } else {
+        LogInfo("Freshness: Target %p \"%s\" is no longer in breach (%.1fs since the last refresh).",
+                (void*)t->hwnd, TargetTitle(t), (double)ageUs / 1e6);
+        if (t->freshnessUs != 0) ConsolePrintf("Info: \"%s\" is fresh again.\n", TargetTitle(t));
+    }
+    if (g_backend == &SIMULATED_BACKEND || g_backend == &REPLAY_BACKEND) return;
+    RunFreshnessCommand(t, breached, ageUs);
+    UpdateFreshnessMarker(nowUs);
+}
+
+/**
+ * @brief Starts freshness_command without waiting for it. The event is passed in
+ * environment variables: REFRESHER_EVENT (breach, recovered or untracked),
+ * REFRESHER_HWND, REFRESHER_TITLE, REFRESHER_AGE_S and REFRESHER_OBJECTIVE_S.
+ * @param t Target.
+ * @param breached TRUE on entering a breach.
+ * @param ageUs Time since the target's last successful refresh.
+ */
+static void RunFreshnessCommand(const RefreshTarget *t, BOOL breached, ULONGLONG ageUs) {
+    if (g_freshness_command[0] == '\0') return;
+    char value[64];
+    SetEnvironmentVariable("REFRESHER_EVENT", breached ? "breach" : (t->freshnessUs != 0 ? "recovered" : "untracked"));
+    snprintf(value, sizeof(value), "%p", (void*)t->hwnd);
+    SetEnvironmentVariable("REFRESHER_HWND", value);
+    SetEnvironmentVariable("REFRESHER_TITLE", TargetTitle(t));
+    snprintf(value, sizeof(value), "%.0f", (double)ageUs / 1e6);
+    SetEnvironmentVariable("REFRESHER_AGE_S", value);
+    snprintf(value, sizeof(value), "%.0f", (double)t->freshnessUs / 1e6);
+    SetEnvironmentVariable("REFRESHER_OBJECTIVE_S", value);
+
+    char commandLine[sizeof(g_freshness_command)]; // CreateProcess may write to the command line
+    strncpy(commandLine, g_freshness_command, sizeof(commandLine) - 1);
+    commandLine[sizeof(commandLine) - 1] = '\0';
+    STARTUPINFO startupInfo;
+    PROCESS_INFORMATION processInfo;
+    memset(&startupInfo, 0, sizeof(startupInfo));
+    startupInfo.cb = sizeof(startupInfo);
+    if (!CreateProcess(NULL, commandLine, NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, NULL, &startupInfo, &processInfo)) {
+        LogWarning("Freshness: Could not run freshness_command '%s'. Error: %lu", g_freshness_command, GetLastError());
+        return;
+    }
+    CloseHandle(processInfo.hThread);
+    CloseHandle(processInfo.hProcess);
+}
+
+/**
+ * @brief Rewrites the marker file with one line per target in breach, or deletes it
+ * when none is.
+ * @param nowUs Current time on the UnrecordedNowUs clock.
+ */
+static void UpdateFreshnessMarker(ULONGLONG nowUs) {
+    if (g_freshness_marker_path[0] == '\0') return;
+    int inBreach = 0;
+    for (int i = 0; i < g_target_table.count; ++i) {
+        if (g_target_table.targets[i].inBreach) inBreach++;
+    }
+    if (inBreach == 0) {
+        if (!DeleteFile(g_freshness_marker_path) && GetLastError() != ERROR_FILE_NOT_FOUND) {
+            LogWarning("Freshness: Could not delete marker file '%s'. Error: %lu", g_freshness_marker_path, GetLastError());
+        }
+        return;
+    }
+    FILE *marker = fopen(g_freshness_marker_path, "w");
+    if (marker == NULL) {
+        LogWarning("Freshness: Could not write marker file '%s'.", g_freshness_marker_path);
+        return;
+    }
+    for (int i = 0; i < g_target_table.count; ++i) {
+        const RefreshTarget *t = &g_target_table.targets[i];
+        if (!t->inBreach) continue;
+        fprintf(marker, "%p age_s=%.0f objective_s=%.0f \"%s\"\n", (void*)t->hwnd,
+                (double)(nowUs - t->lastFreshUs) / 1e6, (double)t->freshnessUs / 1e6, TargetTitle(t));
+    }
+    fclose(marker);
+}
+
+/**
+ * @brief Sets the freshness timer for the earliest time a tracked target not yet in
+ * breach can breach. The wakeup may come FRESHNESS_CHECK_TOLERANCE_MS late, so the
+ * OS can fold it into another one.
+ */
+static void ArmFreshnessTimer(void) {
+    if (g_hFreshnessTimer == NULL) return;
+    ULONGLONG earliestUs = ULLONG_MAX;
+    for (int i = 0; i < g_target_table.count; ++i) {
+        const RefreshTarget *t = &g_target_table.targets[i];
+        if (t->freshnessUs == 0 || t->inBreach) continue;
+        if (FreshnessDueUs(t) < earliestUs) earliestUs = FreshnessDueUs(t);
+    }
+    if (earliestUs == ULLONG_MAX) {
+        CancelWaitableTimer(g_hFreshnessTimer);
+        return;
+    }
+    ULONGLONG nowUs = UnrecordedNowUs();
+    ULONGLONG dueInUs = (earliestUs > nowUs ? earliestUs - nowUs : 0) + 1000; // Just past the objective
+    LARGE_INTEGER dueTime;
+    dueTime.QuadPart = -(LONGLONG)dueInUs * 10; // Relative, in 100ns units
+    if (!SetWaitableTimerEx(g_hFreshnessTimer, &dueTime, 0, NULL, NULL, NULL, FRESHNESS_CHECK_TOLERANCE_MS)) {
+        LogWarning("Freshness: Setting the timer failed. Error: %lu. Breaches are noticed when a refresh ends.", GetLastError());
+    }
+}
+
+/** @brief Reactor handler of the freshness timer. Accounting only; the scheduler is not woken. */
+static void OnFreshnessTimer(void) {
+    ULONGLONG nowUs = UnrecordedNowUs();
+    for (int i = 0; i < g_target_table.count; ++i) {
+        UpdateFreshness(&g_target_table.targets[i], nowUs);
+    }
+    ArmFreshnessTimer();
+}
+
+/**
+ * @brief Share of the last FRESHNESS_WINDOW_S a target spent in breach. The average
+ * starts at zero, so it is scaled up while less than a window has been tracked.
+ * @param t Tracked target.
+ * @return Share between 0 and 1.
+ */
+static double RecentBreachShare(const RefreshTarget *t) {
+    double filled = 1.0 - exp(-(double)t->trackedUs / (FRESHNESS_WINDOW_S * 1e6));
+    return filled > 0.0 ? t->recentBreachShare / filled : 0.0;
+}
+
+/**
+ * @brief Sums the freshness compliance of the tracked targets of a table.
+ * @param table Targets.
+ * @param compliancePct Receives the share of tracked time within the objective, since tracking started.
+ * @param recentPct Receives the same share, weighted over the last FRESHNESS_WINDOW_S.
+ * @param breaches Receives the number of breaches.
+ * @param breachS Receives the time spent in breach.
+ * @return FALSE if no target was tracked.
+ */
+static BOOL GetFreshnessCompliance(const TargetTable *table, double *compliancePct, double *recentPct,
+                                   int *breaches, double *breachS) {
+    ULONGLONG trackedUs = 0, breachUs = 0;
+    double recentBreachShare = 0.0;
+    int tracked = 0;
+    *breaches = 0;
+    for (int i = 0; i < table->count; ++i) {
+        const RefreshTarget *t = &table->targets[i];
+        if (t->trackedUs == 0) continue;
+        trackedUs += t->trackedUs;
+        breachUs += t->breachUs;
+        recentBreachShare += RecentBreachShare(t);
+        *breaches += t->breaches;
+        tracked++;
+    }
+    if (tracked == 0) return FALSE;
+    *compliancePct = 100.0 * (1.0 - (double)breachUs / (double)trackedUs);
+    *recentPct = 100.0 * (1.0 - recentBreachShare / tracked);
+    *breachS = (double)breachUs / 1e6;
+    return TRUE;
+}
+
+/**
+ * @brief Logs each tracked target's freshness compliance at the end of a run.
+ * @param table Targets that were scheduled.
+ */
+static void ReportFreshness(const TargetTable *table) {
+    for (int i = 0; i < table->count; ++i) {
+        const RefreshTarget *t = &table->targets[i];
+        if (t->trackedUs == 0) continue;
+        LogInfo("Freshness: Target %p \"%s\": %.2f%% within the objective (%.2f%% over the last hour), %d breach(es), %.1fs in breach.",
+                (void*)t->hwnd, TargetTitle(t), 100.0 * (1.0 - (double)t->breachUs / (double)t->trackedUs),
+                100.0 * (1.0 - RecentBreachShare(t)), t->breaches, (double)t->breachUs / 1e6);
+    }
+}
+
+// === Push Trigger Functions ===
+
+/**
+ * @brief Opens trigger_file and watches its directory, and checks its size every
+ * TRIGGER_POLL_MS as well: a directory change is only reported when the file's
+ * directory entry is updated, which may not happen while the writer holds it open.
+ * Only lines appended from now on are events; the file is created if it does not exist yet.
+ */
+static void StartTriggerSource(void) {
+    memset(&g_trigger, 0, sizeof(g_trigger));
+    if (g_trigger_file_path[0] == '\0') return;
+
+    g_trigger.hFile = CreateFile(g_trigger_file_path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                 NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (g_trigger.hFile == INVALID_HANDLE_VALUE) {
+        LogWarning("Trigger: Cannot open trigger_file '%s'. Error: %lu. Refreshing on the timer only.", g_trigger_file_path, GetLastError());
+        g_trigger.hFile = NULL;
+        return;
+    }
+    LARGE_INTEGER size;
+    g_trigger.offset = GetFileSizeEx(g_trigger.hFile, &size) ? size.QuadPart : 0;
+
+    char directory[MAX_PATH_LENGTH];
+    snprintf(directory, sizeof(directory), "%s", g_trigger_file_path);
+    char *slash = strrchr(directory, '\\');
+    if (slash == NULL) slash = strrchr(directory, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+    } else {
+        strcpy(directory, ".");
+    }
+    g_trigger.hChange = FindFirstChangeNotification(directory, FALSE, FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+    if (g_trigger.hChange == INVALID_HANDLE_VALUE) {
+        LogWarning("Trigger: Cannot watch '%s'. Error: %lu. Events are noticed by the size check only.", directory, GetLastError());
+        g_trigger.hChange = NULL;
+    }
+    g_trigger.hPollTimer = CreateWaitableTimerEx(NULL, NULL, 0, TIMER_ALL_ACCESS);
+    LARGE_INTEGER dueTime;
+    dueTime.QuadPart = -(LONGLONG)TRIGGER_POLL_MS * 10000; // Relative, in 100ns units
+    if (g_trigger.hPollTimer != NULL &&
+        !SetWaitableTimerEx(g_trigger.hPollTimer, &dueTime, TRIGGER_POLL_MS, NULL, NULL, NULL, TRIGGER_POLL_TOLERANCE_MS)) {
+        CloseHandle(g_trigger.hPollTimer);
+        g_trigger.hPollTimer = NULL;
+    }
+    if (g_trigger.hPollTimer == NULL) {
+        LogWarning("Trigger: Size check timer failed. Error: %lu. Appends the directory watch misses are not noticed.", GetLastError());
+    }
+    if (g_trigger.hChange == NULL && g_trigger.hPollTimer == NULL) {
+        LogWarning("Trigger: Cannot follow '%s'. Refreshing on the timer only.", g_trigger_file_path);
+        CloseHandle(g_trigger.hFile);
+        g_trigger.hFile = NULL;
+        return;
+    }
+    LogInfo("Trigger: Tailing '%s' (filter '%s', debounce %lums, minimum gap %lus).", g_trigger_file_path,
+            g_trigger_filter, g_trigger_debounce_ms, g_trigger_min_gap_s);
+}
+
+/** @brief Closes the trigger file, its directory watch and its size check timer. */
+static void StopTriggerSource(void) {
+    if (g_trigger.hChange != NULL) {
+        FindCloseChangeNotification(g_trigger.hChange);
+        g_trigger.hChange = NULL;
+    }
+    if (g_trigger.hPollTimer != NULL) {
+        CancelWaitableTimer(g_trigger.hPollTimer);
+        CloseHandle(g_trigger.hPollTimer);
+        g_trigger.hPollTimer = NULL;
+    }
+    if (g_trigger.hFile != NULL) {
+        CloseHandle(g_trigger.hFile);
+        g_trigger.hFile = NULL;
+    }
+}
+
+/** @brief Reactor handler of the trigger directory watch. */
+static void OnTriggerFileChanged(void) {
+    if (!FindNextChangeNotification(g_trigger.hChange)) {
+        LogWarning("Trigger: Directory watch failed. Error: %lu. Events are noticed by the size check only.", GetLastError());
+        FindCloseChangeNotification(g_trigger.hChange);
+        g_trigger.hChange = NULL;
+        if (g_trigger.hPollTimer == NULL) StopTriggerSource();
+        return;
+    }
+    ReadTriggerFile();
+}
+
+/** @brief Reactor handler of the trigger file's periodic size check. */
+static void OnTriggerPollTimer(void) {
+    ReadTriggerFile();
+}
+
+/**
+ * @brief Reads what was appended to the trigger file and handles each complete line.
+ * A file that shrank was rewritten and is read again from the start.
+ */
+static void ReadTriggerFile(void) {
+    if (g_trigger.hFile == NULL) return;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(g_trigger.hFile, &size) || size.QuadPart == g_trigger.offset) return; // Another file changed
+    if (size.QuadPart < g_trigger.offset) {
+        g_trigger.offset = 0;
+        g_trigger.lineLength = 0;
+    }
+    LARGE_INTEGER position;
+    position.QuadPart = g_trigger.offset;
+    SetFilePointerEx(g_trigger.hFile, position, NULL, FILE_BEGIN);
+
+    char buffer[4096];
+    DWORD bytesRead = 0;
+    while (ReadFile(g_trigger.hFile, buffer, sizeof(buffer), &bytesRead, NULL) && bytesRead > 0) {
+        g_trigger.offset += bytesRead;
+        for (DWORD i = 0; i < bytesRead; ++i) {
+            if (buffer[i] == '\n') {
+                g_trigger.line[g_trigger.lineLength] = '\0';
+                HandleTriggerLine(g_trigger.line);
+                g_trigger.lineLength = 0;
+            } else if (g_trigger.lineLength < sizeof(g_trigger.line) - 1) {
+                g_trigger.line[g_trigger.lineLength++] = buffer[i];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Handles one event line. Blank lines (the separators of an SSE stream) and lines
+ * without trigger_filter are skipped. A line with "target=N" triggers the N-th selected
+ * window only; any other line triggers them all.
+ * @param line Event line; trimmed in place.
+ */
+static void HandleTriggerLine(char *line) {
+    line = TrimWhitespace(line);
+    if (line[0] == '\0' || strstr(line, g_trigger_filter) == NULL) return;
+    const char *selector = strstr(line, "target=");
+    int number = (selector != NULL) ? atoi(selector + 7) : 0;
+    LogDebug("Trigger: Event \"%s\".", line);
+    TriggerTargets(number);
+}
+
+/**
+ * @brief Counts one event and brings the refresh of the waiting target(s) forward. A
+ * target in the middle of a refresh keeps the event until its next wait is planned.
+ * @param number Selected window to trigger, from 1; 0 for every one.
+ * @return Number of targets whose deadline the event moved or kept pending.
+ */
+static int TriggerTargets(int number) {
+    TargetTable *table = (g_scheduled_table != NULL) ? g_scheduled_table : &g_target_table;
+    ULONGLONG nowUs = UnrecordedNowUs();
+    int triggered = 0;
+    g_trigger.events++;
+    for (int i = 0; i < table->count; ++i) {
+        if (number != 0 && i != number - 1) continue;
+        RefreshTarget *t = &table->targets[i];
+        if (TargetHot(t, state) == TARGET_GONE) continue;
+        if (TargetHot(t, state) != TARGET_WAITING || t->catchUp) {
+            if (t->pendingTriggerUs == 0) t->pendingTriggerUs = nowUs; // A refresh is under way
+        } else {
+            TriggerTarget(t, nowUs);
+        }
+        triggered++;
+    }
+    return triggered;
+}
+
+/**
+ * @brief Applies an event that came while the target was not waiting to the wait just
+ * planned, unless a refresh delivered after the event already answered it.
+ * @param t Target whose cycle just began.
+ */
+static void ApplyPendingTrigger(RefreshTarget *t) {
+    ULONGLONG eventUs = t->pendingTriggerUs;
+    if (eventUs == 0) return;
+    t->pendingTriggerUs = 0;
+    if (TargetHot(t, state) != TARGET_WAITING || t->catchUp || t->deliveredUs >= eventUs) return;
+    TriggerTarget(t, UnrecordedNowUs());
+    t->triggerEventUs = eventUs; // Latency is counted from the event, not from when it was applied
+}
+
+/**
+ * @brief Moves a waiting target's deadline to the end of the debounce period, or to the
+ * end of the minimum gap after its last refresh if that is later. The random timer's
+ * deadline is kept while it is the earlier one.
+ * @param t Target in TARGET_WAITING.
+ * @param nowUs Current time on the UnrecordedNowUs clock, which in a live run is the backend clock.
+ */
+static void TriggerTarget(RefreshTarget *t, ULONGLONG nowUs) {
+    if (t->triggerEventUs == 0) {
+        t->triggerEventUs = nowUs;
+        t->fallbackDueUs = TargetHot(t, deadlineUs);
+    }
+    ULONGLONG dueUs = nowUs + (ULONGLONG)g_trigger_debounce_ms * 1000;
+    ULONGLONG gapEndUs = t->deliveredUs + (ULONGLONG)g_trigger_min_gap_s * 1000000;
+    if (t->deliveredUs != 0 && gapEndUs > dueUs) dueUs = gapEndUs;
+    TargetHot(t, deadlineUs) = (dueUs < t->fallbackDueUs) ? dueUs : t->fallbackDueUs;
+    g_reactor_wake = TRUE;
+}
+
+/**
+ * @brief Summarizes how many events arrived and the event-to-keystroke latency of the
+ * refreshes they brought.
+ * @param buffer Receives the summary.
+ * @param bufferSize Size of the buffer.
+ * @return FALSE if no event arrived.
+ */
+static BOOL FormatTriggers(char *buffer, size_t bufferSize) {
+    if (g_trigger.events == 0) return FALSE;
+    snprintf(buffer, bufferSize, "%lu event(s), %lu refresh(es) brought forward; event to keystroke %.1fms on average, %.1fms at most",
+             g_trigger.events, g_trigger.refreshes,
+             g_trigger.refreshes > 0 ? (double)g_trigger.latencyTotalUs / 1000.0 / g_trigger.refreshes : 0.0,
+             (double)g_trigger.latencyMaxUs / 1000.0);
+    return TRUE;
+}
+
+// === Page Load Functions ===
+
+/**
+ * @brief Notes that a refresh was delivered and the page is loading. The simulated
+ * desktop has no titles to watch; there a load needs SIM_PAGE_LOAD_MS of its process,
+ * which its loads in flight share evenly (AdvanceSimulatedLoads).
+ * @param t Target whose refresh was delivered.
+ * @param nowUs Current time on the UnrecordedNowUs clock.
+ */
+static void StartPageLoad(RefreshTarget *t, ULONGLONG nowUs) {
+    if (g_backend == &SIMULATED_BACKEND) AdvanceSimulatedLoads(t->table, t->processId, nowUs);
+    if (t->loadStartUs != 0 && IsLoadInFlight(t, nowUs)) g_page_loads.abandoned++; // Never finished; the new load replaces it
+    t->loadStartUs = nowUs;
+    t->loadDoneUs = 0;
+    t->loadDueUs = (t->dueUs != 0 && t->dueUs < nowUs) ? t->dueUs : nowUs;
+    t->loadWorkUs = (ULONGLONG)SIM_PAGE_LOAD_MS * 1000;
+    t->loadAdvancedUs = nowUs;
+}
+
+/**
+ * @brief Records a finished load's times: delivered to loaded, and due to loaded.
+ * @param t Target whose load finished.
+ * @param doneUs When it finished.
+ */
+static void RecordPageLoad(RefreshTarget *t, ULONGLONG doneUs) {
+    t->loadDoneUs = doneUs;
+    g_page_loads.loads++;
+    g_page_loads.loadMs[g_page_loads.next] = (double)(doneUs - t->loadStartUs) / 1000.0;
+    g_page_loads.readyMs[g_page_loads.next] = (double)(doneUs - t->loadDueUs) / 1000.0;
+    g_page_loads.next = (g_page_loads.next + 1) % LOAD_TIME_SAMPLES;
+    if (g_page_loads.count < LOAD_TIME_SAMPLES) g_page_loads.count++;
+}
+
+/**
+ * @brief Records a load seen to finish and lets the next refresh queued for the process go.
+ * @param t Target whose load finished.
+ * @param doneUs When it finished.
+ */
+static void FinishPageLoad(RefreshTarget *t, ULONGLONG doneUs) {
+    RecordPageLoad(t, doneUs);
+    UpdateLoadQueue(t->processId);
+}
+
+/**
+ * @brief Brings the simulated loads of a process up to date. The loads in flight share
+ * the process evenly, so each progresses at 1/n of full speed while n are running, and
+ * a load started later slows down the ones already running. Loads that complete are
+ * recorded at the time they did; the caller lets the load queue move.
+ * @param table Targets of the scheduler.
+ * @param processId Simulated process.
+ * @param nowUs Current time on the UnrecordedNowUs clock.
+ */
+static void AdvanceSimulatedLoads(TargetTable *table, DWORD processId, ULONGLONG nowUs) {
+    for (;;) {
+        int running = 0;
+        ULONGLONG advancedUs = nowUs, leastWorkUs = ULLONG_MAX;
+        for (int id = 0; id < table->count; ++id) {
+            RefreshTarget *other = &table->targets[id];
+            if (other->processId != processId || other->loadStartUs == 0 || other->loadDoneUs != 0) continue;
+            running++;
+            advancedUs = other->loadAdvancedUs; // All running loads were advanced together
+            if (other->loadWorkUs < leastWorkUs) leastWorkUs = other->loadWorkUs;
+        }
+        if (running == 0 || advancedUs >= nowUs) return;
+        // Up to the next completion, or to now if none comes first.
+        ULONGLONG stepUs = nowUs - advancedUs;
+        BOOL completes = (leastWorkUs * (ULONGLONG)running <= stepUs);
+        if (completes) stepUs = leastWorkUs * (ULONGLONG)running;
+        ULONGLONG workUs = completes ? leastWorkUs : stepUs / (ULONGLONG)running;
+        for (int id = 0; id < table->count; ++id) {
+            RefreshTarget *other = &table->targets[id];
+            if (other->processId != processId || other->loadStartUs == 0 || other->loadDoneUs != 0) continue;
+            other->loadWorkUs -= (workUs < other->loadWorkUs) ? workUs : other->loadWorkUs;
+            other->loadAdvancedUs = advancedUs + stepUs;
+            if (other->loadWorkUs == 0) RecordPageLoad(other, advancedUs + stepUs);
+        }
+        if (!completes) return;
+    }
+}
+
+/**
+ * @brief Tells whether a target's page is still loading. A finished load, or one that
+ * ran past load_timeout_s unseen (counted as a timeout), is retired.
+ * @param t Target.
+ * @param nowUs Current time on the UnrecordedNowUs clock.
+ * @return TRUE while the load is in flight.
+ */
+static BOOL IsLoadInFlight(RefreshTarget *t, ULONGLONG nowUs) {
+    if (t->loadStartUs == 0) return FALSE;
+    if (t->loadDoneUs == 0 && nowUs < t->loadStartUs + (ULONGLONG)g_load_timeout_s * 1000000) return TRUE;
+    if (t->loadDoneUs == 0) g_page_loads.timeouts++;
+    t->loadStartUs = 0;
+    return FALSE;
+}
+
+/**
+ * @brief Counts the other targets of a target's process that are loading, or are past
+ * their wait and about to load (queued for or holding the focus).
+ * @param t Target whose process is counted; itself excluded.
+ * @param nowUs Current time on the UnrecordedNowUs clock.
+ * @param earliestEndUs Receives when the first load in flight ends at the latest (for a simulated
+ * load, if no other starts meanwhile); if none is loading yet, a load timeout from now, in
+ * case the refreshes about to load never report back.
+ * @return Number of loads in flight or about to start.
+ */
+static int CountProcessLoads(const RefreshTarget *t, ULONGLONG nowUs, ULONGLONG *earliestEndUs) {
+    TargetTable *table = t->table;
+    BOOL simulated = (g_backend == &SIMULATED_BACKEND);
+    if (simulated) AdvanceSimulatedLoads(table, t->processId, nowUs);
+    int loads = 0, running = 0;
+    ULONGLONG leastWorkUs = ULLONG_MAX;
+    *earliestEndUs = ULLONG_MAX;
+    for (int id = 0; id < table->count; ++id) {
+        RefreshTarget *other = &table->targets[id];
+        if (other->processId != t->processId) continue;
+        if (other == t) {
+            if (simulated && IsLoadInFlight(other, nowUs)) running++; // Its last load still shares the process
+            continue;
+        }
+        TargetState state = (TargetState)table->state[id];
+        if (IsLoadInFlight(other, nowUs)) {
+            ULONGLONG endUs = other->loadStartUs + (ULONGLONG)g_load_timeout_s * 1000000;
+            if (endUs < *earliestEndUs) *earliestEndUs = endUs;
+            if (other->loadWorkUs < leastWorkUs) leastWorkUs = other->loadWorkUs;
+            running++;
+            loads++;
+        } else if ((state == TARGET_FOCUS_QUEUED && !other->budgetDeferred) || state == TARGET_ACTIVATING ||
+                   state == TARGET_SETTLING || state == TARGET_INJECTING || state == TARGET_RESTORING) {
+            loads++;
+        }
+    }
+    if (simulated && leastWorkUs != ULLONG_MAX) *earliestEndUs = nowUs + leastWorkUs * (ULONGLONG)running;
+    if (*earliestEndUs == ULLONG_MAX) *earliestEndUs = nowUs + (ULONGLONG)g_load_timeout_s * 1000000;
+    return loads;
+}
+
+/**
+ * @brief Lets a due refresh go if its process is under max_loads_per_process and no
+ * refresh of the process queued before it; otherwise queues it. The head of a queue
+ * is due when the first load in flight ends at the latest; the others wait for
+ * UpdateLoadQueue.
+ * @param t Target whose refresh is due.
+ * @return TRUE if the refresh may go now.
+ */
+static BOOL TakeLoadSlot(RefreshTarget *t) {
+    if (g_max_loads_per_process <= 0 || !g_page_loads.tracking) return TRUE;
+    ULONGLONG nowUs = UnrecordedNowUs();
+    ULONGLONG earliestEndUs;
+    int loads = CountProcessLoads(t, nowUs, &earliestEndUs);
+    BOOL aheadInQueue = FALSE;
+    TargetTable *table = t->table;
+    for (int id = 0; id < table->count; ++id) {
+        const RefreshTarget *other = &table->targets[id];
+        if (other != t && other->processId == t->processId && table->state[id] == TARGET_LOAD_QUEUED &&
+            (TargetHot(t, state) != TARGET_LOAD_QUEUED || other->loadQueuedAtUs < t->loadQueuedAtUs)) {
+            aheadInQueue = TRUE;
+        }
+    }
+    if (loads < g_max_loads_per_process && !aheadInQueue) {
+        // Leaves the queue; the next in it moves up once this refresh's result is recorded.
+        if (TargetHot(t, state) == TARGET_LOAD_QUEUED) TargetHot(t, state) = TARGET_WAITING;
+        return TRUE;
+    }
+    if (TargetHot(t, state) != TARGET_LOAD_QUEUED) {
+        g_scheduler_stats.loadQueued++;
+        t->loadQueuedAtUs = nowUs;
+        LogDebug("Loads: %d page load(s) in flight in process %lu. HWND %p queued.", loads, t->processId, (void*)t->hwnd);
+    }
+    TargetHot(t, state) = TARGET_LOAD_QUEUED;
+    TargetHot(t, deadlineUs) = aheadInQueue ? ULLONG_MAX : earliestEndUs;
+    TargetHot(t, exactDeadline) = FALSE;
+    return FALSE;
+}
+
+/**
+ * @brief Makes the first refresh queued for a process due, at once if the process is
+ * under its limit, or else when its first load in flight ends at the latest.
+ * @param processId Process whose queue to update.
+ */
+static void UpdateLoadQueue(DWORD processId) {
+    TargetTable *table = g_scheduled_table;
+    if (table == NULL || g_max_loads_per_process <= 0) return;
+    RefreshTarget *head = NULL;
+    for (int id = 0; id < table->count; ++id) {
+        RefreshTarget *queued = &table->targets[id];
+        if (table->state[id] != TARGET_LOAD_QUEUED || queued->processId != processId) continue;
+        if (head == NULL || queued->loadQueuedAtUs < head->loadQueuedAtUs) head = queued;
+    }
+    if (head == NULL) return;
+    ULONGLONG earliestEndUs;
+    int loads = CountProcessLoads(head, UnrecordedNowUs(), &earliestEndUs);
+    TargetHot(head, deadlineUs) = (loads < g_max_loads_per_process) ? 0 : earliestEndUs;
+    g_reactor_wake = TRUE;
+}
+
+/**
+ * @brief Computes percentiles of recorded page load times.
+ * @param samples g_page_loads.loadMs or g_page_loads.readyMs.
+ * @param p50Ms Receives the median, in milliseconds.
+ * @param p99Ms Receives the 99th percentile.
+ * @param maxMs Receives the maximum.
+ * @return FALSE if no load was timed.
+ */
+static BOOL GetPageLoadTimes(const double *samples, double *p50Ms, double *p99Ms, double *maxMs) {
+    static double sorted[LOAD_TIME_SAMPLES];
+    int count = g_page_loads.count;
+    if (count == 0) return FALSE;
+    memcpy(sorted, samples, (size_t)count * sizeof(double));
+    qsort(sorted, (size_t)count, sizeof(double), CompareDoubles);
+    *p50Ms = sorted[count / 2];
+    *p99Ms = sorted[(count * 99) / 100];
+    *maxMs = sorted[count - 1];
+    return TRUE;
+}
+
+/**
+ * @brief Summarizes the page loads: due to loaded, which is what the limit is judged
+ * by, and the load alone, with how many refreshes waited behind the limit.
+ * @param buffer Receives the summary.
+ * @param bufferSize Size of the buffer.
+ * @return FALSE if no load was started.
+ */
+static BOOL FormatPageLoads(char *buffer, size_t bufferSize) {
+    double readyP50 = 0.0, readyP99 = 0.0, readyMax = 0.0, loadP50 = 0.0, loadP99 = 0.0, loadMax = 0.0;
+    if (!GetPageLoadTimes(g_page_loads.readyMs, &readyP50, &readyP99, &readyMax) &&
+        g_page_loads.timeouts == 0 && g_page_loads.abandoned == 0) {
+        return FALSE;
+    }
+    GetPageLoadTimes(g_page_loads.loadMs, &loadP50, &loadP99, &loadMax);
+    snprintf(buffer, bufferSize, "%lu page load(s), due to loaded p50 %.0fms, p99 %.0fms, max %.0fms; the load alone p50 %.0fms, "
+             "p99 %.0fms; %lu timed out; %lu abandoned for the next refresh; %lu refresh(es) queued (max_loads_per_process %d)",
+             g_page_loads.loads, readyP50, readyP99, readyMax, loadP50, loadP99, g_page_loads.timeouts, g_page_loads.abandoned,
+             g_scheduler_stats.loadQueued, g_max_loads_per_process);
+    return TRUE;
+}
+
+// === Time Profile Functions ===
+
+/**
+ * @brief Parses a time_profile value: days ("mon-fri", "sat,sun", "daily"), a time
+ * window ("09:30-16:00"; "22:00-06:00" runs past midnight, "00:00-24:00" is the whole
+ * day), then either two delays in seconds or "paused".
+ * @param value Text after the '='.
+ * @param profile Receives the profile.
+ * @return FALSE if the value is malformed.
+ */
+static BOOL ParseTimeProfile(const char *value, TimeProfile *profile) {
+    static const char *const DAY_NAMES[] = { "mon", "tue", "wed", "thu", "fri", "sat", "sun" };
+    char days[32], window[32], first[32] = "", second[32] = "";
+    int fields = sscanf(value, "%31s %31s %31s %31s", days, window, first, second);
+    if (fields < 3) return FALSE;
+
+    memset(profile, 0, sizeof(*profile));
+    if (strcmp(days, "daily") == 0 || strcmp(days, "*") == 0) {
+        profile->days = 0x7F;
+    } else {
+        for (char *part = strtok(days, ","); part != NULL; part = strtok(NULL, ",")) {
+            int from = -1, to = -1;
+            char *dash = strchr(part, '-');
+            if (dash != NULL) *dash = '\0';
+            for (int d = 0; d < 7; ++d) {
+                if (strcmp(part, DAY_NAMES[d]) == 0) from = d;
+                if (dash != NULL && strcmp(dash + 1, DAY_NAMES[d]) == 0) to = d;
+            }
+            if (dash == NULL) to = from;
+            if (from < 0 || to < 0) return FALSE;
+            for (int d = from; ; d = (d + 1) % 7) { // "sat-mon" wraps over the weekend
+                profile->days |= (unsigned char)(1 << d);
+                if (d == to) break;
+            }
+        }
+    }
+
+    unsigned int startH, startM, endH, endM;
+    char extra;
+    if (sscanf(window, "%u:%u-%u:%u%c", &startH, &startM, &endH, &endM, &extra) != 4 ||
+        startH > 23 || startM > 59 || endH > 24 || endM > 59 || (endH == 24 && endM != 0)) {
+        return FALSE;
+    }
+    profile->startS = (startH * 60 + startM) * 60;
+    profile->endS = (endH * 60 + endM) * 60;
+
+    if (fields == 3 && strcmp(first, "paused") == 0) {
+        profile->paused = TRUE;
+    } else {
+        char *end1 = NULL, *end2 = NULL;
+        profile->minDelayS = strtod(first, &end1);
+        profile->maxDelayS = strtod(second, &end2);
+        if (fields != 4 || *end1 != '\0' || *end2 != '\0' || profile->minDelayS <= 0.0 || profile->maxDelayS >= 3600.0 ||
+            profile->minDelayS > profile->maxDelayS) {
+            return FALSE;
+        }
+    }
+    snprintf(profile->spec, sizeof(profile->spec), "%s", value);
+    return TRUE;
+}
+
+/**
+ * @brief Tells whether a second of the week lies in one of a profile's windows.
+ * @param profile Profile.
+ * @param secondOfWeek Seconds since Monday 00:00.
+ * @return TRUE if covered.
+ */
+static BOOL TimeProfileCovers(const TimeProfile *profile, DWORD secondOfWeek) {
+    DWORD lengthS = (profile->endS > profile->startS) ? profile->endS - profile->startS : profile->endS + 86400 - profile->startS;
+    for (int d = 0; d < 7; ++d) {
+        if (!(profile->days & (1 << d))) continue;
+        DWORD startS = (DWORD)d * 86400 + profile->startS;
+        if ((secondOfWeek + SECONDS_PER_WEEK - startS) % SECONDS_PER_WEEK < lengthS) return TRUE;
+    }
+    return FALSE;
+}
+
+/** @brief qsort comparator for DWORD seconds. */
+static int CompareSeconds(const void *a, const void *b) {
+    DWORD x = *(const DWORD*)a, y = *(const DWORD*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Compiles the time profiles into the week's transition table: every window
+ * start and end is a candidate, and each keeps the profile of the last line covering
+ * it. Adjacent entries with the same profile are merged.
+ */
+static void CompileTimeProfiles(void) {
+    static DWORD boundaries[MAX_PROFILE_TRANSITIONS];
+    int count = 0;
+    boundaries[count++] = 0;
+    for (int p = 0; p < g_time_profile_count; ++p) {
+        const TimeProfile *profile = &g_time_profiles[p];
+        for (int d = 0; d < 7; ++d) {
+            if (!(profile->days & (1 << d))) continue;
+            DWORD startS = (DWORD)d * 86400 + profile->startS;
+            DWORD lengthS = (profile->endS > profile->startS) ? profile->endS - profile->startS : profile->endS + 86400 - profile->startS;
+            boundaries[count++] = startS % SECONDS_PER_WEEK;
+            boundaries[count++] = (startS + lengthS) % SECONDS_PER_WEEK;
+        }
+    }
+    qsort(boundaries, (size_t)count, sizeof(DWORD), CompareSeconds);
+
+    g_profile_transition_count = 0;
+    for (int i = 0; i < count; ++i) {
+        if (i > 0 && boundaries[i] == boundaries[i - 1]) continue;
+        int active = -1;
+        for (int p = 0; p < g_time_profile_count; ++p) {
+            if (TimeProfileCovers(&g_time_profiles[p], boundaries[i])) active = p;
+        }
+        if (g_profile_transition_count > 0 && g_profile_transitions[g_profile_transition_count - 1].profile == active) continue;
+        g_profile_transitions[g_profile_transition_count].startS = boundaries[i];
+        g_profile_transitions[g_profile_transition_count++].profile = active;
+    }
+    if (g_time_profile_count > 0) {
+        LogInfo("LoadConfig: %d time profile(s) compiled into %d transition(s) a week.", g_time_profile_count, g_profile_transition_count);
+    }
+}
+
+/**
+ * @brief Reads the time of the week the profiles are looked up at: local time in a live
+ * run, the virtual clock on the simulated desktop (which starts on a Monday at 00:00).
+ * @return Milliseconds since Monday 00:00.
+ */
+static ULONGLONG TimeProfileMsOfWeek(void) {
+    if (g_backend == &SIMULATED_BACKEND) return g_sim.clockMs % ((ULONGLONG)SECONDS_PER_WEEK * 1000);
+    SYSTEMTIME now;
+    GetLocalTime(&now);
+    ULONGLONG day = (now.wDayOfWeek + 6) % 7; // SYSTEMTIME counts from Sunday
+    return (((day * 24 + now.wHour) * 60 + now.wMinute) * 60 + now.wSecond) * 1000 + now.wMilliseconds;
+}
+
+/**
+ * @brief Looks up the time profile in force now. A journal records the outcome, and a
+ * replay plans with the recorded delays or pause, since it runs at another time of day.
+ * @param minDelayS Receives the shortest wait to plan.
+ * @param maxDelayS Receives the longest wait to plan.
+ * @param pausedForMs Receives how long refreshes stay paused from now; 0 if they are not.
+ * @return Index of the profile, or -1 where min_delay and max_delay apply (or a replayed
+ * profile the current configuration does not have).
+ */
+static int GetTimeProfile(double *minDelayS, double *maxDelayS, DWORD *pausedForMs) {
+    if (g_backend == &REPLAY_BACKEND) {
+        *minDelayS = g_min_delay_seconds;
+        *maxDelayS = g_max_delay_seconds;
+        *pausedForMs = 0;
+        const JournalRecord *record = ReplayTake(JOURNAL_OP_TIME_PROFILE);
+        if (record == NULL) return -1;
+        if (record->value >> 63) {
+            *pausedForMs = (DWORD)(record->value & 0xFFFFFFFFu);
+        } else {
+            *minDelayS = (double)(record->value >> 32) / 1000.0;
+            *maxDelayS = (double)(record->value & 0xFFFFFFFFu) / 1000.0;
+        }
+        return ((int)record->arg - 1 < g_time_profile_count) ? (int)record->arg - 1 : -1;
+    }
+    int profile = LookUpTimeProfile(minDelayS, maxDelayS, pausedForMs);
+    if (g_backend == &JOURNAL_BACKEND) {
+        unsigned long long value = (*pausedForMs > 0) ? (1ULL << 63) | *pausedForMs :
+            ((unsigned long long)(*minDelayS * 1000.0) << 32) | (unsigned long long)(*maxDelayS * 1000.0);
+        JournalWrite(JOURNAL_OP_TIME_PROFILE, (unsigned short)(profile + 1), g_journal_inner->nowUs(), value);
+    }
+    return profile;
+}
+
+/** @brief Name of a profile for messages; -1 is one the replayed journal had. */
+static const char* TimeProfileName(int profile) {
+    return (profile >= 0) ? g_time_profiles[profile].spec : "recorded";
+}
+
+/**
+ * @brief Finds the time profile in force at the current time of the week.
+ * @param minDelayS Receives the shortest wait to plan.
+ * @param maxDelayS Receives the longest wait to plan.
+ * @param pausedForMs Receives how long refreshes stay paused from now; 0 if they are not.
+ * @return Index of the profile, or -1 where min_delay and max_delay apply.
+ */
+static int LookUpTimeProfile(double *minDelayS, double *maxDelayS, DWORD *pausedForMs) {
+    *minDelayS = g_min_delay_seconds;
+    *maxDelayS = g_max_delay_seconds;
+    *pausedForMs = 0;
+    if (g_profile_transition_count == 0) return -1;
+
+    ULONGLONG nowMs = TimeProfileMsOfWeek();
+    int low = 0, high = g_profile_transition_count - 1;
+    while (low < high) { // Last transition at or before now; the first is at 0
+        int mid = (low + high + 1) / 2;
+        if ((ULONGLONG)g_profile_transitions[mid].startS * 1000 <= nowMs) low = mid; else high = mid - 1;
+    }
+    int profile = g_profile_transitions[low].profile;
+    if (profile < 0) return -1;
+    if (!g_time_profiles[profile].paused) {
+        *minDelayS = g_time_profiles[profile].minDelayS;
+        *maxDelayS = g_time_profiles[profile].maxDelayS;
+        return profile;
+    }
+    // Paused until the next transition to a profile that is not.
+    ULONGLONG weekMs = (ULONGLONG)SECONDS_PER_WEEK * 1000;
+    ULONGLONG untilMs = weekMs;
+    for (int step = 1; step <= g_profile_transition_count; ++step) {
+        const ProfileTransition *next = &g_profile_transitions[(low + step) % g_profile_transition_count];
+        if (next->profile >= 0 && g_time_profiles[next->profile].paused) continue;
+        untilMs = ((ULONGLONG)next->startS * 1000 + weekMs - nowMs) % weekMs;
+        if (untilMs == 0) untilMs = weekMs;
+        break;
+    }
+    *pausedForMs = (DWORD)untilMs;
+    return profile;
+}
+
+/**
+ * @brief Summarizes the waits planned under each time profile.
+ * @param buffer Receives the summary.
+ * @param bufferSize Size of the buffer.
+ * @return FALSE if no time profile is configured.
+ */
+static BOOL FormatTimeProfiles(char *buffer, size_t bufferSize) {
+    if (g_time_profile_count == 0) return FALSE;
+    size_t length = (size_t)snprintf(buffer, bufferSize, "%lu wait(s) at min_delay/max_delay", g_base_profile_waits);
+    for (int p = 0; p < g_time_profile_count && length < bufferSize; ++p) {
+        length += (size_t)snprintf(buffer + length, bufferSize - length, "; \"%s\": %lu %s", g_time_profiles[p].spec,
+                                   g_time_profiles[p].waits, g_time_profiles[p].paused ? "pause(s)" : "wait(s)");
+    }
+    return TRUE;
+}
+
+// === Focus Theft Budget Functions ===
+
+/** @brief Starts measuring focus theft afresh, with a full budget. */
+static void ResetFocusTheft(void) {
+    memset(&g_focus_theft, 0, sizeof(g_focus_theft));
+    g_focus_theft.startUs = UnrecordedNowUs();
+    g_focus_theft.refilledUs = g_focus_theft.startUs;
+    g_focus_theft.creditUs = (LONGLONG)g_focus_budget_ms * 1000;
+}
+
+/**
+ * @brief Closes the hours that have passed since the last measurement and logs each one's theft.
+ * @param nowUs Current time on the UnrecordedNowUs clock.
+ */
+static void RollFocusTheftHour(ULONGLONG nowUs) {
+    if (g_focus_theft.startUs == 0) ResetFocusTheft();
+    unsigned long hour = (unsigned long)((nowUs - g_focus_theft.startUs) / 3600000000ULL);
+    while (g_focus_theft.hour < hour) {
+        if (g_focus_theft.hourSwitches > 0 || g_focus_theft.hourPosted > 0 || g_focus_theft.hourDeferred > 0) {
+            LogInfo("Focus: Hour %lu: the foreground was taken for %.1fs in %lu switch(es); %lu refresh(es) posted and %lu deferred over budget.",
+                    g_focus_theft.hour + 1, (double)g_focus_theft.hourUs / 1e6, g_focus_theft.hourSwitches,
+                    g_focus_theft.hourPosted, g_focus_theft.hourDeferred);
+        }
+        if (g_focus_theft.hourUs > g_focus_theft.worstHourUs) g_focus_theft.worstHourUs = g_focus_theft.hourUs;
+        g_focus_theft.hourUs = 0;
+        g_focus_theft.hourSwitches = g_focus_theft.hourPosted = g_focus_theft.hourDeferred = 0;
+        g_focus_theft.hour++;
+    }
+}
+
+/**
+ * @brief Tops up the budget credit and tells whether it is used up.
+ * @return TRUE if a focus switch now would be over budget.
+ */
+static BOOL IsOverFocusBudget(void) {
+    if (g_focus_budget_ms == 0) return FALSE;
+    ULONGLONG nowUs = UnrecordedNowUs();
+    RollFocusTheftHour(nowUs);
+    LONGLONG capUs = (LONGLONG)g_focus_budget_ms * 1000;
+    g_focus_theft.creditUs += (LONGLONG)((nowUs - g_focus_theft.refilledUs) * g_focus_budget_ms / 60000);
+    if (g_focus_theft.creditUs > capUs) g_focus_theft.creditUs = capUs;
+    g_focus_theft.refilledUs = nowUs;
+    return g_focus_theft.creditUs <= 0;
+}
+
+/**
+ * @brief Puts a refresh over the focus budget in the focus queue until the credit is
+ * back. It gives up its page load slot meanwhile.
+ * @param t Target whose refresh is due.
+ */
+static void DeferForFocusBudget(RefreshTarget *t) {
+    ULONGLONG waitUs = (ULONGLONG)(-g_focus_theft.creditUs) * 60000 / g_focus_budget_ms + 1000;
+    if (!t->budgetDeferred) {
+        t->budgetDeferred = TRUE;
+        g_focus_theft.deferred++;
+        g_focus_theft.hourDeferred++;
+        LogDebug("Focus: Over the focus budget. HWND %p deferred by %.1fs.", (void*)t->hwnd, (double)waitUs / 1e6);
+        t->queuedAtUs = BackendNowUs();
+    }
+    TargetHot(t, state) = TARGET_FOCUS_QUEUED;
+    TargetHot(t, deadlineUs) = UnrecordedNowUs() + waitUs;
+    TargetHot(t, exactDeadline) = FALSE;
+    UpdateLoadQueue(t->processId); // The slot it held may let a queued refresh go
+}
+
+/**
+ * @brief Charges a finished focus switch's theft: from the moment the target took the
+ * foreground to the moment it moved on (the foreground event in a live run, or the end
+ * of the switch). Nothing is charged if the target was in front already, or no window was.
+ * @param t Target whose focus switch ends.
+ */
+static void RecordFocusTheft(RefreshTarget *t) {
+    if (t->theftStartUs == 0 || t->originalForeground == NULL) return;
+    ULONGLONG nowUs = UnrecordedNowUs();
+    ULONGLONG endUs = (t->theftEndUs != 0) ? t->theftEndUs : nowUs;
+    ULONGLONG theftUs = (endUs > t->theftStartUs) ? endUs - t->theftStartUs : 0;
+    t->theftStartUs = 0;
+    t->theftEndUs = 0;
+    RollFocusTheftHour(nowUs);
+    if (g_focus_budget_ms > 0) {
+        IsOverFocusBudget(); // Tops the credit up to now before charging
+        g_focus_theft.creditUs -= (LONGLONG)theftUs;
+    }
+    g_focus_theft.totalUs += theftUs;
+    g_focus_theft.hourUs += theftUs;
+    g_focus_theft.switches++;
+    g_focus_theft.hourSwitches++;
+    LogDebug("Focus: HWND %p held the foreground for %.0fms; %.0fms of budget left.", (void*)t->hwnd,
+             (double)theftUs / 1000.0, (double)g_focus_theft.creditUs / 1000.0);
+}
+
+/**
+ * @brief Summarizes the focus theft: total, per hour and against the budget. Closes
+ * the hours that have passed, so the current one is logged at exit as well.
+ * @param buffer Receives the summary.
+ * @param bufferSize Size of the buffer.
+ * @return FALSE if the foreground was never taken and no refresh was over budget.
+ */
+static BOOL FormatFocusTheft(char *buffer, size_t bufferSize) {
+    if (g_focus_theft.switches == 0 && g_focus_theft.posted == 0 && g_focus_theft.deferred == 0) return FALSE;
+    ULONGLONG nowUs = UnrecordedNowUs();
+    RollFocusTheftHour(nowUs);
+    double hours = (double)(nowUs - g_focus_theft.startUs) / 3600e6;
+    ULONGLONG worstHourUs = (g_focus_theft.hourUs > g_focus_theft.worstHourUs) ? g_focus_theft.hourUs : g_focus_theft.worstHourUs;
+    int length = snprintf(buffer, bufferSize, "%.1fs taken from the user's window in %lu switch(es) (%.0fms each), %.1fs per hour, %.1fs in the worst hour",
+                          (double)g_focus_theft.totalUs / 1e6, g_focus_theft.switches,
+                          g_focus_theft.switches > 0 ? (double)g_focus_theft.totalUs / 1000.0 / g_focus_theft.switches : 0.0,
+                          hours > 0.0 ? (double)g_focus_theft.totalUs / 1e6 / (hours < 1.0 ? 1.0 : hours) : 0.0,
+                          (double)worstHourUs / 1e6);
+    if (g_focus_budget_ms > 0 && length > 0 && (size_t)length < bufferSize) {
+        snprintf(buffer + length, bufferSize - (size_t)length, "; budget %lums a minute, %lu refresh(es) posted and %lu deferred over it",
+                 g_focus_budget_ms, g_focus_theft.posted, g_focus_theft.deferred);
+    }
+    return TRUE;
+}
+
+// === ETW Tracepoint Functions ===
+
+/** @brief Registers the tracepoint provider with ETW. Failure only disables the probes. */
+static void InitializeTracepoints(void) {
+    ULONG status = EventRegister(&TRACEPOINT_PROVIDER_GUID, TracepointEnableCallback, NULL, &g_tracepoint_provider);
+    if (status != ERROR_SUCCESS) {
+        LogWarning("Tracepoints: EventRegister failed. Error: %lu. Tracepoints disabled.", status);
+        g_tracepoint_provider = 0;
+    }
+}
+
+/** @brief Unregisters the tracepoint provider. */
+static void ShutdownTracepoints(void) {
+    if (g_tracepoint_provider != 0) {
+        EventUnregister(g_tracepoint_provider);
+        g_tracepoint_provider = 0;
+    }
+    g_tracepoints_enabled = 0;
+}
+
+/**
+ * @brief Called by ETW when a session enables or disables the provider.
+ * Caches the state so unattached probes cost a single flag check.
+ */
+static void NTAPI TracepointEnableCallback(LPCGUID sourceId, ULONG isEnabled, UCHAR level, ULONGLONG matchAnyKeyword,
+                                           ULONGLONG matchAllKeyword, PEVENT_FILTER_DESCRIPTOR filterData, PVOID callbackContext) {
+    (void)sourceId; (void)level; (void)matchAnyKeyword; (void)matchAllKeyword; (void)filterData; (void)callbackContext;
+    if (isEnabled == EVENT_CONTROL_CODE_ENABLE_PROVIDER) {
+        InterlockedExchange(&g_tracepoints_enabled, 1);
+    } else if (isEnabled == EVENT_CONTROL_CODE_DISABLE_PROVIDER) {
+        InterlockedExchange(&g_tracepoints_enabled, 0);
+    }
+}
+
+/**
+ * @brief Writes one probe as an ETW string event: "<probe> target=<id> <args>".
+ * Only called through TRACEPOINT(), i.e. when a session is listening.
+ * @param probe Probe name (e.g., "activate_attempt").
+ * @param targetId Target the probe refers to.
+ * @param format Format string for the key=value arguments.
+ */
+static void EmitTracepoint(const char *probe, int targetId, const char *format, ...) {
+    char text[MAX_TRACEPOINT_LENGTH];
+    WCHAR wideText[MAX_TRACEPOINT_LENGTH];
+    int length = snprintf(text, sizeof(text), "%s target=%d ", probe, targetId);
+    if (length < 0 || length >= (int)sizeof(text)) return;
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text + length, sizeof(text) - (size_t)length, format, args);
+    va_end(args);
+
+    if (MultiByteToWideChar(CP_ACP, 0, text, -1, wideText, MAX_TRACEPOINT_LENGTH) > 0) {
+        EventWriteString(g_tracepoint_provider, 0, 0, wideText);
+    }
+}
+
+/**
+ * @brief Current time for probe arguments; 0 without reading the clock when nobody listens.
+ * @return Microseconds from the UnrecordedNowUs clock, or 0.
+ */
+static ULONGLONG TracepointNowUs(void) {
+    return g_tracepoints_enabled ? UnrecordedNowUs() : 0;
+}
+
+/**
+ * @brief Microseconds since the current refresh started (its deadline was reached).
+ * Returns 0 without reading the clock when nobody listens, or when no refresh has started.
+ * @return Elapsed time in microseconds for probe arguments.
+ */
+static ULONGLONG TracepointElapsedUs(void) {
+    if (!g_tracepoints_enabled || g_tracepoint_cycle_start_us == 0) return 0;
+    ULONGLONG nowUs = UnrecordedNowUs();
+    return (nowUs >= g_tracepoint_cycle_start_us) ? nowUs - g_tracepoint_cycle_start_us : 0;
+}
+
+// === Trace Event Functions ===
+
+/**
+ * @brief Opens the trace file named by trace_file and writes the track names.
+ * @param targetTitle Title of the target window, used to label its track.
+ * @return TRUE if tracing is enabled, FALSE if disabled or the file could not be opened.
+ */
+static BOOL InitializeTracing(const char *targetTitle) {
+    if (g_trace_file_path[0] == '\0') return FALSE;
+
+    g_trace_file = fopen(g_trace_file_path, "w");
+    if (g_trace_file == NULL) {
+        ConsolePrintf("Warning: Could not open trace file '%s'. Tracing disabled.\n", g_trace_file_path);
+        LogWarning("Trace: Failed to open '%s'. Tracing disabled.", g_trace_file_path);
+        return FALSE;
+    }
+
+    // JSON array format; viewers accept a missing closing bracket if the process is killed.
+    fprintf(g_trace_file, "[\n");
+    fprintf(g_trace_file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Window Refresher\"}},\n", TRACE_TRACK_SCHEDULER);
+    fprintf(g_trace_file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Scheduler\"}}", TRACE_TRACK_SCHEDULER);
+    g_trace_first_record = FALSE;
+    g_trace_event_count = 0;
+    g_trace_dropped_events = 0;
+    g_trace_last_flush_us = UnrecordedNowUs();
+    g_trace_enabled = TRUE;
+    TraceNameTrack(TRACE_TRACK_TARGET, targetTitle);
+    LogInfo("Trace: Writing trace events to '%s'.", g_trace_file_path);
+    return TRUE;
+}
+
+/**
+ * @brief Names a target's trace track after its window title.
+ * Each refresh target has its own track (TRACE_TRACK_TARGET + index).
+ * @param track Track to name.
+ * @param targetTitle Title of the target window.
+ */
+static void TraceNameTrack(int track, const char *targetTitle) {
+    if (!g_trace_enabled) return;
+    fprintf(g_trace_file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Target: ", track);
+    WriteJsonEscaped(g_trace_file, (targetTitle != NULL && targetTitle[0] != '\0') ? targetTitle : "No Title");
+    fprintf(g_trace_file, "\"}}");
+}
+
+/** @brief Writes any buffered events, closes the JSON array and the trace file. */
+static void ShutdownTracing(void) {
+    if (!g_trace_enabled) return;
+    FlushTraceEvents(TRUE);
+    fprintf(g_trace_file, "\n]\n");
+    fclose(g_trace_file);
+    g_trace_file = NULL;
+    g_trace_enabled = FALSE;
+    if (g_trace_dropped_events > 0) {
+        LogWarning("Trace: %lu events were dropped because the buffer was full.", g_trace_dropped_events);
+    }
+}
+
+/**
+ * @brief Returns the start timestamp for a span, or 0 when tracing is off.
+ * @return Current time in microseconds, or 0.
+ */
+static ULONGLONG TraceBegin(void) {
+    return g_trace_enabled ? UnrecordedNowUs() : 0;
+}
+
+/**
+ * @brief Records a complete span ("X" event) from startUs until now.
+ * @param name Span name (string literal).
+ * @param track Track (rendered as thread id) the span belongs to.
+ * @param startUs Timestamp returned by TraceBegin().
+ * @param argName Name of an optional numeric argument, or NULL.
+ * @param argValue Value of the optional argument.
+ */
+static void TraceSpan(const char *name, int track, ULONGLONG startUs, const char *argName, long argValue) {
+    if (!g_trace_enabled) return;
+    if (g_trace_event_count >= TRACE_BUFFER_EVENTS) {
+        g_trace_dropped_events++;
+        return;
+    }
+    ULONGLONG nowUs = UnrecordedNowUs();
+    TraceEvent *event = &g_trace_events[g_trace_event_count++];
+    event->name = name;
+    event->phase = 'X';
+    event->track = track;
+    event->startUs = startUs;
+    event->durationUs = (nowUs > startUs) ? nowUs - startUs : 0;
+    event->argName = argName;
+    event->argValue = argValue;
+}
+
+/**
+ * @brief Records an instant event ("i" event), used for skips and failures.
+ * @param name Event name (string literal).
+ * @param track Track the event belongs to.
+ */
+static void TraceInstant(const char *name, int track) {
+    if (!g_trace_enabled) return;
+    if (g_trace_event_count >= TRACE_BUFFER_EVENTS) {
+        g_trace_dropped_events++;
+        return;
+    }
+    TraceEvent *event = &g_trace_events[g_trace_event_count++];
+    event->name = name;
+    event->phase = 'i';
+    event->track = track;
+    event->startUs = UnrecordedNowUs();
+    event->durationUs = 0;
+    event->argName = NULL;
+    event->argValue = 0;
+}
+
+/**
+ * @brief Writes buffered events to the trace file.
+ * Called between cycles; only does I/O once the buffer is half full or a minute has passed.
+ * @param force Write regardless of buffer fill and time.
+ */
+static void FlushTraceEvents(BOOL force) {
+    if (!g_trace_enabled || g_trace_event_count == 0) return;
+    ULONGLONG nowUs = UnrecordedNowUs();
+    if (!force && g_trace_event_count < TRACE_FLUSH_THRESHOLD &&
+        nowUs - g_trace_last_flush_us < TRACE_FLUSH_INTERVAL_US) {
+        return;
+    }
+
+    for (int i = 0; i < g_trace_event_count; ++i) {
+        const TraceEvent *event = &g_trace_events[i];
+        fprintf(g_trace_file, "%s{\"name\":\"%s\",\"cat\":\"refresh\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%llu",
+                g_trace_first_record ? "" : ",\n", event->name, event->phase, event->track, event->startUs);
+        if (event->phase == 'X') {
+            fprintf(g_trace_file, ",\"dur\":%llu", event->durationUs);
+        } else {
+            fprintf(g_trace_file, ",\"s\":\"t\"");
+        }
+        if (event->argName != NULL) {
+            fprintf(g_trace_file, ",\"args\":{\"%s\":%ld}", event->argName, event->argValue);
+        }
+        fprintf(g_trace_file, "}");
+        g_trace_first_record = FALSE;
+    }
+    fflush(g_trace_file);
+    g_trace_event_count = 0;
+    g_trace_last_flush_us = nowUs;
+}
+
+/**
+ * @brief Writes a string as the body of a JSON string literal (without quotes).
+ * @param file Destination file.
+ * @param text Text to escape.
+ */
+static void WriteJsonEscaped(FILE *file, const char *text) {
+    for (const unsigned char *c = (const unsigned char*)text; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+}
+
+// === Utility Functions ===
+
+/**
+ * @brief Prints a status line to the console. Called through ConsolePrintf.
+ * Used for everything printed once the windows are selected, so console = quiet
+ * silences it and console writes show up in the API call accounting.
+ * @param site Calling function, for the accounting.
+ * @param format Format string for the message.
+ */
+static void ConsolePrintfAt(const char *site, const char *format, ...) {
+    if (!g_console_output_enabled) return;
+    if (!g_status_view.active && g_console_mode == CONSOLE_QUIET && !g_console_startup) return;
+    char line[MAX_CONSOLE_LINE_LENGTH];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length < 0) return;
+    if ((size_t)length >= sizeof(line)) length = (int)sizeof(line) - 1;
+
+    if (g_status_view.active) {
+        // Shown on the table's last line at the next redraw instead of scrolling the table away.
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) line[--length] = '\0';
+        memcpy(g_status_view.lastEvent, line, (size_t)length + 1);
+        return;
+    }
+    ConsoleWriteAt(site, line, (size_t)length);
+}
+
+/**
+ * @brief Writes text to the console buffer and accounts for the time the write took.
+ * Called through ConsoleWrite. The text goes out at the next ConsoleFlush, before the
+ * program waits, so the lines of one step share a flush.
+ * @param site Calling function, for the accounting.
+ * @param text Text to write.
+ * @param length Number of bytes.
+ */
+static void ConsoleWriteAt(const char *site, const char *text, size_t length) {
+    ULONGLONG startUs = Win32NowUs(); // Wall time, not the backend clock: this is a cost measurement
+    fwrite(text, 1, length, stdout);
+    g_console_stats.totalUs += Win32NowUs() - startUs;
+    g_console_stats.writes++;
+    g_console_stats.bytes += length;
+    g_console_stats.unflushed = TRUE;
+    COUNT_API_CALL_AT(API_CONSOLE_WRITE, site);
+}
+
+/** @brief Pushes buffered console writes out, accounting for the time it takes. */
+static void ConsoleFlush(void) {
+    if (!g_console_stats.unflushed) return;
+    ULONGLONG startUs = Win32NowUs();
+    fflush(stdout);
+    g_console_stats.totalUs += Win32NowUs() - startUs;
+    g_console_stats.unflushed = FALSE;
+}
+
+/**
+ * @brief Generates a random delay in seconds between a specified min and max.
+ * Uses the backend's random source (CryptGenRandom on Win32), falls back to rand().
+ * @param min_s Minimum delay in seconds.
+ * @param max_s Maximum delay in seconds.
+ * @return Random delay in seconds.
+ */
+static double GetRandomDelaySeconds(double min_s, double max_s) {
+    if (min_s >= max_s) {
+        LogDebug("GetRandomDelay: min_s (%.2f) >= max_s (%.2f). Returning min_s.", min_s, max_s);
+        return min_s;
+    }
+
+    unsigned int random_value;
+    if (!BackendGenRandom(&random_value)) {
+        random_value = rand(); // Fallback
+    }
+
+    double scale = (double)random_value / (double)UINT_MAX;
+    return min_s + scale * (max_s - min_s);
+}
+
+/**
+ * @brief Pauses execution for a specified number of milliseconds, with no tolerance.
+ * Used while the target holds the foreground, where every extra millisecond is visible.
+ * @param milliseconds Duration to wait.
+ */
+static void WaitMilliseconds(DWORD milliseconds) {
+    if (milliseconds > 0) {
+        BackendSleep(milliseconds, 0);
+    }
+}
+
+/**
+ * @brief Pauses execution for an idle wait that the OS may defer to coalesce wakeups.
+ * The tolerable delay is timer_tolerance_pct of the wait, capped at MAX_TIMER_TOLERANCE_MS.
+ * @param milliseconds Duration to wait.
+ */
+static void WaitCoalesced(DWORD milliseconds) {
+    if (milliseconds > 0) {
+        DWORD toleranceMs = (DWORD)(((ULONGLONG)milliseconds * (ULONGLONG)g_timer_tolerance_pct) / 100);
+        if (toleranceMs > MAX_TIMER_TOLERANCE_MS) toleranceMs = MAX_TIMER_TOLERANCE_MS;
+        BackendSleep(milliseconds, toleranceMs);
+    }
+}
+
+/**
+ * @brief Creates the waitable timer used by the Win32 backend for all waits.
+ * @return TRUE on success, FALSE if the timer could not be created (waits use the message wait timeout instead).
+ */
+static BOOL InitializeWaitTimer(void) {
+    g_hWaitTimer = CreateWaitableTimer(NULL, FALSE, NULL);
+    g_wakeup_window_start_ms = GetTickCount64();
+    g_wakeup_count = 0;
+    return g_hWaitTimer != NULL;
+}
+
+/** @brief Closes the waitable timer. */
+static void ShutdownWaitTimer(void) {
+    if (g_hWaitTimer != NULL) {
+        CloseHandle(g_hWaitTimer);
+        g_hWaitTimer = NULL;
+    }
+}
+
+/**
+ * @brief Logs the number of wakeups per hour, once per WAKEUP_REPORT_INTERVAL_MS.
+ * @param force Log immediately regardless of the interval (e.g., at shutdown).
+ */
+static void ReportWakeupRate(BOOL force) {
+    ULONGLONG elapsedMs = GetTickCount64() - g_wakeup_window_start_ms;
+    if (!force && elapsedMs < WAKEUP_REPORT_INTERVAL_MS) return;
+    if (elapsedMs == 0) return;
+
+    double perHour = (double)g_wakeup_count * 3600000.0 / (double)elapsedMs;
+    LogInfo("Wakeups: %lu in %.1f minutes (%.1f per hour, timer tolerance %d%%).",
+            g_wakeup_count, (double)elapsedMs / 60000.0, perHour, g_timer_tolerance_pct);
+    g_wakeup_window_start_ms += elapsedMs;
+    g_wakeup_count = 0;
+}
+
+/**
+ * @brief Checks if either Alt key is currently held down.
+ * @return TRUE if an Alt key is pressed, FALSE otherwise.
  */
 static BOOL IsAltKeyHeld(void) {
+    // VK_MENU is down while either Alt key is, so one call covers VK_LMENU and VK_RMENU.
     // Check high-order bit (0x8000) for current pressed state
-    return (GetAsyncKeyState(VK_MENU) & 0x8000) ||
-           (GetAsyncKeyState(VK_LMENU) & 0x8000) ||
-           (GetAsyncKeyState(VK_RMENU) & 0x8000);
+    return (BackendGetAsyncKeyState(VK_MENU) & 0x8000) != 0;
+}
+
+// === Win32 Backend ===
+
+static BOOL  Win32IsWindow(HWND hWnd) { return IsWindow(hWnd); }
+static int   Win32GetWindowText(HWND hWnd, char *buffer, int bufferSize) { return GetWindowText(hWnd, buffer, bufferSize); }
+static HWND  Win32GetForegroundWindow(void) { return GetForegroundWindow(); }
+static BOOL  Win32SetForegroundWindow(HWND hWnd) { return SetForegroundWindow(hWnd); }
+static BOOL  Win32IsIconic(HWND hWnd) { return IsIconic(hWnd); }
+// Asynchronous: ShowWindow on another thread's window waits until that thread has handled
+// the resulting messages. Every caller pauses before it activates or checks the window.
+static BOOL  Win32ShowWindow(HWND hWnd, int nCmdShow) { return ShowWindowAsync(hWnd, nCmdShow); }
+static DWORD Win32GetWindowThreadId(HWND hWnd) { return GetWindowThreadProcessId(hWnd, NULL); }
+static BOOL  Win32AttachThreadInput(DWORD idAttach, DWORD idAttachTo, BOOL fAttach) { return AttachThreadInput(idAttach, idAttachTo, fAttach); }
+static UINT  Win32SendInput(UINT count, INPUT *inputs) { return SendInput(count, inputs, sizeof(INPUT)); }
+static SHORT Win32GetAsyncKeyState(int vKey) { return GetAsyncKeyState(vKey); }
+static BOOL  Win32PostMessage(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) { return PostMessage(hWnd, msg, wParam, lParam); }
+
+/**
+ * @brief Waits in the reactor, declaring how late the wakeup may be.
+ * Only the scheduler's deadline wait ends early when an event handler sets
+ * g_reactor_wake; every other wait lasts its full duration, with the wake kept for
+ * the scheduler.
+ * @param milliseconds Duration to wait.
+ * @param toleranceMs How much later than the deadline the wakeup may occur.
+ */
+static void Win32Sleep(DWORD milliseconds, DWORD toleranceMs) {
+    if (g_wait_interruptible || milliseconds == INFINITE) {
+        ReactorWait(milliseconds, toleranceMs);
+        return;
+    }
+    // Reactor events are handled meanwhile, but the wait lasts the full duration.
+    ULONGLONG endMs = GetTickCount64() + milliseconds;
+    while (!ReactorWait(milliseconds, toleranceMs)) {
+        ULONGLONG nowMs = GetTickCount64();
+        if (nowMs >= endMs) break;
+        milliseconds = (DWORD)(endMs - nowMs);
+    }
+}
+
+/**
+ * @brief Fills value with random bits from the cached CryptoAPI provider.
+ * @param value Receives the random value.
+ * @return TRUE on success, FALSE if no provider is available or generation failed.
+ */
+static BOOL Win32GenRandom(unsigned int *value) {
+    if (g_hCryptProv == 0) return FALSE;
+    if (!CryptGenRandom(g_hCryptProv, sizeof(*value), (BYTE*)value)) {
+        LogError("GetRandomDelay: CryptGenRandom failed. Error: %lu. Falling back to rand().", GetLastError());
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Returns a monotonic timestamp in microseconds from the performance counter.
+ * @return Microseconds since an arbitrary fixed point.
+ */
+static ULONGLONG Win32NowUs(void) {
+    static LONGLONG frequency = 0;
+    LARGE_INTEGER counter;
+    if (frequency == 0) {
+        LARGE_INTEGER freq;
+        if (!QueryPerformanceFrequency(&freq) || freq.QuadPart == 0) return GetTickCount64() * 1000;
+        frequency = freq.QuadPart;
+    }
+    QueryPerformanceCounter(&counter);
+    return (ULONGLONG)(counter.QuadPart / frequency) * 1000000ULL +
+           (ULONGLONG)(counter.QuadPart % frequency) * 1000000ULL / (ULONGLONG)frequency;
+}
+
+// === Simulated Backend ===
+// A deterministic desktop with one target window and one "user" window. Focus
+// switches always succeed and Sleep advances a virtual clock instead of blocking,
+// unless the soak test has armed a fault for the current cycle. With several focus
+// domains each is a separate display with its own foreground window.
+
+/** @brief Resets the simulated desktop to its initial state (user window in front). */
+static void ResetSimulatedDesktop(void) {
+    memset(&g_sim, 0, sizeof(g_sim));
+    g_sim.foreground = SIM_USER_HWND;
+    for (int domain = 0; domain < MAX_FOCUS_DOMAINS; ++domain) g_sim.domainForeground[domain] = SIM_USER_HWND;
+    g_sim.targetExists = TRUE;
+    g_sim.clockMs = 0;
+    g_sim.rngState = 0x2545F491u;
+}
+
+/** @brief Makes the foreground that of the display the stepped target's focus domain is on. */
+static void SimSelectDomain(void) {
+    if (g_step_domain == g_sim.domain) return;
+    g_sim.domainForeground[g_sim.domain] = g_sim.foreground;
+    g_sim.domain = g_step_domain;
+    g_sim.foreground = g_sim.domainForeground[g_sim.domain];
+}
+
+static BOOL SimIsWindow(HWND hWnd) {
+    return (hWnd == SIM_TARGET_HWND && g_sim.targetExists) || hWnd == SIM_USER_HWND;
+}
+
+static int SimGetWindowText(HWND hWnd, char *buffer, int bufferSize) {
+    const char *title = (hWnd == SIM_TARGET_HWND) ? "Simulated Target" : "Simulated User Window";
+    if (!SimIsWindow(hWnd) || bufferSize <= 0) return 0;
+    snprintf(buffer, (size_t)bufferSize, "%s", title);
+    return (int)strlen(buffer);
+}
+
+/** @brief Draws from the focus model's random stream (xorshift32), separate from the delay RNG. */
+static double SimModelUniform(void) {
+    unsigned int x = g_sim.modelRngState;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    g_sim.modelRngState = x;
+    return ((double)x + 0.5) / 4294967296.0;
+}
+
+/** @brief Draws one lateness sample from the focus model, in ms. */
+static ULONGLONG SimModelLatenessMs(void) {
+    const FocusModel *model = g_sim.focusModel;
+    if (model->latenessCount == 0) return 0;
+    return model->latenessMs[(int)(SimModelUniform() * model->latenessCount) % model->latenessCount];
+}
+
+/** @brief Moves the target out of the foreground, adding to its hold time. */
+static void SimEndForegroundHold(HWND newForeground, ULONGLONG atMs) {
+    if (g_sim.foreground == SIM_TARGET_HWND && atMs >= g_sim.foregroundSinceMs) {
+        g_sim.foregroundHoldMs += atMs - g_sim.foregroundSinceMs;
+    }
+    g_sim.foreground = newForeground;
+}
+
+/** @brief Applies the focus model's pending activation and focus loss up to the current time. */
+static void SimAdvanceFocusModel(void) {
+    const FocusModel *model = g_sim.focusModel;
+    if (model == NULL) return;
+    if (g_sim.pendingForegroundMs != 0 && g_sim.clockMs >= g_sim.pendingForegroundMs) {
+        ULONGLONG arrivedMs = g_sim.pendingForegroundMs;
+        g_sim.pendingForegroundMs = 0;
+        g_sim.foreground = SIM_TARGET_HWND;
+        g_sim.foregroundSinceMs = arrivedMs;
+        g_sim.inputReadyMs = arrivedMs + SimModelLatenessMs();
+        g_sim.focusLossMs = (model->focusLossPerMs > 0.0)
+            ? arrivedMs + (ULONGLONG)(-log(SimModelUniform()) / model->focusLossPerMs) : ULLONG_MAX;
+    }
+    if (g_sim.foreground == SIM_TARGET_HWND && g_sim.clockMs >= g_sim.focusLossMs) {
+        SimEndForegroundHold(SIM_USER_HWND, g_sim.focusLossMs);
+    }
+}
+
+static HWND SimGetForegroundWindow(void) {
+    SimSelectDomain();
+    SimAdvanceFocusModel();
+    return g_sim.foreground;
+}
+
+static BOOL SimSetForegroundWindow(HWND hWnd) {
+    if (!SimIsWindow(hWnd)) return FALSE;
+    SimSelectDomain();
+    if (g_sim.focusModel != NULL) {
+        SimAdvanceFocusModel();
+        if (hWnd == SIM_TARGET_HWND) {
+            // Activation takes effect after a random delay; repeated requests do not restart it.
+            if (g_sim.foreground != SIM_TARGET_HWND && g_sim.pendingForegroundMs == 0) {
+                g_sim.pendingForegroundMs = g_sim.clockMs + 1 +
+                    (ULONGLONG)(-log(SimModelUniform()) * g_sim.focusModel->activationMeanMs);
+            }
+        } else {
+            g_sim.pendingForegroundMs = 0;
+            SimEndForegroundHold(hWnd, g_sim.clockMs);
+        }
+        return TRUE;
+    }
+    if (hWnd == SIM_TARGET_HWND && g_sim.fault == SIM_FAULT_DESTROY_ON_ACTIVATE) {
+        g_sim.targetExists = FALSE;
+        return FALSE;
+    }
+    if (hWnd == SIM_TARGET_HWND && g_sim.fault == SIM_FAULT_HUNG_TARGET) return FALSE;
+    g_sim.foreground = hWnd;
+    return TRUE;
+}
+
+static BOOL SimIsIconic(HWND hWnd) { (void)hWnd; return FALSE; }
+static BOOL SimShowWindow(HWND hWnd, int nCmdShow) { (void)nCmdShow; return SimIsWindow(hWnd); }
+
+static DWORD SimGetWindowThreadId(HWND hWnd) {
+    if (hWnd == SIM_TARGET_HWND && g_sim.targetExists) return SIM_TARGET_THREAD_ID;
+    if (hWnd == SIM_USER_HWND) return SIM_USER_THREAD_ID;
+    return 0;
+}
+
+static BOOL SimAttachThreadInput(DWORD idAttach, DWORD idAttachTo, BOOL fAttach) {
+    (void)idAttach;
+    if (idAttachTo == 0) return FALSE;
+    if (fAttach && idAttachTo == SIM_TARGET_THREAD_ID && g_sim.fault == SIM_FAULT_HUNG_TARGET) {
+        g_sim.clockMs += SIM_HUNG_TARGET_BLOCK_MS;
+        return FALSE;
+    }
+    g_sim.attachedInputs += fAttach ? 1 : -1;
+    return TRUE;
+}
+
+static UINT SimSendInput(UINT count, INPUT *inputs) {
+    SimSelectDomain();
+    SimAdvanceFocusModel();
+    if (g_sim.foreground == SIM_TARGET_HWND && g_sim.targetExists && g_sim.clockMs >= g_sim.inputReadyMs) {
+        g_sim.deliveredInjections++;
+    }
+    if (g_sim.fault == SIM_FAULT_PARTIAL_INPUT) {
+        UINT inserted = 0;
+        while (inserted < count && !(inputs[inserted].ki.dwFlags & KEYEVENTF_KEYUP)) inserted++;
+        count = inserted;
+        g_sim.fault = SIM_FAULT_NONE; // Only the first batch of the cycle is cut short
+    }
+    for (UINT i = 0; i < count; ++i) {
+        g_sim.injectedKeyDown[inputs[i].ki.wVk & 0xFF] = !(inputs[i].ki.dwFlags & KEYEVENTF_KEYUP);
+    }
+    if (g_sim.foreground != SIM_TARGET_HWND || !g_sim.targetExists) g_sim.misdirectedInjections++;
+    if (g_sim.fault == SIM_FAULT_USER_TYPING) g_sim.injectionsWhileTyping++;
+    g_sim.injections++;
+    g_sim.lastInjectMs = g_sim.clockMs;
+    return count;
+}
+
+static SHORT SimGetAsyncKeyState(int vKey) {
+    if (g_sim.fault == SIM_FAULT_USER_TYPING && (vKey == VK_MENU || vKey == VK_LMENU)) return (SHORT)0x8000;
+    return g_sim.injectedKeyDown[vKey & 0xFF] ? (SHORT)0x8000 : 0;
+}
+
+static BOOL SimPostMessage(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    (void)wParam; (void)lParam;
+    if (!SimIsWindow(hWnd)) return FALSE;
+    if (msg == WM_KEYDOWN) {
+        if (g_sim.fault == SIM_FAULT_USER_TYPING) g_sim.injectionsWhileTyping++;
+        g_sim.injections++;
+        g_sim.lastInjectMs = g_sim.clockMs;
+    }
+    return TRUE;
+}
+
+static BOOL SimGenRandom(unsigned int *value) {
+    // xorshift32: deterministic so simulated runs are reproducible
+    unsigned int x = g_sim.rngState;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    g_sim.rngState = x;
+    *value = x;
+    return TRUE;
+}
+
+static void SimSleep(DWORD milliseconds, DWORD toleranceMs) {
+    ConsoleFlush();
+    if (g_sim.triggerEveryMs != 0 && g_scheduled_table != NULL && g_sim.clockMs + milliseconds >= g_sim.nextTriggerMs) {
+        // The event ends the wait early, as the reactor does in a live run.
+        if (g_sim.nextTriggerMs > g_sim.clockMs) g_sim.clockMs = g_sim.nextTriggerMs;
+        g_sim.nextTriggerMs += g_sim.triggerEveryMs;
+        TriggerTargets(0);
+        g_reactor_wake = TRUE; // The scheduler looks at its deadlines again before stepping
+        return;
+    }
+    g_sim.clockMs += milliseconds;
+    if (g_sim.focusModel != NULL) {
+        if (toleranceMs == 0) g_sim.clockMs += SimModelLatenessMs();
+        SimAdvanceFocusModel();
+    }
+    if (g_sim.sleepsThisCycle++ == 0) {
+        g_sim.wakeMs = g_sim.clockMs;
+        if (g_sim.fault == SIM_FAULT_CLOCK_JUMP) {
+            // The wait ended on time; the refresher runs on after the machine resumes.
+            g_sim.clockMs += SOAK_CLOCK_JUMP_MS;
+            g_sim.suspendedMs += SOAK_CLOCK_JUMP_MS;
+        }
+    }
+    // The second wait with the target in front is the settle pause after activation.
+    if (g_sim.foreground == SIM_TARGET_HWND && ++g_sim.sleepsWithTargetInFront == 2 &&
+        g_sim.fault == SIM_FAULT_STEAL_DURING_SETTLE) {
+        g_sim.foreground = SIM_USER_HWND;
+    }
+}
+static ULONGLONG SimNowUs(void) { return g_sim.clockMs * 1000; }
+
+// === Journal Backend ===
+// Wraps the backend in use and appends one JournalRecord per call. Only the start of
+// each call is timestamped (sleeps also their end), so recording adds one clock read
+// and a buffered 16-byte write per call.
+
+/** @brief Saturates a microsecond interval to the 32 bits stored in a record. */
+static unsigned int JournalSaturateUs(ULONGLONG us) {
+    return us > 0xFFFFFFFFULL ? 0xFFFFFFFFu : (unsigned int)us;
+}
+
+/**
+ * @brief Appends one record to the journal.
+ * @param op Operation.
+ * @param arg Behaviour-selecting argument.
+ * @param startUs When the call started, on the recorded backend's clock.
+ * @param value Result of the call.
+ */
+static void JournalWrite(JournalOp op, unsigned short arg, ULONGLONG startUs, unsigned long long value) {
+    JournalRecord record;
+    record.op = (unsigned char)op;
+    record.reserved = 0;
+    record.arg = arg;
+    record.deltaUs = JournalSaturateUs(startUs >= g_journal_last_us ? startUs - g_journal_last_us : 0);
+    record.value = value;
+    g_journal_last_us = startUs;
+    if (fwrite(&record, sizeof(record), 1, g_journal_file) == 1) g_journal_record_count++;
+}
+
+static BOOL JournalIsWindow(HWND hWnd) {
+    ULONGLONG startUs = g_journal_inner->nowUs();
+    BOOL result = g_journal_inner->isWindow(hWnd);
+    JournalWrite(JOURNAL_OP_IS_WINDOW, hWnd == g_journal_target, startUs, (unsigned long long)result);
+    return result;
+}
+
+static int JournalGetWindowText(HWND hWnd, char *buffer, int bufferSize) {
+    ULONGLONG startUs = g_journal_inner->nowUs();
+    int result = g_journal_inner->getWindowText(hWnd, buffer, bufferSize);
+    JournalWrite(JOURNAL_OP_GET_WINDOW_TEXT, hWnd == g_journal_target, startUs, (unsigned long long)result);
+    return result;
+}
+
+static HWND JournalGetForegroundWindow(void) {
+    ULONGLONG startUs = g_journal_inner->nowUs();
+    HWND result = g_journal_inner->getForegroundWindow();
+    JournalWrite(JOURNAL_OP_GET_FOREGROUND, result == g_journal_target, startUs, (unsigned long long)(ULONG_PTR)result);
+    return result;
+}
+
+static BOOL JournalSetForegroundWindow(HWND hWnd) {
+    ULONGLONG startUs = g_journal_inner->nowUs();
+    BOOL result = g_journal_inner->setForegroundWindow(hWnd);
+    JournalWrite(JOURNAL_OP_SET_FOREGROUND, hWnd == g_journal_target, startUs, (unsigned long long)result);
+    return result;
+}
+
+static BOOL JournalIsIconic(HWND hWnd) {
+    ULONGLONG startUs = g_journal_inner->nowUs();
+    BOOL result = g_journal_inner->isIconic(hWnd);
+    JournalWrite(JOURNAL_OP_IS_ICONIC, hWnd == g_journal_target, startUs, (unsigned long long)result);
+    return result;
+}
+
+static BOOL JournalShowWindow(HWND hWnd, int nCmdShow) {
+    ULONGLONG startUs = g_journal_inner->nowUs();
+    BOOL result = g_journal_inner->showWindow(hWnd, nCmdShow);
+    JournalWrite(JOURNAL_OP_SHOW_WINDOW, (unsigned short)nCmdShow, startUs, (unsigned long long)result);
+    return result;
+}
+
+static DWORD JournalGetWindowThreadId(HWND hWnd) {
+    ULONGLONG startUs = g_journal_inner->nowUs();
+    DWORD result = g_journal_inner->getWindowThreadId(hWnd);
+    JournalWrite(JOURNAL_OP_GET_THREAD_ID, hWnd == g_journal_target, startUs, (unsigned long long)result);
+    return result;
+}
+
+static BOOL JournalAttachThreadInput(DWORD idAttach, DWORD idAttachTo, BOOL fAttach) {
+    ULONGLONG startUs = g_journal_inner->nowUs();
+    BOOL result = g_journal_inner->attachThreadInput(idAttach, idAttachTo, fAttach);
+    JournalWrite(JOURNAL_OP_ATTACH_INPUT, (unsigned short)(fAttach != FALSE), startUs, (unsigned long long)result);
+    return result;
+}
+
+static UINT JournalSendInput(UINT count, INPUT *inputs) {
+    ULONGLONG startUs = g_journal_inner->nowUs();
+    UINT result = g_journal_inner->sendInput(count, inputs);
+    JournalWrite(JOURNAL_OP_SEND_INPUT, (unsigned short)count, startUs, (unsigned long long)result);
+    return result;
+}
+
+static SHORT JournalGetAsyncKeyState(int vKey) {
+    ULONGLONG startUs = g_journal_inner->nowUs();
+    SHORT result = g_journal_inner->getAsyncKeyState(vKey);
+    JournalWrite(JOURNAL_OP_GET_KEY_STATE, (unsigned short)vKey, startUs, (unsigned long long)(unsigned short)result);
+    return result;
+}
+
+static BOOL JournalPostMessage(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    ULONGLONG startUs = g_journal_inner->nowUs();
+    BOOL result = g_journal_inner->postMessage(hWnd, msg, wParam, lParam);
+    JournalWrite(JOURNAL_OP_POST_MESSAGE, (unsigned short)msg, startUs, (unsigned long long)result);
+    return result;
+}
+
+static BOOL JournalGenRandom(unsigned int *value) {
+    ULONGLONG startUs = g_journal_inner->nowUs();
+    BOOL result = g_journal_inner->genRandom(value);
+    JournalWrite(JOURNAL_OP_GEN_RANDOM, 0, startUs, ((unsigned long long)(result != FALSE) << 32) | (result ? *value : 0));
+    return result;
+}
+
+static void JournalSleep(DWORD milliseconds, DWORD toleranceMs) {
+    ULONGLONG startUs = g_journal_inner->nowUs();
+    g_journal_inner->sleep(milliseconds, toleranceMs);
+    ULONGLONG endUs = g_journal_inner->nowUs();
+    JournalWrite(JOURNAL_OP_SLEEP, 0, startUs, ((unsigned long long)JournalSaturateUs(endUs - startUs) << 32) | milliseconds);
+    g_journal_last_us = endUs; // The next delta starts after the sleep
+}
+
+static ULONGLONG JournalNowUs(void) {
+    ULONGLONG nowUs = g_journal_inner->nowUs();
+    JournalWrite(JOURNAL_OP_NOW, 0, nowUs, 0);
+    return nowUs;
+}
+
+/**
+ * @brief Opens the journal and routes all backend calls through the recorder.
+ * @param path Journal file to create.
+ * @param targetHwnd Target window; calls on it are marked in the records.
+ * @return TRUE if recording started, FALSE if the file could not be created.
+ */
+static BOOL StartJournal(const char *path, HWND targetHwnd) {
+    g_journal_file = fopen(path, "wb");
+    if (g_journal_file == NULL) {
+        LogError("Journal: Failed to open '%s' for writing.", path);
+        return FALSE;
+    }
+    JournalHeader header = { { 'R', 'F', 'J', '1' }, JOURNAL_VERSION, (unsigned long long)(ULONG_PTR)targetHwnd };
+    fwrite(&header, sizeof(header), 1, g_journal_file);
+    g_journal_inner = g_backend;
+    g_journal_target = targetHwnd;
+    g_journal_last_us = g_journal_inner->nowUs();
+    g_journal_record_count = 0;
+    g_backend = &JOURNAL_BACKEND;
+    ConsolePrintf("Info: Recording backend calls to journal '%s'.\n", path);
+    LogInfo("Journal: Recording %s backend calls to '%s'.", g_journal_inner->name, path);
+    return TRUE;
+}
+
+/**
+ * @brief Writes the marker that starts a refresh cycle; replay resynchronizes on these.
+ * @param cycle Cycle number.
+ * @param catchUp TRUE if the cycle is a catch-up refresh without a wait.
+ */
+static void JournalMarkCycle(int cycle, BOOL catchUp) {
+    if (g_journal_file == NULL) return;
+    JournalWrite(JOURNAL_OP_CYCLE, (unsigned short)(catchUp != FALSE), g_journal_inner->nowUs(), (unsigned long long)cycle);
+}
+
+/** @brief Flushes buffered records, so a crash loses at most the current cycle. */
+static void FlushJournal(void) {
+    if (g_journal_file != NULL) fflush(g_journal_file);
+}
+
+/** @brief Stops recording and closes the journal. */
+static void StopJournal(void) {
+    if (g_journal_file == NULL) return;
+    fclose(g_journal_file);
+    g_journal_file = NULL;
+    g_backend = g_journal_inner;
+    LogInfo("Journal: Wrote %lu records (%lu bytes).", g_journal_record_count,
+            (unsigned long)(sizeof(JournalHeader) + g_journal_record_count * sizeof(JournalRecord)));
+}
+
+// === Replay Backend ===
+// Serves backend calls from a loaded journal. Each call takes the next record of the
+// same operation, skipping at most REPLAY_RESYNC_WINDOW records and never crossing a
+// cycle marker; skipped records and calls without a record count as divergences.
+// The replay clock advances by the recorded gaps between calls; sleeps take the
+// requested duration plus the lateness the recorded sleep had, so changed delays are
+// replayed with production wakeup behaviour.
+
+/**
+ * @brief Advances the recorded clock over one record and notes recorded wake and injection times.
+ * @param record Record being passed, whether or not the replayed code consumed it.
+ */
+static void ReplayPassRecord(const JournalRecord *record) {
+    g_replay.recordedClockUs += record->deltaUs;
+    if (record->op == JOURNAL_OP_SLEEP) {
+        g_replay.recordedClockUs += record->value >> 32;
+        if (!g_replay.catchUp && g_replay.recordedSleeps++ == 0) g_replay.recordedWakeUs = g_replay.recordedClockUs;
+    } else if (record->op == JOURNAL_OP_SEND_INPUT ||
+               (record->op == JOURNAL_OP_POST_MESSAGE && record->arg == WM_KEYDOWN)) {
+        if (!g_replay.recordedInjected) g_replay.recordedInjectUs = g_replay.recordedClockUs;
+        g_replay.recordedInjected = TRUE;
+    }
+}
+
+/**
+ * @brief Finds the record for the call the replayed code is making.
+ * @param op Operation being called.
+ * @return The matching record, or NULL if there is none nearby (a divergence).
+ */
+static const JournalRecord* ReplayTake(JournalOp op) {
+    for (size_t i = g_replay.cursor; i < g_replay.count && i < g_replay.cursor + REPLAY_RESYNC_WINDOW; ++i) {
+        const JournalRecord *record = &g_replay.records[i];
+        if (record->op == JOURNAL_OP_CYCLE) break;
+        if (record->op == (unsigned char)op) {
+            g_replay.divergences += (unsigned long)(i - g_replay.cursor);
+            for (; g_replay.cursor <= i; ++g_replay.cursor) ReplayPassRecord(&g_replay.records[g_replay.cursor]);
+            g_replay.clockUs += record->deltaUs;
+            return record;
+        }
+    }
+    g_replay.divergences++;
+    return NULL;
+}
+
+/**
+ * @brief Moves to the next cycle marker and resets the per-cycle observations.
+ * @return TRUE if a cycle follows, FALSE at the end of the journal.
+ */
+static BOOL ReplayBeginCycle(void) {
+    while (g_replay.cursor < g_replay.count && g_replay.records[g_replay.cursor].op != JOURNAL_OP_CYCLE) {
+        ReplayPassRecord(&g_replay.records[g_replay.cursor++]);
+        g_replay.divergences++;
+    }
+    if (g_replay.cursor >= g_replay.count) return FALSE;
+    const JournalRecord *marker = &g_replay.records[g_replay.cursor++];
+    g_replay.recordedClockUs += marker->deltaUs;
+    g_replay.clockUs = g_replay.recordedClockUs; // Both runs start every cycle at the recorded time
+    g_replay.catchUp = (marker->arg != 0);
+    g_replay.recordedSleeps = g_replay.sleeps = 0;
+    g_replay.recordedWakeUs = g_replay.wakeUs = g_replay.clockUs;
+    g_replay.recordedInjected = g_replay.injected = FALSE;
+    return TRUE;
+}
+
+/** @brief Passes the records the replayed cycle did not use, up to the next cycle marker. */
+static void ReplayFinishCycle(void) {
+    while (g_replay.cursor < g_replay.count && g_replay.records[g_replay.cursor].op != JOURNAL_OP_CYCLE) {
+        ReplayPassRecord(&g_replay.records[g_replay.cursor++]);
+        g_replay.divergences++;
+    }
+}
+
+/** @brief Notes a keystroke delivery in the replayed run. */
+static void ReplayNoteInjection(void) {
+    if (!g_replay.injected) g_replay.injectUs = g_replay.clockUs;
+    g_replay.injected = TRUE;
+}
+
+static BOOL ReplayIsWindow(HWND hWnd) {
+    (void)hWnd;
+    const JournalRecord *record = ReplayTake(JOURNAL_OP_IS_WINDOW);
+    return record != NULL ? (BOOL)record->value : TRUE;
+}
+
+static int ReplayGetWindowText(HWND hWnd, char *buffer, int bufferSize) {
+    const JournalRecord *record = ReplayTake(JOURNAL_OP_GET_WINDOW_TEXT);
+    if (bufferSize <= 0) return 0;
+    buffer[0] = '\0';
+    if (record != NULL && record->value == 0) return 0;
+    snprintf(buffer, (size_t)bufferSize, "%s", hWnd == g_replay.target ? "Replayed Target" : "Replayed Window");
+    return (int)strlen(buffer);
+}
+
+static HWND ReplayGetForegroundWindow(void) {
+    const JournalRecord *record = ReplayTake(JOURNAL_OP_GET_FOREGROUND);
+    if (record != NULL) g_replay.lastForeground = (HWND)(ULONG_PTR)record->value;
+    return g_replay.lastForeground;
+}
+
+static BOOL ReplaySetForegroundWindow(HWND hWnd) {
+    (void)hWnd;
+    const JournalRecord *record = ReplayTake(JOURNAL_OP_SET_FOREGROUND);
+    return record != NULL ? (BOOL)record->value : FALSE;
+}
+
+static BOOL ReplayIsIconic(HWND hWnd) {
+    (void)hWnd;
+    const JournalRecord *record = ReplayTake(JOURNAL_OP_IS_ICONIC);
+    return record != NULL ? (BOOL)record->value : FALSE;
+}
+
+static BOOL ReplayShowWindow(HWND hWnd, int nCmdShow) {
+    (void)hWnd; (void)nCmdShow;
+    const JournalRecord *record = ReplayTake(JOURNAL_OP_SHOW_WINDOW);
+    return record != NULL ? (BOOL)record->value : TRUE;
+}
+
+static DWORD ReplayGetWindowThreadId(HWND hWnd) {
+    (void)hWnd;
+    const JournalRecord *record = ReplayTake(JOURNAL_OP_GET_THREAD_ID);
+    return record != NULL ? (DWORD)record->value : 0;
+}
+
+static BOOL ReplayAttachThreadInput(DWORD idAttach, DWORD idAttachTo, BOOL fAttach) {
+    (void)idAttach; (void)idAttachTo; (void)fAttach;
+    const JournalRecord *record = ReplayTake(JOURNAL_OP_ATTACH_INPUT);
+    return record != NULL ? (BOOL)record->value : FALSE;
+}
+
+static UINT ReplaySendInput(UINT count, INPUT *inputs) {
+    (void)inputs;
+    const JournalRecord *record = ReplayTake(JOURNAL_OP_SEND_INPUT);
+    ReplayNoteInjection();
+    return record != NULL ? (UINT)record->value : count;
+}
+
+static SHORT ReplayGetAsyncKeyState(int vKey) {
+    (void)vKey;
+    const JournalRecord *record = ReplayTake(JOURNAL_OP_GET_KEY_STATE);
+    return record != NULL ? (SHORT)(unsigned short)record->value : 0;
+}
+
+static BOOL ReplayPostMessage(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    (void)hWnd; (void)wParam; (void)lParam;
+    const JournalRecord *record = ReplayTake(JOURNAL_OP_POST_MESSAGE);
+    if (msg == WM_KEYDOWN) ReplayNoteInjection();
+    return record != NULL ? (BOOL)record->value : TRUE;
+}
+
+static BOOL ReplayGenRandom(unsigned int *value) {
+    const JournalRecord *record = ReplayTake(JOURNAL_OP_GEN_RANDOM);
+    if (record != NULL) {
+        *value = (unsigned int)(record->value & 0xFFFFFFFFu);
+        return (record->value >> 32) != 0;
+    }
+    // xorshift32 once the recorded random values run out
+    unsigned int x = g_replay.rngState;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    g_replay.rngState = x;
+    *value = x;
+    return TRUE;
+}
+
+static void ReplaySleep(DWORD milliseconds, DWORD toleranceMs) {
+    (void)toleranceMs;
+    const JournalRecord *record = ReplayTake(JOURNAL_OP_SLEEP);
+    ULONGLONG latenessUs = 0;
+    if (record != NULL) {
+        ULONGLONG recordedRequestedUs = (record->value & 0xFFFFFFFFu) * 1000ULL;
+        ULONGLONG recordedActualUs = record->value >> 32;
+        if (recordedActualUs > recordedRequestedUs) latenessUs = recordedActualUs - recordedRequestedUs;
+    }
+    if (milliseconds == INFINITE) {
+        g_replay.clockUs += (record != NULL) ? record->value >> 32 : 0; // Only events ended it; take the recorded time
+    } else {
+        g_replay.clockUs += (ULONGLONG)milliseconds * 1000 + latenessUs;
+    }
+    if (!g_replay.catchUp && g_replay.sleeps++ == 0) g_replay.wakeUs = g_replay.clockUs;
+}
+
+static ULONGLONG ReplayNowUs(void) {
+    ReplayTake(JOURNAL_OP_NOW);
+    return g_replay.clockUs;
+}
+
+/**
+ * @brief Loads a journal file into g_replay.
+ * @param path Journal file.
+ * @return TRUE on success, FALSE if the file is missing or not a journal.
+ */
+static BOOL LoadJournal(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("Error: Could not open journal '%s'.\n", path);
+        return FALSE;
+    }
+    JournalHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "RFJ1", 4) != 0 ||
+        header.version != JOURNAL_VERSION) {
+        printf("Error: '%s' is not a version %d refresher journal.\n", path, JOURNAL_VERSION);
+        fclose(file);
+        return FALSE;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, (long)sizeof(header), SEEK_SET);
+    size_t capacity = (size > (long)sizeof(header)) ? (size_t)(size - (long)sizeof(header)) / sizeof(JournalRecord) : 0;
+    g_replay.records = (JournalRecord*)malloc(capacity > 0 ? capacity * sizeof(JournalRecord) : 1);
+    if (g_replay.records == NULL) {
+        printf("Error: Not enough memory to load journal '%s'.\n", path);
+        fclose(file);
+        return FALSE;
+    }
+    g_replay.count = fread(g_replay.records, sizeof(JournalRecord), capacity, file);
+    g_replay.target = (HWND)(ULONG_PTR)header.targetHwnd;
+    fclose(file);
+    return TRUE;
+}
+
+/**
+ * @brief Prints mean, p50, p95 and max of a latency sample set.
+ * @param label Row label.
+ * @param latenciesUs Samples in microseconds; sorted in place.
+ * @param count Number of samples.
+ */
+static void PrintReplayLatencies(const char *label, double *latenciesUs, int count) {
+    if (count == 0) {
+        printf("%-10s no refreshes\n", label);
+        return;
+    }
+    double sum = 0.0;
+    for (int i = 0; i < count; ++i) sum += latenciesUs[i];
+    qsort(latenciesUs, (size_t)count, sizeof(double), CompareDoubles);
+    printf("%-10s mean %9.2fms  p50 %9.2fms  p95 %9.2fms  max %9.2fms\n", label, sum / count / 1000.0,
+           latenciesUs[count / 2] / 1000.0, latenciesUs[(count * 95) / 100 < count ? (count * 95) / 100 : count - 1] / 1000.0,
+           latenciesUs[count - 1] / 1000.0);
+}
+
+/**
+ * @brief Re-runs the refresh cycles of a recorded journal with the current code and configuration,
+ * and compares deadline-to-injection latency against the recording.
+ * @param journalPath Journal recorded with journal_file.
+ * @return EXIT_SUCCESS if the journal was replayed, EXIT_FAILURE if it could not be loaded.
+ */
+static int RunReplay(const char *journalPath) {
+    memset(&g_replay, 0, sizeof(g_replay));
+    g_replay.rngState = 0x2545F491u;
+    if (!LoadJournal(journalPath)) return EXIT_FAILURE;
+
+    g_backend = &REPLAY_BACKEND;
+    LoadConfiguration();
+    g_journal_file_path[0] = '\0'; // Never record while replaying
+    InitializeTracing("Replayed Target");
+    g_console_output_enabled = FALSE;
+    LogInfo("Replay: Replaying %lu records from '%s'.", (unsigned long)g_replay.count, journalPath);
+
+    size_t maxCycles = 0;
+    for (size_t i = 0; i < g_replay.count; ++i) {
+        if (g_replay.records[i].op == JOURNAL_OP_CYCLE) maxCycles++;
+    }
+    double *recordedLatencies = (double*)malloc((maxCycles > 0 ? maxCycles : 1) * sizeof(double));
+    double *replayedLatencies = (double*)malloc((maxCycles > 0 ? maxCycles : 1) * sizeof(double));
+    if (recordedLatencies == NULL || replayedLatencies == NULL) {
+        printf("Error: Not enough memory to replay '%s'.\n", journalPath);
+        free(recordedLatencies);
+        free(replayedLatencies);
+        free(g_replay.records);
+        return EXIT_FAILURE;
+    }
+
+    int cycles = 0, recordedCount = 0, replayedCount = 0, outcomeChanges = 0, keystroke_count = 0;
+    while (ReplayBeginCycle()) {
+        RunRefreshCycle(g_replay.target, &keystroke_count, g_replay.catchUp);
+        ReplayFinishCycle();
+        FlushTraceEvents(FALSE);
+        cycles++;
+        if (g_replay.recordedInjected) recordedLatencies[recordedCount++] = (double)(g_replay.recordedInjectUs - g_replay.recordedWakeUs);
+        if (g_replay.injected) replayedLatencies[replayedCount++] = (double)(g_replay.injectUs - g_replay.wakeUs);
+        if (g_replay.recordedInjected != g_replay.injected) outcomeChanges++;
+    }
+    ShutdownTracing();
+    g_console_output_enabled = TRUE;
+
+    printf("Replay: %d cycles, %lu records, %lu divergence(s), %d cycle(s) with a different refresh outcome.\n",
+           cycles, (unsigned long)g_replay.count, g_replay.divergences, outcomeChanges);
+    printf("Deadline-to-injection latency (%d recorded refreshes, %d replayed):\n", recordedCount, replayedCount);
+    PrintReplayLatencies("recorded", recordedLatencies, recordedCount);
+    PrintReplayLatencies("replayed", replayedLatencies, replayedCount);
+    LogInfo("Replay: %d cycles, %lu divergences, %d outcome changes, %d recorded and %d replayed refreshes.",
+            cycles, g_replay.divergences, outcomeChanges, recordedCount, replayedCount);
+
+    free(recordedLatencies);
+    free(replayedLatencies);
+    free(g_replay.records);
+    g_replay.records = NULL;
+    return EXIT_SUCCESS;
+}
+
+// === Focus Timing Tuner ===
+// "--tune" fits a FocusModel to the focus switches in a journal, then searches the
+// focus timing grid on the simulated desktop for the lowest foreground hold time that
+// still delivers the target share of refreshes, and writes the winner as a profile
+// that the refresher loads with tuning_profile. The grid is screened with short runs;
+// only the best few candidates are simulated at full length.
+
+/** @brief Predicted behaviour of one focus timing candidate. */
+typedef struct TuneResult {
+    FocusTiming timing;
+    double successPct;   // Refreshes delivered to a target that was in front and ready for input
+    double meanHoldMs;   // Foreground held by the target per refresh
+} TuneResult;
+
+/**
+ * @brief Fits a focus model to the activation attempts, settle checks and exact waits in the loaded journal.
+ * @param model Receives the model; latenessMs must have room for TUNE_MAX_LATENESS_SAMPLES.
+ * @param attempts Receives the number of recorded activation attempts.
+ * @return TRUE if the journal contains activation attempts to fit to.
+ */
+static BOOL FitFocusModel(FocusModel *model, unsigned long *attempts) {
+    enum { FIT_IDLE, FIT_SET, FIT_ATTEMPT_SLEPT, FIT_FOCUSED, FIT_SETTLE_SLEPT } state = FIT_IDLE;
+    unsigned long successes = 0, settles = 0, losses = 0;
+    double retrySumMs = 0.0, settleSumMs = 0.0;
+    BOOL idleWaitPending = FALSE;
+    *attempts = 0;
+    model->latenessCount = 0;
+
+    for (size_t i = 0; i < g_replay.count; ++i) {
+        const JournalRecord *record = &g_replay.records[i];
+        switch (record->op) {
+            case JOURNAL_OP_CYCLE:
+                idleWaitPending = (record->arg == 0);
+                state = FIT_IDLE;
+                break;
+            case JOURNAL_OP_SET_FOREGROUND:
+                state = (record->arg == 1) ? FIT_SET : FIT_IDLE;
+                break;
+            case JOURNAL_OP_SLEEP: {
+                ULONGLONG requestedMs = record->value & 0xFFFFFFFFu;
+                ULONGLONG actualUs = record->value >> 32;
+                if (idleWaitPending) { // The random wait is coalesced; its lateness says nothing about exact waits
+                    idleWaitPending = FALSE;
+                    break;
+                }
+                if (model->latenessCount < TUNE_MAX_LATENESS_SAMPLES) {
+                    ULONGLONG latenessUs = (actualUs > requestedMs * 1000) ? actualUs - requestedMs * 1000 : 0;
+                    model->latenessMs[model->latenessCount++] = (unsigned int)((latenessUs + 500) / 1000);
+                }
+                if (state == FIT_SET) { state = FIT_ATTEMPT_SLEPT; retrySumMs += (double)requestedMs; }
+                else if (state == FIT_FOCUSED) { state = FIT_SETTLE_SLEPT; settleSumMs += (double)requestedMs; }
+                else state = FIT_IDLE;
+                break;
+            }
+            case JOURNAL_OP_GET_FOREGROUND:
+                if (state == FIT_ATTEMPT_SLEPT) {
+                    (*attempts)++;
+                    if (record->arg == 1) { successes++; state = FIT_FOCUSED; } else state = FIT_IDLE;
+                } else if (state == FIT_SETTLE_SLEPT) {
+                    settles++;
+                    if (record->arg != 1) losses++;
+                    state = FIT_IDLE;
+                }
+                break;
+            default:
+                break; // Other calls do not change the phase
+        }
+    }
+    if (*attempts == 0) return FALSE;
+
+    // P(focus within R) = 1 - exp(-R / mean) for the recorded retry delay R.
+    double retryMs = retrySumMs / (double)*attempts;
+    double successRate = (double)successes / (double)*attempts;
+    if (successRate >= 0.999) model->activationMeanMs = (retryMs > 0.0 ? retryMs : 1.0) / 10.0;
+    else if (successRate <= 0.001) model->activationMeanMs = (retryMs > 0.0 ? retryMs : 1.0) * 10.0;
+    else model->activationMeanMs = -retryMs / log(1.0 - successRate);
+
+    // P(focus lost during settle S) = 1 - exp(-S * hazard).
+    double settleMs = (settles > 0) ? settleSumMs / (double)settles : 0.0;
+    double lossRate = (settles > 0) ? (double)losses / (double)settles : 0.0;
+    model->focusLossPerMs = (settleMs > 0.0 && lossRate > 0.0 && lossRate < 1.0) ? -log(1.0 - lossRate) / settleMs : 0.0;
+    LogInfo("Tune: %lu attempts (%.1f%% focused within %.0fms), %lu settles (%.2f%% lost within %.0fms), %d lateness samples.",
+            *attempts, successRate * 100.0, retryMs, settles, lossRate * 100.0, settleMs, model->latenessCount);
+    return TRUE;
+}
+
+/**
+ * @brief Predicts success rate and hold time of one focus timing on the modelled desktop.
+ * Every candidate sees the same random streams, so differences come from the timing alone.
+ * @param model Fitted focus model.
+ * @param timing Candidate focus timing.
+ * @param cycles Simulated refreshes.
+ * @return The prediction.
+ */
+static TuneResult EvaluateFocusTiming(const FocusModel *model, FocusTiming timing, int cycles) {
+    TuneResult result;
+    int keystroke_count = 0;
+    result.timing = timing;
+    g_focus_timing = timing;
+    ResetSimulatedDesktop();
+    g_sim.focusModel = model;
+    g_sim.modelRngState = 0x9E3779B9u;
+    for (int cycle = 0; cycle < cycles; ++cycle) {
+        RunRefreshCycle(SIM_TARGET_HWND, &keystroke_count, FALSE);
+        // An activation that lands after the refresher gave up is abandoned, like a cancelled flash.
+        g_sim.pendingForegroundMs = 0;
+        if (g_sim.foreground == SIM_TARGET_HWND) SimEndForegroundHold(SIM_USER_HWND, g_sim.clockMs);
+    }
+    g_sim.focusModel = NULL;
+    result.successPct = 100.0 * g_sim.deliveredInjections / cycles;
+    result.meanHoldMs = (double)g_sim.foregroundHoldMs / cycles;
+    return result;
+}
+
+/**
+ * @brief Orders tuning results: those reaching the success target by hold time, then the
+ * rest by success rate and hold time.
+ * @param a Result to compare.
+ * @param b Result to compare against.
+ * @param successPct Minimum share of refreshes that must be delivered.
+ * @return TRUE if a is the better choice.
+ */
+static BOOL TuneResultBetter(const TuneResult *a, const TuneResult *b, double successPct) {
+    BOOL aMeets = a->successPct >= successPct;
+    BOOL bMeets = b->successPct >= successPct;
+    if (aMeets != bMeets) return aMeets;
+    if (!aMeets && a->successPct != b->successPct) return a->successPct > b->successPct;
+    return a->meanHoldMs < b->meanHoldMs;
+}
+
+/**
+ * @brief Fits the focus model to a journal, searches the focus timing grid and writes the best profile.
+ * @param journalPath Journal recorded with journal_file.
+ * @param profilePath Profile file to write.
+ * @param successPct Minimum share of refreshes that must be delivered.
+ * @return EXIT_SUCCESS if a profile was written, EXIT_FAILURE otherwise.
+ */
+static int RunTuner(const char *journalPath, const char *profilePath, double successPct) {
+    static const int ATTEMPTS[] = { 1, 2, 3, 4, 5 };
+    static const DWORD RETRY_DELAYS_MS[] = { 5, 10, 20, 35, 50, 75, 100, 150 };
+    static const DWORD SETTLE_DELAYS_MS[] = { 0, 10, 25, 50, 75, 100, 150, 200, 250, 350, 500 };
+    static unsigned int latenessSamples[TUNE_MAX_LATENESS_SAMPLES];
+
+    memset(&g_replay, 0, sizeof(g_replay));
+    if (!LoadJournal(journalPath)) return EXIT_FAILURE;
+    FocusModel model = { 0.0, 0.0, latenessSamples, 0 };
+    unsigned long attempts = 0;
+    BOOL fitted = FitFocusModel(&model, &attempts);
+    free(g_replay.records);
+    g_replay.records = NULL;
+    if (!fitted) {
+        printf("Error: '%s' contains no focus switches to the target. Record with delivery = sendinput.\n", journalPath);
+        return EXIT_FAILURE;
+    }
+
+    g_backend = &SIMULATED_BACKEND;
+    LoadConfiguration();
+    FocusTiming configured = g_focus_timing;
+    g_console_output_enabled = FALSE;
+    g_delivery_strategy = DELIVERY_SENDINPUT;
+    printf("Model: activation mean %.1fms, focus loss %.4f%%/ms, %d wait lateness samples (from %lu attempts).\n",
+           model.activationMeanMs, model.focusLossPerMs * 100.0, model.latenessCount, attempts);
+
+    FILE *realLogFile = g_debug_log_file;
+    g_debug_log_file = NULL; // Millions of simulated log lines would dominate the search
+    TuneResult current = EvaluateFocusTiming(&model, configured, TUNE_CYCLES_PER_CANDIDATE);
+
+    // Screen the grid with short runs, keeping the best few in order.
+    TuneResult finalists[TUNE_FINALISTS];
+    int finalistCount = 0;
+    for (size_t a = 0; a < sizeof(ATTEMPTS) / sizeof(ATTEMPTS[0]); ++a) {
+        for (size_t r = 0; r < sizeof(RETRY_DELAYS_MS) / sizeof(RETRY_DELAYS_MS[0]); ++r) {
+            for (size_t st = 0; st < sizeof(SETTLE_DELAYS_MS) / sizeof(SETTLE_DELAYS_MS[0]); ++st) {
+                FocusTiming candidate = { ATTEMPTS[a], RETRY_DELAYS_MS[r], SETTLE_DELAYS_MS[st], configured.postSendDelayMs };
+                TuneResult result = EvaluateFocusTiming(&model, candidate, TUNE_SCREEN_CYCLES);
+                int slot = finalistCount;
+                while (slot > 0 && TuneResultBetter(&result, &finalists[slot - 1], successPct)) slot--;
+                if (slot >= TUNE_FINALISTS) continue;
+                if (finalistCount < TUNE_FINALISTS) finalistCount++;
+                memmove(&finalists[slot + 1], &finalists[slot], (size_t)(finalistCount - 1 - slot) * sizeof(finalists[0]));
+                finalists[slot] = result;
+            }
+        }
+    }
+
+    // Only the finalists are simulated at full length; they have to beat the current timing.
+    TuneResult best = current;
+    BOOL improved = FALSE;
+    for (int i = 0; i < finalistCount; ++i) {
+        TuneResult result = EvaluateFocusTiming(&model, finalists[i].timing, TUNE_CYCLES_PER_CANDIDATE);
+        if (TuneResultBetter(&result, &best, successPct)) {
+            best = result;
+            improved = TRUE;
+        }
+    }
+    g_debug_log_file = realLogFile;
+    g_console_output_enabled = TRUE;
+    g_focus_timing = configured;
+    if (improved && best.successPct < successPct) {
+        printf("Warning: No candidate reaches %.1f%% success; using the most reliable one.\n", successPct);
+    }
+
+    printf("Current: %d attempts, retry %lums, settle %lums -> %.2f%% delivered, %.1fms held per refresh.\n",
+           current.timing.switchAttempts, current.timing.retryDelayMs, current.timing.settleDelayMs,
+           current.successPct, current.meanHoldMs);
+    if (!improved) {
+        printf("No candidate beats the current focus timing. '%s' was not written.\n", profilePath);
+        LogInfo("Tune: The current focus timing is the best; no profile written.");
+        return EXIT_SUCCESS;
+    }
+    printf("Tuned:   %d attempts, retry %lums, settle %lums -> %.2f%% delivered, %.1fms held per refresh.\n",
+           best.timing.switchAttempts, best.timing.retryDelayMs, best.timing.settleDelayMs,
+           best.successPct, best.meanHoldMs);
+
+    FILE *profile = fopen(profilePath, "w");
+    if (profile == NULL) {
+        printf("Error: Could not write tuning profile '%s'.\n", profilePath);
+        LogError("Tune: Failed to open '%s' for writing.", profilePath);
+        return EXIT_FAILURE;
+    }
+    fprintf(profile, "# Focus timing profile fitted by --tune from '%s' (%lu activation attempts)\n", journalPath, attempts);
+    fprintf(profile, "# Predicted: %.2f%% delivered (target %.1f%%), %.1fms foreground hold per refresh\n",
+            best.successPct, successPct, best.meanHoldMs);
+    fprintf(profile, "focus_switch_attempts = %d\n", best.timing.switchAttempts);
+    fprintf(profile, "focus_retry_delay_ms = %lu\n", best.timing.retryDelayMs);
+    fprintf(profile, "focus_settle_delay_ms = %lu\n", best.timing.settleDelayMs);
+    fprintf(profile, "post_send_delay_ms = %lu\n", best.timing.postSendDelayMs);
+    fclose(profile);
+    printf("Wrote '%s'. Add \"tuning_profile = %s\" to %s to use it.\n", profilePath, profilePath, CONFIG_FILE_NAME);
+    LogInfo("Tune: Wrote '%s': attempts=%d retry=%lums settle=%lums, predicted %.2f%% delivered, %.1fms hold.",
+            profilePath, best.timing.switchAttempts, best.timing.retryDelayMs, best.timing.settleDelayMs,
+            best.successPct, best.meanHoldMs);
+    return EXIT_SUCCESS;
+}
+
+// === API Call Accounting Functions ===
+
+/** @brief Clears the per-cycle call counters. */
+static void ResetApiCallCounters(void) {
+#ifdef REFRESHER_API_COUNTERS
+    g_api_call_site_count = 0;
+#endif
+    g_api_calls_this_cycle = 0;
+    g_api_round_trips_this_cycle = 0;
+}
+
+#ifdef REFRESHER_API_COUNTERS
+
+/**
+ * @brief Records one API call made from the given function.
+ * @param kind The API being called.
+ * @param site Name of the calling function (__func__).
+ */
+static void CountApiCall(ApiCallKind kind, const char *site) {
+    g_api_calls_this_cycle++;
+    if (kind <= API_POST_MESSAGE) g_api_round_trips_this_cycle++;
+    for (int i = 0; i < g_api_call_site_count; ++i) {
+        if (g_api_call_sites[i].kind == kind && g_api_call_sites[i].site == site) {
+            g_api_call_sites[i].count++;
+            return;
+        }
+    }
+    if (g_api_call_site_count < MAX_API_CALL_SITES) {
+        g_api_call_sites[g_api_call_site_count].kind = kind;
+        g_api_call_sites[g_api_call_site_count].site = site;
+        g_api_call_sites[g_api_call_site_count].count = 1;
+        g_api_call_site_count++;
+    }
+}
+
+
+/**
+ * @brief Logs the per-call-site breakdown for the cycle that just finished.
+ * @param cycle Cycle number, for the log.
+ * @return Total number of counted calls in the cycle.
+ */
+static unsigned int ReportApiCallCounters(int cycle) {
+    // Snapshot first: the log writes below are themselves counted.
+    unsigned int total = g_api_calls_this_cycle;
+    int sites = g_api_call_site_count;
+    LogDebug("ApiCalls: Cycle %d made %u calls (budget %d), %u of them window-system round trips, on the %s backend.",
+             cycle, total, API_CALL_BUDGET_PER_CYCLE, g_api_round_trips_this_cycle, g_backend->name);
+    for (int i = 0; i < sites; ++i) {
+        LogDebug("ApiCalls:   %-26s %4u  from %s",
+                 API_CALL_NAMES[g_api_call_sites[i].kind], g_api_call_sites[i].count, g_api_call_sites[i].site);
+    }
+    if (total > API_CALL_BUDGET_PER_CYCLE) {
+        LogWarning("ApiCalls: Cycle %d exceeded the per-cycle budget (%u > %d).", cycle, total, API_CALL_BUDGET_PER_CYCLE);
+    }
+    return total;
 }
+#endif
@@ -0,0 +1,97 @@
+<#
+.SYNOPSIS
+    Captures the Window Refresher ETW tracepoints for a while and prints latency
+    distributions per probe.
+
+.DESCRIPTION
+    Starts an ETW session for the "WindowRefresher" provider
+    {b3e2de7e-dfbf-457e-87d9-d2b6a807b408}, lets the already running refresher
+    emit probes for -Seconds, stops the session and summarizes the events:
+
+      cycle_start        late_us     (how late the refresh deadline fired)
+      activate_attempt   elapsed_us  (time from deadline to each SetForegroundWindow attempt)
+      focus_acquired     elapsed_us  (deadline to target in foreground)
+      inject             elapsed_us  (deadline to Ctrl+F5 sent)
+      restore            elapsed_us  (deadline to original foreground restored)
+      skip               counted per reason, one per skipped refresh
+      focus_lost         counted per phase (the refresh also emits skip reason=focus_lost)
+
+    No restart or special build of the refresher is needed; the probes cost a
+    single flag check while no session is attached.
+
+    Run from an elevated PowerShell prompt (logman needs administrator rights).
+
+.EXAMPLE
+    .\tools\refresher_latency.ps1 -Seconds 600
+#>
+param(
+    [int]$Seconds = 300,
+    [string]$EtlPath = (Join-Path $env:TEMP 'refresher_probes.etl')
+)
+
+$ErrorActionPreference = 'Stop'
+$ProviderGuid = '{b3e2de7e-dfbf-457e-87d9-d2b6a807b408}'
+$SessionName = 'WindowRefresherProbes'
+
+logman start $SessionName -p $ProviderGuid 0xffffffffffffffff 0xff -o $EtlPath -ets | Out-Null
+try {
+    Write-Host "Capturing refresher tracepoints for $Seconds s (Ctrl+C stops early)..."
+    Start-Sleep -Seconds $Seconds
+} finally {
+    logman stop $SessionName -ets | Out-Null
+}
+
+# Each event is a string "<probe> target=<id> key=value ...".
+$samples = @{}
+$reasons = @{}
+foreach ($event in Get-WinEvent -Path $EtlPath -Oldest -ErrorAction SilentlyContinue) {
+    $text = if ($event.Message) { $event.Message } elseif ($event.Properties.Count -gt 0) { [string]$event.Properties[0].Value } else { '' }
+    $fields = $text.Trim() -split '\s+'
+    if ($fields.Count -lt 2) { continue }
+    $probe = $fields[0]
+    $values = @{}
+    foreach ($field in $fields[1..($fields.Count - 1)]) {
+        $pair = $field -split '=', 2
+        if ($pair.Count -eq 2) { $values[$pair[0]] = $pair[1] }
+    }
+
+    if ($probe -eq 'skip' -or $probe -eq 'focus_lost') {
+        $key = "$probe/" + $(if ($values['reason']) { $values['reason'] } else { $values['phase'] })
+        $reasons[$key] = 1 + [int]$reasons[$key]
+        continue
+    }
+    $metric = if ($probe -eq 'cycle_start') { 'late_us' } else { 'elapsed_us' }
+    if ($values.ContainsKey($metric)) {
+        $name = "$probe $metric"
+        if (-not $samples.ContainsKey($name)) { $samples[$name] = New-Object System.Collections.Generic.List[double] }
+        $samples[$name].Add([double]$values[$metric])
+    }
+}
+
+function Get-Percentile([double[]]$sorted, [double]$p) {
+    $index = [math]::Min($sorted.Count - 1, [math]::Floor($p * $sorted.Count))
+    return $sorted[[int]$index]
+}
+
+foreach ($name in ($samples.Keys | Sort-Object)) {
+    $sorted = [double[]]($samples[$name] | Sort-Object)
+    '{0,-30} n={1,-6} p50={2,10:N0}us p90={3,10:N0}us p99={4,10:N0}us max={5,10:N0}us' -f $name, $sorted.Count,
+        (Get-Percentile $sorted 0.50), (Get-Percentile $sorted 0.90), (Get-Percentile $sorted 0.99), $sorted[-1]
+
+    # Power-of-two histogram, like bpftrace's hist().
+    $buckets = @{}
+    foreach ($value in $sorted) {
+        $bucket = if ($value -le 0) { 0 } else { [int][math]::Floor([math]::Log($value, 2)) }
+        $buckets[$bucket] = 1 + [int]$buckets[$bucket]
+    }
+    $peak = ($buckets.Values | Measure-Object -Maximum).Maximum
+    foreach ($bucket in ($buckets.Keys | Sort-Object)) {
+        $low = if ($bucket -eq 0) { 0 } else { [math]::Pow(2, $bucket) }
+        $bar = '@' * [math]::Ceiling(40 * $buckets[$bucket] / $peak)
+        '    [{0,10:N0}, {1,10:N0})  {2,6} |{3}' -f $low, [math]::Pow(2, $bucket + 1), $buckets[$bucket], $bar
+    }
+}
+
+foreach ($key in ($reasons.Keys | Sort-Object)) {
+    '{0,-30} count={1}' -f $key, $reasons[$key]
+}